@@ -0,0 +1,348 @@
+/* -*- c-basic-offset: 8 -*-
+   rdesktop: A Remote Desktop Protocol client.
+   Network characteristics auto-detection, [MS-RDPBCGR] 2.2.14
+
+   This program is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <sys/time.h>
+#include "rdesktop.h"
+
+/* Performance flags that are chosen by auto-detection, everything
+   else in g_rdp5_performanceflags is left as the user set it. */
+#define AUTODETECT_PERF_MASK (PERF_DISABLE_WALLPAPER | PERF_DISABLE_FULLWINDOWDRAG | \
+			      PERF_DISABLE_MENUANIMATIONS | PERF_DISABLE_THEMING | \
+			      PERF_ENABLE_FONT_SMOOTHING)
+
+extern RD_BOOL g_encryption;
+extern RD_BOOL g_network_autodetect;
+extern RD_BOOL g_seamless_rdp;
+extern uint32 g_rdp5_performanceflags;
+extern uint16 g_mcs_msgchannel;
+
+/* Bandwidth measurement in progress */
+static RD_BOOL g_bw_measuring = False;
+static struct timeval g_bw_start;
+static uint32 g_bw_bytes;
+
+/* Current estimates, 0 means not yet known */
+static uint32 g_base_rtt;	/* ms */
+static uint32 g_average_rtt;	/* ms */
+static uint32 g_bandwidth;	/* kbit/s */
+static uint8 g_connection_type;
+
+static const char *
+autodetect_connection_type_name(uint8 type)
+{
+	switch (type)
+	{
+		case CONNECTION_TYPE_MODEM:
+			return "modem";
+		case CONNECTION_TYPE_BROADBAND_LOW:
+			return "low-speed broadband";
+		case CONNECTION_TYPE_SATELLITE:
+			return "satellite";
+		case CONNECTION_TYPE_BROADBAND_HIGH:
+			return "high-speed broadband";
+		case CONNECTION_TYPE_WAN:
+			return "WAN";
+		case CONNECTION_TYPE_LAN:
+			return "LAN";
+	}
+	return "unknown";
+}
+
+static uint8
+autodetect_classify(uint32 rtt, uint32 bandwidth)
+{
+	if (bandwidth < 256)
+		return CONNECTION_TYPE_MODEM;
+	if (bandwidth < 2000)
+		return CONNECTION_TYPE_BROADBAND_LOW;
+	if (bandwidth < 10000)
+		return (rtt >= 300) ? CONNECTION_TYPE_SATELLITE : CONNECTION_TYPE_BROADBAND_HIGH;
+	return (rtt > 50) ? CONNECTION_TYPE_WAN : CONNECTION_TYPE_LAN;
+}
+
+static uint32
+autodetect_performance_flags(uint8 type)
+{
+	switch (type)
+	{
+		case CONNECTION_TYPE_MODEM:
+			return (PERF_DISABLE_WALLPAPER | PERF_DISABLE_FULLWINDOWDRAG |
+				PERF_DISABLE_MENUANIMATIONS | PERF_DISABLE_THEMING);
+		case CONNECTION_TYPE_BROADBAND_LOW:
+			return (PERF_DISABLE_WALLPAPER | PERF_DISABLE_FULLWINDOWDRAG |
+				PERF_DISABLE_MENUANIMATIONS);
+		case CONNECTION_TYPE_SATELLITE:
+			return (PERF_DISABLE_WALLPAPER | PERF_DISABLE_FULLWINDOWDRAG |
+				PERF_DISABLE_MENUANIMATIONS | PERF_ENABLE_FONT_SMOOTHING);
+		case CONNECTION_TYPE_BROADBAND_HIGH:
+			return (PERF_DISABLE_WALLPAPER | PERF_ENABLE_FONT_SMOOTHING);
+		default:
+			return PERF_ENABLE_FONT_SMOOTHING;
+	}
+}
+
+/* Pick a connection type from the current estimates and, if the
+   adaptive mode is enabled, the matching performance flags. The
+   flags are sent in the client info PDU, which means a change takes
+   effect on the next (re)connect. */
+static void
+autodetect_update(void)
+{
+	uint32 flags;
+	uint8 type;
+
+	if (g_bandwidth == 0 || g_average_rtt == 0)
+		return;
+
+	type = autodetect_classify(g_average_rtt, g_bandwidth);
+	if (type == g_connection_type)
+		return;
+
+	g_connection_type = type;
+	logger(Protocol, Verbose,
+	       "autodetect_update(), rtt %u ms (base %u ms), bandwidth %u kbit/s, link looks like %s",
+	       g_average_rtt, g_base_rtt, g_bandwidth, autodetect_connection_type_name(type));
+
+	if (!g_network_autodetect)
+		return;
+
+	flags = autodetect_performance_flags(type);
+	if (g_seamless_rdp)
+		flags &= ~PERF_DISABLE_FULLWINDOWDRAG;
+
+	g_rdp5_performanceflags = (g_rdp5_performanceflags & ~AUTODETECT_PERF_MASK) | flags;
+	logger(Core, Verbose, "Network auto-detect selected %s experience (flags 0x%x)",
+	       autodetect_connection_type_name(type), g_rdp5_performanceflags);
+}
+
+/* Exponentially weighted moving average, same weight as TCP SRTT */
+static uint32
+autodetect_smooth(uint32 estimate, uint32 sample)
+{
+	if (estimate == 0)
+		return sample;
+	return (estimate * 7 + sample) / 8;
+}
+
+static STREAM
+autodetect_init_response(uint16 seqno, uint16 type, int length)
+{
+	STREAM s;
+	uint32 flags = SEC_AUTODETECT_RSP | (g_encryption ? SEC_ENCRYPT : 0);
+
+	s = sec_init(flags, 6 + length);
+
+	/* TS_AUTODETECT_RSP */
+	out_uint8(s, 6 + length);	/* headerLength */
+	out_uint8(s, TYPE_ID_AUTODETECT_RESPONSE);	/* headerTypeId */
+	out_uint16_le(s, seqno);	/* sequenceNumber */
+	out_uint16_le(s, type);	/* responseType */
+
+	return s;
+}
+
+static void
+autodetect_send_response(STREAM s)
+{
+	uint32 flags = SEC_AUTODETECT_RSP | (g_encryption ? SEC_ENCRYPT : 0);
+
+	s_mark_end(s);
+	sec_send_to_channel(s, flags, g_mcs_msgchannel);
+}
+
+static void
+autodetect_send_rtt_response(uint16 seqno)
+{
+	STREAM s;
+
+	s = autodetect_init_response(seqno, RDP_RTT_RESPONSE, 0);
+	autodetect_send_response(s);
+}
+
+static void
+autodetect_process_bw_start(void)
+{
+	g_bw_measuring = True;
+	g_bw_bytes = 0;
+	gettimeofday(&g_bw_start, NULL);
+}
+
+static void
+autodetect_process_bw_stop(uint16 seqno, uint16 type)
+{
+	STREAM s;
+	struct timeval now;
+	uint32 delta;
+
+	gettimeofday(&now, NULL);
+	if (!g_bw_measuring)
+	{
+		logger(Protocol, Warning,
+		       "autodetect_process_bw_stop(), got stop without a preceding start");
+		g_bw_start = now;
+		g_bw_bytes = 0;
+	}
+	g_bw_measuring = False;
+
+	delta = (now.tv_sec - g_bw_start.tv_sec) * 1000 +
+		(now.tv_usec - g_bw_start.tv_usec) / 1000;
+
+	logger(Protocol, Debug, "autodetect_process_bw_stop(), %u bytes in %u ms", g_bw_bytes,
+	       delta);
+
+	s = autodetect_init_response(seqno, (type == RDP_BW_STOP_CONNECTTIME) ?
+				     RDP_BW_RESULTS_CONNECTTIME : RDP_BW_RESULTS_CONTINUOUS, 8);
+	out_uint32_le(s, delta);	/* timeDelta */
+	out_uint32_le(s, g_bw_bytes);	/* byteCount */
+	autodetect_send_response(s);
+
+	/* Too short intervals say more about the timer than the link */
+	if (delta >= 10)
+	{
+		g_bandwidth = autodetect_smooth(g_bandwidth,
+						(uint32) ((double) g_bw_bytes * 8 / delta));
+		autodetect_update();
+	}
+}
+
+static void
+autodetect_process_netchar_result(STREAM s, uint16 type)
+{
+	uint32 base_rtt = 0, bandwidth = 0, average_rtt = 0;
+	int length = 4;
+
+	/* Each result type leaves out one of baseRTT and bandwidth */
+	if (type != RDP_NETCHAR_RESULT_BW_AVG)
+		length += 4;
+	if (type != RDP_NETCHAR_RESULT_BASE_AVG)
+		length += 4;
+
+	if (!s_check_rem(s, length))
+	{
+		logger(Protocol, Warning,
+		       "autodetect_process_netchar_result(), result 0x%04x is truncated", type);
+		return;
+	}
+
+	if (type != RDP_NETCHAR_RESULT_BW_AVG)
+		in_uint32_le(s, base_rtt);	/* baseRTT */
+	if (type != RDP_NETCHAR_RESULT_BASE_AVG)
+		in_uint32_le(s, bandwidth);	/* bandwidth */
+	in_uint32_le(s, average_rtt);	/* averageRTT */
+
+	logger(Protocol, Debug,
+	       "autodetect_process_netchar_result(), base rtt %u ms, bandwidth %u kbit/s, average rtt %u ms",
+	       base_rtt, bandwidth, average_rtt);
+
+	/* The server has the better view of the RTT, use its numbers
+	   as they are. Bandwidth is combined with our own samples. */
+	if (base_rtt != 0)
+		g_base_rtt = base_rtt;
+	if (average_rtt != 0)
+		g_average_rtt = average_rtt;
+	if (bandwidth != 0)
+		g_bandwidth = autodetect_smooth(g_bandwidth, bandwidth);
+
+	autodetect_update();
+}
+
+/* Account for data received while a bandwidth measurement is running */
+void
+autodetect_bytes_received(uint32 length)
+{
+	if (g_bw_measuring)
+		g_bw_bytes += length;
+}
+
+/* Process a TS_AUTODETECT_REQ received on the MCS message channel */
+void
+autodetect_process(STREAM s)
+{
+	uint8 length, type_id;
+	uint16 seqno, type;
+	struct stream packet = *s;
+
+	if (!s_check_rem(s, 6))
+	{
+		rdp_protocol_error("autodetect_process(), consume of header would overrun",
+				   &packet);
+	}
+
+	in_uint8(s, length);	/* headerLength */
+	in_uint8(s, type_id);	/* headerTypeId */
+	in_uint16_le(s, seqno);	/* sequenceNumber */
+	in_uint16_le(s, type);	/* requestType */
+
+	if (type_id != TYPE_ID_AUTODETECT_REQUEST)
+	{
+		logger(Protocol, Warning, "autodetect_process(), unexpected header type 0x%x",
+		       type_id);
+		return;
+	}
+
+	logger(Protocol, Debug, "autodetect_process(), request 0x%04x, seqno %d, length %d",
+	       type, seqno, length);
+
+	switch (type)
+	{
+		case RDP_RTT_REQUEST_CONTINUOUS:
+		case RDP_RTT_REQUEST_CONNECTTIME:
+			autodetect_send_rtt_response(seqno);
+			break;
+
+		case RDP_BW_START_CONTINUOUS:
+		case RDP_BW_START_TUNNEL:
+		case RDP_BW_START_CONNECTTIME:
+			autodetect_process_bw_start();
+			break;
+
+		case RDP_BW_PAYLOAD:
+			/* Counted by autodetect_bytes_received() */
+			break;
+
+		case RDP_BW_STOP_CONNECTTIME:
+			/* payload is counted like RDP_BW_PAYLOAD */
+			autodetect_process_bw_stop(seqno, type);
+			break;
+
+		case RDP_BW_STOP_CONTINUOUS:
+		case RDP_BW_STOP_TUNNEL:
+			autodetect_process_bw_stop(seqno, type);
+			break;
+
+		case RDP_NETCHAR_RESULT_BASE_AVG:
+		case RDP_NETCHAR_RESULT_BW_AVG:
+		case RDP_NETCHAR_RESULT_ALL:
+			autodetect_process_netchar_result(s, type);
+			break;
+
+		default:
+			logger(Protocol, Warning, "autodetect_process(), unhandled request type 0x%x",
+			       type);
+			break;
+	}
+}
+
+/* Estimates describe the link and are kept over reconnects, only a
+   measurement that was interrupted by the disconnect is dropped. */
+void
+autodetect_reset_state(void)
+{
+	g_bw_measuring = False;
+	g_bw_bytes = 0;
+}
@@ -17,263 +17,141 @@
    along with this program.  If not, see <http://www.gnu.org/licenses/>.
 */
 
-/* three separate function for speed when decompressing the bitmaps
-   when modifying one function make the change in the others
-   jay.sorg@gmail.com */
-
 /* indent is confused by this file */
 /* *INDENT-OFF* */
 
 #include "rdesktop.h"
 
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
 #define CVAL(p)   (*(p++))
-#ifdef NEED_ALIGN
-#ifdef L_ENDIAN
-#define CVAL2(p, v) { v = (*(p++)); v |= (*(p++)) << 8; }
-#else
-#define CVAL2(p, v) { v = (*(p++)) << 8; v |= (*(p++)); }
-#endif /* L_ENDIAN */
-#else
-#define CVAL2(p, v) { v = (*((uint16*)p)); p += 2; }
-#endif /* NEED_ALIGN */
-
-#define UNROLL8(exp) { exp exp exp exp exp exp exp exp }
-
-#define REPEAT(statement) \
-{ \
-	while((count & ~0x7) && ((x+8) < width)) \
-		UNROLL8( statement; count--; x++; ); \
-	\
-	while((count > 0) && (x < width)) \
-	{ \
-		statement; \
-		count--; \
-		x++; \
-	} \
-}
 
-#define MASK_UPDATE() \
-{ \
-	mixmask <<= 1; \
-	if (mixmask == 0) \
-	{ \
-		mask = fom_mask ? fom_mask : CVAL(input); \
-		mixmask = 1; \
-	} \
+/* RDP 6.0 planar format header, [MS-RDPEGDI] 2.2.2.5.1 */
+#define PLANAR_HEADER_CLL_MASK	0x07
+#define PLANAR_HEADER_CS	0x08
+#define PLANAR_HEADER_RLE	0x10
+#define PLANAR_HEADER_NA	0x20
+
+/* Interleaved RLE, [MS-RDPBCGR] 2.2.9.1.1.3.1.2.4. One decoder serves
+   all pixel sizes: it is inlined with bpp a constant at each call
+   site, which gives a specialized copy per size. Runs are written a
+   line segment at a time, with pixels kept as bytes in wire order. */
+
+/* A multiple of 1, 2 and 3 byte pixels */
+#define RLE_PATTERN_SIZE	48
+
+/* n pixels of one colour */
+static inline void
+bitmap_colour_run(uint8 * dst, uint8 * colour, int n, const int bpp)
+{
+	int done;
+
+	if (n <= 0)
+		return;
+
+	if (bpp == 1)
+	{
+		memset(dst, colour[0], n);
+		return;
+	}
+
+	memcpy(dst, colour, bpp);
+	for (done = 1; done < n; done *= 2)
+		memcpy(dst + done * bpp, dst, MIN(done, n - done) * bpp);
 }
 
-/* 1 byte bitmap decompress */
-static RD_BOOL
-bitmap_decompress1(uint8 * output, int width, int height, uint8 * input, int size)
+/* n pixels of the previous line with mix applied, or of mix alone on
+   the first line */
+static inline void
+bitmap_mix_run(uint8 * dst, uint8 * prev, uint8 * mix, int n, const int bpp)
 {
-	uint8 *end = input + size;
-	uint8 *prevline = NULL, *line = NULL;
-	int opcode, count, offset, isfillormix, x = width;
-	int lastopcode = -1, insertmix = False, bicolour = False;
-	uint8 code;
-	uint8 colour1 = 0, colour2 = 0;
-	uint8 mixmask, mask = 0;
-	uint8 mix = 0xff;
-	int fom_mask = 0;
+	uint8 pattern[RLE_PATTERN_SIZE];
+	int i, bytes = n * bpp;
 
-	while (input < end)
+	if (prev == NULL)
 	{
-		fom_mask = 0;
-		code = CVAL(input);
-		opcode = code >> 4;
-		/* Handle different opcode forms */
-		switch (opcode)
-		{
-			case 0xc:
-			case 0xd:
-			case 0xe:
-				opcode -= 6;
-				count = code & 0xf;
-				offset = 16;
-				break;
-			case 0xf:
-				opcode = code & 0xf;
-				if (opcode < 9)
-				{
-					count = CVAL(input);
-					count |= CVAL(input) << 8;
-				}
-				else
-				{
-					count = (opcode < 0xb) ? 8 : 1;
-				}
-				offset = 0;
-				break;
-			default:
-				opcode >>= 1;
-				count = code & 0x1f;
-				offset = 32;
-				break;
-		}
-		/* Handle strange cases for counts */
-		if (offset != 0)
-		{
-			isfillormix = ((opcode == 2) || (opcode == 7));
-			if (count == 0)
-			{
-				if (isfillormix)
-					count = CVAL(input) + 1;
-				else
-					count = CVAL(input) + offset;
-			}
-			else if (isfillormix)
-			{
-				count <<= 3;
-			}
-		}
-		/* Read preliminary data */
-		switch (opcode)
-		{
-			case 0:	/* Fill */
-				if ((lastopcode == opcode) && !((x == width) && (prevline == NULL)))
-					insertmix = True;
-				break;
-			case 8:	/* Bicolour */
-				colour1 = CVAL(input);
-				colour2 = CVAL(input);
-				break;
-			case 3:	/* Colour */
-				colour2 = CVAL(input);
-				break;
-			case 6:	/* SetMix/Mix */
-			case 7:	/* SetMix/FillOrMix */
-				mix = CVAL(input);
-				opcode -= 5;
-				break;
-			case 9:	/* FillOrMix_1 */
-				mask = 0x03;
-				opcode = 0x02;
-				fom_mask = 3;
-				break;
-			case 0x0a:	/* FillOrMix_2 */
-				mask = 0x05;
-				opcode = 0x02;
-				fom_mask = 5;
-				break;
-		}
-		lastopcode = opcode;
-		mixmask = 0;
-		/* Output body */
-		while (count > 0)
+		bitmap_colour_run(dst, mix, n, bpp);
+		return;
+	}
+
+	if (bytes >= RLE_PATTERN_SIZE)
+	{
+		for (i = 0; i < RLE_PATTERN_SIZE; i++)
+			pattern[i] = mix[i % bpp];
+
+		for (; bytes >= RLE_PATTERN_SIZE; bytes -= RLE_PATTERN_SIZE)
 		{
-			if (x >= width)
-			{
-				if (height <= 0)
-					return False;
-				x = 0;
-				height--;
-				prevline = line;
-				line = output + height * width;
-			}
-			switch (opcode)
-			{
-				case 0:	/* Fill */
-					if (insertmix)
-					{
-						if (prevline == NULL)
-							line[x] = mix;
-						else
-							line[x] = prevline[x] ^ mix;
-						insertmix = False;
-						count--;
-						x++;
-					}
-					if (prevline == NULL)
-					{
-						REPEAT(line[x] = 0)
-					}
-					else
-					{
-						REPEAT(line[x] = prevline[x])
-					}
-					break;
-				case 1:	/* Mix */
-					if (prevline == NULL)
-					{
-						REPEAT(line[x] = mix)
-					}
-					else
-					{
-						REPEAT(line[x] = prevline[x] ^ mix)
-					}
-					break;
-				case 2:	/* Fill or Mix */
-					if (prevline == NULL)
-					{
-						REPEAT
-						(
-							MASK_UPDATE();
-							if (mask & mixmask)
-								line[x] = mix;
-							else
-								line[x] = 0;
-						)
-					}
-					else
-					{
-						REPEAT
-						(
-							MASK_UPDATE();
-							if (mask & mixmask)
-								line[x] = prevline[x] ^ mix;
-							else
-								line[x] = prevline[x];
-						)
-					}
-					break;
-				case 3:	/* Colour */
-					REPEAT(line[x] = colour2)
-					break;
-				case 4:	/* Copy */
-					REPEAT(line[x] = CVAL(input))
-					break;
-				case 8:	/* Bicolour */
-					REPEAT
-					(
-						if (bicolour)
-						{
-							line[x] = colour2;
-							bicolour = False;
-						}
-						else
-						{
-							line[x] = colour1;
-							bicolour = True; count++;
-						}
-					)
-					break;
-				case 0xd:	/* White */
-					REPEAT(line[x] = 0xff)
-					break;
-				case 0xe:	/* Black */
-					REPEAT(line[x] = 0)
-					break;
-				default:
-					logger(Core, Warning, "bitmap_decompress(), unhandled bitmap opcode 0x%x", opcode);
-					return False;
-			}
+			for (i = 0; i < RLE_PATTERN_SIZE; i++)
+				dst[i] = prev[i] ^ pattern[i];
+			dst += RLE_PATTERN_SIZE;
+			prev += RLE_PATTERN_SIZE;
 		}
 	}
-	return True;
+
+	for (i = 0; i < bytes; i++)
+		dst[i] = prev[i] ^ mix[i % bpp];
 }
 
-/* 2 byte bitmap decompress */
-static RD_BOOL
-bitmap_decompress2(uint8 * output, int width, int height, uint8 * input, int size)
+/* Eight pixels of a fill or mix run, mixing those whose bit is set in
+   mask, least significant bit first */
+static inline void
+bitmap_mask_mix(uint8 * dst, uint8 * prev, uint8 * mix, uint8 mask, const int bpp)
+{
+	uint8 select;
+	int i, j;
+
+#ifdef __SSE2__
+	if (bpp == 1)
+	{
+		__m128i bits = _mm_set_epi8(0, 0, 0, 0, 0, 0, 0, 0,
+					    -128, 64, 32, 16, 8, 4, 2, 1);
+		__m128i lanes = _mm_and_si128(_mm_set1_epi8(mask), bits);
+		__m128i out = _mm_and_si128(_mm_set1_epi8(mix[0]), _mm_cmpeq_epi8(lanes, bits));
+
+		if (prev != NULL)
+			out = _mm_xor_si128(out, _mm_loadl_epi64((__m128i *) prev));
+		_mm_storel_epi64((__m128i *) dst, out);
+		return;
+	}
+
+	if (bpp == 2)
+	{
+		__m128i bits = _mm_set_epi16(128, 64, 32, 16, 8, 4, 2, 1);
+		__m128i lanes = _mm_and_si128(_mm_set1_epi16(mask), bits);
+		uint16 colour;
+		__m128i out;
+
+		memcpy(&colour, mix, 2);
+		out = _mm_and_si128(_mm_set1_epi16(colour), _mm_cmpeq_epi16(lanes, bits));
+		if (prev != NULL)
+			out = _mm_xor_si128(out, _mm_loadu_si128((__m128i *) prev));
+		_mm_storeu_si128((__m128i *) dst, out);
+		return;
+	}
+#endif
+
+	for (i = 0; i < 8; i++)
+	{
+		select = (mask & (1 << i)) ? 0xff : 0;
+		for (j = 0; j < bpp; j++)
+			dst[i * bpp + j] = (prev ? prev[i * bpp + j] : 0) ^ (mix[j] & select);
+	}
+}
+
+static inline RD_BOOL
+bitmap_decompress_rle(uint8 * output, int width, int height, uint8 * input, int size,
+		      const int bpp)
 {
 	uint8 *end = input + size;
-	uint16 *prevline = NULL, *line = NULL;
-	int opcode, count, offset, isfillormix, x = width;
+	uint8 *prevline = NULL, *line = NULL, *dst, *prev;
+	int opcode, count, offset, isfillormix, x = width, n, i;
 	int lastopcode = -1, insertmix = False, bicolour = False;
 	uint8 code;
-	uint16 colour1 = 0, colour2 = 0;
+	uint8 colour1[4] = {0, 0, 0, 0}, colour2[4] = {0, 0, 0, 0};
 	uint8 mixmask, mask = 0;
-	uint16 mix = 0xffff;
+	uint8 mix[4] = {0xff, 0xff, 0xff, 0xff};
 	int fom_mask = 0;
 
 	while (input < end)
@@ -295,6 +173,8 @@ bitmap_decompress2(uint8 * output, int width, int height, uint8 * input, int siz
 				opcode = code & 0xf;
 				if (opcode < 9)
 				{
+					if (end - input < 2)
+						return False;
 					count = CVAL(input);
 					count |= CVAL(input) << 8;
 				}
@@ -316,6 +196,8 @@ bitmap_decompress2(uint8 * output, int width, int height, uint8 * input, int siz
 			isfillormix = ((opcode == 2) || (opcode == 7));
 			if (count == 0)
 			{
+				if (input >= end)
+					return False;
 				if (isfillormix)
 					count = CVAL(input) + 1;
 				else
@@ -333,16 +215,26 @@ bitmap_decompress2(uint8 * output, int width, int height, uint8 * input, int siz
 				if ((lastopcode == opcode) && !((x == width) && (prevline == NULL)))
 					insertmix = True;
 				break;
-			case 8:	/* Bicolour */
-				CVAL2(input, colour1);
-				CVAL2(input, colour2);
+			case 8:	/* Bicolour, count is in pairs of pixels */
+				if (end - input < 2 * bpp)
+					return False;
+				memcpy(colour1, input, bpp);
+				memcpy(colour2, input + bpp, bpp);
+				input += 2 * bpp;
+				count *= 2;
 				break;
 			case 3:	/* Colour */
-				CVAL2(input, colour2);
+				if (end - input < bpp)
+					return False;
+				memcpy(colour2, input, bpp);
+				input += bpp;
 				break;
 			case 6:	/* SetMix/Mix */
 			case 7:	/* SetMix/FillOrMix */
-				CVAL2(input, mix);
+				if (end - input < bpp)
+					return False;
+				memcpy(mix, input, bpp);
+				input += bpp;
 				opcode -= 5;
 				break;
 			case 9:	/* FillOrMix_1 */
@@ -358,7 +250,7 @@ bitmap_decompress2(uint8 * output, int width, int height, uint8 * input, int siz
 		}
 		lastopcode = opcode;
 		mixmask = 0;
-		/* Output body */
+		/* Output body, one line segment at a time */
 		while (count > 0)
 		{
 			if (x >= width)
@@ -368,396 +260,127 @@ bitmap_decompress2(uint8 * output, int width, int height, uint8 * input, int siz
 				x = 0;
 				height--;
 				prevline = line;
-				line = ((uint16 *) output) + height * width;
+				line = output + height * width * bpp;
 			}
+			n = MIN(count, width - x);
+			dst = line + x * bpp;
+			prev = (prevline == NULL) ? NULL : prevline + x * bpp;
+
 			switch (opcode)
 			{
 				case 0:	/* Fill */
 					if (insertmix)
 					{
-						if (prevline == NULL)
-							line[x] = mix;
-						else
-							line[x] = prevline[x] ^ mix;
+						bitmap_mix_run(dst, prev, mix, 1, bpp);
 						insertmix = False;
 						count--;
 						x++;
+						continue;
 					}
-					if (prevline == NULL)
-					{
-						REPEAT(line[x] = 0)
-					}
+					if (prev == NULL)
+						memset(dst, 0, n * bpp);
 					else
-					{
-						REPEAT(line[x] = prevline[x])
-					}
+						memcpy(dst, prev, n * bpp);
 					break;
 				case 1:	/* Mix */
-					if (prevline == NULL)
-					{
-						REPEAT(line[x] = mix)
-					}
-					else
-					{
-						REPEAT(line[x] = prevline[x] ^ mix)
-					}
+					bitmap_mix_run(dst, prev, mix, n, bpp);
 					break;
 				case 2:	/* Fill or Mix */
-					if (prevline == NULL)
-					{
-						REPEAT
-						(
-							MASK_UPDATE();
-							if (mask & mixmask)
-								line[x] = mix;
-							else
-								line[x] = 0;
-						)
-					}
-					else
+					for (i = 0; i < n;)
 					{
-						REPEAT
-						(
-							MASK_UPDATE();
-							if (mask & mixmask)
-								line[x] = prevline[x] ^ mix;
-							else
-								line[x] = prevline[x];
-						)
-					}
-					break;
-				case 3:	/* Colour */
-					REPEAT(line[x] = colour2)
-					break;
-				case 4:	/* Copy */
-					REPEAT(CVAL2(input, line[x]))
-					break;
-				case 8:	/* Bicolour */
-					REPEAT
-					(
-						if (bicolour)
+						/* Whole mask bytes at once */
+						if ((mixmask == 0 || mixmask == 0x80) && n - i >= 8)
 						{
-							line[x] = colour2;
-							bicolour = False;
+							if (fom_mask == 0 && input >= end)
+								return False;
+							mask = fom_mask ? fom_mask : CVAL(input);
+							bitmap_mask_mix(dst + i * bpp,
+									prev ? prev + i * bpp : NULL,
+									mix, mask, bpp);
+							mixmask = 0x80;
+							i += 8;
+							continue;
 						}
-						else
-						{
-							line[x] = colour1;
-							bicolour = True;
-							count++;
-						}
-					)
-					break;
-				case 0xd:	/* White */
-					REPEAT(line[x] = 0xffff)
-					break;
-				case 0xe:	/* Black */
-					REPEAT(line[x] = 0)
-					break;
-				default:
-					logger(Core, Warning, "bitmap_decompress2(), unhandled bitmap opcode 0x%x", opcode);
-					return False;
-			}
-		}
-	}
-	return True;
-}
 
-/* 3 byte bitmap decompress */
-static RD_BOOL
-bitmap_decompress3(uint8 * output, int width, int height, uint8 * input, int size)
-{
-	uint8 *end = input + size;
-	uint8 *prevline = NULL, *line = NULL;
-	int opcode, count, offset, isfillormix, x = width;
-	int lastopcode = -1, insertmix = False, bicolour = False;
-	uint8 code;
-	uint8 colour1[3] = {0, 0, 0}, colour2[3] = {0, 0, 0};
-	uint8 mixmask, mask = 0;
-	uint8 mix[3] = {0xff, 0xff, 0xff};
-	int fom_mask = 0;
-
-	while (input < end)
-	{
-		fom_mask = 0;
-		code = CVAL(input);
-		opcode = code >> 4;
-		/* Handle different opcode forms */
-		switch (opcode)
-		{
-			case 0xc:
-			case 0xd:
-			case 0xe:
-				opcode -= 6;
-				count = code & 0xf;
-				offset = 16;
-				break;
-			case 0xf:
-				opcode = code & 0xf;
-				if (opcode < 9)
-				{
-					count = CVAL(input);
-					count |= CVAL(input) << 8;
-				}
-				else
-				{
-					count = (opcode <
-						 0xb) ? 8 : 1;
-				}
-				offset = 0;
-				break;
-			default:
-				opcode >>= 1;
-				count = code & 0x1f;
-				offset = 32;
-				break;
-		}
-		/* Handle strange cases for counts */
-		if (offset != 0)
-		{
-			isfillormix = ((opcode == 2) || (opcode == 7));
-			if (count == 0)
-			{
-				if (isfillormix)
-					count = CVAL(input) + 1;
-				else
-					count = CVAL(input) + offset;
-			}
-			else if (isfillormix)
-			{
-				count <<= 3;
-			}
-		}
-		/* Read preliminary data */
-		switch (opcode)
-		{
-			case 0:	/* Fill */
-				if ((lastopcode == opcode) && !((x == width) && (prevline == NULL)))
-					insertmix = True;
-				break;
-			case 8:	/* Bicolour */
-				colour1[0] = CVAL(input);
-				colour1[1] = CVAL(input);
-				colour1[2] = CVAL(input);
-				colour2[0] = CVAL(input);
-				colour2[1] = CVAL(input);
-				colour2[2] = CVAL(input);
-				break;
-			case 3:	/* Colour */
-				colour2[0] = CVAL(input);
-				colour2[1] = CVAL(input);
-				colour2[2] = CVAL(input);
-				break;
-			case 6:	/* SetMix/Mix */
-			case 7:	/* SetMix/FillOrMix */
-				mix[0] = CVAL(input);
-				mix[1] = CVAL(input);
-				mix[2] = CVAL(input);
-				opcode -= 5;
-				break;
-			case 9:	/* FillOrMix_1 */
-				mask = 0x03;
-				opcode = 0x02;
-				fom_mask = 3;
-				break;
-			case 0x0a:	/* FillOrMix_2 */
-				mask = 0x05;
-				opcode = 0x02;
-				fom_mask = 5;
-				break;
-		}
-		lastopcode = opcode;
-		mixmask = 0;
-		/* Output body */
-		while (count > 0)
-		{
-			if (x >= width)
-			{
-				if (height <= 0)
-					return False;
-				x = 0;
-				height--;
-				prevline = line;
-				line = output + height * (width * 3);
-			}
-			switch (opcode)
-			{
-				case 0:	/* Fill */
-					if (insertmix)
-					{
-						if (prevline == NULL)
+						mixmask <<= 1;
+						if (mixmask == 0)
 						{
-							line[x * 3] = mix[0];
-							line[x * 3 + 1] = mix[1];
-							line[x * 3 + 2] = mix[2];
+							if (fom_mask == 0 && input >= end)
+								return False;
+							mask = fom_mask ? fom_mask : CVAL(input);
+							mixmask = 1;
 						}
+						if (mask & mixmask)
+							bitmap_mix_run(dst + i * bpp,
+								       prev ? prev + i * bpp : NULL,
+								       mix, 1, bpp);
+						else if (prev == NULL)
+							memset(dst + i * bpp, 0, bpp);
 						else
-						{
-							line[x * 3] =
-							 prevline[x * 3] ^ mix[0];
-							line[x * 3 + 1] =
-							 prevline[x * 3 + 1] ^ mix[1];
-							line[x * 3 + 2] =
-							 prevline[x * 3 + 2] ^ mix[2];
-						}
-						insertmix = False;
-						count--;
-						x++;
-					}
-					if (prevline == NULL)
-					{
-						REPEAT
-						(
-							line[x * 3] = 0;
-							line[x * 3 + 1] = 0;
-							line[x * 3 + 2] = 0;
-						)
-					}
-					else
-					{
-						REPEAT
-						(
-							line[x * 3] = prevline[x * 3];
-							line[x * 3 + 1] = prevline[x * 3 + 1];
-							line[x * 3 + 2] = prevline[x * 3 + 2];
-						)
-					}
-					break;
-				case 1:	/* Mix */
-					if (prevline == NULL)
-					{
-						REPEAT
-						(
-							line[x * 3] = mix[0];
-							line[x * 3 + 1] = mix[1];
-							line[x * 3 + 2] = mix[2];
-						)
-					}
-					else
-					{
-						REPEAT
-						(
-							line[x * 3] =
-							 prevline[x * 3] ^ mix[0];
-							line[x * 3 + 1] =
-							 prevline[x * 3 + 1] ^ mix[1];
-							line[x * 3 + 2] =
-							 prevline[x * 3 + 2] ^ mix[2];
-						)
-					}
-					break;
-				case 2:	/* Fill or Mix */
-					if (prevline == NULL)
-					{
-						REPEAT
-						(
-							MASK_UPDATE();
-							if (mask & mixmask)
-							{
-								line[x * 3] = mix[0];
-								line[x * 3 + 1] = mix[1];
-								line[x * 3 + 2] = mix[2];
-							}
-							else
-							{
-								line[x * 3] = 0;
-								line[x * 3 + 1] = 0;
-								line[x * 3 + 2] = 0;
-							}
-						)
-					}
-					else
-					{
-						REPEAT
-						(
-							MASK_UPDATE();
-							if (mask & mixmask)
-							{
-								line[x * 3] = 
-								 prevline[x * 3] ^ mix [0];
-								line[x * 3 + 1] =
-								 prevline[x * 3 + 1] ^ mix [1];
-								line[x * 3 + 2] =
-								 prevline[x * 3 + 2] ^ mix [2];
-							}
-							else
-							{
-								line[x * 3] =
-								 prevline[x * 3];
-								line[x * 3 + 1] =
-								 prevline[x * 3 + 1];
-								line[x * 3 + 2] =
-								 prevline[x * 3 + 2];
-							}
-						)
+							memcpy(dst + i * bpp, prev + i * bpp, bpp);
+						i++;
 					}
 					break;
 				case 3:	/* Colour */
-					REPEAT
-					(
-						line[x * 3] = colour2 [0];
-						line[x * 3 + 1] = colour2 [1];
-						line[x * 3 + 2] = colour2 [2];
-					)
+					bitmap_colour_run(dst, colour2, n, bpp);
 					break;
 				case 4:	/* Copy */
-					REPEAT
-					(
-						line[x * 3] = CVAL(input);
-						line[x * 3 + 1] = CVAL(input);
-						line[x * 3 + 2] = CVAL(input);
-					)
+					if (end - input < n * bpp)
+						return False;
+					memcpy(dst, input, n * bpp);
+					input += n * bpp;
 					break;
 				case 8:	/* Bicolour */
-					REPEAT
-					(
-						if (bicolour)
-						{
-							line[x * 3] = colour2[0];
-							line[x * 3 + 1] = colour2[1];
-							line[x * 3 + 2] = colour2[2];
-							bicolour = False;
-						}
-						else
-						{
-							line[x * 3] = colour1[0];
-							line[x * 3 + 1] = colour1[1];
-							line[x * 3 + 2] = colour1[2];
-							bicolour = True;
-							count++;
-						}
-					)
+					for (i = 0; i < n; i++)
+					{
+						memcpy(dst + i * bpp, bicolour ? colour2 : colour1, bpp);
+						bicolour = !bicolour;
+					}
 					break;
 				case 0xd:	/* White */
-					REPEAT
-					(
-						line[x * 3] = 0xff;
-						line[x * 3 + 1] = 0xff;
-						line[x * 3 + 2] = 0xff;
-					)
+					memset(dst, 0xff, n * bpp);
 					break;
 				case 0xe:	/* Black */
-					REPEAT
-					(
-						line[x * 3] = 0;
-						line[x * 3 + 1] = 0;
-						line[x * 3 + 2] = 0;
-					)
+					memset(dst, 0, n * bpp);
 					break;
 				default:
-					logger(Core, Warning, "bitmap_decompress3(), unhandled bitmap opcode 0x%x", opcode);
+					logger(Core, Warning, "bitmap_decompress_rle(), unhandled bitmap opcode 0x%x", opcode);
 					return False;
 			}
+			count -= n;
+			x += n;
 		}
 	}
 	return True;
 }
 
-/* decompress a colour plane */
+/* 1 byte bitmap decompress */
+static RD_BOOL
+bitmap_decompress1(uint8 * output, int width, int height, uint8 * input, int size)
+{
+	return bitmap_decompress_rle(output, width, height, input, size, 1);
+}
+
+/* 2 byte bitmap decompress */
+static RD_BOOL
+bitmap_decompress2(uint8 * output, int width, int height, uint8 * input, int size)
+{
+	return bitmap_decompress_rle(output, width, height, input, size, 2);
+}
+
+/* 3 byte bitmap decompress */
+static RD_BOOL
+bitmap_decompress3(uint8 * output, int width, int height, uint8 * input, int size)
+{
+	return bitmap_decompress_rle(output, width, height, input, size, 3);
+}
+
+/* decompress a colour plane, writing every fourth byte and moving
+   line_step bytes from one line to the next. Returns the number of
+   input bytes used, or -1 if the plane runs past size bytes. */
 static int
-process_plane(uint8 * in, int width, int height, uint8 * out, int size)
+process_plane(uint8 * in, int width, int height, uint8 * out, int size, int line_step)
 {
-	UNUSED(size);
 	int indexw;
 	int indexh;
 	int code;
@@ -770,14 +393,16 @@ process_plane(uint8 * in, int width, int height, uint8 * out, int size)
 	uint8 * this_line;
 	uint8 * org_in;
 	uint8 * org_out;
+	uint8 * end;
 
 	org_in = in;
 	org_out = out;
+	end = in + size;
 	last_line = 0;
 	indexh = 0;
 	while (indexh < height)
 	{
-		out = (org_out + width * height * 4) - ((indexh + 1) * width * 4);
+		out = org_out + indexh * line_step;
 		color = 0;
 		this_line = out;
 		indexw = 0;
@@ -785,6 +410,8 @@ process_plane(uint8 * in, int width, int height, uint8 * out, int size)
 		{
 			while (indexw < width)
 			{
+				if (in >= end)
+					return -1;
 				code = CVAL(in);
 				replen = code & 0xf;
 				collen = (code >> 4) & 0xf;
@@ -794,6 +421,8 @@ process_plane(uint8 * in, int width, int height, uint8 * out, int size)
 					replen = revcode;
 					collen = 0;
 				}
+				if (end - in < collen)
+					return -1;
 				while (indexw < width && collen > 0)
 				{
 					color = CVAL(in);
@@ -815,6 +444,8 @@ process_plane(uint8 * in, int width, int height, uint8 * out, int size)
 		{
 			while (indexw < width)
 			{
+				if (in >= end)
+					return -1;
 				code = CVAL(in);
 				replen = code & 0xf;
 				collen = (code >> 4) & 0xf;
@@ -824,6 +455,8 @@ process_plane(uint8 * in, int width, int height, uint8 * out, int size)
 					replen = revcode;
 					collen = 0;
 				}
+				if (end - in < collen)
+					return -1;
 				while (indexw < width && collen > 0)
 				{
 					x = CVAL(in);
@@ -860,13 +493,15 @@ process_plane(uint8 * in, int width, int height, uint8 * out, int size)
 	return (int) (in - org_in);
 }
 
-/* 4 byte bitmap decompress */
+/* 4 byte bitmap decompress, planes stored bottom-up */
 static RD_BOOL
 bitmap_decompress4(uint8 * output, int width, int height, uint8 * input, int size)
 {
 	int code;
 	int bytes_pro;
 	int total_pro;
+	int plane;
+	uint8 * last_line;
 
 	code = CVAL(input);
 	if (code != 0x10)
@@ -874,20 +509,75 @@ bitmap_decompress4(uint8 * output, int width, int height, uint8 * input, int siz
 		return False;
 	}
 	total_pro = 1;
-	bytes_pro = process_plane(input, width, height, output + 3, size - total_pro);
-	total_pro += bytes_pro;
-	input += bytes_pro;
-	bytes_pro = process_plane(input, width, height, output + 2, size - total_pro);
-	total_pro += bytes_pro;
-	input += bytes_pro;
-	bytes_pro = process_plane(input, width, height, output + 1, size - total_pro);
-	total_pro += bytes_pro;
-	input += bytes_pro;
-	bytes_pro = process_plane(input, width, height, output + 0, size - total_pro);
-	total_pro += bytes_pro;
+	last_line = output + (height - 1) * width * 4;
+	for (plane = 3; plane >= 0; plane--)
+	{
+		bytes_pro = process_plane(input, width, height, last_line + plane,
+					  size - total_pro, -width * 4);
+		if (bytes_pro < 0)
+			return False;
+		total_pro += bytes_pro;
+		input += bytes_pro;
+	}
 	return size == total_pro;
 }
 
+/* RDP 6.0 planar bitmap as sent by the graphics pipeline, top-down,
+   with or without RLE and alpha plane. Planes with colour loss or
+   chroma subsampling are not supported. */
+RD_BOOL
+bitmap_decompress_planar(uint8 * output, int width, int height, uint8 * input, int size)
+{
+	uint8 header;
+	uint8 * end;
+	int plane;
+	int first;
+	int used;
+	int i;
+
+	if (size < 1)
+		return False;
+
+	end = input + size;
+	header = CVAL(input);
+	if (header & (PLANAR_HEADER_CLL_MASK | PLANAR_HEADER_CS))
+	{
+		logger(Graphics, Warning,
+		       "bitmap_decompress_planar(), unsupported format header 0x%x", header);
+		return False;
+	}
+
+	/* Without an alpha plane, the bitmap is opaque */
+	first = 0;
+	if (header & PLANAR_HEADER_NA)
+	{
+		for (i = 0; i < width * height; i++)
+			output[i * 4 + 3] = 0xff;
+		first = 1;
+	}
+
+	for (plane = first; plane < 4; plane++)
+	{
+		if (header & PLANAR_HEADER_RLE)
+		{
+			used = process_plane(input, width, height, output + 3 - plane,
+					     end - input, width * 4);
+			if (used < 0)
+				return False;
+			input += used;
+		}
+		else
+		{
+			if (end - input < width * height)
+				return False;
+			for (i = 0; i < width * height; i++)
+				output[i * 4 + 3 - plane] = input[i];
+			input += width * height;
+		}
+	}
+	return True;
+}
+
 /* main decompress function */
 RD_BOOL
 bitmap_decompress(uint8 * output, int width, int height, uint8 * input, int size, int Bpp)
@@ -45,13 +45,13 @@ struct bmpcache_entry
 	sint16 next;
 };
 
-static struct bmpcache_entry g_bmpcache[3][0xa00];
-static RD_HBITMAP g_volatile_bc[3];
+static struct bmpcache_entry g_bmpcache[BMPCACHE2_NUM_CACHES][0xa00];
+static RD_HBITMAP g_volatile_bc[BMPCACHE2_NUM_CACHES];
 
-static int g_bmpcache_lru[3] = { NOT_SET, NOT_SET, NOT_SET };
-static int g_bmpcache_mru[3] = { NOT_SET, NOT_SET, NOT_SET };
+static int g_bmpcache_lru[BMPCACHE2_NUM_CACHES] = { NOT_SET, NOT_SET, NOT_SET, NOT_SET };
+static int g_bmpcache_mru[BMPCACHE2_NUM_CACHES] = { NOT_SET, NOT_SET, NOT_SET, NOT_SET };
 
-static int g_bmpcache_count[3];
+static int g_bmpcache_count[BMPCACHE2_NUM_CACHES];
 
 /* Setup the bitmap cache lru/mru linked list */
 void
@@ -272,6 +272,8 @@ cache_save_state(void)
 			}
 			logger(Core, Debug, "cache_save_state(), %d stamps written", t);
 		}
+
+	pstcache_save_index();
 }
 
 
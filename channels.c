@@ -26,6 +26,11 @@
 #define CHANNEL_FLAG_LAST		0x02
 #define CHANNEL_FLAG_SHOW_PROTOCOL	0x10
 
+/* Room for the ISO, MCS, security and channel headers of a chunk, and
+   the number of chunks passed to tcp_send_vector() at once */
+#define CHANNEL_HEADERS_LENGTH		(7 + 8 + 4 + 8)
+#define CHANNEL_VECTOR_CHUNKS		64
+
 extern RDP_VERSION g_rdp_version;
 extern RD_BOOL g_encryption;
 
@@ -77,6 +82,63 @@ channel_init(VCHANNEL * channel, uint32 length)
 	return s;
 }
 
+/* Send the chunks of an unencrypted message straight from the stream,
+   each behind headers written to a separate buffer */
+static void
+channel_send_vector(STREAM s, VCHANNEL * channel)
+{
+	static uint8 headers[CHANNEL_VECTOR_CHUNKS][CHANNEL_HEADERS_LENGTH];
+	SEND_VECTOR vector[CHANNEL_VECTOR_CHUNKS * 2];
+	struct stream hdr;
+	uint32 length, flags, thislength, sent;
+	int sec_hdrlen, n;
+	uint8 *data;
+
+	s_pop_layer(s, channel_hdr);
+	data = s->p + 8;
+	length = s->end - data;
+	sec_hdrlen = sec_header_length(0);
+
+	logger(Protocol, Debug, "channel_send(), channel = %d, length = %d", channel->mcs_id,
+	       length);
+
+	memset(&hdr, 0, sizeof(hdr));
+	sent = 0;
+	n = 0;
+	do
+	{
+		thislength = MIN(length - sent, CHANNEL_CHUNK_LENGTH);
+		flags = (sent == 0) ? CHANNEL_FLAG_FIRST : 0;
+		if (sent + thislength == length)
+			flags |= CHANNEL_FLAG_LAST;
+		if (channel->flags & CHANNEL_OPTION_SHOW_PROTOCOL)
+			flags |= CHANNEL_FLAG_SHOW_PROTOCOL;
+
+		hdr.data = hdr.p = headers[n];
+		hdr.size = CHANNEL_HEADERS_LENGTH;
+		iso_out_data_header(&hdr, 7 + 8 + sec_hdrlen + 8 + thislength);
+		mcs_out_data_header(&hdr, channel->mcs_id, sec_hdrlen + 8 + thislength);
+		if (sec_hdrlen)
+			out_uint32_le(&hdr, 0);	/* security flags */
+		out_uint32_le(&hdr, length);
+		out_uint32_le(&hdr, flags);
+
+		vector[2 * n].data = headers[n];
+		vector[2 * n].length = hdr.p - headers[n];
+		vector[2 * n + 1].data = data + sent;
+		vector[2 * n + 1].length = thislength;
+		n++;
+		sent += thislength;
+
+		if (n == CHANNEL_VECTOR_CHUNKS || sent == length)
+		{
+			tcp_send_vector(vector, 2 * n);
+			n = 0;
+		}
+	}
+	while (sent < length);
+}
+
 void
 channel_send(STREAM s, VCHANNEL * channel)
 {
@@ -88,6 +150,16 @@ channel_send(STREAM s, VCHANNEL * channel)
 	scard_lock(SCARD_LOCK_CHANNEL);
 #endif
 
+	/* Encryption needs each chunk and its header in one buffer */
+	if (!g_encryption)
+	{
+		channel_send_vector(s, channel);
+#ifdef WITH_SCARD
+		scard_unlock(SCARD_LOCK_CHANNEL);
+#endif
+		return;
+	}
+
 	/* first fragment sent in-place */
 	s_pop_layer(s, channel_hdr);
 	length = s->end - s->p - 8;
@@ -138,55 +210,74 @@ channel_send(STREAM s, VCHANNEL * channel)
 #endif
 }
 
+/* Channels get consecutive MCS ids as they are registered */
+static VCHANNEL *
+channel_get_by_mcs_id(uint16 mcs_channel)
+{
+	if (mcs_channel <= MCS_GLOBAL_CHANNEL ||
+	    mcs_channel - (MCS_GLOBAL_CHANNEL + 1) >= (int) g_num_channels)
+		return NULL;
+
+	return &g_channels[mcs_channel - (MCS_GLOBAL_CHANNEL + 1)];
+}
+
 void
 channel_process(STREAM s, uint16 mcs_channel)
 {
 	uint32 length, flags;
 	uint32 thislength;
-	VCHANNEL *channel = NULL;
-	unsigned int i;
+	VCHANNEL *channel;
 	STREAM in;
 
-	for (i = 0; i < g_num_channels; i++)
-	{
-		channel = &g_channels[i];
-		if (channel->mcs_id == mcs_channel)
-			break;
-	}
-
-	if (i >= g_num_channels)
+	channel = channel_get_by_mcs_id(mcs_channel);
+	if (channel == NULL)
 		return;
 
+	if (!s_check_rem(s, 8))
+		return;
 	in_uint32_le(s, length);
 	in_uint32_le(s, flags);
 	if ((flags & CHANNEL_FLAG_FIRST) && (flags & CHANNEL_FLAG_LAST))
 	{
 		/* single fragment - pass straight up */
 		channel->process(s);
+		return;
 	}
-	else
+
+	/* add fragment to defragmentation buffer, which spans the whole
+	   message from its first fragment and is kept for the next one */
+	in = &channel->in;
+	if (flags & CHANNEL_FLAG_FIRST)
 	{
-		/* add fragment to defragmentation buffer */
-		in = &channel->in;
-		if (flags & CHANNEL_FLAG_FIRST)
+		if (length > in->size)
 		{
-			if (length > in->size)
-			{
-				in->data = (uint8 *) xrealloc(in->data, length);
-				in->size = length;
-			}
-			in->p = in->data;
+			/* nothing to keep, so no need for xrealloc to copy */
+			xfree(in->data);
+			in->data = (uint8 *) xmalloc(length);
+			in->size = length;
 		}
+		in->p = in->data;
+		in->end = in->data + length;
+	}
+	else if (in->end == in->data)
+	{
+		logger(Protocol, Warning,
+		       "channel_process(), fragment without a first one on channel %d",
+		       mcs_channel);
+		return;
+	}
 
-		thislength = MIN(s->end - s->p, in->data + in->size - in->p);
-		memcpy(in->p, s->p, thislength);
-		in->p += thislength;
+	thislength = MIN(s->end - s->p, in->end - in->p);
+	memcpy(in->p, s->p, thislength);
+	in->p += thislength;
 
-		if (flags & CHANNEL_FLAG_LAST)
-		{
-			in->end = in->p;
-			in->p = in->data;
-			channel->process(in);
-		}
+	if (flags & CHANNEL_FLAG_LAST)
+	{
+		in->end = in->p;
+		in->p = in->data;
+		channel->process(in);
+
+		/* nothing pending */
+		in->p = in->end = in->data;
 	}
 }
@@ -51,6 +51,32 @@
 #define FASTPATH_UPDATETYPE_CACHED		0xA
 #define FASTPATH_UPDATETYPE_POINTER		0xB
 
+/* [MS-RDPBCGR] 2.2.9.1.2.1.10.1 */
+#define CMDTYPE_SET_SURFACE_BITS	0x0001
+#define CMDTYPE_FRAME_MARKER		0x0004
+#define CMDTYPE_STREAM_SURFACE_BITS	0x0006
+
+/* [MS-RDPBCGR] 2.2.9.2.3 */
+#define SURFACECMD_FRAMEACTION_BEGIN	0x0000
+#define SURFACECMD_FRAMEACTION_END	0x0001
+
+/* [MS-RDPBCGR] 2.2.9.2.1.1 */
+#define EX_COMPRESSED_BITMAP_HEADER_PRESENT	0x01
+
+/* Client assigned codec IDs, 0 is uncompressed data */
+#define RDP_CODEC_ID_NONE	0x00
+#define RDP_CODEC_ID_NSCODEC	0x01
+#define RDP_CODEC_ID_REMOTEFX	0x03
+
+/* Size of the NSCodec capability set */
+#define NSC_PROPERTIES_LENGTH	3
+
+/* Size of the RemoteFX client capabilities container */
+#define RFX_PROPERTIES_LENGTH	49
+
+/* Decoding threads besides the main one */
+#define WORKPOOL_MAX_THREADS	8
+
 #define FASTPATH_FRAGMENT_SINGLE	(0x0 << 4)
 #define FASTPATH_FRAGMENT_LAST		(0x1 << 4)
 #define FASTPATH_FRAGMENT_FIRST		(0x2 << 4)
@@ -163,11 +189,13 @@ enum MCS_DPU_REASON
 #define SEC_TAG_SRV_INFO	0x0c01
 #define SEC_TAG_SRV_CRYPT	0x0c02
 #define SEC_TAG_SRV_CHANNELS	0x0c03
+#define SEC_TAG_SRV_MSGCHANNEL	0x0c04
 
 #define CS_CORE			0xc001
 #define CS_SECURITY		0xc002
 #define CS_NET			0xc003
 #define CS_CLUSTER		0xc004
+#define CS_MCS_MSGCHANNEL	0xc006
 
 #define SEC_TAG_PUBKEY		0x0006
 #define SEC_TAG_KEYSIG		0x0008
@@ -224,9 +252,11 @@ enum RDP_DATA_PDU_TYPE
 	RDP_DATA_PDU_CLIENT_WINDOW_STATUS = 0x23,	/* PDUTYPE2_SUPRESS_OUTPUT */
 	RDP_DATA_PDU_LOGON = 0x26,	/* PDUTYPE2_SAVE_SESSION_INFO */
 	RDP_DATA_PDU_FONT2 = 0x27,	/* PDUTYPE2_FONTLIST */
+	RDP_DATA_PDU_FONTMAP = 0x28,	/* PDUTYPE2_FONTMAP */
 	RDP_DATA_PDU_KEYBOARD_INDICATORS = 0x29,	/* PDUTYPE2_SET_KEYBOARD_INDICATORS */
 	RDP_DATA_PDU_SET_ERROR_INFO = 0x2f,	/* PDUTYPE2_SET_ERROR_INFO */
 	RDP_DATA_PDU_AUTORECONNECT_STATUS = 0x32,	/* PDUTYPE2_ARC_STATUS_PDU */
+	RDP_DATA_PDU_FRAME_ACKNOWLEDGE = 0x38,	/* PDUTYPE2_FRAME_ACKNOWLEDGE */
 };
 
 enum RDP_SAVE_SESSION_PDU_TYPE
@@ -335,7 +365,12 @@ enum RDP_INPUT_DEVICE
 #define BMPCACHE2_C0_CELLS	0x78
 #define BMPCACHE2_C1_CELLS	0x78
 #define BMPCACHE2_C2_CELLS	0x150
+#define BMPCACHE2_C3_CELLS	0x40
 #define BMPCACHE2_NUM_PSTCELLS	0x9f6
+#define BMPCACHE2_NUM_CACHES	4
+
+/* Largest bitmap in a cell of cache id: 16x16, 32x32, 64x64, 128x128 */
+#define BMPCACHE2_CELL_PIXELS(id)	((uint32)0x100 << (2 * (id)))
 
 #define PDU_FLAG_FIRST		0x01
 #define PDU_FLAG_LAST		0x02
@@ -398,6 +433,22 @@ enum RDP_INPUT_DEVICE
 #define RDP_CAPSET_LARGE_POINTER	27
 #define RDP_CAPLEN_LARGE_POINTER	6
 
+#define RDP_CAPSET_SURFCMDS	28
+#define RDP_CAPLEN_SURFCMDS	12
+
+#define RDP_CAPSET_BITMAP_CODECS	29
+
+#define RDP_CAPSET_FRAME_ACKNOWLEDGE	30
+#define RDP_CAPLEN_FRAME_ACKNOWLEDGE	8
+
+/* Frames the server may send ahead of our acknowledgements */
+#define RDP_MAX_UNACKNOWLEDGED_FRAMES	2
+
+/* cmdFlags, [MS-RDPBCGR] 2.2.7.2.9 */
+#define SURFCMDS_SET_SURFACE_BITS	0x00000002
+#define SURFCMDS_FRAME_MARKER		0x00000010
+#define SURFCMDS_STREAM_SURFACE_BITS	0x00000040
+
 #define RDP_SOURCE		"MSTSC"
 
 /* Logon flags */
@@ -739,6 +790,38 @@ enum RDP_DESKTOP_ORIENTATION
 #define RNS_UD_CS_SUPPORT_DYNAMIC_TIME_ZONE	0x0200
 #define RNS_UD_CS_SUPPORT_HEARTBEAT_PDU		0x0400
 
+/* connectionType, [MS-RDPBCGR] 2.2.1.3.2 */
+#define CONNECTION_TYPE_MODEM		0x01
+#define CONNECTION_TYPE_BROADBAND_LOW	0x02
+#define CONNECTION_TYPE_SATELLITE	0x03
+#define CONNECTION_TYPE_BROADBAND_HIGH	0x04
+#define CONNECTION_TYPE_WAN		0x05
+#define CONNECTION_TYPE_LAN		0x06
+#define CONNECTION_TYPE_AUTODETECT	0x07
+
+/* headerTypeId, [MS-RDPBCGR] 2.2.14.3 */
+#define TYPE_ID_AUTODETECT_REQUEST	0x00
+#define TYPE_ID_AUTODETECT_RESPONSE	0x01
+
+/* requestType, [MS-RDPBCGR] 2.2.14.1 */
+#define RDP_RTT_REQUEST_CONTINUOUS	0x0001
+#define RDP_RTT_REQUEST_CONNECTTIME	0x1001
+#define RDP_BW_START_CONTINUOUS		0x0014
+#define RDP_BW_START_TUNNEL		0x0114
+#define RDP_BW_START_CONNECTTIME	0x1014
+#define RDP_BW_PAYLOAD			0x0002
+#define RDP_BW_STOP_CONNECTTIME		0x002b
+#define RDP_BW_STOP_CONTINUOUS		0x0429
+#define RDP_BW_STOP_TUNNEL		0x0629
+#define RDP_NETCHAR_RESULT_BASE_AVG	0x0840
+#define RDP_NETCHAR_RESULT_BW_AVG	0x0880
+#define RDP_NETCHAR_RESULT_ALL		0x08c0
+
+/* responseType, [MS-RDPBCGR] 2.2.14.2 */
+#define RDP_RTT_RESPONSE		0x0000
+#define RDP_BW_RESULTS_CONNECTTIME	0x0003
+#define RDP_BW_RESULTS_CONTINUOUS	0x000b
+
 /* [MS-RDPBCGR] 2.2.7.1.1 */
 #define OSMAJORTYPE_WINDOWS	0x0001
 #define OSMINORTYPE_WINDOWSNT	0x0003
@@ -761,6 +844,10 @@ enum RDP_DESKTOP_ORIENTATION
 #define SOLIDPATTERNBRUSHONLY	0x0040
 #define ORDERFLAGS_EXTRA_FLAGS	0x0080
 
+/* orderSupportExFlags, [MS-RDPBCGR] 2.2.7.1.3 */
+#define ORDERFLAGS_EX_CACHE_BITMAP_REV3_SUPPORT	0x0002
+#define ORDERFLAGS_EX_ALTSEC_FRAME_MARKER_SUPPORT	0x0004
+
 /* orderSupport index, [MS-RDPBCGR] 2.2.7.1.3 */
 #define TS_NEG_DSTBLT_INDEX		0x00
 #define TS_NEG_PATBLT_INDEX		0x01
@@ -732,6 +732,7 @@ cssp_connect(char *server, char *user, char *domain, char *password, STREAM s)
 		return False;
 	}
 
+	timing_start(TIMING_CREDSSP);
 	tcp_tls_get_server_pubkey(&pubkey);
 
 	// Enter the spnego loop
@@ -857,6 +858,7 @@ cssp_connect(char *server, char *user, char *domain, char *password, STREAM s)
 	if (!cssp_send_tsrequest(NULL, &blob, NULL))
 		goto bail_out;
 
+	timing_stop(TIMING_CREDSSP);
 	return True;
 
       bail_out:
@@ -48,6 +48,7 @@ static char ctrlsock_name[PATH_MAX];
 static struct _ctrl_slave_t *_ctrl_slaves;
 
 #define CMD_SEAMLESS_SPAWN "seamless.spawn"
+#define CMD_CONNECTION_TIMING "connection.timing"
 
 typedef struct _ctrl_slave_t
 {
@@ -151,6 +152,7 @@ _ctrl_dispatch_command(_ctrl_slave_t * slave)
 	char *p;
 	char *cmd;
 	unsigned int res;
+	char buf[512];
 
 	/* unescape linebuffer */
 	cmd = utils_string_unescape(slave->linebuf);
@@ -168,6 +170,14 @@ _ctrl_dispatch_command(_ctrl_slave_t * slave)
 		if (seamless_send_spawn(p) == (unsigned int) -1)
 			res = 1;
 	}
+	else if (strncmp(cmd, CMD_CONNECTION_TIMING, strlen(CMD_CONNECTION_TIMING)) == 0)
+	{
+		/* reply with the timing line, followed by the result */
+		timing_format(buf, sizeof(buf) - 1);
+		strcat(buf, "\n");
+		send(slave->sock, buf, strlen(buf), 0);
+		res = ERR_RESULT_OK;
+	}
 	else
 	{
 		res = ERR_RESULT_NO_SUCH_COMMAND;
@@ -20,9 +20,14 @@
 
 #include "rdesktop.h"
 
-#define MAX_DVC_CHANNELS 20
 #define INVALID_CHANNEL ((uint32)-1)
 
+/* Channels are found by name hash, and by channel id once opened */
+#define DVC_BY_NAME	0
+#define DVC_BY_ID	1
+
+#define DVC_TABLE_MIN_SIZE 16
+
 #define DYNVC_CREATE_REQ		0x01
 #define DYNVC_DATA_FIRST		0x02
 #define DYNVC_DATA			0x03
@@ -33,6 +38,12 @@
 #define DYNVC_SOFT_SYNC_REQUEST		0x08
 #define DYNVC_SOFT_SYNC_RESPONSE	0x09
 
+/* Highest capabilities version, version 3 adds compressed data */
+#define DYNVC_CAPS_VERSION		3
+
+/* Largest message reassembled from DATA_FIRST and DATA PDUs */
+#define DVC_MAX_MESSAGE_LENGTH		(64 * 1024 * 1024)
+
 typedef union dvc_hdr_t
 {
 	uint8 data;
@@ -49,82 +60,173 @@ typedef struct dvc_channel_t
 	uint32 hash;
 	uint32 channel_id;
 	dvc_channel_process_fn handler;
+	dvc_channel_open_fn open_handler;
+
+	/* Message being reassembled, pending if length is not 0. The
+	   buffer is kept for the next message. */
+	uint8 *reassembly;
+	uint32 reassembly_size;
+	uint32 reassembly_length;
+	uint32 reassembly_offset;
+
+	struct dvc_channel_t *next[2];	/* in the DVC_BY_NAME and DVC_BY_ID buckets */
 } dvc_channel_t;
 
+/* Chained hash table, grown to keep about one channel per bucket */
+typedef struct dvc_table_t
+{
+	dvc_channel_t **buckets;
+	uint32 size;		/* power of two */
+	uint32 count;
+} dvc_table_t;
+
 static VCHANNEL *dvc_channel;
-static dvc_channel_t channels[MAX_DVC_CHANNELS];
+static dvc_table_t channels[2];
+
+/* Bulk decompressor shared by all channels */
+static ZGFX_CONTEXT dvc_zgfx;
 
 static uint32 dvc_in_channelid(STREAM s, dvc_hdr_t hdr);
 
-static RD_BOOL
-dvc_channels_exists(const char *name)
+static uint32
+dvc_table_key(dvc_channel_t * ch, int index)
 {
-	int i;
-	uint32 hash;
-	hash = utils_djb2_hash(name);
-	for (i = 0; i < MAX_DVC_CHANNELS; i++)
-	{
-		if (channels[i].hash == hash)
-			return True;
-	}
+	return index == DVC_BY_ID ? ch->channel_id : ch->hash;
+}
 
-	return False;
+static uint32
+dvc_table_bucket(dvc_table_t * table, uint32 key)
+{
+	return (key ^ (key >> 16)) & (table->size - 1);
 }
 
-static const dvc_channel_t *
-dvc_channels_get_by_id(uint32 id)
+static void
+dvc_table_insert(dvc_table_t * table, int index, dvc_channel_t * ch)
 {
-	int i;
+	dvc_channel_t **buckets, *next;
+	uint32 i, size, bucket;
 
-	for (i = 0; i < MAX_DVC_CHANNELS; i++)
+	if (table->count >= table->size)
 	{
-		if (channels[i].channel_id == id)
+		/* Rehash into twice the buckets */
+		buckets = table->buckets;
+		size = table->size;
+
+		table->size = MAX(DVC_TABLE_MIN_SIZE, size * 2);
+		table->buckets = (dvc_channel_t **) xmalloc(table->size * sizeof(dvc_channel_t *));
+		memset(table->buckets, 0, table->size * sizeof(dvc_channel_t *));
+
+		for (i = 0; i < size; i++)
 		{
-			return &channels[i];
+			for (; buckets[i] != NULL; buckets[i] = next)
+			{
+				next = buckets[i]->next[index];
+				bucket = dvc_table_bucket(table, dvc_table_key(buckets[i], index));
+				buckets[i]->next[index] = table->buckets[bucket];
+				table->buckets[bucket] = buckets[i];
+			}
 		}
+
+		xfree(buckets);
+	}
+
+	bucket = dvc_table_bucket(table, dvc_table_key(ch, index));
+	ch->next[index] = table->buckets[bucket];
+	table->buckets[bucket] = ch;
+	table->count++;
+}
+
+static dvc_channel_t *
+dvc_table_lookup(dvc_table_t * table, int index, uint32 key)
+{
+	dvc_channel_t *ch;
+
+	if (table->count == 0)
+		return NULL;
+
+	for (ch = table->buckets[dvc_table_bucket(table, key)]; ch != NULL; ch = ch->next[index])
+	{
+		if (dvc_table_key(ch, index) == key)
+			return ch;
 	}
 
 	return NULL;
 }
 
-static uint32
-dvc_channels_get_id(const char *name)
+static void
+dvc_table_remove(dvc_table_t * table, int index, dvc_channel_t * ch)
 {
-	int i;
-	uint32 hash;
-	hash = utils_djb2_hash(name);
+	dvc_channel_t **link;
 
-	for (i = 0; i < MAX_DVC_CHANNELS; i++)
+	link = &table->buckets[dvc_table_bucket(table, dvc_table_key(ch, index))];
+	for (; *link != NULL; link = &(*link)->next[index])
 	{
-		if (channels[i].hash == hash)
+		if (*link == ch)
 		{
-			return channels[i].channel_id;
+			*link = ch->next[index];
+			table->count--;
+			return;
 		}
 	}
+}
+
+static dvc_channel_t *
+dvc_channels_get_by_name(const char *name)
+{
+	return dvc_table_lookup(&channels[DVC_BY_NAME], DVC_BY_NAME, utils_djb2_hash(name));
+}
+
+static RD_BOOL
+dvc_channels_exists(const char *name)
+{
+	return dvc_channels_get_by_name(name) != NULL;
+}
+
+static dvc_channel_t *
+dvc_channels_get_by_id(uint32 id)
+{
+	if (id == INVALID_CHANNEL)
+		return NULL;
+
+	return dvc_table_lookup(&channels[DVC_BY_ID], DVC_BY_ID, id);
+}
+
+static uint32
+dvc_channels_get_id(const char *name)
+{
+	dvc_channel_t *ch;
+
+	ch = dvc_channels_get_by_name(name);
+	if (ch == NULL)
+		return INVALID_CHANNEL;
 
-	return INVALID_CHANNEL;
+	return ch->channel_id;
 }
 
+/* Mark a channel closed. It stays registered and may be opened again. */
 static RD_BOOL
 dvc_channels_remove_by_id(uint32 channelid)
 {
-	int i;
+	dvc_channel_t *ch;
 
-	for (i = 0; i < MAX_DVC_CHANNELS; i++)
-	{
-		if (channels[i].channel_id == channelid)
-		{
-			memset(&channels[i], 0, sizeof(dvc_channel_t));
-			return True;
-		}
-	}
-	return False;
+	ch = dvc_channels_get_by_id(channelid);
+	if (ch == NULL)
+		return False;
+
+	dvc_table_remove(&channels[DVC_BY_ID], DVC_BY_ID, ch);
+	ch->channel_id = INVALID_CHANNEL;
+
+	xfree(ch->reassembly);
+	ch->reassembly = NULL;
+	ch->reassembly_size = 0;
+	ch->reassembly_length = 0;
+	return True;
 }
 
 static RD_BOOL
 dvc_channels_add(const char *name, dvc_channel_process_fn handler, uint32 channel_id)
 {
-	int i;
+	dvc_channel_t *ch;
 	uint32 hash;
 
 	if (dvc_channels_exists(name) == True)
@@ -134,64 +236,49 @@ dvc_channels_add(const char *name, dvc_channel_process_fn handler, uint32 channe
 		return False;
 	}
 
-	for (i = 0; i < MAX_DVC_CHANNELS; i++)
-	{
-		if (channels[i].hash == 0)
-		{
-			hash = utils_djb2_hash(name);
-			channels[i].hash = hash;
-			channels[i].handler = handler;
-			channels[i].channel_id = channel_id;
-			logger(Core, Debug,
-			       "dvc_channels_add(), Added hash=%x, channel_id=%d, name=%s, handler=%p",
-			       hash, channel_id, name, handler);
-			return True;
-		}
-	}
+	hash = utils_djb2_hash(name);
 
-	logger(Core, Warning,
-	       "dvc_channels_add(), Failed to add channel, maximum number of channels are being used");
-	return False;
+	ch = (dvc_channel_t *) xmalloc(sizeof(dvc_channel_t));
+	memset(ch, 0, sizeof(dvc_channel_t));
+	ch->hash = hash;
+	ch->handler = handler;
+	ch->channel_id = channel_id;
+
+	dvc_table_insert(&channels[DVC_BY_NAME], DVC_BY_NAME, ch);
+	if (channel_id != INVALID_CHANNEL)
+		dvc_table_insert(&channels[DVC_BY_ID], DVC_BY_ID, ch);
+
+	logger(Core, Debug,
+	       "dvc_channels_add(), Added hash=%x, channel_id=%d, name=%s, handler=%p",
+	       hash, channel_id, name, handler);
+	return True;
 }
 
 static int
 dvc_channels_set_id(const char *name, uint32 channel_id)
 {
-	int i;
-	uint32 hash;
+	dvc_channel_t *ch;
 
-	hash = utils_djb2_hash(name);
+	ch = dvc_channels_get_by_name(name);
+	if (ch == NULL)
+		return -1;
 
-	for (i = 0; i < MAX_DVC_CHANNELS; i++)
-	{
-		if (channels[i].hash == hash)
-		{
-			logger(Core, Debug, "dvc_channels_set_id(), name = '%s', channel_id = %d",
-			       name, channel_id);
-			channels[i].channel_id = channel_id;
-			return 0;
-		}
-	}
+	logger(Core, Debug, "dvc_channels_set_id(), name = '%s', channel_id = %d",
+	       name, channel_id);
+
+	/* The channel id might be reused, or the channel reopened */
+	dvc_channels_remove_by_id(channel_id);
+	dvc_channels_remove_by_id(ch->channel_id);
 
-	return -1;
+	ch->channel_id = channel_id;
+	dvc_table_insert(&channels[DVC_BY_ID], DVC_BY_ID, ch);
+	return 0;
 }
 
 RD_BOOL
 dvc_channels_is_available(const char *name)
 {
-	int i;
-	uint32 hash;
-	hash = utils_djb2_hash(name);
-
-	for (i = 0; i < MAX_DVC_CHANNELS; i++)
-	{
-		if (channels[i].hash == hash)
-		{
-			return (channels[i].channel_id != INVALID_CHANNEL);
-		}
-	}
-
-	return False;
+	return dvc_channels_get_id(name) != INVALID_CHANNEL;
 }
 
 RD_BOOL
@@ -200,6 +287,21 @@ dvc_channels_register(const char *name, dvc_channel_process_fn handler)
 	return dvc_channels_add(name, handler, INVALID_CHANNEL);
 }
 
+/* Set a function to be called when the server has opened the
+   channel, for protocols where the client speaks first */
+RD_BOOL
+dvc_channels_set_open_handler(const char *name, dvc_channel_open_fn handler)
+{
+	dvc_channel_t *ch;
+
+	ch = dvc_channels_get_by_name(name);
+	if (ch == NULL)
+		return False;
+
+	ch->open_handler = handler;
+	return True;
+}
+
 
 static STREAM
 dvc_init_packet(dvc_hdr_t hdr, uint32 channelid, size_t length)
@@ -272,11 +374,10 @@ dvc_send(const char *name, STREAM s)
 
 
 static void
-dvc_send_capabilities_response()
+dvc_send_capabilities_response(uint16 supportedversion)
 {
 	STREAM s;
 	dvc_hdr_t hdr;
-	uint16 supportedversion = 0x01;
 
 	hdr.hdr.cbid = 0x00;
 	hdr.hdr.sp = 0x00;
@@ -305,7 +406,10 @@ dvc_process_caps_pdu(STREAM s)
 
 	logger(Protocol, Debug, "dvc_process_caps(), server supports dvc %d", version);
 
-	dvc_send_capabilities_response();
+	/* A new connection, nothing compressed yet */
+	zgfx_reset(&dvc_zgfx);
+
+	dvc_send_capabilities_response(MIN(version, DYNVC_CAPS_VERSION));
 }
 
 static void
@@ -327,6 +431,7 @@ dvc_process_create_pdu(STREAM s, dvc_hdr_t hdr)
 {
 	char name[512];
 	uint32 channelid;
+	const dvc_channel_t *ch;
 
 	channelid = dvc_in_channelid(s, hdr);
 
@@ -341,6 +446,10 @@ dvc_process_create_pdu(STREAM s, dvc_hdr_t hdr)
 
 		dvc_channels_set_id(name, channelid);
 		dvc_send_create_response(True, hdr, channelid);
+
+		ch = dvc_channels_get_by_id(channelid);
+		if (ch != NULL && ch->open_handler != NULL)
+			ch->open_handler();
 	}
 	else
 	{
@@ -371,13 +480,128 @@ dvc_in_channelid(STREAM s, dvc_hdr_t hdr)
 	return id;
 }
 
+static uint32
+dvc_in_length(STREAM s, dvc_hdr_t hdr)
+{
+	uint32 length;
+
+	length = 0;
+
+	switch (hdr.hdr.sp)
+	{
+		case 0:
+			in_uint8(s, length);
+			break;
+		case 1:
+			in_uint16_le(s, length);
+			break;
+		case 2:
+			in_uint32_le(s, length);
+			break;
+	}
+	return length;
+}
+
+static void
+dvc_dispatch(dvc_channel_t * ch, uint8 * data, uint32 length)
+{
+	struct stream packet;
+
+	memset(&packet, 0, sizeof(packet));
+	packet.data = packet.p = data;
+	packet.size = length;
+	packet.end = data + length;
+
+	/* dispatch packet to channel handler */
+	ch->handler(&packet);
+}
+
+/* Start reassembling a message of total bytes, preallocating it all */
+static void
+dvc_reassembly_start(dvc_channel_t * ch, uint32 total, uint8 * data, uint32 length)
+{
+	ch->reassembly_length = 0;
+
+	if (total > DVC_MAX_MESSAGE_LENGTH || length > total)
+	{
+		logger(Protocol, Warning,
+		       "dvc_reassembly_start(), bad message length %u on channel %d", total,
+		       ch->channel_id);
+		return;
+	}
+
+	if (length == total)
+	{
+		dvc_dispatch(ch, data, length);
+		return;
+	}
+
+	if (total > ch->reassembly_size)
+	{
+		xfree(ch->reassembly);
+		ch->reassembly = (uint8 *) xmalloc(total);
+		ch->reassembly_size = total;
+	}
+
+	memcpy(ch->reassembly, data, length);
+	ch->reassembly_length = total;
+	ch->reassembly_offset = length;
+}
+
+static void
+dvc_reassembly_append(dvc_channel_t * ch, uint8 * data, uint32 length)
+{
+	if (length > ch->reassembly_length - ch->reassembly_offset)
+	{
+		logger(Protocol, Warning,
+		       "dvc_reassembly_append(), message overruns %u bytes on channel %d",
+		       ch->reassembly_length, ch->channel_id);
+		ch->reassembly_length = 0;
+		return;
+	}
+
+	memcpy(ch->reassembly + ch->reassembly_offset, data, length);
+	ch->reassembly_offset += length;
+
+	if (ch->reassembly_offset == ch->reassembly_length)
+	{
+		ch->reassembly_length = 0;
+		dvc_dispatch(ch, ch->reassembly, ch->reassembly_offset);
+	}
+}
+
+/* Process DATA, DATA_FIRST and their compressed variants */
 static void
 dvc_process_data_pdu(STREAM s, dvc_hdr_t hdr)
 {
-	const dvc_channel_t *ch;
-	uint32 channelid;
+	dvc_channel_t *ch;
+	uint32 channelid, total, length;
+	uint8 *data;
+	RD_BOOL first, compressed;
+
+	first = (hdr.hdr.cmd == DYNVC_DATA_FIRST || hdr.hdr.cmd == DYNVC_DATA_FIRST_COMPRESSED);
+	compressed = (hdr.hdr.cmd == DYNVC_DATA_FIRST_COMPRESSED ||
+		      hdr.hdr.cmd == DYNVC_DATA_COMPRESSED);
 
 	channelid = dvc_in_channelid(s, hdr);
+	total = first ? dvc_in_length(s, hdr) : 0;
+	if (!s_check(s))
+	{
+		logger(Protocol, Error, "dvc_process_data(), truncated header");
+		return;
+	}
+
+	length = s->end - s->p;
+	in_uint8p(s, data, length);
+
+	/* The history is shared, so decompress even for unknown channels */
+	if (compressed && !zgfx_decompress_segment(&dvc_zgfx, data, length, &data, &length))
+	{
+		logger(Protocol, Error,
+		       "dvc_process_data(), bad compressed data on channel %d", channelid);
+		return;
+	}
+
 	ch = dvc_channels_get_by_id(channelid);
 	if (ch == NULL)
 	{
@@ -386,8 +610,22 @@ dvc_process_data_pdu(STREAM s, dvc_hdr_t hdr)
 		return;
 	}
 
-	/* dispatch packet to channel handler */
-	ch->handler(s);
+	if (first)
+	{
+		if (ch->reassembly_length != 0)
+			logger(Protocol, Warning,
+			       "dvc_process_data(), incomplete message dropped on channel %d",
+			       channelid);
+		dvc_reassembly_start(ch, total, data, length);
+	}
+	else if (ch->reassembly_length != 0)
+	{
+		dvc_reassembly_append(ch, data, length);
+	}
+	else
+	{
+		dvc_dispatch(ch, data, length);
+	}
 }
 
 static void
@@ -424,7 +662,10 @@ dvc_process_pdu(STREAM s)
 			dvc_process_create_pdu(s, hdr);
 			break;
 
+		case DYNVC_DATA_FIRST:
 		case DYNVC_DATA:
+		case DYNVC_DATA_FIRST_COMPRESSED:
+		case DYNVC_DATA_COMPRESSED:
 			dvc_process_data_pdu(s, hdr);
 			break;
 
@@ -434,12 +675,6 @@ dvc_process_pdu(STREAM s)
 
 #if 0				/* Unimplemented */
 
-		case DYNVC_DATA_FIRST:
-			break;
-		case DYNVC_DATA_FIRST_COMPRESSED:
-			break;
-		case DYNVC_DATA_COMPRESSED:
-			break;
 		case DYNVC_SOFT_SYNC_REQUEST:
 			break;
 		case DYNVC_SOFT_SYNC_RESPONSE:
@@ -457,7 +692,7 @@ dvc_process_pdu(STREAM s)
 RD_BOOL
 dvc_init()
 {
-	memset(channels, 0, sizeof(channels));
+	zgfx_init(&dvc_zgfx);
 	dvc_channel = channel_register("drdynvc",
 				       CHANNEL_OPTION_INITIALIZED | CHANNEL_OPTION_ENCRYPT_RDP,
 				       dvc_process_pdu);
@@ -0,0 +1,342 @@
+/* -*- c-basic-offset: 8 -*-
+   rdesktop: A Remote Desktop Protocol client.
+   H.264/AVC420 decoding for the graphics pipeline, [MS-RDPEGFX] 2.2.4.4
+
+   This program is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "rdesktop.h"
+#include "h264.h"
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+/* An AVC420 bitmap carries the rectangles it updates, followed by one
+   H.264 frame covering the whole surface. The frame is decoded by a
+   software decoder chosen at build time, after which the updated
+   rectangles are converted from YUV 4:2:0 to BGRX, in bands of rows
+   spread over a pool of worker threads. */
+
+/* Rows converted as one piece of work */
+#define H264_BAND_ROWS			64
+
+/* Use the conversion threads for at least this many pixels */
+#define H264_MIN_THREADED_PIXELS	(256 * 256)
+
+typedef struct h264_band_t
+{
+	int left, top, right, bottom;
+} h264_band_t;
+
+static struct h264_decoder *g_h264_decoder = NULL;
+static RD_BOOL g_h264_registered = False;
+
+/* The conversion in progress */
+static struct h264_picture g_h264_picture;
+static uint8 *g_h264_dst;
+static int g_h264_dst_width;
+static h264_band_t *g_h264_bands = NULL;
+static int g_h264_num_bands;
+static int g_h264_bands_size;
+
+#ifdef __SSE2__
+static RD_BOOL g_h264_sse2 = True;
+#endif
+
+/* BT.709 with full range samples, as Windows servers encode, in 14 bit
+   fixed point. U and V are offset by -128. */
+#define YUV_Y		(1 << 14)
+#define YUV_V_R		25802	/* 1.5748 */
+#define YUV_U_G		3069	/* 0.1873 */
+#define YUV_V_G		7669	/* 0.4681 */
+#define YUV_U_B		30402	/* 1.8556 */
+#define YUV_ROUND	(1 << 13)
+#define YUV_SHIFT	14
+
+static uint8
+h264_clamp(sint32 value)
+{
+	return value < 0 ? 0 : value > 255 ? 255 : value;
+}
+
+static void
+h264_pixel(uint8 * out, int y, int u, int v)
+{
+	sint32 c = y * YUV_Y + YUV_ROUND;
+
+	out[0] = h264_clamp((c + u * YUV_U_B) >> YUV_SHIFT);
+	out[1] = h264_clamp((c - u * YUV_U_G - v * YUV_V_G) >> YUV_SHIFT);
+	out[2] = h264_clamp((c + v * YUV_V_R) >> YUV_SHIFT);
+	out[3] = 0;
+}
+
+/* Convert width pixels of one row starting at column x, given the
+   rows of the three planes */
+static void
+h264_yuv420_to_bgrx(uint8 * y, uint8 * u, uint8 * v, int x, int width, uint8 * out)
+{
+	int end = x + width;
+
+	/* Start on a pixel with chroma of its own */
+	if (x & 1)
+	{
+		h264_pixel(out, y[x], u[x >> 1] - 128, v[x >> 1] - 128);
+		out += 4;
+		x++;
+	}
+
+#ifdef __SSE2__
+	if (g_h264_sse2)
+	{
+		__m128i k_r = _mm_set_epi16(YUV_V_R, YUV_Y, YUV_V_R, YUV_Y,
+					    YUV_V_R, YUV_Y, YUV_V_R, YUV_Y);
+		__m128i k_g = _mm_set_epi16(-YUV_U_G, YUV_Y, -YUV_U_G, YUV_Y,
+					    -YUV_U_G, YUV_Y, -YUV_U_G, YUV_Y);
+		__m128i k_gv = _mm_set_epi16(0, -YUV_V_G, 0, -YUV_V_G, 0, -YUV_V_G, 0, -YUV_V_G);
+		__m128i k_b = _mm_set_epi16(YUV_U_B, YUV_Y, YUV_U_B, YUV_Y,
+					    YUV_U_B, YUV_Y, YUV_U_B, YUV_Y);
+		__m128i round = _mm_set1_epi32(YUV_ROUND);
+		__m128i offset = _mm_set1_epi16(128);
+		__m128i zero = _mm_setzero_si128();
+		__m128i yy, uu, vv, r, g, b, lo, hi, bg, rx;
+		uint32 word;
+
+#define YUV_MADD(a, c, k) \
+		_mm_srai_epi32(_mm_add_epi32(_mm_madd_epi16(_mm_unpack##a##_epi16(yy, c), k), round), \
+			       YUV_SHIFT)
+
+		/* Eight pixels and four chroma samples at a time */
+		for (; x + 8 <= end; x += 8)
+		{
+			yy = _mm_unpacklo_epi8(_mm_loadl_epi64((__m128i *) (y + x)), zero);
+
+			memcpy(&word, u + (x >> 1), 4);
+			uu = _mm_sub_epi16(_mm_unpacklo_epi8(_mm_cvtsi32_si128(word), zero), offset);
+			uu = _mm_unpacklo_epi16(uu, uu);
+			memcpy(&word, v + (x >> 1), 4);
+			vv = _mm_sub_epi16(_mm_unpacklo_epi8(_mm_cvtsi32_si128(word), zero), offset);
+			vv = _mm_unpacklo_epi16(vv, vv);
+
+			r = _mm_packs_epi32(YUV_MADD(lo, vv, k_r), YUV_MADD(hi, vv, k_r));
+			b = _mm_packs_epi32(YUV_MADD(lo, uu, k_b), YUV_MADD(hi, uu, k_b));
+
+			lo = _mm_add_epi32(_mm_madd_epi16(_mm_unpacklo_epi16(yy, uu), k_g),
+					   _mm_madd_epi16(_mm_unpacklo_epi16(vv, zero), k_gv));
+			hi = _mm_add_epi32(_mm_madd_epi16(_mm_unpackhi_epi16(yy, uu), k_g),
+					   _mm_madd_epi16(_mm_unpackhi_epi16(vv, zero), k_gv));
+			g = _mm_packs_epi32(_mm_srai_epi32(_mm_add_epi32(lo, round), YUV_SHIFT),
+					    _mm_srai_epi32(_mm_add_epi32(hi, round), YUV_SHIFT));
+
+			b = _mm_packus_epi16(b, b);
+			g = _mm_packus_epi16(g, g);
+			r = _mm_packus_epi16(r, r);
+			bg = _mm_unpacklo_epi8(b, g);
+			rx = _mm_unpacklo_epi8(r, zero);
+			_mm_storeu_si128((__m128i *) out, _mm_unpacklo_epi16(bg, rx));
+			_mm_storeu_si128((__m128i *) (out + 16), _mm_unpackhi_epi16(bg, rx));
+			out += 32;
+		}
+#undef YUV_MADD
+	}
+#endif
+
+	for (; x < end; x++)
+	{
+		h264_pixel(out, y[x], u[x >> 1] - 128, v[x >> 1] - 128);
+		out += 4;
+	}
+}
+
+static void
+h264_convert_band(h264_band_t * band)
+{
+	struct h264_picture *pic = &g_h264_picture;
+	uint8 *out;
+	int y;
+
+	for (y = band->top; y < band->bottom; y++)
+	{
+		out = g_h264_dst + (y * g_h264_dst_width + band->left) * 4;
+		h264_yuv420_to_bgrx(pic->planes[0] + y * pic->strides[0],
+				    pic->planes[1] + (y >> 1) * pic->strides[1],
+				    pic->planes[2] + (y >> 1) * pic->strides[2],
+				    band->left, band->right - band->left, out);
+	}
+}
+
+static void
+h264_convert_band_item(int worker, int item)
+{
+	UNUSED(worker);
+	h264_convert_band(&g_h264_bands[item]);
+}
+
+/* Convert all bands of the current picture */
+static void
+h264_convert_bands(uint32 pixels)
+{
+	int i;
+
+	if (pixels >= H264_MIN_THREADED_PIXELS)
+	{
+		workpool_run(h264_convert_band_item, g_h264_num_bands);
+		return;
+	}
+
+	for (i = 0; i < g_h264_num_bands; i++)
+		h264_convert_band(&g_h264_bands[i]);
+}
+
+/* Split a rectangle into bands, returning its number of pixels */
+static uint32
+h264_add_bands(int left, int top, int right, int bottom)
+{
+	h264_band_t *band;
+	int y;
+
+	for (y = top; y < bottom; y = (y + H264_BAND_ROWS) & ~(H264_BAND_ROWS - 1))
+	{
+		if (g_h264_num_bands == g_h264_bands_size)
+		{
+			g_h264_bands_size = MAX(16, g_h264_bands_size * 2);
+			g_h264_bands = (h264_band_t *) xrealloc(g_h264_bands,
+								g_h264_bands_size *
+								sizeof(h264_band_t));
+		}
+
+		band = &g_h264_bands[g_h264_num_bands++];
+		band->left = left;
+		band->top = y;
+		band->right = right;
+		band->bottom = MIN(bottom, (y + H264_BAND_ROWS) & ~(H264_BAND_ROWS - 1));
+	}
+
+	return (uint32) (right - left) * (bottom - top);
+}
+
+static void
+h264_register_decoders(void)
+{
+	g_h264_registered = True;
+
+#if defined(H264_FFMPEG)
+	g_h264_decoder = ffmpeg_register();
+#elif defined(H264_OPENH264)
+	g_h264_decoder = openh264_register();
+#endif
+
+	if (g_h264_decoder != NULL)
+		logger(Graphics, Debug, "h264_register_decoders(), using %s",
+		       g_h264_decoder->name);
+}
+
+/* Whether AVC420 can be offered to the server */
+RD_BOOL
+h264_available(void)
+{
+	if (!g_h264_registered)
+		h264_register_decoders();
+
+	return g_h264_decoder != NULL;
+}
+
+/* Start decoding a new H.264 stream, NULL if there is no decoder */
+H264_CONTEXT *
+h264_open(void)
+{
+	H264_CONTEXT *h264;
+	void *state;
+
+	if (!h264_available())
+		return NULL;
+
+	state = g_h264_decoder->open();
+	if (state == NULL)
+		return NULL;
+
+	h264 = (H264_CONTEXT *) xmalloc(sizeof(H264_CONTEXT));
+	h264->state = state;
+	return h264;
+}
+
+void
+h264_close(H264_CONTEXT * h264)
+{
+	if (h264 == NULL)
+		return;
+
+	g_h264_decoder->close(h264->state);
+	xfree(h264);
+}
+
+/* Decode an RDPGFX_AVC420_BITMAP_STREAM into a BGRX, top-down buffer
+   of dst_width pixels per line. Only the updated rectangles, clipped
+   to clip and the picture, are written. */
+RD_BOOL
+h264_decode_avc420(H264_CONTEXT * h264, uint8 * data, uint32 length, uint8 * dst,
+		   int dst_width, RD_RECT * clip)
+{
+	struct stream packet;
+	STREAM s = &packet;
+	uint16 left, top, right, bottom;
+	uint32 count, i, pixels;
+	struct h264_picture *pic = &g_h264_picture;
+	uint8 *rects;
+
+	memset(&packet, 0, sizeof(packet));
+	packet.data = packet.p = data;
+	packet.size = length;
+	packet.end = data + length;
+
+	/* RDPGFX_H264_METABLOCK */
+	if (!s_check_rem(s, 4))
+		return False;
+	in_uint32_le(s, count);	/* numRegionRects */
+	if (count > length / 10 || !s_check_rem(s, count * 10))
+		return False;
+	in_uint8p(s, rects, count * 8);	/* regionRects */
+	in_uint8s(s, count * 2);	/* quantQualityVals */
+
+	if (!g_h264_decoder->decode(h264->state, s->p, s->end - s->p, pic))
+		return False;
+
+	if (pic->width == 0)
+		return True;
+
+	g_h264_num_bands = 0;
+	pixels = 0;
+	s->p = rects;
+	for (i = 0; i < count; i++)
+	{
+		in_uint16_le(s, left);
+		in_uint16_le(s, top);
+		in_uint16_le(s, right);
+		in_uint16_le(s, bottom);
+
+		left = MAX(left, clip->x);
+		top = MAX(top, clip->y);
+		right = MIN(right, MIN(clip->x + clip->cx, pic->width));
+		bottom = MIN(bottom, MIN(clip->y + clip->cy, pic->height));
+		if (left >= right || top >= bottom)
+			continue;
+
+		pixels += h264_add_bands(left, top, right, bottom);
+	}
+
+	g_h264_dst = dst;
+	g_h264_dst_width = dst_width;
+	h264_convert_bands(pixels);
+	return True;
+}
@@ -0,0 +1,40 @@
+/*
+   rdesktop: A Remote Desktop Protocol client.
+   H.264 decoder infrastructure
+
+   This program is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/* A decoded YUV 4:2:0 picture, owned by the decoder and valid until
+   its next call */
+struct h264_picture
+{
+	uint8 *planes[3];	/* Y, U, V */
+	int strides[3];
+	int width, height;	/* zero if no picture came out */
+};
+
+struct h264_decoder
+{
+	void *(*open) (void);
+	void (*close) (void *state);
+	  RD_BOOL(*decode) (void *state, uint8 * data, uint32 length,
+			    struct h264_picture * picture);
+
+	char *name;
+};
+
+/* Decoder backends */
+struct h264_decoder *ffmpeg_register(void);
+struct h264_decoder *openh264_register(void);
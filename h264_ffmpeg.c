@@ -0,0 +1,157 @@
+/* -*- c-basic-offset: 8 -*-
+   rdesktop: A Remote Desktop Protocol client.
+   H.264 decoder backend - FFmpeg libavcodec
+
+   This program is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "rdesktop.h"
+#include "h264.h"
+#include <unistd.h>
+#include <libavcodec/avcodec.h>
+
+#define FFMPEG_MAX_THREADS	8
+
+typedef struct ffmpeg_state_t
+{
+	AVCodecContext *context;
+	AVPacket *packet;
+	AVFrame *frame;
+	uint8 *input;		/* the data, with the padding libavcodec wants */
+	uint32 input_size;
+} ffmpeg_state_t;
+
+static void
+ffmpeg_close(void *state)
+{
+	ffmpeg_state_t *av = (ffmpeg_state_t *) state;
+
+	avcodec_free_context(&av->context);
+	av_packet_free(&av->packet);
+	av_frame_free(&av->frame);
+	xfree(av->input);
+	xfree(av);
+}
+
+static void *
+ffmpeg_open(void)
+{
+	const AVCodec *codec;
+	ffmpeg_state_t *av;
+	long cpus;
+
+	codec = avcodec_find_decoder(AV_CODEC_ID_H264);
+	if (codec == NULL)
+	{
+		logger(Graphics, Warning, "ffmpeg_open(), no H.264 decoder in libavcodec");
+		return NULL;
+	}
+
+	av = (ffmpeg_state_t *) xmalloc(sizeof(ffmpeg_state_t));
+	memset(av, 0, sizeof(ffmpeg_state_t));
+
+	av_log_set_level(AV_LOG_FATAL);
+
+	av->context = avcodec_alloc_context3(codec);
+	av->packet = av_packet_alloc();
+	av->frame = av_frame_alloc();
+	if (av->context == NULL || av->packet == NULL || av->frame == NULL)
+	{
+		ffmpeg_close(av);
+		return NULL;
+	}
+
+	/* Every frame must come out as soon as it is in, which rules out
+	   frame threads. Slices are decoded on worker threads instead. */
+	cpus = sysconf(_SC_NPROCESSORS_ONLN);
+	av->context->thread_count = MAX(1, MIN(cpus, FFMPEG_MAX_THREADS));
+	av->context->thread_type = FF_THREAD_SLICE;
+	av->context->flags |= AV_CODEC_FLAG_LOW_DELAY;
+
+	if (avcodec_open2(av->context, codec, NULL) < 0)
+	{
+		logger(Graphics, Warning, "ffmpeg_open(), avcodec_open2() failed");
+		ffmpeg_close(av);
+		return NULL;
+	}
+
+	return av;
+}
+
+static RD_BOOL
+ffmpeg_decode(void *state, uint8 * data, uint32 length, struct h264_picture *picture)
+{
+	ffmpeg_state_t *av = (ffmpeg_state_t *) state;
+	AVFrame *frame = av->frame;
+	int i, ret;
+
+	picture->width = picture->height = 0;
+
+	if (length + AV_INPUT_BUFFER_PADDING_SIZE > av->input_size)
+	{
+		av->input_size = length + AV_INPUT_BUFFER_PADDING_SIZE;
+		av->input = (uint8 *) xrealloc(av->input, av->input_size);
+	}
+	memcpy(av->input, data, length);
+	memset(av->input + length, 0, AV_INPUT_BUFFER_PADDING_SIZE);
+
+	av->packet->data = av->input;
+	av->packet->size = length;
+
+	if (avcodec_send_packet(av->context, av->packet) < 0)
+	{
+		logger(Graphics, Warning, "ffmpeg_decode(), avcodec_send_packet() failed");
+		return False;
+	}
+
+	ret = avcodec_receive_frame(av->context, frame);
+	if (ret == AVERROR(EAGAIN))
+		return True;
+	if (ret < 0)
+	{
+		logger(Graphics, Warning, "ffmpeg_decode(), avcodec_receive_frame() failed");
+		return False;
+	}
+
+	if (frame->format != AV_PIX_FMT_YUV420P && frame->format != AV_PIX_FMT_YUVJ420P)
+	{
+		logger(Graphics, Warning, "ffmpeg_decode(), unsupported pixel format %d",
+		       frame->format);
+		return False;
+	}
+
+	for (i = 0; i < 3; i++)
+	{
+		picture->planes[i] = frame->data[i];
+		picture->strides[i] = frame->linesize[i];
+	}
+	picture->width = frame->width;
+	picture->height = frame->height;
+	return True;
+}
+
+struct h264_decoder *
+ffmpeg_register(void)
+{
+	static struct h264_decoder ffmpeg_decoder;
+
+	memset(&ffmpeg_decoder, 0, sizeof(ffmpeg_decoder));
+
+	ffmpeg_decoder.name = "libavcodec";
+	ffmpeg_decoder.open = ffmpeg_open;
+	ffmpeg_decoder.close = ffmpeg_close;
+	ffmpeg_decoder.decode = ffmpeg_decode;
+
+	return &ffmpeg_decoder;
+}
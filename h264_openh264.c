@@ -0,0 +1,106 @@
+/* -*- c-basic-offset: 8 -*-
+   rdesktop: A Remote Desktop Protocol client.
+   H.264 decoder backend - Cisco OpenH264
+
+   This program is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "rdesktop.h"
+#include "h264.h"
+#include <wels/codec_api.h>
+
+/* OpenH264 decodes on the calling thread; only the colour conversion
+   in h264.c is spread over worker threads with this backend. */
+
+static void
+openh264_close(void *state)
+{
+	ISVCDecoder *decoder = (ISVCDecoder *) state;
+
+	(*decoder)->Uninitialize(decoder);
+	WelsDestroyDecoder(decoder);
+}
+
+static void *
+openh264_open(void)
+{
+	ISVCDecoder *decoder = NULL;
+	SDecodingParam param;
+
+	if (WelsCreateDecoder(&decoder) != 0 || decoder == NULL)
+	{
+		logger(Graphics, Warning, "openh264_open(), WelsCreateDecoder() failed");
+		return NULL;
+	}
+
+	memset(&param, 0, sizeof(param));
+	param.eEcActiveIdc = ERROR_CON_DISABLE;
+	param.sVideoProperty.eVideoBsType = VIDEO_BITSTREAM_AVC;
+
+	if ((*decoder)->Initialize(decoder, &param) != 0)
+	{
+		logger(Graphics, Warning, "openh264_open(), Initialize() failed");
+		WelsDestroyDecoder(decoder);
+		return NULL;
+	}
+
+	return decoder;
+}
+
+static RD_BOOL
+openh264_decode(void *state, uint8 * data, uint32 length, struct h264_picture *picture)
+{
+	ISVCDecoder *decoder = (ISVCDecoder *) state;
+	uint8 *planes[3] = { NULL, NULL, NULL };
+	SBufferInfo info;
+	DECODING_STATE ret;
+	int i;
+
+	picture->width = picture->height = 0;
+
+	memset(&info, 0, sizeof(info));
+	ret = (*decoder)->DecodeFrameNoDelay(decoder, data, length, planes, &info);
+	if (ret != dsErrorFree)
+	{
+		logger(Graphics, Warning, "openh264_decode(), decoding failed, state 0x%x", ret);
+		return False;
+	}
+
+	if (info.iBufferStatus != 1)
+		return True;
+
+	for (i = 0; i < 3; i++)
+	{
+		picture->planes[i] = planes[i];
+		picture->strides[i] = info.UsrData.sSystemBuffer.iStride[i == 0 ? 0 : 1];
+	}
+	picture->width = info.UsrData.sSystemBuffer.iWidth;
+	picture->height = info.UsrData.sSystemBuffer.iHeight;
+	return True;
+}
+
+struct h264_decoder *
+openh264_register(void)
+{
+	static struct h264_decoder openh264_decoder;
+
+	memset(&openh264_decoder, 0, sizeof(openh264_decoder));
+
+	openh264_decoder.name = "OpenH264";
+	openh264_decoder.open = openh264_open;
+	openh264_decoder.close = openh264_close;
+	openh264_decoder.decode = openh264_decode;
+
+	return &openh264_decoder;
+}
@@ -170,15 +170,10 @@ iso_init(int length)
 	return s;
 }
 
-/* Send an ISO data PDU */
+/* Output the header of an ISO data PDU of length bytes */
 void
-iso_send(STREAM s)
+iso_out_data_header(STREAM s, uint16 length)
 {
-	uint16 length;
-
-	s_pop_layer(s, iso_hdr);
-	length = s->end - s->p;
-
 	out_uint8(s, T123_HEADER_VERSION);	/* version */
 	out_uint8(s, 0);	/* reserved */
 	out_uint16_be(s, length);
@@ -186,6 +181,14 @@ iso_send(STREAM s)
 	out_uint8(s, 2);	/* hdrlen */
 	out_uint8(s, ISO_PDU_DT);	/* code */
 	out_uint8(s, 0x80);	/* eot */
+}
+
+/* Send an ISO data PDU */
+void
+iso_send(STREAM s)
+{
+	s_pop_layer(s, iso_hdr);
+	iso_out_data_header(s, s->end - s->p);
 
 	tcp_send(s);
 }
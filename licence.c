@@ -358,6 +358,8 @@ licence_process(STREAM s)
 {
 	uint8 tag;
 
+	timing_start(TIMING_LICENSING);
+
 	in_uint8(s, tag);
 	in_uint8s(s, 3);	/* version, length */
 
@@ -388,4 +390,7 @@ licence_process(STREAM s)
 			logger(Protocol, Warning,
 			       "license_process(), unhandled license PDU tag 0x%02", tag);
 	}
+
+	if (g_licence_issued || g_licence_error_result)
+		timing_stop(TIMING_LICENSING);
 }
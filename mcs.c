@@ -22,6 +22,7 @@
 #include "rdesktop.h"
 
 uint16 g_mcs_userid;
+uint16 g_mcs_msgchannel;
 extern VCHANNEL g_channels[];
 extern unsigned int g_num_channels;
 
@@ -304,21 +305,23 @@ mcs_init(int length)
 	return s;
 }
 
-/* Send an MCS transport data packet to a specific channel */
+/* Output the header of an MCS send data request with length bytes of data */
 void
-mcs_send_to_channel(STREAM s, uint16 channel)
+mcs_out_data_header(STREAM s, uint16 channel, uint16 length)
 {
-	uint16 length;
-
-	s_pop_layer(s, mcs_hdr);
-	length = s->end - s->p - 8;
-	length |= 0x8000;
-
 	out_uint8(s, (MCS_SDRQ << 2));
 	out_uint16_be(s, g_mcs_userid);
 	out_uint16_be(s, channel);
 	out_uint8(s, 0x70);	/* flags */
-	out_uint16_be(s, length);
+	out_uint16_be(s, length | 0x8000);
+}
+
+/* Send an MCS transport data packet to a specific channel */
+void
+mcs_send_to_channel(STREAM s, uint16 channel)
+{
+	s_pop_layer(s, mcs_hdr);
+	mcs_out_data_header(s, channel, s->end - s->p - 8);
 
 	iso_send(s);
 }
@@ -377,6 +380,7 @@ mcs_connect_finalize(STREAM mcs_data)
 	unsigned int i;
 
 	logger(Protocol, Debug, "%s()", __func__);
+	timing_start(TIMING_MCS);
 	mcs_send_connect_initial(mcs_data);
 	if (!mcs_recv_connect_response(mcs_data))
 		goto error;
@@ -402,6 +406,15 @@ mcs_connect_finalize(STREAM mcs_data)
 		if (!mcs_recv_cjcf())
 			goto error;
 	}
+
+	if (g_mcs_msgchannel != 0)
+	{
+		mcs_send_cjrq(g_mcs_msgchannel);
+		if (!mcs_recv_cjcf())
+			goto error;
+	}
+
+	timing_stop(TIMING_MCS);
 	return True;
 
       error:
@@ -422,5 +435,6 @@ void
 mcs_reset_state(void)
 {
 	g_mcs_userid = 0;
+	g_mcs_msgchannel = 0;
 	iso_reset_state();
 }
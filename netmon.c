@@ -0,0 +1,180 @@
+/* -*- c-basic-offset: 8 -*-
+   rdesktop: A Remote Desktop Protocol client.
+   Network link state monitoring
+
+   This program is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <unistd.h>
+#include <sys/time.h>
+#include <sys/types.h>
+#include <errno.h>
+#ifdef HAVE_SYS_SELECT_H
+#include <sys/select.h>
+#endif
+#ifdef HAVE_LINUX_RTNETLINK_H
+#include <sys/socket.h>
+#include <net/if.h>
+#include <linux/netlink.h>
+#include <linux/rtnetlink.h>
+#endif
+
+#include "rdesktop.h"
+
+/* The monitor is used while waiting between reconnect attempts. It
+   lets the wait end as soon as an interface comes up or a route or
+   address is added, e.g. after a Wi-Fi handover or when a VPN has
+   been re-established. Without netlink the wait is a plain sleep. */
+
+static int g_netmon_sock = -1;
+
+RD_BOOL
+netmon_open(void)
+{
+#ifdef HAVE_LINUX_RTNETLINK_H
+	struct sockaddr_nl addr;
+
+	if (g_netmon_sock != -1)
+		return True;
+
+	g_netmon_sock = socket(AF_NETLINK, SOCK_RAW, NETLINK_ROUTE);
+	if (g_netmon_sock < 0)
+	{
+		logger(Core, Debug, "netmon_open(), socket() failed: %s", strerror(errno));
+		g_netmon_sock = -1;
+		return False;
+	}
+
+	memset(&addr, 0, sizeof(addr));
+	addr.nl_family = AF_NETLINK;
+	addr.nl_groups = RTMGRP_LINK | RTMGRP_IPV4_IFADDR | RTMGRP_IPV4_ROUTE |
+		RTMGRP_IPV6_IFADDR | RTMGRP_IPV6_ROUTE;
+
+	if (bind(g_netmon_sock, (struct sockaddr *) &addr, sizeof(addr)) < 0)
+	{
+		logger(Core, Debug, "netmon_open(), bind() failed: %s", strerror(errno));
+		close(g_netmon_sock);
+		g_netmon_sock = -1;
+		return False;
+	}
+
+	logger(Core, Debug, "netmon_open(), monitoring link state changes");
+	return True;
+#else
+	return False;
+#endif
+}
+
+void
+netmon_close(void)
+{
+	if (g_netmon_sock == -1)
+		return;
+
+	close(g_netmon_sock);
+	g_netmon_sock = -1;
+}
+
+#ifdef HAVE_LINUX_RTNETLINK_H
+/* Drain pending netlink messages, returns True if any of them
+   indicates that connectivity may have come back */
+static RD_BOOL
+netmon_process_events(void)
+{
+	char buf[8192];
+	struct nlmsghdr *nh;
+	struct ifinfomsg *ifi;
+	RD_BOOL change = False;
+	int len;
+
+	while ((len = recv(g_netmon_sock, buf, sizeof(buf), MSG_DONTWAIT)) > 0)
+	{
+		for (nh = (struct nlmsghdr *) buf; NLMSG_OK(nh, (unsigned int) len);
+		     nh = NLMSG_NEXT(nh, len))
+		{
+			switch (nh->nlmsg_type)
+			{
+				case RTM_NEWLINK:
+					ifi = (struct ifinfomsg *) NLMSG_DATA(nh);
+					if ((ifi->ifi_flags & (IFF_UP | IFF_RUNNING)) ==
+					    (IFF_UP | IFF_RUNNING))
+					{
+						logger(Core, Debug,
+						       "netmon_process_events(), interface %d is up",
+						       ifi->ifi_index);
+						change = True;
+					}
+					break;
+
+				case RTM_NEWADDR:
+				case RTM_NEWROUTE:
+					logger(Core, Debug,
+					       "netmon_process_events(), new %s",
+					       nh->nlmsg_type == RTM_NEWADDR ? "address" : "route");
+					change = True;
+					break;
+			}
+		}
+	}
+
+	return change;
+}
+#endif
+
+/* Wait for at most timeout milliseconds. Returns True if the wait was
+   cut short by a link state change. */
+RD_BOOL
+netmon_wait(uint32 timeout)
+{
+	struct timeval now, deadline, tv;
+	fd_set rfds;
+	int n;
+
+	gettimeofday(&deadline, NULL);
+	deadline.tv_sec += timeout / 1000;
+	deadline.tv_usec += (timeout % 1000) * 1000;
+	if (deadline.tv_usec >= 1000000)
+	{
+		deadline.tv_sec++;
+		deadline.tv_usec -= 1000000;
+	}
+
+	while (1)
+	{
+		gettimeofday(&now, NULL);
+		if (timercmp(&now, &deadline, >=))
+			return False;
+		timersub(&deadline, &now, &tv);
+
+		FD_ZERO(&rfds);
+		if (g_netmon_sock != -1)
+			FD_SET(g_netmon_sock, &rfds);
+
+		n = select(g_netmon_sock + 1, &rfds, NULL, NULL, &tv);
+		if (n < 0 && errno != EINTR)
+		{
+			logger(Core, Warning, "netmon_wait(), select() failed: %s",
+			       strerror(errno));
+			return False;
+		}
+
+#ifdef HAVE_LINUX_RTNETLINK_H
+		if (n > 0 && g_netmon_sock != -1 && FD_ISSET(g_netmon_sock, &rfds))
+		{
+			if (netmon_process_events())
+				return True;
+		}
+#endif
+	}
+}
@@ -0,0 +1,322 @@
+/* -*- c-basic-offset: 8 -*-
+   rdesktop: A Remote Desktop Protocol client.
+   NSCodec, [MS-RDPNSC]
+
+   This program is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "rdesktop.h"
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+/* An NSCodec bitmap is four RLE compressed planes: luma, orange
+   chroma, green chroma and alpha. The chroma planes have lost their
+   low bits (colour loss level) and may be subsampled by two in both
+   directions (chroma subsampling), so decoding goes
+
+     RLE -> chroma shift and supersampling -> YCoCg to RGB
+
+   where the last two steps are done together, one row at a time. */
+
+#define NSC_HEADER_LENGTH	20
+#define NSC_MAX_COLOR_LOSS	7
+#define NSC_MAX_PIXELS		(8192 * 8192)
+
+/* Properties of the bitmap codecs capability set, TS_NSCODEC_CAPABILITYSET */
+#define NSC_ALLOW_DYNAMIC_FIDELITY	1
+#define NSC_ALLOW_SUBSAMPLING		1
+#define NSC_COLOR_LOSS_LEVEL		3
+
+static uint8 *g_nsc_planes = NULL;
+static uint32 g_nsc_planes_size;
+static uint8 *g_nsc_pixels = NULL;
+static uint32 g_nsc_pixels_size;
+
+#ifdef __SSE2__
+static RD_BOOL g_nsc_sse2 = True;
+#endif
+
+#define ROUND_UP(x, n) (((x) + (n) - 1) & ~((n) - 1))
+
+/* Expand an RLE compressed plane of length bytes. A byte followed by
+   the same byte starts a run, the last four bytes are stored as is. */
+static RD_BOOL
+nsc_rle_decode(uint8 * in, uint32 length, uint8 * out, uint32 size)
+{
+	uint8 *end = in + length;
+	uint32 left = size, run;
+	uint8 value;
+
+	while (left > 4)
+	{
+		if (in >= end)
+			return False;
+		value = *in++;
+
+		if (left == 5 || in >= end || *in != value)
+		{
+			*out++ = value;
+			left--;
+			continue;
+		}
+
+		in++;
+		if (in >= end)
+			return False;
+
+		if (*in < 0xff)
+		{
+			run = *in++ + 2;
+		}
+		else
+		{
+			if (end - in < 5)
+				return False;
+			run = in[1] | (in[2] << 8) | (in[3] << 16) | ((uint32) in[4] << 24);
+			in += 5;
+		}
+
+		if (run > left)
+			return False;
+		memset(out, value, run);
+		out += run;
+		left -= run;
+	}
+
+	if (end - in < 4 || left != 4)
+		return False;
+	memcpy(out, in, 4);
+	return True;
+}
+
+/* Convert one row. With subsampling the chroma rows hold a sample for
+   every two pixels. The chroma values are shifted back up by the
+   colour loss level and sign extended from 8 bits. */
+static void
+nsc_ycocg_to_bgrx(uint8 * y, uint8 * co, uint8 * cg, uint8 * a, int width, int shift,
+		  RD_BOOL subsampled, uint8 * out)
+{
+	int x = 0, yv, cov, cgv, r, g, b;
+	int step = subsampled ? 1 : 0;
+
+#ifdef __SSE2__
+	if (g_nsc_sse2)
+	{
+		__m128i zero = _mm_setzero_si128();
+		__m128i count = _mm_cvtsi32_si128(shift);
+		__m128i yy, oo, gg, aa, r16, g16, b16, bg, ra;
+		uint32 word;
+
+		for (; x + 8 <= width; x += 8)
+		{
+			yy = _mm_unpacklo_epi8(_mm_loadl_epi64((__m128i *) (y + x)), zero);
+			aa = _mm_loadl_epi64((__m128i *) (a + x));
+
+			if (subsampled)
+			{
+				memcpy(&word, co + x / 2, 4);
+				oo = _mm_cvtsi32_si128(word);
+				oo = _mm_unpacklo_epi8(oo, oo);
+				memcpy(&word, cg + x / 2, 4);
+				gg = _mm_cvtsi32_si128(word);
+				gg = _mm_unpacklo_epi8(gg, gg);
+			}
+			else
+			{
+				oo = _mm_loadl_epi64((__m128i *) (co + x));
+				gg = _mm_loadl_epi64((__m128i *) (cg + x));
+			}
+
+			/* Shift within 8 bits and sign extend */
+			oo = _mm_srai_epi16(_mm_slli_epi16(_mm_sll_epi16
+							   (_mm_unpacklo_epi8(oo, zero), count), 8), 8);
+			gg = _mm_srai_epi16(_mm_slli_epi16(_mm_sll_epi16
+							   (_mm_unpacklo_epi8(gg, zero), count), 8), 8);
+
+			g16 = _mm_add_epi16(yy, gg);
+			yy = _mm_sub_epi16(yy, gg);
+			r16 = _mm_add_epi16(yy, oo);
+			b16 = _mm_sub_epi16(yy, oo);
+
+			b16 = _mm_packus_epi16(b16, b16);
+			g16 = _mm_packus_epi16(g16, g16);
+			r16 = _mm_packus_epi16(r16, r16);
+			bg = _mm_unpacklo_epi8(b16, g16);
+			ra = _mm_unpacklo_epi8(r16, aa);
+			_mm_storeu_si128((__m128i *) (out + x * 4), _mm_unpacklo_epi16(bg, ra));
+			_mm_storeu_si128((__m128i *) (out + x * 4 + 16), _mm_unpackhi_epi16(bg, ra));
+		}
+	}
+#endif
+
+	out += x * 4;
+	for (; x < width; x++)
+	{
+		yv = y[x];
+		cov = (sint8) (co[x >> step] << shift);
+		cgv = (sint8) (cg[x >> step] << shift);
+
+		r = yv + cov - cgv;
+		g = yv + cgv;
+		b = yv - cov - cgv;
+
+		*out++ = b < 0 ? 0 : b > 255 ? 255 : b;
+		*out++ = g < 0 ? 0 : g > 255 ? 255 : g;
+		*out++ = r < 0 ? 0 : r > 255 ? 255 : r;
+		*out++ = a[x];
+	}
+}
+
+/* Decode an NSCodec bitmap stream into width x height BGRX pixels */
+RD_BOOL
+nsc_decode(uint8 * output, int width, int height, uint8 * input, uint32 size)
+{
+	struct stream packet;
+	STREAM s = &packet;
+	uint32 plane_length[4], plane_size[4], offset[4], total;
+	uint8 color_loss, subsampling, *plane;
+	int i, y, row_width, chroma_width;
+
+	if (size < NSC_HEADER_LENGTH || width <= 0 || height <= 0 ||
+	    (uint32) width * height > NSC_MAX_PIXELS)
+		return False;
+
+	memset(&packet, 0, sizeof(packet));
+	packet.data = packet.p = input;
+	packet.size = size;
+	packet.end = input + size;
+
+	/* NSCODEC_BITMAP_STREAM */
+	for (i = 0; i < 4; i++)
+		in_uint32_le(s, plane_length[i]);	/* PlaneByteCount */
+	in_uint8(s, color_loss);	/* ColorLossLevel */
+	in_uint8(s, subsampling);	/* ChromaSubsamplingLevel */
+	in_uint8s(s, 2);	/* Reserved */
+
+	if (color_loss < 1 || color_loss > NSC_MAX_COLOR_LOSS)
+	{
+		logger(Graphics, Warning, "nsc_decode(), bad colour loss level %d", color_loss);
+		return False;
+	}
+
+	/* Subsampled planes are padded to whole chroma samples, and the
+	   luma rows to a multiple of eight */
+	row_width = subsampling ? ROUND_UP(width, 8) : width;
+	chroma_width = subsampling ? row_width / 2 : width;
+	plane_size[0] = row_width * height;
+	plane_size[1] = plane_size[2] =
+		chroma_width * (subsampling ? ROUND_UP(height, 2) / 2 : height);
+	plane_size[3] = width * height;
+
+	total = 0;
+	for (i = 0; i < 4; i++)
+	{
+		offset[i] = total;
+		/* Room for whole SIMD loads past the end of the row */
+		total += plane_size[i] + 16;
+	}
+
+	if (total > g_nsc_planes_size)
+	{
+		g_nsc_planes = (uint8 *) xrealloc(g_nsc_planes, total);
+		g_nsc_planes_size = total;
+	}
+
+	for (i = 0; i < 4; i++)
+	{
+		plane = g_nsc_planes + offset[i];
+
+		if (!s_check_rem(s, plane_length[i]))
+		{
+			logger(Graphics, Error, "nsc_decode(), plane %d overruns the bitmap", i);
+			return False;
+		}
+
+		if (plane_length[i] == 0)
+		{
+			/* Mostly the alpha plane, when the bitmap is opaque */
+			memset(plane, 0xff, plane_size[i]);
+		}
+		else if (plane_length[i] == plane_size[i])
+		{
+			memcpy(plane, s->p, plane_size[i]);
+		}
+		else if (plane_length[i] > plane_size[i] ||
+			 !nsc_rle_decode(s->p, plane_length[i], plane, plane_size[i]))
+		{
+			logger(Graphics, Error, "nsc_decode(), bad RLE data in plane %d", i);
+			return False;
+		}
+
+		in_uint8s(s, plane_length[i]);
+	}
+
+	for (y = 0; y < height; y++)
+	{
+		nsc_ycocg_to_bgrx(g_nsc_planes + offset[0] + y * row_width,
+				  g_nsc_planes + offset[1] + (subsampling ? y / 2 : y) * chroma_width,
+				  g_nsc_planes + offset[2] + (subsampling ? y / 2 : y) * chroma_width,
+				  g_nsc_planes + offset[3] + y * width, width, color_loss - 1,
+				  subsampling != 0, output + y * width * 4);
+	}
+
+	return True;
+}
+
+/* Decode and paint an NSCodec bitmap from a surface bits command */
+RD_BOOL
+nsc_process_message(SURFACE_BITS * bits)
+{
+	uint32 size;
+
+	if (bits->bpp != 32)
+	{
+		logger(Graphics, Warning, "nsc_process_message(), unsupported %d bpp", bits->bpp);
+		return False;
+	}
+
+	if ((uint32) bits->width * bits->height > NSC_MAX_PIXELS)
+	{
+		logger(Graphics, Warning, "nsc_process_message(), %dx%d bitmap is too large",
+		       bits->width, bits->height);
+		return False;
+	}
+
+	size = (uint32) bits->width * bits->height * 4;
+
+	if (size > g_nsc_pixels_size)
+	{
+		g_nsc_pixels = (uint8 *) xrealloc(g_nsc_pixels, size);
+		g_nsc_pixels_size = size;
+	}
+
+	if (!nsc_decode(g_nsc_pixels, bits->width, bits->height, bits->data, bits->length))
+		return False;
+
+	ui_paint_bitmap(bits->left, bits->top, MIN(bits->width, bits->right - bits->left),
+			MIN(bits->height, bits->bottom - bits->top), bits->width, bits->height,
+			g_nsc_pixels);
+	return True;
+}
+
+/* Output the NSCodec properties of the bitmap codecs capability set */
+void
+nsc_out_properties(STREAM s)
+{
+	out_uint8(s, NSC_ALLOW_DYNAMIC_FIDELITY);	/* fAllowDynamicFidelity */
+	out_uint8(s, NSC_ALLOW_SUBSAMPLING);	/* fAllowSubsampling */
+	out_uint8(s, NSC_COLOR_LOSS_LEVEL);	/* colorLossLevel */
+}
@@ -22,7 +22,10 @@
 
 extern uint8 *g_next_packet;
 static RDP_ORDER_STATE g_order_state;
+static RD_POINT g_points[MAX_POINTS];
 extern RDP_VERSION g_rdp_version;
+extern int g_server_depth;
+extern uint16 g_glyph_support_level;
 
 /* Read field indicating which parameters are present */
 static void
@@ -69,6 +72,38 @@ rdp_in_coord(STREAM s, sint16 * coord, RD_BOOL delta)
 	}
 }
 
+/* Read a TWO_BYTE_SIGNED_ENCODING value */
+static void
+rdp_in_2byte_signed(STREAM s, sint16 * value)
+{
+	uint8 byte, lo;
+
+	in_uint8(s, byte);
+	*value = byte & 0x3f;
+	if (byte & 0x80)
+	{
+		in_uint8(s, lo);
+		*value = (*value << 8) | lo;
+	}
+	if (byte & 0x40)
+		*value = -*value;
+}
+
+/* Read a TWO_BYTE_UNSIGNED_ENCODING value */
+static void
+rdp_in_2byte_unsigned(STREAM s, uint16 * value)
+{
+	uint8 byte, lo;
+
+	in_uint8(s, byte);
+	*value = byte & 0x7f;
+	if (byte & 0x80)
+	{
+		in_uint8(s, lo);
+		*value = (*value << 8) | lo;
+	}
+}
+
 /* Parse a delta co-ordinate in polyline/polygon order form */
 static int
 parse_delta(uint8 * buffer, int *offset)
@@ -87,6 +122,37 @@ parse_delta(uint8 * buffer, int *offset)
 	return value;
 }
 
+/* Parse the delta encoded points of a polyline/polygon order into
+   g_points, following the start point. The points are relative to
+   the previous one, as expected by ui_polyline() and ui_polygon().
+   Returns False if the data ends before all points are parsed. */
+static RD_BOOL
+parse_delta_points(sint16 x, sint16 y, int npoints, uint8 * buffer, int size)
+{
+	RD_POINT *point = g_points;
+	int index, next, data;
+	uint8 flags = 0;
+
+	point->x = x;
+	point->y = y;
+
+	index = 0;
+	data = ((npoints - 1) / 4) + 1;
+	for (next = 1; (next <= npoints) && (data < size); next++)
+	{
+		if ((next - 1) % 4 == 0)
+			flags = buffer[index++];
+
+		point++;
+		point->x = (flags & 0x80) ? 0 : parse_delta(buffer, &data);
+		point->y = (flags & 0x40) ? 0 : parse_delta(buffer, &data);
+
+		flags <<= 2;
+	}
+
+	return (next - 1 == npoints);
+}
+
 /* Read a colour entry */
 static void
 rdp_in_colour(STREAM s, uint32 * colour)
@@ -374,6 +440,290 @@ process_rect(STREAM s, RECT_ORDER * os, uint32 present, RD_BOOL delta)
 	ui_rect(os->x, os->y, os->cx, os->cy, os->colour);
 }
 
+/* Read the coded delta list of a multi rectangle order */
+static void
+rdp_in_delta_rects(STREAM s, uint16 * datasize, uint8 * data)
+{
+	in_uint16_le(s, *datasize);
+	if (*datasize > MAX_DELTA_DATA)
+	{
+		logger(Graphics, Error, "rdp_in_delta_rects(), delta list too large, %d bytes",
+		       *datasize);
+		in_uint8s(s, *datasize);
+		*datasize = 0;
+		return;
+	}
+
+	in_uint8a(s, data, *datasize);
+}
+
+/* Parse a delta co-ordinate, making sure it is within the data */
+static RD_BOOL
+parse_delta_checked(uint8 * buffer, int size, int *offset, int *value)
+{
+	if (*offset >= size || ((buffer[*offset] & 0x80) && *offset + 1 >= size))
+		return False;
+
+	*value = parse_delta(buffer, offset);
+	return True;
+}
+
+/* Parse a DELTA_RECTS_FIELD into a list of absolute rectangles. Left
+   and top are relative to the previous rectangle, width and height
+   are repeated from it when left out. */
+static RD_BOOL
+parse_delta_rects(RD_RECT * rects, int nentries, uint8 * data, int datasize)
+{
+	int i, index, offset, value;
+	uint8 flags = 0;
+
+	if (nentries > MAX_DELTA_RECTS || (nentries + 1) / 2 > datasize)
+		return False;
+
+	index = 0;
+	offset = (nentries + 1) / 2;
+	for (i = 0; i < nentries; i++)
+	{
+		if (i % 2 == 0)
+			flags = data[index++];
+
+		if (i == 0)
+			memset(&rects[i], 0, sizeof(RD_RECT));
+		else
+			rects[i] = rects[i - 1];
+
+		if (~flags & 0x80)
+		{
+			if (!parse_delta_checked(data, datasize, &offset, &value))
+				return False;
+			rects[i].x += value;
+		}
+
+		if (~flags & 0x40)
+		{
+			if (!parse_delta_checked(data, datasize, &offset, &value))
+				return False;
+			rects[i].y += value;
+		}
+
+		if (~flags & 0x20)
+		{
+			if (!parse_delta_checked(data, datasize, &offset, &value))
+				return False;
+			rects[i].cx = value;
+		}
+
+		if (~flags & 0x10)
+		{
+			if (!parse_delta_checked(data, datasize, &offset, &value))
+				return False;
+			rects[i].cy = value;
+		}
+
+		flags <<= 4;
+	}
+
+	return True;
+}
+
+/* Process a multiple destination blt order */
+static void
+process_multidestblt(STREAM s, MULTIDESTBLT_ORDER * os, uint32 present, RD_BOOL delta)
+{
+	RD_RECT rects[MAX_DELTA_RECTS];
+
+	if (present & 0x01)
+		rdp_in_coord(s, &os->x, delta);
+
+	if (present & 0x02)
+		rdp_in_coord(s, &os->y, delta);
+
+	if (present & 0x04)
+		rdp_in_coord(s, &os->cx, delta);
+
+	if (present & 0x08)
+		rdp_in_coord(s, &os->cy, delta);
+
+	if (present & 0x10)
+		in_uint8(s, os->opcode);
+
+	if (present & 0x20)
+		in_uint8(s, os->nentries);
+
+	if (present & 0x40)
+		rdp_in_delta_rects(s, &os->datasize, os->data);
+
+	logger(Graphics, Debug,
+	       "process_multidestblt(), op=0x%x, x=%d, y=%d, cx=%d, cy=%d, n=%d, sz=%d",
+	       os->opcode, os->x, os->y, os->cx, os->cy, os->nentries, os->datasize);
+
+	if (!parse_delta_rects(rects, os->nentries, os->data, os->datasize))
+	{
+		logger(Graphics, Error, "process_multidestblt(), parse error");
+		return;
+	}
+
+	ui_multi_destblt(ROP2_S(os->opcode), rects, os->nentries);
+}
+
+/* Process a multiple pattern blt order */
+static void
+process_multipatblt(STREAM s, MULTIPATBLT_ORDER * os, uint32 present, RD_BOOL delta)
+{
+	RD_RECT rects[MAX_DELTA_RECTS];
+	BRUSH brush;
+
+	if (present & 0x0001)
+		rdp_in_coord(s, &os->x, delta);
+
+	if (present & 0x0002)
+		rdp_in_coord(s, &os->y, delta);
+
+	if (present & 0x0004)
+		rdp_in_coord(s, &os->cx, delta);
+
+	if (present & 0x0008)
+		rdp_in_coord(s, &os->cy, delta);
+
+	if (present & 0x0010)
+		in_uint8(s, os->opcode);
+
+	if (present & 0x0020)
+		rdp_in_colour(s, &os->bgcolour);
+
+	if (present & 0x0040)
+		rdp_in_colour(s, &os->fgcolour);
+
+	rdp_parse_brush(s, &os->brush, present >> 7);
+
+	if (present & 0x1000)
+		in_uint8(s, os->nentries);
+
+	if (present & 0x2000)
+		rdp_in_delta_rects(s, &os->datasize, os->data);
+
+	logger(Graphics, Debug,
+	       "process_multipatblt(), op=0x%x, x=%d, y=%d, cx=%d, cy=%d, bs=%d, bg=0x%x, fg=0x%x, n=%d, sz=%d",
+	       os->opcode, os->x, os->y, os->cx, os->cy, os->brush.style, os->bgcolour,
+	       os->fgcolour, os->nentries, os->datasize);
+
+	if (!parse_delta_rects(rects, os->nentries, os->data, os->datasize))
+	{
+		logger(Graphics, Error, "process_multipatblt(), parse error");
+		return;
+	}
+
+	setup_brush(&brush, &os->brush);
+
+	ui_multi_patblt(ROP2_P(os->opcode), rects, os->nentries,
+			&brush, os->bgcolour, os->fgcolour);
+}
+
+/* Process a multiple screen blt order */
+static void
+process_multiscreenblt(STREAM s, MULTISCREENBLT_ORDER * os, uint32 present, RD_BOOL delta)
+{
+	RD_RECT rects[MAX_DELTA_RECTS];
+
+	if (present & 0x0001)
+		rdp_in_coord(s, &os->x, delta);
+
+	if (present & 0x0002)
+		rdp_in_coord(s, &os->y, delta);
+
+	if (present & 0x0004)
+		rdp_in_coord(s, &os->cx, delta);
+
+	if (present & 0x0008)
+		rdp_in_coord(s, &os->cy, delta);
+
+	if (present & 0x0010)
+		in_uint8(s, os->opcode);
+
+	if (present & 0x0020)
+		rdp_in_coord(s, &os->srcx, delta);
+
+	if (present & 0x0040)
+		rdp_in_coord(s, &os->srcy, delta);
+
+	if (present & 0x0080)
+		in_uint8(s, os->nentries);
+
+	if (present & 0x0100)
+		rdp_in_delta_rects(s, &os->datasize, os->data);
+
+	logger(Graphics, Debug,
+	       "process_multiscreenblt(), op=0x%x, x=%d, y=%d, cx=%d, cy=%d, srcx=%d, srcy=%d, n=%d, sz=%d",
+	       os->opcode, os->x, os->y, os->cx, os->cy, os->srcx, os->srcy, os->nentries,
+	       os->datasize);
+
+	if (!parse_delta_rects(rects, os->nentries, os->data, os->datasize))
+	{
+		logger(Graphics, Error, "process_multiscreenblt(), parse error");
+		return;
+	}
+
+	/* The source is given for the bounding rectangle */
+	ui_multi_screenblt(ROP2_S(os->opcode), rects, os->nentries,
+			   os->srcx - os->x, os->srcy - os->y);
+}
+
+/* Process a multiple opaque rectangle order */
+static void
+process_multirect(STREAM s, MULTIRECT_ORDER * os, uint32 present, RD_BOOL delta)
+{
+	RD_RECT rects[MAX_DELTA_RECTS];
+	uint32 i;
+
+	if (present & 0x0001)
+		rdp_in_coord(s, &os->x, delta);
+
+	if (present & 0x0002)
+		rdp_in_coord(s, &os->y, delta);
+
+	if (present & 0x0004)
+		rdp_in_coord(s, &os->cx, delta);
+
+	if (present & 0x0008)
+		rdp_in_coord(s, &os->cy, delta);
+
+	if (present & 0x0010)
+	{
+		in_uint8(s, i);
+		os->colour = (os->colour & 0xffffff00) | i;
+	}
+
+	if (present & 0x0020)
+	{
+		in_uint8(s, i);
+		os->colour = (os->colour & 0xffff00ff) | (i << 8);
+	}
+
+	if (present & 0x0040)
+	{
+		in_uint8(s, i);
+		os->colour = (os->colour & 0xff00ffff) | (i << 16);
+	}
+
+	if (present & 0x0080)
+		in_uint8(s, os->nentries);
+
+	if (present & 0x0100)
+		rdp_in_delta_rects(s, &os->datasize, os->data);
+
+	logger(Graphics, Debug,
+	       "process_multirect(), x=%d, y=%d, cx=%d, cy=%d, fg=0x%x, n=%d, sz=%d",
+	       os->x, os->y, os->cx, os->cy, os->colour, os->nentries, os->datasize);
+
+	if (!parse_delta_rects(rects, os->nentries, os->data, os->datasize))
+	{
+		logger(Graphics, Error, "process_multirect(), parse error");
+		return;
+	}
+
+	ui_multi_rect(rects, os->nentries, os->colour);
+}
+
 /* Process a desktop save order */
 static void
 process_desksave(STREAM s, DESKSAVE_ORDER * os, uint32 present, RD_BOOL delta)
@@ -524,10 +874,6 @@ process_triblt(STREAM s, TRIBLT_ORDER * os, uint32 present, RD_BOOL delta)
 static void
 process_polygon(STREAM s, POLYGON_ORDER * os, uint32 present, RD_BOOL delta)
 {
-	int index, data, next;
-	uint8 flags = 0;
-	RD_POINT *points;
-
 	if (present & 0x01)
 		rdp_in_coord(s, &os->x, delta);
 
@@ -562,44 +908,17 @@ process_polygon(STREAM s, POLYGON_ORDER * os, uint32 present, RD_BOOL delta)
 		return;
 	}
 
-	points = (RD_POINT *) xmalloc((os->npoints + 1) * sizeof(RD_POINT));
-	memset(points, 0, (os->npoints + 1) * sizeof(RD_POINT));
-
-	points[0].x = os->x;
-	points[0].y = os->y;
-
-	index = 0;
-	data = ((os->npoints - 1) / 4) + 1;
-	for (next = 1; (next <= os->npoints) && (next < 256) && (data < os->datasize); next++)
-	{
-		if ((next - 1) % 4 == 0)
-			flags = os->data[index++];
-
-		if (~flags & 0x80)
-			points[next].x = parse_delta(os->data, &data);
-
-		if (~flags & 0x40)
-			points[next].y = parse_delta(os->data, &data);
-
-		flags <<= 2;
-	}
-
-	if (next - 1 == os->npoints)
-		ui_polygon(os->opcode - 1, os->fillmode, points, os->npoints + 1, NULL, 0,
+	if (parse_delta_points(os->x, os->y, os->npoints, os->data, os->datasize))
+		ui_polygon(os->opcode - 1, os->fillmode, g_points, os->npoints + 1, NULL, 0,
 			   os->fgcolour);
 	else
 		logger(Graphics, Error, "process_polygon(), polygon parse error");
-
-	xfree(points);
 }
 
 /* Process a polygon2 order */
 static void
 process_polygon2(STREAM s, POLYGON2_ORDER * os, uint32 present, RD_BOOL delta)
 {
-	int index, data, next;
-	uint8 flags = 0;
-	RD_POINT *points;
 	BRUSH brush;
 
 	if (present & 0x0001)
@@ -644,45 +963,18 @@ process_polygon2(STREAM s, POLYGON2_ORDER * os, uint32 present, RD_BOOL delta)
 
 	setup_brush(&brush, &os->brush);
 
-	points = (RD_POINT *) xmalloc((os->npoints + 1) * sizeof(RD_POINT));
-	memset(points, 0, (os->npoints + 1) * sizeof(RD_POINT));
-
-	points[0].x = os->x;
-	points[0].y = os->y;
-
-	index = 0;
-	data = ((os->npoints - 1) / 4) + 1;
-	for (next = 1; (next <= os->npoints) && (next < 256) && (data < os->datasize); next++)
-	{
-		if ((next - 1) % 4 == 0)
-			flags = os->data[index++];
-
-		if (~flags & 0x80)
-			points[next].x = parse_delta(os->data, &data);
-
-		if (~flags & 0x40)
-			points[next].y = parse_delta(os->data, &data);
-
-		flags <<= 2;
-	}
-
-	if (next - 1 == os->npoints)
-		ui_polygon(os->opcode - 1, os->fillmode, points, os->npoints + 1,
+	if (parse_delta_points(os->x, os->y, os->npoints, os->data, os->datasize))
+		ui_polygon(os->opcode - 1, os->fillmode, g_points, os->npoints + 1,
 			   &brush, os->bgcolour, os->fgcolour);
 	else
 		logger(Graphics, Error, "process_polygon2(), polygon parse error");
-
-	xfree(points);
 }
 
 /* Process a polyline order */
 static void
 process_polyline(STREAM s, POLYLINE_ORDER * os, uint32 present, RD_BOOL delta)
 {
-	int index, next, data;
-	uint8 flags = 0;
 	PEN pen;
-	RD_POINT *points;
 
 	if (present & 0x01)
 		rdp_in_coord(s, &os->x, delta);
@@ -714,36 +1006,13 @@ process_polyline(STREAM s, POLYLINE_ORDER * os, uint32 present, RD_BOOL delta)
 		return;
 	}
 
-	points = (RD_POINT *) xmalloc((os->lines + 1) * sizeof(RD_POINT));
-	memset(points, 0, (os->lines + 1) * sizeof(RD_POINT));
-
-	points[0].x = os->x;
-	points[0].y = os->y;
 	pen.style = pen.width = 0;
 	pen.colour = os->fgcolour;
 
-	index = 0;
-	data = ((os->lines - 1) / 4) + 1;
-	for (next = 1; (next <= os->lines) && (data < os->datasize); next++)
-	{
-		if ((next - 1) % 4 == 0)
-			flags = os->data[index++];
-
-		if (~flags & 0x80)
-			points[next].x = parse_delta(os->data, &data);
-
-		if (~flags & 0x40)
-			points[next].y = parse_delta(os->data, &data);
-
-		flags <<= 2;
-	}
-
-	if (next - 1 == os->lines)
-		ui_polyline(os->opcode - 1, points, os->lines + 1, &pen);
+	if (parse_delta_points(os->x, os->y, os->lines, os->data, os->datasize))
+		ui_polyline(os->opcode - 1, g_points, os->lines + 1, &pen);
 	else
 		logger(Graphics, Error, "process_polyline(), parse error");
-
-	xfree(points);
 }
 
 /* Process an ellipse order */
@@ -900,6 +1169,192 @@ process_text2(STREAM s, TEXT2_ORDER * os, uint32 present, RD_BOOL delta)
 		     &brush, os->bgcolour, os->fgcolour, os->text, os->length);
 }
 
+/* Draw the text of a fast index or fast glyph order */
+static void
+draw_fast_text(uint8 font, uint8 flags, uint8 charinc, uint32 bgcolour, uint32 fgcolour,
+	       BOUNDS * clip, BOUNDS * op, sint16 x, sint16 y, uint8 * text, uint8 length)
+{
+	BOUNDS box = *op;
+	BRUSH brush;
+	uint8 which;
+
+	/* A bottom of -32768 means that top holds flags that say which
+	   sides of the opaque rectangle are the same as the background */
+	if (box.bottom == -32768)
+	{
+		which = box.top & 0x0f;
+		if (which & 0x01)
+			box.bottom = clip->bottom;
+		if (which & 0x02)
+			box.right = clip->right;
+		if (which & 0x04)
+			box.top = clip->top;
+		if (which & 0x08)
+			box.left = clip->left;
+	}
+
+	if (box.left == 0)
+		box.left = clip->left;
+	if (box.right == 0)
+		box.right = clip->right;
+
+	if (x == -32768)
+		x = clip->left;
+	if (y == -32768)
+		y = clip->top;
+
+	/* Always a solid brush */
+	memset(&brush, 0, sizeof(brush));
+
+	ui_draw_text(font, flags, charinc, MIX_TRANSPARENT, x, y,
+		     clip->left, clip->top, clip->right - clip->left, clip->bottom - clip->top,
+		     box.left, box.top, box.right - box.left, box.bottom - box.top,
+		     &brush, bgcolour, fgcolour, text, length);
+}
+
+/* Read the fields shared by the fast index and fast glyph orders */
+static void
+rdp_in_fast_text(STREAM s, uint32 present, RD_BOOL delta, uint8 * font, uint8 * flags,
+		 uint8 * charinc, uint32 * bgcolour, uint32 * fgcolour, BOUNDS * clip,
+		 BOUNDS * box, sint16 * x, sint16 * y)
+{
+	if (present & 0x0001)
+		in_uint8(s, *font);
+
+	/* fDrawing, ulCharInc is the low byte */
+	if (present & 0x0002)
+	{
+		in_uint8(s, *charinc);
+		in_uint8(s, *flags);
+	}
+
+	if (present & 0x0004)
+		rdp_in_colour(s, fgcolour);
+
+	if (present & 0x0008)
+		rdp_in_colour(s, bgcolour);
+
+	if (present & 0x0010)
+		rdp_in_coord(s, &clip->left, delta);
+
+	if (present & 0x0020)
+		rdp_in_coord(s, &clip->top, delta);
+
+	if (present & 0x0040)
+		rdp_in_coord(s, &clip->right, delta);
+
+	if (present & 0x0080)
+		rdp_in_coord(s, &clip->bottom, delta);
+
+	if (present & 0x0100)
+		rdp_in_coord(s, &box->left, delta);
+
+	if (present & 0x0200)
+		rdp_in_coord(s, &box->top, delta);
+
+	if (present & 0x0400)
+		rdp_in_coord(s, &box->right, delta);
+
+	if (present & 0x0800)
+		rdp_in_coord(s, &box->bottom, delta);
+
+	if (present & 0x1000)
+		rdp_in_coord(s, x, delta);
+
+	if (present & 0x2000)
+		rdp_in_coord(s, y, delta);
+}
+
+/* Process a fast index order, a compact text order without brush */
+static void
+process_fast_index(STREAM s, FAST_INDEX_ORDER * os, uint32 present, RD_BOOL delta)
+{
+	rdp_in_fast_text(s, present, delta, &os->font, &os->flags, &os->charinc,
+			 &os->bgcolour, &os->fgcolour, &os->clip, &os->box, &os->x, &os->y);
+
+	if (present & 0x4000)
+	{
+		in_uint8(s, os->length);
+		in_uint8a(s, os->text, os->length);
+	}
+
+	logger(Graphics, Debug,
+	       "process_fast_index(), x=%d, y=%d, cl=%d, ct=%d, cr=%d, cb=%d, bl=%d, bt=%d, br=%d, bb=%d, bg=0x%x, fg=0x%x, font=%d, fl=0x%x, n=%d",
+	       os->x, os->y, os->clip.left, os->clip.top, os->clip.right, os->clip.bottom,
+	       os->box.left, os->box.top, os->box.right, os->box.bottom, os->bgcolour,
+	       os->fgcolour, os->font, os->flags, os->length);
+
+	draw_fast_text(os->font, os->flags, os->charinc, os->bgcolour, os->fgcolour,
+		       &os->clip, &os->box, os->x, os->y, os->text, os->length);
+}
+
+/* Process a fast glyph order, a single glyph that may carry its own
+   glyph definition to be cached before it is drawn */
+static void
+process_fast_glyph(STREAM s, FAST_GLYPH_ORDER * os, uint32 present, RD_BOOL delta)
+{
+	struct stream packet;
+	RD_HGLYPH bitmap;
+	sint16 offset, baseline;
+	uint16 width, height;
+	uint8 text[2];
+	int datasize;
+
+	rdp_in_fast_text(s, present, delta, &os->font, &os->flags, &os->charinc,
+			 &os->bgcolour, &os->fgcolour, &os->clip, &os->box, &os->x, &os->y);
+
+	if (present & 0x4000)
+	{
+		in_uint8(s, os->datasize);
+		in_uint8a(s, os->data, os->datasize);
+	}
+
+	logger(Graphics, Debug,
+	       "process_fast_glyph(), x=%d, y=%d, cl=%d, ct=%d, cr=%d, cb=%d, bl=%d, bt=%d, br=%d, bb=%d, bg=0x%x, fg=0x%x, font=%d, fl=0x%x, sz=%d",
+	       os->x, os->y, os->clip.left, os->clip.top, os->clip.right, os->clip.bottom,
+	       os->box.left, os->box.top, os->box.right, os->box.bottom, os->bgcolour,
+	       os->fgcolour, os->font, os->flags, os->datasize);
+
+	if (os->datasize < 1)
+	{
+		logger(Graphics, Error, "process_fast_glyph(), missing glyph index");
+		return;
+	}
+
+	if (os->datasize > 1)
+	{
+		memset(&packet, 0, sizeof(packet));
+		packet.data = packet.p = os->data + 1;
+		packet.end = os->data + os->datasize;
+		packet.size = os->datasize - 1;
+
+		rdp_in_2byte_signed(&packet, &offset);
+		rdp_in_2byte_signed(&packet, &baseline);
+		rdp_in_2byte_unsigned(&packet, &width);
+		rdp_in_2byte_unsigned(&packet, &height);
+
+		/* Unlike the glyph cache orders, the bitmap is not padded */
+		datasize = height * ((width + 7) / 8);
+		if (!s_check_rem(&packet, datasize))
+		{
+			logger(Graphics, Error, "process_fast_glyph(), glyph data overrun");
+			return;
+		}
+
+		bitmap = ui_create_glyph(width, height, packet.p);
+		cache_put_font(os->font, os->data[0], offset, baseline, width, height, bitmap);
+	}
+
+	/* A fragment of one glyph, with a zero offset unless the
+	   position is implicit */
+	text[0] = os->data[0];
+	text[1] = 0;
+
+	draw_fast_text(os->font, os->flags, os->charinc, os->bgcolour, os->fgcolour,
+		       &os->clip, &os->box, os->x, os->y, text,
+		       (os->flags & TEXT2_IMPLICIT_X) ? 1 : 2);
+}
+
 /* Process a raw bitmap cache order */
 static void
 process_raw_bmpcache(STREAM s)
@@ -1074,6 +1529,102 @@ process_bmpcache2(STREAM s, uint16 flags, RD_BOOL compressed)
 	xfree(bmpdata);
 }
 
+/* Process a bitmap cache v3 order. The bitmap comes either
+   uncompressed, bottom-up like the other cache orders, or encoded
+   with one of the bitmap codecs; either way in the session depth. */
+static void
+process_bmpcache3(STREAM s, uint16 flags)
+{
+	RD_HBITMAP bitmap;
+	int y;
+	uint8 cache_id, bpp, Bpp, exflags, codec_id;
+	uint16 cache_idx, width, height;
+	uint32 bufsize;
+	uint8 *data, *bmpdata, *bitmap_id;
+
+	cache_id = flags & ID_MASK;
+	in_uint16_le(s, cache_idx);
+	in_uint8p(s, bitmap_id, 8);	/* key1, key2 */
+
+	/* TS_BITMAP_DATA_EX */
+	in_uint8(s, bpp);
+	in_uint8(s, exflags);
+	in_uint8s(s, 1);	/* reserved */
+	in_uint8(s, codec_id);
+	in_uint16_le(s, width);
+	in_uint16_le(s, height);
+	in_uint32_le(s, bufsize);
+
+	if (exflags & EX_COMPRESSED_BITMAP_HEADER_PRESENT)
+		in_uint8s(s, 24);	/* exBitmapDataHeader */
+
+	if (!s_check_rem(s, bufsize))
+	{
+		rdp_protocol_error("process_bmpcache3(), consume of bitmap data would overrun", s);
+		return;
+	}
+	in_uint8p(s, data, bufsize);
+
+	logger(Graphics, Debug,
+	       "process_bmpcache3(), codec=%d, flags=%x, cx=%d, cy=%d, id=%d, idx=%d, bpp=%d, bs=%d",
+	       codec_id, flags, width, height, cache_id, cache_idx, bpp, bufsize);
+
+	Bpp = (bpp + 7) / 8;
+	if (Bpp != (g_server_depth + 7) / 8 || (codec_id != RDP_CODEC_ID_NONE && Bpp != 4))
+	{
+		logger(Graphics, Warning, "process_bmpcache3(), %d bpp bitmap in a %d bpp session",
+		       bpp, g_server_depth);
+		return;
+	}
+
+	if (cache_id >= BMPCACHE2_NUM_CACHES || width == 0 || height == 0 ||
+	    (uint32) width * height > BMPCACHE2_CELL_PIXELS(cache_id))
+	{
+		logger(Graphics, Error, "process_bmpcache3(), %dx%d bitmap does not fit cache %d",
+		       width, height, cache_id);
+		return;
+	}
+
+	bmpdata = (uint8 *) xmalloc(width * height * Bpp);
+
+	if (codec_id == RDP_CODEC_ID_NONE)
+	{
+		if (bufsize < (uint32) width * height * Bpp)
+		{
+			logger(Graphics, Error, "process_bmpcache3(), short bitmap data, %u bytes",
+			       bufsize);
+			xfree(bmpdata);
+			return;
+		}
+
+		for (y = 0; y < height; y++)
+			memcpy(&bmpdata[(height - y - 1) * (width * Bpp)],
+			       &data[y * (width * Bpp)], width * Bpp);
+	}
+	else if (!surface_decode_bitmap(codec_id, bmpdata, width, height, data, bufsize))
+	{
+		logger(Graphics, Error, "process_bmpcache3(), failed to decode bitmap data");
+		xfree(bmpdata);
+		return;
+	}
+
+	bitmap = ui_create_bitmap(width, height, bmpdata);
+
+	if (bitmap)
+	{
+		cache_put_bitmap(cache_id, cache_idx, bitmap);
+		if (!(flags & CBR3_DO_NOT_CACHE))
+			pstcache_save_bitmap(cache_id, cache_idx, bitmap_id, width, height,
+					     width * height * Bpp, bmpdata);
+	}
+	else
+	{
+		logger(Graphics, Error, "process_bmpcache3(), ui_create_bitmap(), failed");
+	}
+
+	xfree(bmpdata);
+}
+
 /* Process a colourmap cache order */
 static void
 process_colcache(STREAM s)
@@ -1139,6 +1690,46 @@ process_fontcache(STREAM s)
 	}
 }
 
+/* Process a font cache order, revision 2. The cache id and number of
+   glyphs are in the order header flags. */
+static void
+process_fontcache2(STREAM s, uint16 flags)
+{
+	RD_HGLYPH bitmap;
+	uint8 font, nglyphs, character;
+	sint16 offset, baseline;
+	uint16 width, height;
+	int i, datasize;
+	uint8 *data;
+
+	font = flags & 0x0f;
+	nglyphs = flags >> 8;
+
+	logger(Graphics, Debug, "process_fontcache2(), font=%d, n=%d", font, nglyphs);
+
+	for (i = 0; i < nglyphs; i++)
+	{
+		in_uint8(s, character);
+		rdp_in_2byte_signed(s, &offset);
+		rdp_in_2byte_signed(s, &baseline);
+		rdp_in_2byte_unsigned(s, &width);
+		rdp_in_2byte_unsigned(s, &height);
+
+		datasize = (height * ((width + 7) / 8) + 3) & ~3;
+		if (!s_check_rem(s, datasize))
+		{
+			logger(Graphics, Error, "process_fontcache2(), glyph data overrun");
+			return;
+		}
+		in_uint8p(s, data, datasize);
+
+		bitmap = ui_create_glyph(width, height, data);
+		cache_put_font(font, character, offset, baseline, width, height, bitmap);
+	}
+
+	/* The unicode characters that may follow are not used */
+}
+
 static void
 process_compressed_8x8_brush_data(uint8 * in, uint8 * out, int Bpp)
 {
@@ -1287,7 +1878,11 @@ process_secondary_order(STREAM s)
 			break;
 
 		case RDP_ORDER_FONTCACHE:
-			process_fontcache(s);
+			/* The server only sends revision 2 once it is advertised */
+			if (g_glyph_support_level == GLYPH_SUPPORT_ENCODE)
+				process_fontcache2(s, flags);
+			else
+				process_fontcache(s);
 			break;
 
 		case RDP_ORDER_RAW_BMPCACHE2:
@@ -1298,6 +1893,10 @@ process_secondary_order(STREAM s)
 			process_bmpcache2(s, flags, True);	/* compressed */
 			break;
 
+		case RDP_ORDER_BMPCACHE3:
+			process_bmpcache3(s, flags);
+			break;
+
 		case RDP_ORDER_BRUSHCACHE:
 			process_brushcache(s, flags);
 			break;
@@ -1310,6 +1909,32 @@ process_secondary_order(STREAM s)
 	s->p = next_order;
 }
 
+/* Process an alternate secondary order. These have no common length
+   field, so an unknown one ends the order PDU. */
+static RD_BOOL
+process_altsec_order(STREAM s, uint8 type)
+{
+	uint32 action;
+
+	switch (type)
+	{
+		case RDP_ALTSEC_ORDER_FRAME_MARKER:
+			in_uint32_le(s, action);
+			logger(Graphics, Debug, "process_altsec_order(), frame %s",
+			       action == TS_FRAME_START ? "start" : "end");
+			if (action == TS_FRAME_START)
+				ui_begin_frame();
+			else
+				ui_end_frame();
+			return True;
+
+		default:
+			logger(Graphics, Warning,
+			       "process_altsec_order(), unhandled alternate secondary order %d", type);
+			return False;
+	}
+}
+
 /* Process an order PDU */
 void
 process_orders(STREAM s, uint16 num_orders)
@@ -1320,12 +1945,21 @@ process_orders(STREAM s, uint16 num_orders)
 	int size, processed = 0;
 	RD_BOOL delta;
 
+	timing_stop(TIMING_FIRST_FRAME);
+
 	while (processed < num_orders)
 	{
 		in_uint8(s, order_flags);
 
 		if (!(order_flags & RDP_ORDER_STANDARD))
 		{
+			if ((order_flags & RDP_ORDER_SECONDARY)
+			    && process_altsec_order(s, order_flags >> 2))
+			{
+				processed++;
+				continue;
+			}
+
 			logger(Graphics, Error, "process_orders(), order parsing failed");
 			break;
 		}
@@ -1353,6 +1987,11 @@ process_orders(STREAM s, uint16 num_orders)
 				case RDP_ORDER_LINE:
 				case RDP_ORDER_POLYGON2:
 				case RDP_ORDER_ELLIPSE2:
+				case RDP_ORDER_MULTIPATBLT:
+				case RDP_ORDER_MULTISCREENBLT:
+				case RDP_ORDER_MULTIRECT:
+				case RDP_ORDER_FAST_INDEX:
+				case RDP_ORDER_FAST_GLYPH:
 					size = 2;
 					break;
 
@@ -1434,6 +2073,31 @@ process_orders(STREAM s, uint16 num_orders)
 					process_text2(s, &os->text2, present, delta);
 					break;
 
+				case RDP_ORDER_MULTIDESTBLT:
+					process_multidestblt(s, &os->multidestblt, present, delta);
+					break;
+
+				case RDP_ORDER_MULTIPATBLT:
+					process_multipatblt(s, &os->multipatblt, present, delta);
+					break;
+
+				case RDP_ORDER_MULTISCREENBLT:
+					process_multiscreenblt(s, &os->multiscreenblt, present,
+							       delta);
+					break;
+
+				case RDP_ORDER_MULTIRECT:
+					process_multirect(s, &os->multirect, present, delta);
+					break;
+
+				case RDP_ORDER_FAST_INDEX:
+					process_fast_index(s, &os->fast_index, present, delta);
+					break;
+
+				case RDP_ORDER_FAST_GLYPH:
+					process_fast_glyph(s, &os->fast_glyph, present, delta);
+					break;
+
 				default:
 					logger(Graphics, Warning,
 					       "process_orders(), unhandled order type %d",
@@ -36,9 +36,15 @@ enum RDP_ORDER_TYPE
 	RDP_ORDER_DESKSAVE = 11,
 	RDP_ORDER_MEMBLT = 13,
 	RDP_ORDER_TRIBLT = 14,
+	RDP_ORDER_MULTIDESTBLT = 15,
+	RDP_ORDER_MULTIPATBLT = 16,
+	RDP_ORDER_MULTISCREENBLT = 17,
+	RDP_ORDER_MULTIRECT = 18,
+	RDP_ORDER_FAST_INDEX = 19,
 	RDP_ORDER_POLYGON = 20,
 	RDP_ORDER_POLYGON2 = 21,
 	RDP_ORDER_POLYLINE = 22,
+	RDP_ORDER_FAST_GLYPH = 24,
 	RDP_ORDER_ELLIPSE = 25,
 	RDP_ORDER_ELLIPSE2 = 26,
 	RDP_ORDER_TEXT2 = 27
@@ -52,9 +58,19 @@ enum RDP_SECONDARY_ORDER_TYPE
 	RDP_ORDER_FONTCACHE = 3,
 	RDP_ORDER_RAW_BMPCACHE2 = 4,
 	RDP_ORDER_BMPCACHE2 = 5,
-	RDP_ORDER_BRUSHCACHE = 7
+	RDP_ORDER_BRUSHCACHE = 7,
+	RDP_ORDER_BMPCACHE3 = 8
 };
 
+enum RDP_ALTSEC_ORDER_TYPE
+{
+	RDP_ALTSEC_ORDER_FRAME_MARKER = 13
+};
+
+/* TS_FRAME_MARKER action */
+#define TS_FRAME_START	0x00000000
+#define TS_FRAME_END	0x00000001
+
 typedef struct _DESTBLT_ORDER
 {
 	sint16 x;
@@ -166,8 +182,77 @@ typedef struct _MEMBLT_ORDER
 }
 MEMBLT_ORDER;
 
+/* Coded DELTA_RECTS_FIELD, at most 45 rectangles of 4 two byte
+   values each, preceded by one zero bits nibble per rectangle */
+#define MAX_DELTA_RECTS 45
+#define MAX_DELTA_DATA (((MAX_DELTA_RECTS + 1) / 2) + MAX_DELTA_RECTS * 8)
+
+typedef struct _MULTIDESTBLT_ORDER
+{
+	sint16 x;
+	sint16 y;
+	sint16 cx;
+	sint16 cy;
+	uint8 opcode;
+	uint8 nentries;
+	uint16 datasize;
+	uint8 data[MAX_DELTA_DATA];
+
+}
+MULTIDESTBLT_ORDER;
+
+typedef struct _MULTIPATBLT_ORDER
+{
+	sint16 x;
+	sint16 y;
+	sint16 cx;
+	sint16 cy;
+	uint8 opcode;
+	uint32 bgcolour;
+	uint32 fgcolour;
+	BRUSH brush;
+	uint8 nentries;
+	uint16 datasize;
+	uint8 data[MAX_DELTA_DATA];
+
+}
+MULTIPATBLT_ORDER;
+
+typedef struct _MULTISCREENBLT_ORDER
+{
+	sint16 x;
+	sint16 y;
+	sint16 cx;
+	sint16 cy;
+	uint8 opcode;
+	sint16 srcx;
+	sint16 srcy;
+	uint8 nentries;
+	uint16 datasize;
+	uint8 data[MAX_DELTA_DATA];
+
+}
+MULTISCREENBLT_ORDER;
+
+typedef struct _MULTIRECT_ORDER
+{
+	sint16 x;
+	sint16 y;
+	sint16 cx;
+	sint16 cy;
+	uint32 colour;
+	uint8 nentries;
+	uint16 datasize;
+	uint8 data[MAX_DELTA_DATA];
+
+}
+MULTIRECT_ORDER;
+
 #define MAX_DATA 256
 
+/* The start point plus at most 255 delta encoded points */
+#define MAX_POINTS 256
+
 typedef struct _POLYGON_ORDER
 {
 	sint16 x;
@@ -266,6 +351,40 @@ typedef struct _TEXT2_ORDER
 }
 TEXT2_ORDER;
 
+typedef struct _FAST_INDEX_ORDER
+{
+	uint8 font;
+	uint8 flags;
+	uint8 charinc;
+	uint32 bgcolour;
+	uint32 fgcolour;
+	BOUNDS clip;
+	BOUNDS box;
+	sint16 x;
+	sint16 y;
+	uint8 length;
+	uint8 text[MAX_TEXT];
+
+}
+FAST_INDEX_ORDER;
+
+typedef struct _FAST_GLYPH_ORDER
+{
+	uint8 font;
+	uint8 flags;
+	uint8 charinc;
+	uint32 bgcolour;
+	uint32 fgcolour;
+	BOUNDS clip;
+	BOUNDS box;
+	sint16 x;
+	sint16 y;
+	uint8 datasize;
+	uint8 data[MAX_DATA];
+
+}
+FAST_GLYPH_ORDER;
+
 typedef struct _RDP_ORDER_STATE
 {
 	uint8 order_type;
@@ -285,6 +404,12 @@ typedef struct _RDP_ORDER_STATE
 	ELLIPSE_ORDER ellipse;
 	ELLIPSE2_ORDER ellipse2;
 	TEXT2_ORDER text2;
+	MULTIDESTBLT_ORDER multidestblt;
+	MULTIPATBLT_ORDER multipatblt;
+	MULTISCREENBLT_ORDER multiscreenblt;
+	MULTIRECT_ORDER multirect;
+	FAST_INDEX_ORDER fast_index;
+	FAST_GLYPH_ORDER fast_glyph;
 
 }
 RDP_ORDER_STATE;
@@ -333,6 +458,13 @@ RDP_BMPCACHE_ORDER;
 #define LONG_FORMAT		0x80
 #define BUFSIZE_MASK		0x3FFF	/* or 0x1FFF? */
 
+/* RDP_BMPCACHE3_ORDER, the flags are in the top nine bits */
+#define CBR3_IGNORABLE_FLAG	0x0400
+#define CBR3_DO_NOT_CACHE	0x0800
+
+/* RDP_FONTCACHE_ORDER */
+#define CG_GLYPH_UNICODE_PRESENT	0x0010
+
 #define MAX_GLYPH 32
 
 typedef struct _RDP_FONT_GLYPH
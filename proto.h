@@ -27,6 +27,7 @@ extern "C" {
 #define UNUSED(param) ((void)param)
 /* bitmap.c */
 RD_BOOL bitmap_decompress(uint8 * output, int width, int height, uint8 * input, int size, int Bpp);
+RD_BOOL bitmap_decompress_planar(uint8 * output, int width, int height, uint8 * input, int size);
 /* cache.c */
 void cache_rebuild_bmpcache_linked_list(uint8 id, sint16 * idx, int count);
 void cache_bump_bitmap(uint8 id, uint16 idx, int bump);
@@ -81,6 +82,7 @@ int get_current_workarea(uint32 * x, uint32 * y, uint32 * width, uint32 * height
 void ewmh_init(void);
 /* iso.c */
 STREAM iso_init(int length);
+void iso_out_data_header(STREAM s, uint16 length);
 void iso_send(STREAM s);
 STREAM iso_recv(RD_BOOL * is_fastpath, uint8 * fastpath_hdr);
 RD_BOOL iso_connect(char *server, char *username, char *domain, char *password, RD_BOOL reconnect,
@@ -93,6 +95,7 @@ RD_BOOL cssp_connect(char *server, char *user, char *domain, char *password, STR
 void licence_process(STREAM s);
 /* mcs.c */
 STREAM mcs_init(int length);
+void mcs_out_data_header(STREAM s, uint16 channel, uint16 length);
 void mcs_send_to_channel(STREAM s, uint16 channel);
 void mcs_send(STREAM s);
 STREAM mcs_recv(uint16 * channel, RD_BOOL * is_fastpath, uint8 * fastpath_hdr);
@@ -114,9 +117,11 @@ void printercache_process(STREAM s);
 /* pstcache.c */
 void pstcache_touch_bitmap(uint8 cache_id, uint16 cache_idx, uint32 stamp);
 RD_BOOL pstcache_load_bitmap(uint8 cache_id, uint16 cache_idx);
-RD_BOOL pstcache_save_bitmap(uint8 cache_id, uint16 cache_idx, uint8 * key, uint8 width,
-			     uint8 height, uint16 length, uint8 * data);
+RD_BOOL pstcache_save_bitmap(uint8 cache_id, uint16 cache_idx, uint8 * key, uint16 width,
+			     uint16 height, uint32 length, uint8 * data);
 int pstcache_enumerate(uint8 id, HASH_KEY * keylist);
+void pstcache_precache(uint8 id);
+void pstcache_save_index(void);
 RD_BOOL pstcache_init(uint8 cache_id);
 /* rdesktop.c */
 int main(int argc, char *argv[]);
@@ -136,6 +141,8 @@ RD_BOOL subprocess(char *const argv[], str_handle_lines_t linehandler, void *dat
 char *l_to_a(long N, int base);
 int load_licence(unsigned char **data);
 void save_licence(unsigned char *data, int length);
+int load_tls_session(const char *key, unsigned char **data);
+void save_tls_session(const char *key, unsigned char *data, int length);
 void rd_create_ui(void);
 RD_BOOL rd_pstcache_mkdir(void);
 int rd_open_file(char *filename);
@@ -151,6 +158,8 @@ void rdp_in_unistr(STREAM s, int in_len, char **string, uint32 * str_size);
 void rdp_send_input(uint32 time, uint16 message_type, uint16 device_flags, uint16 param1,
 		    uint16 param2);
 void rdp_send_suppress_output_pdu(enum RDP_SUPPRESS_STATUS allowupdates);
+void rdp_send_frame_ack(uint32 frame_id);
+uint32 rdp_multifragment_max_size(void);
 void process_colour_pointer_pdu(STREAM s);
 void process_new_pointer_pdu(STREAM s);
 void process_cached_pointer_pdu(STREAM s);
@@ -196,6 +205,7 @@ void buf_out_uint32(uint8 * buffer, uint32 value);
 void sec_sign(uint8 * signature, int siglen, uint8 * session_key, int keylen, uint8 * data,
 	      int datalen);
 void sec_decrypt(uint8 * data, int length);
+int sec_header_length(uint32 flags);
 STREAM sec_init(uint32 flags, int maxlen);
 void sec_send_to_channel(STREAM s, uint32 flags, uint16 channel);
 void sec_send(STREAM s, uint32 flags);
@@ -212,6 +222,9 @@ RD_BOOL serial_get_timeout(RD_NTHANDLE handle, uint32 length, uint32 * timeout,
 /* tcp.c */
 STREAM tcp_init(uint32 maxlen);
 void tcp_send(STREAM s);
+void tcp_send_vector(SEND_VECTOR * vector, int count);
+void tcp_hold(void);
+void tcp_release(void);
 STREAM tcp_recv(STREAM s, uint32 length);
 RD_BOOL tcp_connect(char *server);
 void tcp_disconnect(void);
@@ -221,6 +234,10 @@ void tcp_reset_state(void);
 RD_BOOL tcp_tls_connect(void);
 RD_BOOL tcp_tls_get_server_pubkey(STREAM s);
 void tcp_run_ui(RD_BOOL run);
+/* netmon.c */
+RD_BOOL netmon_open(void);
+void netmon_close(void);
+RD_BOOL netmon_wait(uint32 timeout);
 
 /* asn.c */
 RD_BOOL ber_in_header(STREAM s, int *tagval, int *length);
@@ -296,6 +313,11 @@ void ui_triblt(uint8 opcode, int x, int y, int cx, int cy, RD_HBITMAP src, int s
 	       BRUSH * brush, uint32 bgcolour, uint32 fgcolour);
 void ui_line(uint8 opcode, int startx, int starty, int endx, int endy, PEN * pen);
 void ui_rect(int x, int y, int cx, int cy, uint32 colour);
+void ui_multi_destblt(uint8 opcode, RD_RECT * rects, int count);
+void ui_multi_patblt(uint8 opcode, RD_RECT * rects, int count, BRUSH * brush, uint32 bgcolour,
+		     uint32 fgcolour);
+void ui_multi_screenblt(uint8 opcode, RD_RECT * rects, int count, int srcdx, int srcdy);
+void ui_multi_rect(RD_RECT * rects, int count, uint32 colour);
 void ui_polygon(uint8 opcode, uint8 fillmode, RD_POINT * point, int npoints, BRUSH * brush,
 		uint32 bgcolour, uint32 fgcolour);
 void ui_polyline(uint8 opcode, RD_POINT * points, int npoints, PEN * pen);
@@ -310,6 +332,9 @@ void ui_desktop_save(uint32 offset, int x, int y, int cx, int cy);
 void ui_desktop_restore(uint32 offset, int x, int y, int cx, int cy);
 void ui_begin_update(void);
 void ui_end_update(void);
+void ui_begin_frame(void);
+void ui_end_frame(void);
+void ui_reset_state(void);
 void ui_seamless_begin(RD_BOOL hidden);
 void ui_seamless_end();
 void ui_seamless_hide_desktop(void);
@@ -331,14 +356,57 @@ void ui_seamless_syncbegin(unsigned long flags);
 void ui_seamless_ack(unsigned int serial);
 /* lspci.c */
 RD_BOOL lspci_init(void);
+/* rdpgfx.c */
+void rdpgfx_init(void);
 /* rdpedisp.c */
 void rdpedisp_init(void);
 RD_BOOL rdpedisp_is_available();
 void rdpedisp_set_session_size(uint32 width, uint32 height);
+/* timing.c */
+void timing_reset(void);
+void timing_start(timing_phase phase);
+void timing_stop(timing_phase phase);
+int timing_format(char *buf, size_t size);
+void timing_report(void);
+/* h264.c */
+RD_BOOL h264_available(void);
+H264_CONTEXT *h264_open(void);
+void h264_close(H264_CONTEXT * h264);
+RD_BOOL h264_decode_avc420(H264_CONTEXT * h264, uint8 * data, uint32 length, uint8 * dst,
+			   int dst_width, RD_RECT * clip);
+/* nsc.c */
+RD_BOOL nsc_decode(uint8 * output, int width, int height, uint8 * input, uint32 size);
+RD_BOOL nsc_process_message(SURFACE_BITS * bits);
+void nsc_out_properties(STREAM s);
+/* rfx.c */
+RD_BOOL rfx_process_message(SURFACE_BITS * bits);
+RD_BOOL rfx_decode(uint8 * output, int width, int height, uint8 * input, uint32 size);
+void rfx_out_properties(STREAM s);
+/* workpool.c */
+int workpool_num_threads(void);
+void workpool_run(workpool_job_t fn, int count);
+/* surface.c */
+RD_BOOL surface_process_bits(STREAM s);
+uint16 surface_codecs_caplen(void);
+void surface_out_codecs_capabilityset(STREAM s);
+RD_BOOL surface_decode_bitmap(uint8 codec_id, uint8 * output, int width, int height, uint8 * data,
+			      uint32 length);
+/* autodetect.c */
+void autodetect_process(STREAM s);
+void autodetect_bytes_received(uint32 length);
+void autodetect_reset_state(void);
+/* zgfx.c */
+void zgfx_init(ZGFX_CONTEXT * zgfx);
+void zgfx_reset(ZGFX_CONTEXT * zgfx);
+RD_BOOL zgfx_decompress_segment(ZGFX_CONTEXT * zgfx, uint8 * data, uint32 length, uint8 ** out,
+				uint32 * out_length);
+RD_BOOL zgfx_decompress(ZGFX_CONTEXT * zgfx, STREAM s, uint8 ** out, uint32 * out_length);
 /* dvc.c */
 typedef void (*dvc_channel_process_fn) (STREAM s);
+typedef void (*dvc_channel_open_fn) (void);
 RD_BOOL dvc_init(void);
 RD_BOOL dvc_channels_register(const char *name, dvc_channel_process_fn handler);
+RD_BOOL dvc_channels_set_open_handler(const char *name, dvc_channel_open_fn handler);
 RD_BOOL dvc_channels_is_available(const char *name);
 void dvc_send(const char *name, STREAM s);
 /* seamless.c */
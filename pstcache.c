@@ -19,10 +19,25 @@
 
 #include "rdesktop.h"
 
-#define MAX_CELL_SIZE		0x1000	/* pixels */
-
 #define IS_PERSISTENT(id) (id < 8 && g_pstcache_fd[id] > 0)
 
+/* Each cell holds a header and the largest bitmap of its cache */
+#define CELL_SIZE(id) (g_pstcache_Bpp * BMPCACHE2_CELL_PIXELS(id) + sizeof(CELLHEADER))
+
+#define PSTCACHE_INDEX_MAGIC	0x58444e49	/* "INDX" */
+
+/* The cell headers of a cache file, kept in memory and mirrored to an
+   index file next to it, so that connecting takes one read instead of
+   one seek and read per cell. The index file is only trusted if the
+   previous session wrote it back on exit; otherwise the headers are
+   read from the cells once. */
+typedef struct _PSTCACHE_INDEX
+{
+	uint32 magic;
+	CELLHEADER cells[BMPCACHE2_NUM_PSTCELLS];
+}
+PSTCACHE_INDEX;
+
 extern int g_server_depth;
 extern RD_BOOL g_bitmap_cache;
 extern RD_BOOL g_bitmap_cache_persist_enable;
@@ -33,6 +48,10 @@ int g_pstcache_Bpp;
 RD_BOOL g_pstcache_enumerated = False;
 uint8 zero_key[] = { 0, 0, 0, 0, 0, 0, 0, 0 };
 
+static PSTCACHE_INDEX *g_pstcache_index[8];
+static int g_pstcache_index_fd[8];
+static int g_pstcache_num_keys[8];
+
 
 /* Update mru stamp/index for a bitmap */
 void
@@ -43,8 +62,10 @@ pstcache_touch_bitmap(uint8 cache_id, uint16 cache_idx, uint32 stamp)
 	if (!IS_PERSISTENT(cache_id) || cache_idx >= BMPCACHE2_NUM_PSTCELLS)
 		return;
 
+	g_pstcache_index[cache_id]->cells[cache_idx].stamp = stamp;
+
 	fd = g_pstcache_fd[cache_id];
-	rd_lseek_file(fd, 12 + cache_idx * (g_pstcache_Bpp * MAX_CELL_SIZE + sizeof(CELLHEADER)));
+	rd_lseek_file(fd, 12 + cache_idx * CELL_SIZE(cache_id));
 	rd_write_file(fd, &stamp, sizeof(stamp));
 }
 
@@ -54,7 +75,7 @@ pstcache_load_bitmap(uint8 cache_id, uint16 cache_idx)
 {
 	uint8 *celldata;
 	int fd;
-	CELLHEADER cellhdr;
+	CELLHEADER *cellhdr;
 	RD_HBITMAP bitmap;
 
 	if (!g_bitmap_cache_persist_enable)
@@ -63,13 +84,20 @@ pstcache_load_bitmap(uint8 cache_id, uint16 cache_idx)
 	if (!IS_PERSISTENT(cache_id) || cache_idx >= BMPCACHE2_NUM_PSTCELLS)
 		return False;
 
+	cellhdr = &g_pstcache_index[cache_id]->cells[cache_idx];
+	if (cellhdr->length == 0)
+		return False;
+
 	fd = g_pstcache_fd[cache_id];
-	rd_lseek_file(fd, cache_idx * (g_pstcache_Bpp * MAX_CELL_SIZE + sizeof(CELLHEADER)));
-	rd_read_file(fd, &cellhdr, sizeof(CELLHEADER));
-	celldata = (uint8 *) xmalloc(cellhdr.length);
-	rd_read_file(fd, celldata, cellhdr.length);
+	rd_lseek_file(fd, cache_idx * CELL_SIZE(cache_id) + sizeof(CELLHEADER));
+	celldata = (uint8 *) xmalloc(cellhdr->length);
+	if (rd_read_file(fd, celldata, cellhdr->length) != cellhdr->length)
+	{
+		xfree(celldata);
+		return False;
+	}
 
-	bitmap = ui_create_bitmap(cellhdr.width, cellhdr.height, celldata);
+	bitmap = ui_create_bitmap(cellhdr->width, cellhdr->height, celldata);
 	logger(Core, Debug, "pstcache_load_bitmap(), load bitmap from disk: id=%d, idx=%d, bmp=%p)",
 	       cache_id, cache_idx, bitmap);
 	cache_put_bitmap(cache_id, cache_idx, bitmap);
@@ -81,7 +109,7 @@ pstcache_load_bitmap(uint8 cache_id, uint16 cache_idx)
 /* Store a bitmap in the persistent cache */
 RD_BOOL
 pstcache_save_bitmap(uint8 cache_id, uint16 cache_idx, uint8 * key,
-		     uint8 width, uint8 height, uint16 length, uint8 * data)
+		     uint16 width, uint16 height, uint32 length, uint8 * data)
 {
 	int fd;
 	CELLHEADER cellhdr;
@@ -89,29 +117,37 @@ pstcache_save_bitmap(uint8 cache_id, uint16 cache_idx, uint8 * key,
 	if (!IS_PERSISTENT(cache_id) || cache_idx >= BMPCACHE2_NUM_PSTCELLS)
 		return False;
 
+	/* Anything else would spill into the next cell */
+	if (width > 0xff || height > 0xff ||
+	    length > (uint32) g_pstcache_Bpp * BMPCACHE2_CELL_PIXELS(cache_id))
+	{
+		logger(Core, Warning,
+		       "pstcache_save_bitmap(), %dx%d bitmap does not fit a cell of cache %d", width,
+		       height, cache_id);
+		return False;
+	}
+
 	memcpy(cellhdr.key, key, sizeof(HASH_KEY));
 	cellhdr.width = width;
 	cellhdr.height = height;
 	cellhdr.length = length;
 	cellhdr.stamp = 0;
+	g_pstcache_index[cache_id]->cells[cache_idx] = cellhdr;
 
 	fd = g_pstcache_fd[cache_id];
-	rd_lseek_file(fd, cache_idx * (g_pstcache_Bpp * MAX_CELL_SIZE + sizeof(CELLHEADER)));
+	rd_lseek_file(fd, cache_idx * CELL_SIZE(cache_id));
 	rd_write_file(fd, &cellhdr, sizeof(CELLHEADER));
 	rd_write_file(fd, data, length);
 
 	return True;
 }
 
-/* List the bitmap keys from the persistent cache file */
+/* List the bitmap keys of the persistent cache, from the index */
 int
 pstcache_enumerate(uint8 id, HASH_KEY * keylist)
 {
-	int fd, n;
-	uint16 idx;
-	sint16 mru_idx[0xa00];
-	uint32 mru_stamp[0xa00];
-	CELLHEADER cellhdr;
+	CELLHEADER *cells;
+	int idx;
 
 	if (!(g_bitmap_cache && g_bitmap_cache_persist_enable && IS_PERSISTENT(id)))
 		return 0;
@@ -120,43 +156,126 @@ pstcache_enumerate(uint8 id, HASH_KEY * keylist)
 	if (g_pstcache_enumerated)
 		return 0;
 
-	logger(Core, Debug, "pstcache_enumerate(), start enumeration");
+	cells = g_pstcache_index[id]->cells;
 	for (idx = 0; idx < BMPCACHE2_NUM_PSTCELLS; idx++)
 	{
-		fd = g_pstcache_fd[id];
-		rd_lseek_file(fd, idx * (g_pstcache_Bpp * MAX_CELL_SIZE + sizeof(CELLHEADER)));
-		if (rd_read_file(fd, &cellhdr, sizeof(CELLHEADER)) <= 0)
+		if (memcmp(cells[idx].key, zero_key, sizeof(HASH_KEY)) == 0)
 			break;
 
-		if (memcmp(cellhdr.key, zero_key, sizeof(HASH_KEY)) != 0)
-		{
-			memcpy(keylist[idx], cellhdr.key, sizeof(HASH_KEY));
+		memcpy(keylist[idx], cells[idx].key, sizeof(HASH_KEY));
+	}
+
+	logger(Core, Debug, "pstcache_enumerate(), %d cached bitmaps", idx);
+
+	g_pstcache_num_keys[id] = idx;
+	g_pstcache_enumerated = True;
+	return idx;
+}
+
+/* Load the recently used bitmaps of the enumerated keys into the
+   bitmap cache, and order the cache by when they were last used. This
+   is left until the key list is on its way to the server. */
+void
+pstcache_precache(uint8 id)
+{
+	CELLHEADER *cells;
+	int idx, n, count;
+	sint16 mru_idx[BMPCACHE2_NUM_PSTCELLS];
+	uint32 mru_stamp[BMPCACHE2_NUM_PSTCELLS];
+
+	if (!IS_PERSISTENT(id) || g_pstcache_num_keys[id] == 0)
+		return;
 
-			/* Pre-cache (not possible for 8-bit colour depth cause it needs a colourmap) */
-			if (g_bitmap_cache_precache && cellhdr.stamp && g_server_depth > 8)
-				pstcache_load_bitmap(id, idx);
+	cells = g_pstcache_index[id]->cells;
+	count = g_pstcache_num_keys[id];
+	g_pstcache_num_keys[id] = 0;
 
-			/* Sort by stamp */
-			for (n = idx; n > 0 && cellhdr.stamp < mru_stamp[n - 1]; n--)
-			{
-				mru_idx[n] = mru_idx[n - 1];
-				mru_stamp[n] = mru_stamp[n - 1];
-			}
+	for (idx = 0; idx < count; idx++)
+	{
+		/* Pre-cache (not possible for 8-bit colour depth cause it needs a colourmap) */
+		if (g_bitmap_cache_precache && cells[idx].stamp && g_server_depth > 8)
+			pstcache_load_bitmap(id, idx);
 
-			mru_idx[n] = idx;
-			mru_stamp[n] = cellhdr.stamp;
+		/* Sort by stamp */
+		for (n = idx; n > 0 && cells[idx].stamp < mru_stamp[n - 1]; n--)
+		{
+			mru_idx[n] = mru_idx[n - 1];
+			mru_stamp[n] = mru_stamp[n - 1];
 		}
-		else
+
+		mru_idx[n] = idx;
+		mru_stamp[n] = cells[idx].stamp;
+	}
+
+	cache_rebuild_bmpcache_linked_list(id, mru_idx, count);
+}
+
+/* Fill the index of a cache, from the index file if it is clean or
+   else from the cells of the cache file */
+static void
+pstcache_load_index(uint8 id)
+{
+	PSTCACHE_INDEX *index;
+	char filename[256];
+	uint32 magic = 0;
+	int fd, idx;
+
+	/* Already loaded for an earlier capability exchange */
+	if (g_pstcache_index_fd[id] > 0)
+		return;
+
+	if (g_pstcache_index[id] == NULL)
+		g_pstcache_index[id] = (PSTCACHE_INDEX *) xmalloc(sizeof(PSTCACHE_INDEX));
+	index = g_pstcache_index[id];
+
+	sprintf(filename, "cache/pstcache_%d_%d.idx", id, g_pstcache_Bpp);
+	fd = rd_open_file(filename);
+	g_pstcache_index_fd[id] = fd;
+
+	if (fd != -1 && rd_read_file(fd, index, sizeof(PSTCACHE_INDEX)) == (int) sizeof(PSTCACHE_INDEX)
+	    && index->magic == PSTCACHE_INDEX_MAGIC)
+	{
+		logger(Core, Debug, "pstcache_load_index(), using index file %s", filename);
+
+		/* Stale from here on, until written back */
+		rd_lseek_file(fd, 0);
+		rd_write_file(fd, &magic, sizeof(magic));
+		return;
+	}
+
+	logger(Core, Debug, "pstcache_load_index(), reading cell headers of cache %d", id);
+	memset(index, 0, sizeof(PSTCACHE_INDEX));
+	for (idx = 0; idx < BMPCACHE2_NUM_PSTCELLS; idx++)
+	{
+		rd_lseek_file(g_pstcache_fd[id], idx * CELL_SIZE(id));
+		if (rd_read_file(g_pstcache_fd[id], &index->cells[idx], sizeof(CELLHEADER)) !=
+		    (int) sizeof(CELLHEADER))
 		{
+			memset(&index->cells[idx], 0, sizeof(CELLHEADER));
 			break;
 		}
 	}
+}
 
-	logger(Core, Debug, "pstcache_enumerate(), %d cached bitmaps", idx);
+/* Write the indexes back, on exit */
+void
+pstcache_save_index(void)
+{
+	int id, fd;
 
-	cache_rebuild_bmpcache_linked_list(id, mru_idx, idx);
-	g_pstcache_enumerated = True;
-	return idx;
+	for (id = 0; id < 8; id++)
+	{
+		fd = g_pstcache_index_fd[id];
+		if (!IS_PERSISTENT(id) || fd <= 0)
+			continue;
+
+		g_pstcache_index[id]->magic = PSTCACHE_INDEX_MAGIC;
+		rd_lseek_file(fd, 0);
+		if (rd_write_file(fd, g_pstcache_index[id], sizeof(PSTCACHE_INDEX)) !=
+		    (int) sizeof(PSTCACHE_INDEX))
+			logger(Core, Warning, "pstcache_save_index(), failed to write index of cache %d",
+			       id);
+	}
 }
 
 /* initialise the persistent bitmap cache */
@@ -198,5 +317,6 @@ pstcache_init(uint8 cache_id)
 	}
 
 	g_pstcache_fd[cache_id] = fd;
+	pstcache_load_index(cache_id);
 	return True;
 }
@@ -51,7 +51,11 @@
 
 /* Reconnect timeout based on approximated cookie life-time */
 #define RECONNECT_TIMEOUT (3600+600)
+/* Delay between reconnect attempts, doubled after each failure */
+#define RECONNECT_BACKOFF_MIN 500	/* ms */
+#define RECONNECT_BACKOFF_MAX 8000	/* ms */
 #define RDESKTOP_LICENSE_STORE "/.local/share/rdesktop/licenses"
+#define RDESKTOP_TLS_SESSION_STORE "/.local/share/rdesktop/tls-sessions"
 
 uint8 g_static_rdesktop_salt_16[16] = {
 	0xb8, 0x82, 0x29, 0x31, 0xc5, 0x39, 0xd9, 0x44,
@@ -114,11 +118,16 @@ RD_BOOL g_use_password_as_pin = False;
 char g_seamless_shell[512];
 char g_seamless_spawn_cmd[512];
 char g_tls_version[4];
+RD_BOOL g_tls_session_persist = False;
+RD_BOOL g_timing_report = False;
+RD_BOOL g_nscodec = False;	/* offer NSCodec in the bitmap codecs capability set */
+RD_BOOL g_rdpgfx = False;	/* offer the graphics pipeline in 32 bpp sessions */
 RD_BOOL g_seamless_persistent_mode = True;
 RD_BOOL g_user_quit = False;
 uint32 g_embed_wnd;
 uint32 g_rdp5_performanceflags = (PERF_DISABLE_FULLWINDOWDRAG |
 				  PERF_DISABLE_MENUANIMATIONS | PERF_ENABLE_FONT_SMOOTHING);
+RD_BOOL g_network_autodetect = False;	/* performance flags from measured link */
 /* Session Directory redirection */
 RD_BOOL g_redirect = False;
 char *g_redirect_server;
@@ -185,6 +194,8 @@ usage(char *program)
 	fprintf(stderr, "   -L: local codepage\n");
 	fprintf(stderr, "   -A: path to SeamlessRDP shell, this enables SeamlessRDP mode\n");
 	fprintf(stderr, "   -V: tls version (1.0, 1.1, 1.2, defaults to 1.0)\n");
+	fprintf(stderr, "   -y: store TLS sessions on disk for faster connects\n");
+	fprintf(stderr, "   -j: print connection phase timing to stdout\n");
 	fprintf(stderr, "   -B: use BackingStore of X-server (if available)\n");
 	fprintf(stderr, "   -e: disable encryption (French TS)\n");
 	fprintf(stderr, "   -E: disable encryption from client to server\n");
@@ -200,7 +211,8 @@ usage(char *program)
 	fprintf(stderr, "   -X: embed into another window with a given id.\n");
 	fprintf(stderr, "   -a: connection colour depth\n");
 	fprintf(stderr, "   -z: enable rdp compression\n");
-	fprintf(stderr, "   -x: RDP5 experience (m[odem 28.8], b[roadband], l[an] or hex nr.)\n");
+	fprintf(stderr,
+		"   -x: RDP5 experience (m[odem 28.8], b[roadband], l[an], auto or hex nr.)\n");
 	fprintf(stderr, "   -P: use persistent bitmap caching\n");
 	fprintf(stderr, "   -r: enable specified device redirection (this flag can be repeated)\n");
 	fprintf(stderr,
@@ -249,8 +261,15 @@ usage(char *program)
 	fprintf(stderr, "   -0: attach to console\n");
 	fprintf(stderr, "   -4: use RDP version 4\n");
 	fprintf(stderr, "   -5: use RDP version 5 (default)\n");
-#ifdef WITH_SCARD
 	fprintf(stderr, "   -o: name=value: Adds an additional option to rdesktop.\n");
+	fprintf(stderr,
+		"           nscodec            on: offer NSCodec for 32 bpp bitmaps instead of\n");
+	fprintf(stderr,
+		"                              relying on planar bitmap updates (default off)\n");
+	fprintf(stderr,
+		"           gfx                on: use the graphics pipeline in 32 bpp sessions\n");
+	fprintf(stderr, "                              (default off)\n");
+#ifdef WITH_SCARD
 	fprintf(stderr,
 		"           sc-csp-name        Specifies the Crypto Service Provider name which\n");
 	fprintf(stderr,
@@ -490,12 +509,36 @@ handle_disconnect_reason(RD_BOOL deactivated, uint16 reason)
 	return retval;
 }
 
+/* Wait before the next reconnect attempt. The delay is jittered so that
+   clients dropped by the same outage do not retry in lockstep, and the
+   wait ends early when the network monitor sees a link or route coming
+   back. */
+static void
+reconnect_wait(uint32 * backoff)
+{
+	uint32 delay;
+
+	delay = *backoff / 2 + rand() % (*backoff / 2 + 1);
+	logger(Core, Debug, "reconnect_wait(), next attempt in %u ms", delay);
+
+	if (netmon_wait(delay))
+	{
+		logger(Core, Verbose, "Network change detected, reconnecting");
+		*backoff = RECONNECT_BACKOFF_MIN;
+		return;
+	}
+
+	*backoff = MIN(*backoff * 2, RECONNECT_BACKOFF_MAX);
+}
+
 static void
 rdesktop_reset_state(void)
 {
 	g_pending_resize_defer = True;
 
 	rdp_reset_state();
+	autodetect_reset_state();
+	ui_reset_state();
 #ifdef WITH_SCARD
 	scard_reset_state();
 #endif
@@ -783,6 +826,9 @@ main(int argc, char *argv[])
 	char *locale = NULL;
 	int username_option = 0;
 	RD_BOOL geometry_option = False;
+	uint32 reconnect_backoff = RECONNECT_BACKOFF_MIN;
+	int reconnect_attempts = 0;
+	struct timeval reconnect_start, now;
 #ifdef WITH_RDPSND
 	char *rdpsnd_optarg = NULL;
 #endif
@@ -818,7 +864,7 @@ main(int argc, char *argv[])
 	g_num_devices = 0;
 
 	while ((c = getopt(argc, argv,
-			   "A:V:u:L:d:s:c:p:n:k:g:o:fbBeEitmMzCDKS:T:NX:a:x:Pr:045vh?")) != -1)
+			   "A:V:u:L:d:s:c:p:n:k:g:o:fbBeEitmMzCDKS:T:NX:a:x:Pr:045vyjh?")) != -1)
 	{
 		switch (c)
 		{
@@ -979,7 +1025,11 @@ main(int argc, char *argv[])
 				break;
 
 			case 'x':
-				if (str_startswith(optarg, "m"))	/* modem */
+				if (str_startswith(optarg, "auto"))	/* measured by server */
+				{
+					g_network_autodetect = True;
+				}
+				else if (str_startswith(optarg, "m"))	/* modem */
 				{
 					g_rdp5_performanceflags = (PERF_DISABLE_CURSOR_SHADOW |
 								   PERF_DISABLE_WALLPAPER |
@@ -1124,7 +1174,6 @@ main(int argc, char *argv[])
 			case '5':
 				g_rdp_version = RDP_V5;
 				break;
-#if WITH_SCARD
 			case 'o':
 				{
 					char *p = strchr(optarg, '=');
@@ -1136,8 +1185,13 @@ main(int argc, char *argv[])
 						continue;
 					}
 
-					if (strncmp(optarg, "sc-csp-name", strlen("sc-scp-name")) ==
-					    0)
+					if (strncmp(optarg, "nscodec=", strlen("nscodec=")) == 0)
+						g_nscodec = (strcmp(p + 1, "on") == 0);
+					else if (strncmp(optarg, "gfx=", strlen("gfx=")) == 0)
+						g_rdpgfx = (strcmp(p + 1, "on") == 0);
+#if WITH_SCARD
+					else if (strncmp(optarg, "sc-csp-name", strlen("sc-scp-name"))
+						 == 0)
 						g_sc_csp_name = strdup(p + 1);
 					else if (strncmp
 						 (optarg, "sc-reader-name",
@@ -1151,13 +1205,19 @@ main(int argc, char *argv[])
 						 (optarg, "sc-container-name",
 						  strlen("sc-container-name")) == 0)
 						g_sc_container_name = strdup(p + 1);
+#endif
 
 				}
 				break;
-#endif
 			case 'v':
 				logger_set_verbose(1);
 				break;
+			case 'y':
+				g_tls_session_persist = True;
+				break;
+			case 'j':
+				g_timing_report = True;
+				break;
 			case 'h':
 			case '?':
 			default:
@@ -1338,10 +1398,12 @@ main(int argc, char *argv[])
 
 	dvc_init();
 	rdpedisp_init();
+	rdpgfx_init();
 
 	setup_user_requested_session_size();
 
 	g_reconnect_loop = False;
+	timerclear(&reconnect_start);
 	while (1)
 	{
 		rdesktop_reset_state();
@@ -1367,6 +1429,7 @@ main(int argc, char *argv[])
 		utils_apply_session_size_limitations(&g_requested_session_width,
 						     &g_requested_session_height);
 
+		reconnect_attempts++;
 		if (!rdp_connect
 		    (server, flags, domain, g_password, shell, directory, g_reconnect_loop))
 		{
@@ -1382,10 +1445,11 @@ main(int argc, char *argv[])
 				logger(Core, Notice,
 				       "Tried to reconnect for %d minutes, giving up.",
 				       RECONNECT_TIMEOUT / 60);
+				netmon_close();
 				return EX_PROTOCOL;
 			}
 
-			sleep(4);
+			reconnect_wait(&reconnect_backoff);
 			continue;
 		}
 
@@ -1395,6 +1459,18 @@ main(int argc, char *argv[])
 			continue;
 		}
 
+		if (timerisset(&reconnect_start))
+		{
+			gettimeofday(&now, NULL);
+			timersub(&now, &reconnect_start, &now);
+			logger(Core, Notice, "Reconnected after %ld.%03ld seconds and %d attempts.",
+			       (long) now.tv_sec, (long) now.tv_usec / 1000, reconnect_attempts);
+			timerclear(&reconnect_start);
+			netmon_close();
+		}
+		reconnect_backoff = RECONNECT_BACKOFF_MIN;
+		reconnect_attempts = 0;
+
 		/* By setting encryption to False here, we have an encrypted login
 		   packet but unencrypted transfer of other packets */
 		if (!g_packet_encryption)
@@ -1463,6 +1539,10 @@ main(int argc, char *argv[])
 				       RECONNECT_TIMEOUT / 60);
 				g_network_error = False;
 				g_reconnect_loop = True;
+
+				gettimeofday(&reconnect_start, NULL);
+				srand(reconnect_start.tv_sec ^ reconnect_start.tv_usec ^ getpid());
+				netmon_open();
 			}
 			else if (g_pending_resize)
 			{
@@ -1910,35 +1990,30 @@ l_to_a(long N, int base)
 	return ret;
 }
 
-int
-load_licence(unsigned char **data)
+/* Build the path of a file in one of the stores in the home directory */
+static RD_BOOL
+rd_store_path(const char *store, const char *name, char *path, size_t size)
 {
-	uint8 ho[20], hi[16];
-	char *home, path[PATH_MAX], hash[41];
-	struct stat st;
-	int fd, length;
+	char *home;
 
 	home = getenv("HOME");
 	if (home == NULL)
-		return -1;
+		return False;
 
-	memset(hi, 0, sizeof(hi));
-	snprintf((char *) hi, 16, "%s", g_hostname);
-	sec_hash_sha1_16(ho, hi, g_static_rdesktop_salt_16);
-	sec_hash_to_string(hash, sizeof(hash), ho, sizeof(ho));
+	snprintf(path, size, "%s%s/%s", home, store, name);
+	path[size - 1] = '\0';
+	return True;
+}
 
-	snprintf(path, PATH_MAX, "%s" RDESKTOP_LICENSE_STORE "/%s.cal", home, hash);
-	path[sizeof(path) - 1] = '\0';
+/* Read a whole file, the data is allocated for the caller on success */
+static int
+rd_load_blob(const char *path, unsigned char **data)
+{
+	struct stat st;
+	int fd, length;
 
-	fd = open(path, O_RDONLY);
-	if (fd == -1)
-	{
-		/* fallback to try reading old license file */
-		snprintf(path, PATH_MAX, "%s/.rdesktop/license.%s", home, g_hostname);
-		path[sizeof(path) - 1] = '\0';
-		if ((fd = open(path, O_RDONLY)) == -1)
-			return -1;
-	}
+	if ((fd = open(path, O_RDONLY)) == -1)
+		return -1;
 
 	if (fstat(fd, &st))
 	{
@@ -1949,62 +2024,142 @@ load_licence(unsigned char **data)
 	*data = (uint8 *) xmalloc(st.st_size);
 	length = read(fd, *data, st.st_size);
 	close(fd);
+
+	if (length <= 0)
+		xfree(*data);
 	return length;
 }
 
-void
-save_licence(unsigned char *data, int length)
+/* Write a file to one of the stores in the home directory. It is
+   written to {name}.new and atomically renamed, and only the user may
+   read it, as licences and TLS sessions are secrets. */
+static void
+rd_save_blob(const char *store, const char *name, unsigned char *data, int length)
 {
-	uint8 ho[20], hi[16];
-	char *home, path[PATH_MAX], tmppath[PATH_MAX], hash[41];
+	char *home, path[PATH_MAX], tmppath[PATH_MAX];
 	int fd;
 
 	home = getenv("HOME");
 	if (home == NULL)
 		return;
 
-	snprintf(path, PATH_MAX, "%s" RDESKTOP_LICENSE_STORE, home);
+	snprintf(path, PATH_MAX, "%s%s", home, store);
 	path[sizeof(path) - 1] = '\0';
 	if (utils_mkdir_p(path, 0700) == -1)
 	{
-		logger(Core, Error, "save_license(), utils_mkdir_p() failed: %s", strerror(errno));
+		logger(Core, Error, "rd_save_blob(), utils_mkdir_p() failed: %s", strerror(errno));
 		return;
 	}
 
-	memset(hi, 0, sizeof(hi));
-	snprintf((char *) hi, 16, "%s", g_hostname);
-	sec_hash_sha1_16(ho, hi, g_static_rdesktop_salt_16);
-	sec_hash_to_string(hash, sizeof(hash), ho, sizeof(ho));
-
-	/* write licence to {sha1}.cal.new, then atomically
-	   rename to {sha1}.cal */
-	snprintf(path, PATH_MAX, "%s" RDESKTOP_LICENSE_STORE "/%s.cal", home, hash);
-	path[sizeof(path) - 1] = '\0';
+	if (!rd_store_path(store, name, path, sizeof(path)))
+		return;
 
 	snprintf(tmppath, PATH_MAX, "%s.new", path);
-	path[sizeof(path) - 1] = '\0';
+	tmppath[sizeof(tmppath) - 1] = '\0';
 
 	fd = open(tmppath, O_WRONLY | O_CREAT | O_TRUNC, 0600);
 	if (fd == -1)
 	{
-		logger(Core, Error, "save_license(), open() failed: %s", strerror(errno));
+		logger(Core, Error, "rd_save_blob(), open() failed: %s", strerror(errno));
 		return;
 	}
 
 	if (write(fd, data, length) != length)
 	{
-		logger(Core, Error, "save_license(), write() failed: %s", strerror(errno));
+		logger(Core, Error, "rd_save_blob(), write() failed: %s", strerror(errno));
 		unlink(tmppath);
 	}
 	else if (rename(tmppath, path) == -1)
 	{
-		logger(Core, Error, "save_license(), rename() failed: %s", strerror(errno));
+		logger(Core, Error, "rd_save_blob(), rename() failed: %s", strerror(errno));
 		unlink(tmppath);
 	}
 
 	close(fd);
 }
 
+/* The licence file is named by a salted hash of the client hostname */
+static void
+licence_file_name(char *name, size_t size)
+{
+	uint8 ho[20], hi[16];
+	char hash[41];
+
+	memset(hi, 0, sizeof(hi));
+	snprintf((char *) hi, 16, "%s", g_hostname);
+	sec_hash_sha1_16(ho, hi, g_static_rdesktop_salt_16);
+	sec_hash_to_string(hash, sizeof(hash), ho, sizeof(ho));
+
+	snprintf(name, size, "%s.cal", hash);
+}
+
+int
+load_licence(unsigned char **data)
+{
+	char *home, name[64], path[PATH_MAX];
+	int length;
+
+	home = getenv("HOME");
+	if (home == NULL)
+		return -1;
+
+	licence_file_name(name, sizeof(name));
+	if (rd_store_path(RDESKTOP_LICENSE_STORE, name, path, sizeof(path))
+	    && (length = rd_load_blob(path, data)) != -1)
+		return length;
+
+	/* fallback to try reading old license file */
+	snprintf(path, PATH_MAX, "%s/.rdesktop/license.%s", home, g_hostname);
+	path[sizeof(path) - 1] = '\0';
+	return rd_load_blob(path, data);
+}
+
+void
+save_licence(unsigned char *data, int length)
+{
+	char name[64];
+
+	licence_file_name(name, sizeof(name));
+	rd_save_blob(RDESKTOP_LICENSE_STORE, name, data, length);
+}
+
+/* The TLS session file is named by a hash of the session key */
+static void
+tls_session_file_name(const char *key, char *name, size_t size)
+{
+	RDSSL_SHA1 sha1;
+	uint8 ho[20];
+	char hash[41];
+
+	rdssl_sha1_init(&sha1);
+	rdssl_sha1_update(&sha1, (uint8 *) key, strlen(key));
+	rdssl_sha1_final(&sha1, ho);
+	sec_hash_to_string(hash, sizeof(hash), ho, sizeof(ho));
+
+	snprintf(name, size, "%s.der", hash);
+}
+
+int
+load_tls_session(const char *key, unsigned char **data)
+{
+	char name[64], path[PATH_MAX];
+
+	tls_session_file_name(key, name, sizeof(name));
+	if (!rd_store_path(RDESKTOP_TLS_SESSION_STORE, name, path, sizeof(path)))
+		return -1;
+
+	return rd_load_blob(path, data);
+}
+
+void
+save_tls_session(const char *key, unsigned char *data, int length)
+{
+	char name[64];
+
+	tls_session_file_name(key, name, sizeof(name));
+	rd_save_blob(RDESKTOP_TLS_SESSION_STORE, name, data, length);
+}
+
 /* create rdesktop ui */
 void
 rd_create_ui()
@@ -87,12 +87,18 @@ extern RD_BOOL g_has_reconnect_random;
 extern uint8 g_client_random[SEC_RANDOM_SIZE];
 static uint32 g_packetno;
 
+/* the server takes frame acknowledgements */
+static RD_BOOL g_frame_acknowledge = False;
+
 extern RD_BOOL g_fullscreen;
 
 /* holds the actual session size reported by server */
 uint16 g_session_width;
 uint16 g_session_height;
 
+/* the glyph support level advertised, which decides the cache glyph revision */
+uint16 g_glyph_support_level = GLYPH_SUPPORT_ENCODE;
+
 static void rdp_out_unistr(STREAM s, char *string, int len);
 
 /* reads a TS_SHARECONTROLHEADER from stream, returns True of there is
@@ -625,6 +631,24 @@ rdp_send_suppress_output_pdu(enum RDP_SUPPRESS_STATUS allowupdates)
 	current_status = allowupdates;
 }
 
+/* Acknowledge a frame that has been presented, lets the server pace
+   its output to what we can keep up with */
+void
+rdp_send_frame_ack(uint32 frame_id)
+{
+	STREAM s;
+
+	if (!g_frame_acknowledge)
+		return;
+
+	logger(Protocol, Debug, "%s(), frame %u", __func__, frame_id);
+
+	s = rdp_init_data(4);
+	out_uint32_le(s, frame_id);	/* frameID */
+	s_mark_end(s);
+	rdp_send_data(s, RDP_DATA_PDU_FRAME_ACKNOWLEDGE);
+}
+
 /* Send persistent bitmap cache enumeration PDUs */
 static void
 rdp_enum_bmpcache2(void)
@@ -747,24 +771,36 @@ rdp_out_ts_order_capabilityset(STREAM s)
 {
 	uint8 order_caps[32];
 	uint16 orderflags = 0;
+	uint16 orderflags_ex = ORDERFLAGS_EX_ALTSEC_FRAME_MARKER_SUPPORT;
 	uint32 cachesize = 0;
 
 	orderflags |= (NEGOTIATEORDERSUPPORT | ZEROBOUNDSDELTASSUPPORT);	/* mandatory flags */
 	orderflags |= COLORINDEXSUPPORT;
+	orderflags |= ORDERFLAGS_EXTRA_FLAGS;
 
 	memset(order_caps, 0, 32);
 
 	order_caps[TS_NEG_DSTBLT_INDEX] = 1;
 	order_caps[TS_NEG_PATBLT_INDEX] = 1;
 	order_caps[TS_NEG_SCRBLT_INDEX] = 1;
+	order_caps[TS_NEG_MULTIDSTBLT_INDEX] = 1;
+	order_caps[TS_NEG_MULTIPATBLT_INDEX] = 1;
+	order_caps[TS_NEG_MULTISCRBLT_INDEX] = 1;
+	order_caps[TS_NEG_MULTIOPAQUERECT_INDEX] = 1;
 	order_caps[TS_NEG_LINETO_INDEX] = 1;
 	order_caps[TS_NEG_MULTI_DRAWNINEGRID_INDEX] = 1;
 	order_caps[TS_NEG_POLYLINE_INDEX] = 1;
 	order_caps[TS_NEG_INDEX_INDEX] = 1;
+	order_caps[TS_NEG_FAST_INDEX_INDEX] = 1;
+	order_caps[TS_NEG_FAST_GLYPH_INDEX] = 1;
 
 	if (g_bitmap_cache)
 		order_caps[TS_NEG_MEMBLT_INDEX] = 1;
 
+	/* Revision 3 bitmaps go to the caches of the revision 2 capability set */
+	if (g_bitmap_cache && g_rdp_version >= RDP_V5)
+		orderflags_ex |= ORDERFLAGS_EX_CACHE_BITMAP_REV3_SUPPORT;
+
 	if (g_desktop_save)
 	{
 		cachesize = 230400;
@@ -791,7 +827,7 @@ rdp_out_ts_order_capabilityset(STREAM s)
 	out_uint16_le(s, orderflags);	/* orderFlags */
 	out_uint8p(s, order_caps, 32);	/* orderSupport */
 	out_uint16_le(s, 0);	/* textFlags (ignored) */
-	out_uint16_le(s, 0);	/* orderSupportExFlags */
+	out_uint16_le(s, orderflags_ex);	/* orderSupportExFlags */
 	out_uint32_le(s, 0);	/* pad4OctetsB */
 	out_uint32_le(s, cachesize);	/* desktopSaveSize */
 	out_uint16_le(s, 0);	/* pad2OctetsC */
@@ -830,7 +866,7 @@ rdp_out_bmpcache2_caps(STREAM s)
 
 	out_uint16_le(s, g_bitmap_cache_persist_enable ? 2 : 0);	/* version */
 
-	out_uint16_be(s, 3);	/* number of caches in this set */
+	out_uint16_be(s, BMPCACHE2_NUM_CACHES);	/* number of caches in this set */
 
 	/* max cell size for cache 0 is 16x16, 1 = 32x32, 2 = 64x64, etc */
 	out_uint32_le(s, BMPCACHE2_C0_CELLS);
@@ -843,7 +879,8 @@ rdp_out_bmpcache2_caps(STREAM s)
 	{
 		out_uint32_le(s, BMPCACHE2_C2_CELLS);
 	}
-	out_uint8s(s, 20);	/* other bitmap caches not used */
+	out_uint32_le(s, BMPCACHE2_C3_CELLS);
+	out_uint8s(s, 16);	/* other bitmap caches not used */
 }
 
 /* Output control capability set */
@@ -982,7 +1019,6 @@ rdp_out_ts_cache_definition(STREAM s, uint16 entries, uint16 maxcellsize)
 static void
 rdp_out_ts_glyphcache_capabilityset(STREAM s)
 {
-	uint16 supportlvl = GLYPH_SUPPORT_FULL;
 	uint32 fragcache = 0x01000100;
 	out_uint16_le(s, RDP_CAPSET_GLYPHCACHE);
 	out_uint16_le(s, RDP_CAPLEN_GLYPHCACHE);
@@ -1000,16 +1036,54 @@ rdp_out_ts_glyphcache_capabilityset(STREAM s)
 	rdp_out_ts_cache_definition(s, 64, 2048);
 
 	out_uint32_le(s, fragcache);	/* FragCache */
-	out_uint16_le(s, supportlvl);	/* GlyphSupportLevel */
+	out_uint16_le(s, g_glyph_support_level);	/* GlyphSupportLevel */
 	out_uint16_le(s, 0);	/* pad2octets */
 }
 
+/* Largest reassembled fast-path update we accept. Surface bits
+   covering the whole session don't fit in the default. */
+uint32
+rdp_multifragment_max_size(void)
+{
+	uint32 size = RDESKTOP_FASTPATH_MULTIFRAGMENT_MAX_SIZE;
+
+	if (g_server_depth == 32)
+		size = MAX(size, (uint32) g_session_width * g_session_height * 4);
+
+	return size;
+}
+
 static void
 rdp_out_ts_multifragmentupdate_capabilityset(STREAM s)
 {
 	out_uint16_le(s, RDP_CAPSET_MULTIFRAGMENTUPDATE);
 	out_uint16_le(s, RDP_CAPLEN_MULTIFRAGMENTUPDATE);
-	out_uint32_le(s, RDESKTOP_FASTPATH_MULTIFRAGMENT_MAX_SIZE);	/* MaxRequestSize */
+	out_uint32_le(s, rdp_multifragment_max_size());	/* MaxRequestSize */
+}
+
+/* Output surface commands capability set */
+static void
+rdp_out_ts_surfcmds_capabilityset(STREAM s)
+{
+	uint32 flags = SURFCMDS_FRAME_MARKER;
+
+	/* Surface bits are decoded to 32 bpp */
+	if (g_server_depth == 32)
+		flags |= SURFCMDS_SET_SURFACE_BITS | SURFCMDS_STREAM_SURFACE_BITS;
+
+	out_uint16_le(s, RDP_CAPSET_SURFCMDS);
+	out_uint16_le(s, RDP_CAPLEN_SURFCMDS);
+	out_uint32_le(s, flags);	/* cmdFlags */
+	out_uint32_le(s, 0);	/* reserved */
+}
+
+/* Output frame acknowledge capability set */
+static void
+rdp_out_ts_frame_acknowledge_capabilityset(STREAM s)
+{
+	out_uint16_le(s, RDP_CAPSET_FRAME_ACKNOWLEDGE);
+	out_uint16_le(s, RDP_CAPLEN_FRAME_ACKNOWLEDGE);
+	out_uint32_le(s, RDP_MAX_UNACKNOWLEDGED_FRAMES);	/* maxUnacknowledgedFrameCount */
 }
 
 static void
@@ -1043,10 +1117,14 @@ rdp_send_confirm_active(void)
 		RDP_CAPLEN_SOUND +
 		RDP_CAPLEN_GLYPHCACHE +
 		RDP_CAPLEN_MULTIFRAGMENTUPDATE +
-		RDP_CAPLEN_LARGE_POINTER + 4 /* w2k fix, sessionid */ ;
+		RDP_CAPLEN_LARGE_POINTER +
+		RDP_CAPLEN_SURFCMDS +
+		RDP_CAPLEN_FRAME_ACKNOWLEDGE + 4 /* w2k fix, sessionid */ ;
 
 	logger(Protocol, Debug, "%s()", __func__);
 
+	caplen += surface_codecs_caplen();
+
 	if (g_rdp_version >= RDP_V5)
 	{
 		caplen += RDP_CAPLEN_BMPCACHE2;
@@ -1070,7 +1148,7 @@ rdp_send_confirm_active(void)
 	out_uint16_le(s, caplen);
 
 	out_uint8p(s, RDP_SOURCE, sizeof(RDP_SOURCE));
-	out_uint16_le(s, 16);	/* num_caps */
+	out_uint16_le(s, 19);	/* num_caps */
 	out_uint8s(s, 2);	/* pad */
 
 	rdp_out_ts_general_capabilityset(s);
@@ -1098,6 +1176,9 @@ rdp_send_confirm_active(void)
 	rdp_out_ts_glyphcache_capabilityset(s);
 	rdp_out_ts_multifragmentupdate_capabilityset(s);
 	rdp_out_ts_large_pointer_capabilityset(s);
+	rdp_out_ts_surfcmds_capabilityset(s);
+	surface_out_codecs_capabilityset(s);
+	rdp_out_ts_frame_acknowledge_capabilityset(s);
 
 	s_mark_end(s);
 	sec_send(s, sec_flags);
@@ -1193,6 +1274,8 @@ rdp_process_server_caps(STREAM s, uint16 length)
 	in_uint16_le(s, ncapsets);
 	in_uint8s(s, 2);	/* pad */
 
+	g_frame_acknowledge = False;
+
 	for (n = 0; n < ncapsets; n++)
 	{
 		if (s->p > start + length)
@@ -1212,6 +1295,10 @@ rdp_process_server_caps(STREAM s, uint16 length)
 			case RDP_CAPSET_BITMAP:
 				rdp_process_bitmap_caps(s);
 				break;
+
+			case RDP_CAPSET_FRAME_ACKNOWLEDGE:
+				g_frame_acknowledge = True;
+				break;
 		}
 
 		s->p = next;
@@ -1222,10 +1309,11 @@ rdp_process_server_caps(STREAM s, uint16 length)
 static void
 process_demand_active(STREAM s)
 {
-	uint8 type;
 	uint16 len_src_descriptor, len_combined_caps;
 	struct stream packet = *s;
 
+	timing_start(TIMING_CAPABILITIES);
+
 	/* at this point we need to ensure that we have ui created */
 	rd_create_ui();
 
@@ -1243,15 +1331,14 @@ process_demand_active(STREAM s)
 
 	rdp_process_server_caps(s, len_combined_caps);
 
+	/* None of the finalization PDUs wait on the server's synchronise,
+	   control and font map replies, which the main loop takes as they
+	   come, so send them all in one write */
+	tcp_hold();
 	rdp_send_confirm_active();
 	rdp_send_synchronise();
 	rdp_send_control(RDP_CTL_COOPERATE);
 	rdp_send_control(RDP_CTL_REQUEST_CONTROL);
-	rdp_recv(&type);	/* RDP_PDU_SYNCHRONIZE */
-	rdp_recv(&type);	/* RDP_CTL_COOPERATE */
-	rdp_recv(&type);	/* RDP_CTL_GRANT_CONTROL */
-	rdp_send_input(0, RDP_INPUT_SYNCHRONIZE, 0,
-		       g_numlock_sync ? ui_get_numlock_state(read_keyboard_state()) : 0, 0);
 
 	if (g_rdp_version >= RDP_V5)
 	{
@@ -1264,8 +1351,17 @@ process_demand_active(STREAM s)
 		rdp_send_fonts(2);
 	}
 
-	rdp_recv(&type);	/* RDP_PDU_UNKNOWN 0x28 (Fonts?) */
+	rdp_send_input(0, RDP_INPUT_SYNCHRONIZE, 0,
+		       g_numlock_sync ? ui_get_numlock_state(read_keyboard_state()) : 0, 0);
+	tcp_release();
+
 	reset_order_state();
+
+	/* Load cached bitmaps while the server prepares the first frame */
+	pstcache_precache(2);
+
+	timing_stop(TIMING_CAPABILITIES);
+	timing_start(TIMING_FIRST_FRAME);
 }
 
 /* Process a colour pointer PDU */
@@ -1512,6 +1608,7 @@ process_bitmap_updates(STREAM s)
 	uint16 num_updates;
 	
 	in_uint16_le(s, num_updates);   /* rectangles */
+	timing_stop(TIMING_FIRST_FRAME);
 
 	for (i = 0; i < num_updates; i++)
 	{
@@ -1734,6 +1831,10 @@ process_data_pdu(STREAM s, uint32 * ext_disc_reason)
 			logger(Protocol, Debug, "process_data_pdu(), received Sync PDU");
 			break;
 
+		case RDP_DATA_PDU_FONTMAP:
+			logger(Protocol, Debug, "process_data_pdu(), received Font Map PDU");
+			break;
+
 		case RDP_DATA_PDU_POINTER:
 			process_pointer_pdu(s);
 			break;
@@ -2028,6 +2129,8 @@ rdp_connect(char *server, uint32 flags, char *domain, char *password,
 	RD_BOOL deactivated = False;
 	uint32 ext_disc_reason = 0;
 
+	timing_reset();
+
 	if (!sec_connect(server, g_username, domain, password, reconnect))
 		return False;
 
@@ -26,8 +26,62 @@ extern uint8 *g_next_packet;
 extern RDPCOMP g_mppc_dict;
 
 
+/* Process a fast-path surface commands update */
 static void
-process_ts_fp_update_by_code(STREAM s, uint8 code)
+process_surface_cmds(STREAM s, uint32 length)
+{
+	uint16 type, action;
+	uint32 frame_id;
+	uint8 *end = s->p + length;
+
+	while (s->p + 2 <= end)
+	{
+		in_uint16_le(s, type);	/* cmdType */
+
+		switch (type)
+		{
+			case CMDTYPE_FRAME_MARKER:
+				if (s->p + 6 > end)
+				{
+					logger(Graphics, Warning,
+					       "process_surface_cmds(), frame marker is truncated");
+					return;
+				}
+
+				in_uint16_le(s, action);	/* frameAction */
+				in_uint32_le(s, frame_id);	/* frameId */
+				logger(Graphics, Debug, "process_surface_cmds(), frame %u %s",
+				       frame_id,
+				       action == SURFACECMD_FRAMEACTION_BEGIN ? "begin" : "end");
+
+				if (action == SURFACECMD_FRAMEACTION_BEGIN)
+				{
+					ui_begin_frame();
+				}
+				else
+				{
+					ui_end_frame();
+					rdp_send_frame_ack(frame_id);
+				}
+				break;
+
+			case CMDTYPE_SET_SURFACE_BITS:
+			case CMDTYPE_STREAM_SURFACE_BITS:
+				if (!surface_process_bits(s))
+					return;
+				break;
+
+			default:
+				/* Without a known length the rest can't be parsed */
+				logger(Graphics, Warning,
+				       "process_surface_cmds(), unhandled command type 0x%x", type);
+				return;
+		}
+	}
+}
+
+static void
+process_ts_fp_update_by_code(STREAM s, uint8 code, uint32 length)
 {
 	uint16 count, x, y;
 
@@ -47,6 +101,9 @@ process_ts_fp_update_by_code(STREAM s, uint8 code)
 			break;
 		case FASTPATH_UPDATETYPE_SYNCHRONIZE:
 			break;
+		case FASTPATH_UPDATETYPE_SURFCMDS:
+			process_surface_cmds(s, length);
+			break;
 		case FASTPATH_UPDATETYPE_PTR_NULL:
 			ui_set_null_cursor();
 			break;
@@ -81,11 +138,12 @@ process_ts_fp_updates(STREAM s)
 	uint8 hdr, code, frag, comp, ctype = 0;
 	uint8 *next;
 
-	uint32 roff, rlen;
+	uint32 roff, rlen, size;
 	struct stream *ns = &(g_mppc_dict.ns);
 	struct stream *ts;
 
 	static STREAM assembled[0x0F] = { 0 };
+	static RD_BOOL discard[0x0F] = { 0 };
 
 	ui_begin_update();
 	while (s->p < s->end)
@@ -127,7 +185,7 @@ process_ts_fp_updates(STREAM s)
 
 		if (frag == FASTPATH_FRAGMENT_SINGLE)
 		{
-			process_ts_fp_update_by_code(ts, code);
+			process_ts_fp_update_by_code(ts, code, length);
 		}
 		else		/* Fragmented packet, we must reassemble */
 		{
@@ -143,15 +201,35 @@ process_ts_fp_updates(STREAM s)
 			if (frag == FASTPATH_FRAGMENT_FIRST)
 			{
 				s_reset(assembled[code]);
+				discard[code] = False;
+			}
+
+			/* Drop the rest of an update that grew too large */
+			size = (assembled[code]->p - assembled[code]->data) + length;
+			if (discard[code] || size > rdp_multifragment_max_size())
+			{
+				if (!discard[code])
+					logger(Protocol, Error,
+					       "process_ts_fp_updates(), fragmented update larger than %u bytes",
+					       rdp_multifragment_max_size());
+				discard[code] = True;
+				s->p = next;
+				continue;
 			}
 
+			if (size > assembled[code]->size)
+				s_realloc(assembled[code],
+					  MIN(MAX(size, assembled[code]->size * 2),
+					      rdp_multifragment_max_size()));
+
 			out_uint8p(assembled[code], ts->p, length);
 
 			if (frag == FASTPATH_FRAGMENT_LAST)
 			{
 				s_mark_end(assembled[code]);
 				assembled[code]->p = assembled[code]->data;
-				process_ts_fp_update_by_code(assembled[code], code);
+				process_ts_fp_update_by_code(assembled[code], code,
+							     s_length(assembled[code]));
 			}
 		}
 
@@ -0,0 +1,864 @@
+/* -*- c-basic-offset: 8 -*-
+   rdesktop: A Remote Desktop Protocol client.
+   Graphics Pipeline Extension, [MS-RDPEGFX]
+
+   This program is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "rdesktop.h"
+
+/* With the graphics pipeline the server draws into offscreen surfaces
+   that the client keeps in 32 bpp buffers, some of which are mapped to
+   the output. Commands arrive in frames; the parts of mapped surfaces
+   touched by a frame are painted to the window when it ends, after
+   which the frame is acknowledged. */
+
+#define RDPGFX_CHANNEL_NAME "Microsoft::Windows::RDS::Graphics"
+
+#define RDPGFX_CMDID_WIRETOSURFACE_1		0x0001
+#define RDPGFX_CMDID_WIRETOSURFACE_2		0x0002
+#define RDPGFX_CMDID_DELETEENCODINGCONTEXT	0x0003
+#define RDPGFX_CMDID_SOLIDFILL			0x0004
+#define RDPGFX_CMDID_SURFACETOSURFACE		0x0005
+#define RDPGFX_CMDID_SURFACETOCACHE		0x0006
+#define RDPGFX_CMDID_CACHETOSURFACE		0x0007
+#define RDPGFX_CMDID_EVICTCACHEENTRY		0x0008
+#define RDPGFX_CMDID_CREATESURFACE		0x0009
+#define RDPGFX_CMDID_DELETESURFACE		0x000A
+#define RDPGFX_CMDID_STARTFRAME			0x000B
+#define RDPGFX_CMDID_ENDFRAME			0x000C
+#define RDPGFX_CMDID_FRAMEACKNOWLEDGE		0x000D
+#define RDPGFX_CMDID_RESETGRAPHICS		0x000E
+#define RDPGFX_CMDID_MAPSURFACETOOUTPUT		0x000F
+#define RDPGFX_CMDID_CACHEIMPORTOFFER		0x0010
+#define RDPGFX_CMDID_CACHEIMPORTREPLY		0x0011
+#define RDPGFX_CMDID_CAPSADVERTISE		0x0012
+#define RDPGFX_CMDID_CAPSCONFIRM		0x0013
+
+#define RDPGFX_CAPVERSION_8			0x00080004
+#define RDPGFX_CAPVERSION_81			0x00080105
+
+#define RDPGFX_CAPS_FLAG_AVC420_ENABLED		0x00000010
+
+#define RDPGFX_CODECID_UNCOMPRESSED		0x0000
+#define RDPGFX_CODECID_PLANAR			0x000A
+#define RDPGFX_CODECID_AVC420			0x000B
+
+#define RDPGFX_MAX_CACHE_SLOTS			4096
+#define RDPGFX_MAX_SURFACE_SIZE			8192
+#define RDPGFX_HEADER_LENGTH			8
+
+typedef struct rdpgfx_rect_t
+{
+	int left, top, right, bottom;
+} rdpgfx_rect_t;
+
+typedef struct rdpgfx_surface_t
+{
+	uint16 id;
+	int width, height;
+	uint8 *data;		/* BGRX, top-down */
+	RD_BOOL mapped;
+	int x, y;		/* output origin when mapped */
+	rdpgfx_rect_t dirty;	/* empty if right is 0 */
+	H264_CONTEXT *h264;	/* opened by the first AVC420 bitmap */
+} rdpgfx_surface_t;
+
+typedef struct rdpgfx_cache_entry_t
+{
+	int width, height;
+	uint8 *data;
+} rdpgfx_cache_entry_t;
+
+extern int g_server_depth;
+extern uint16 g_session_width;
+extern uint16 g_session_height;
+extern RD_BOOL g_fullscreen;
+extern RD_BOOL g_dynamic_session_resize;
+extern RD_BOOL g_rdpgfx;
+
+static rdpgfx_surface_t **g_gfx_surfaces = NULL;
+static int g_gfx_surfaces_size;
+
+static rdpgfx_cache_entry_t g_gfx_cache[RDPGFX_MAX_CACHE_SLOTS];
+
+static uint32 g_gfx_frames_decoded;
+
+/* Bulk decompressor, whose history lasts as long as the channel */
+static ZGFX_CONTEXT g_gfx_zgfx;
+
+/* Decoded bitmaps */
+static uint8 *g_gfx_pixels = NULL;
+static uint32 g_gfx_pixels_size;
+
+static void
+rdpgfx_send(uint16 cmd, STREAM body)
+{
+	struct stream s;
+
+	memset(&s, 0, sizeof(s));
+	s_realloc(&s, RDPGFX_HEADER_LENGTH + s_length(body));
+	s_reset(&s);
+
+	/* RDPGFX_HEADER */
+	out_uint16_le(&s, cmd);	/* cmdId */
+	out_uint16_le(&s, 0);	/* flags */
+	out_uint32_le(&s, RDPGFX_HEADER_LENGTH + s_length(body));	/* pduLength */
+	out_stream(&s, body);
+	s_mark_end(&s);
+
+	dvc_send(RDPGFX_CHANNEL_NAME, &s);
+	xfree(s.data);
+}
+
+static void
+rdpgfx_send_caps_advertise(void)
+{
+	struct stream s;
+	uint32 flags = 0;
+
+#ifdef WITH_H264
+	if (h264_available())
+		flags |= RDPGFX_CAPS_FLAG_AVC420_ENABLED;
+#endif
+
+	memset(&s, 0, sizeof(s));
+	s_realloc(&s, 2 + 2 * 12);
+	s_reset(&s);
+
+	out_uint16_le(&s, 2);	/* capsSetCount */
+
+	/* RDPGFX_CAPSET_VERSION8 */
+	out_uint32_le(&s, RDPGFX_CAPVERSION_8);	/* version */
+	out_uint32_le(&s, 4);	/* capsDataLength */
+	out_uint32_le(&s, 0);	/* flags */
+
+	/* RDPGFX_CAPSET_VERSION81 */
+	out_uint32_le(&s, RDPGFX_CAPVERSION_81);	/* version */
+	out_uint32_le(&s, 4);	/* capsDataLength */
+	out_uint32_le(&s, flags);	/* flags */
+	s_mark_end(&s);
+
+	logger(Graphics, Debug, "rdpgfx_send_caps_advertise()");
+	rdpgfx_send(RDPGFX_CMDID_CAPSADVERTISE, &s);
+	xfree(s.data);
+}
+
+static void
+rdpgfx_send_frame_acknowledge(uint32 frame_id)
+{
+	struct stream s;
+
+	memset(&s, 0, sizeof(s));
+	s_realloc(&s, 12);
+	s_reset(&s);
+
+	out_uint32_le(&s, 0);	/* queueDepth, QUEUE_DEPTH_UNAVAILABLE */
+	out_uint32_le(&s, frame_id);	/* frameId */
+	out_uint32_le(&s, g_gfx_frames_decoded);	/* totalFramesDecoded */
+	s_mark_end(&s);
+
+	rdpgfx_send(RDPGFX_CMDID_FRAMEACKNOWLEDGE, &s);
+	xfree(s.data);
+}
+
+static rdpgfx_surface_t *
+rdpgfx_get_surface(uint16 id)
+{
+	if (id >= g_gfx_surfaces_size || g_gfx_surfaces[id] == NULL)
+	{
+		logger(Graphics, Warning, "rdpgfx_get_surface(), no surface %d", id);
+		return NULL;
+	}
+
+	return g_gfx_surfaces[id];
+}
+
+static void
+rdpgfx_delete_surface(uint16 id)
+{
+	if (id >= g_gfx_surfaces_size || g_gfx_surfaces[id] == NULL)
+		return;
+
+#ifdef WITH_H264
+	h264_close(g_gfx_surfaces[id]->h264);
+#endif
+	xfree(g_gfx_surfaces[id]->data);
+	xfree(g_gfx_surfaces[id]);
+	g_gfx_surfaces[id] = NULL;
+}
+
+/* RDPGFX_RECT16, with exclusive right and bottom. Fails unless the
+   rectangle is non-empty and inside the surface. */
+static RD_BOOL
+rdpgfx_in_rect(STREAM s, rdpgfx_surface_t * surface, rdpgfx_rect_t * rect)
+{
+	uint16 left, top, right, bottom;
+
+	in_uint16_le(s, left);
+	in_uint16_le(s, top);
+	in_uint16_le(s, right);
+	in_uint16_le(s, bottom);
+
+	if (left >= right || top >= bottom || right > surface->width ||
+	    bottom > surface->height)
+		return False;
+
+	rect->left = left;
+	rect->top = top;
+	rect->right = right;
+	rect->bottom = bottom;
+	return True;
+}
+
+/* Mark an area of a surface to be painted at the end of the frame */
+static void
+rdpgfx_invalidate(rdpgfx_surface_t * surface, int left, int top, int right, int bottom)
+{
+	rdpgfx_rect_t *dirty = &surface->dirty;
+
+	if (!surface->mapped)
+		return;
+
+	if (dirty->right == 0)
+	{
+		dirty->left = left;
+		dirty->top = top;
+		dirty->right = right;
+		dirty->bottom = bottom;
+		return;
+	}
+
+	dirty->left = MIN(dirty->left, left);
+	dirty->top = MIN(dirty->top, top);
+	dirty->right = MAX(dirty->right, right);
+	dirty->bottom = MAX(dirty->bottom, bottom);
+}
+
+/* Copy a width x height block between buffers of src_width and
+   dst_width pixels per line. Overlapping blocks in the same buffer are
+   handled by going bottom to top when moving down. */
+static void
+rdpgfx_copy(uint8 * dst, int dst_width, uint8 * src, int src_width, int width, int height)
+{
+	int y;
+
+	if (dst > src)
+	{
+		for (y = height - 1; y >= 0; y--)
+			memmove(dst + y * dst_width * 4, src + y * src_width * 4, width * 4);
+	}
+	else
+	{
+		for (y = 0; y < height; y++)
+			memmove(dst + y * dst_width * 4, src + y * src_width * 4, width * 4);
+	}
+}
+
+static uint8 *
+rdpgfx_pixels(rdpgfx_surface_t * surface, int x, int y)
+{
+	return surface->data + (y * surface->width + x) * 4;
+}
+
+static uint8 *
+rdpgfx_scratch(uint32 size)
+{
+	if (size > g_gfx_pixels_size)
+	{
+		g_gfx_pixels = (uint8 *) xrealloc(g_gfx_pixels, size);
+		g_gfx_pixels_size = size;
+	}
+	return g_gfx_pixels;
+}
+
+/* Paint the dirty parts of all mapped surfaces */
+static void
+rdpgfx_paint(void)
+{
+	rdpgfx_surface_t *surface;
+	rdpgfx_rect_t *dirty;
+	int i, width, height;
+	uint8 *pixels;
+
+	for (i = 0; i < g_gfx_surfaces_size; i++)
+	{
+		surface = g_gfx_surfaces[i];
+		if (surface == NULL || surface->dirty.right == 0)
+			continue;
+
+		dirty = &surface->dirty;
+		width = dirty->right - dirty->left;
+		height = dirty->bottom - dirty->top;
+
+		/* ui_paint_bitmap() takes whole bitmaps only */
+		pixels = rdpgfx_scratch(width * height * 4);
+		rdpgfx_copy(pixels, width, rdpgfx_pixels(surface, dirty->left, dirty->top),
+			    surface->width, width, height);
+		ui_paint_bitmap(surface->x + dirty->left, surface->y + dirty->top, width, height,
+				width, height, pixels);
+
+		dirty->right = 0;
+	}
+}
+
+static RD_BOOL
+rdpgfx_process_caps_confirm(STREAM s)
+{
+	uint32 version, flags;
+
+	if (!s_check_rem(s, 12))
+		return False;
+
+	in_uint32_le(s, version);	/* version */
+	in_uint8s(s, 4);	/* capsDataLength */
+	in_uint32_le(s, flags);	/* flags */
+
+	logger(Graphics, Debug, "rdpgfx_process_caps_confirm(), version 0x%x, flags 0x%x",
+	       version, flags);
+	return True;
+}
+
+static RD_BOOL
+rdpgfx_process_reset_graphics(STREAM s)
+{
+	uint32 width, height;
+	int i;
+
+	if (!s_check_rem(s, 8))
+		return False;
+
+	in_uint32_le(s, width);	/* width */
+	in_uint32_le(s, height);	/* height */
+
+	logger(Graphics, Debug, "rdpgfx_process_reset_graphics(), %dx%d", width, height);
+
+	for (i = 0; i < g_gfx_surfaces_size; i++)
+		rdpgfx_delete_surface(i);
+
+	if (width != g_session_width || height != g_session_height)
+	{
+		g_session_width = width;
+		g_session_height = height;
+
+		if (!g_fullscreen && g_dynamic_session_resize)
+			ui_resize_window(width, height);
+	}
+
+	return True;
+}
+
+static RD_BOOL
+rdpgfx_process_create_surface(STREAM s)
+{
+	uint16 id, width, height;
+	rdpgfx_surface_t *surface;
+
+	if (!s_check_rem(s, 7))
+		return False;
+
+	in_uint16_le(s, id);	/* surfaceId */
+	in_uint16_le(s, width);	/* width */
+	in_uint16_le(s, height);	/* height */
+	in_uint8s(s, 1);	/* pixelFormat */
+
+	logger(Graphics, Debug, "rdpgfx_process_create_surface(), id %d, %dx%d", id, width,
+	       height);
+
+	if (width > RDPGFX_MAX_SURFACE_SIZE || height > RDPGFX_MAX_SURFACE_SIZE)
+	{
+		logger(Graphics, Warning, "rdpgfx_process_create_surface(), surface too large");
+		return True;
+	}
+
+	if (id >= g_gfx_surfaces_size)
+	{
+		g_gfx_surfaces = (rdpgfx_surface_t **) xrealloc(g_gfx_surfaces,
+								(id + 1) *
+								sizeof(rdpgfx_surface_t *));
+		memset(g_gfx_surfaces + g_gfx_surfaces_size, 0,
+		       (id + 1 - g_gfx_surfaces_size) * sizeof(rdpgfx_surface_t *));
+		g_gfx_surfaces_size = id + 1;
+	}
+
+	rdpgfx_delete_surface(id);
+
+	surface = (rdpgfx_surface_t *) xmalloc(sizeof(rdpgfx_surface_t));
+	memset(surface, 0, sizeof(rdpgfx_surface_t));
+	surface->id = id;
+	surface->width = width;
+	surface->height = height;
+	surface->data = (uint8 *) xmalloc(MAX(width * height * 4, 1));
+	memset(surface->data, 0, width * height * 4);
+	g_gfx_surfaces[id] = surface;
+
+	return True;
+}
+
+static RD_BOOL
+rdpgfx_process_delete_surface(STREAM s)
+{
+	uint16 id;
+
+	if (!s_check_rem(s, 2))
+		return False;
+
+	in_uint16_le(s, id);	/* surfaceId */
+
+	rdpgfx_delete_surface(id);
+	return True;
+}
+
+static RD_BOOL
+rdpgfx_process_map_surface_to_output(STREAM s)
+{
+	uint16 id;
+	uint32 x, y;
+	rdpgfx_surface_t *surface;
+
+	if (!s_check_rem(s, 12))
+		return False;
+
+	in_uint16_le(s, id);	/* surfaceId */
+	in_uint8s(s, 2);	/* reserved */
+	in_uint32_le(s, x);	/* outputOriginX */
+	in_uint32_le(s, y);	/* outputOriginY */
+
+
+	surface = rdpgfx_get_surface(id);
+	if (surface == NULL)
+		return True;
+
+	surface->mapped = True;
+	surface->x = x;
+	surface->y = y;
+	return True;
+}
+
+static RD_BOOL
+rdpgfx_process_solid_fill(STREAM s)
+{
+	uint16 id, count;
+	uint8 colour[4];
+	rdpgfx_surface_t *surface;
+	rdpgfx_rect_t rect;
+	uint8 *line;
+	int i, x, y;
+
+	if (!s_check_rem(s, 8))
+		return False;
+
+	in_uint16_le(s, id);	/* surfaceId */
+	in_uint8a(s, colour, 4);	/* fillPixel, B G R XA */
+	in_uint16_le(s, count);	/* fillRectCount */
+
+	if (!s_check_rem(s, count * 8))
+		return False;
+
+	surface = rdpgfx_get_surface(id);
+	if (surface == NULL)
+		return True;
+
+	for (i = 0; i < count; i++)
+	{
+		if (!rdpgfx_in_rect(s, surface, &rect))
+			continue;
+
+		/* Fill the first line, then copy it */
+		line = rdpgfx_pixels(surface, rect.left, rect.top);
+		for (x = 0; x < rect.right - rect.left; x++)
+			memcpy(line + x * 4, colour, 4);
+
+		for (y = rect.top + 1; y < rect.bottom; y++)
+			memcpy(rdpgfx_pixels(surface, rect.left, y), line,
+			       (rect.right - rect.left) * 4);
+
+		rdpgfx_invalidate(surface, rect.left, rect.top, rect.right, rect.bottom);
+	}
+
+	return True;
+}
+
+static RD_BOOL
+rdpgfx_process_surface_to_surface(STREAM s)
+{
+	uint16 src_id, dst_id, count, x, y;
+	rdpgfx_surface_t *src, *dst;
+	rdpgfx_rect_t rect;
+	int i, width, height;
+
+	if (!s_check_rem(s, 14))
+		return False;
+
+	in_uint16_le(s, src_id);	/* surfaceIdSrc */
+	in_uint16_le(s, dst_id);	/* surfaceIdDest */
+
+	src = rdpgfx_get_surface(src_id);
+	dst = rdpgfx_get_surface(dst_id);
+	if (src == NULL || dst == NULL)
+		return True;
+
+	if (!rdpgfx_in_rect(s, src, &rect))
+		return True;
+
+	in_uint16_le(s, count);	/* destPtsCount */
+	if (!s_check_rem(s, count * 4))
+		return False;
+
+	width = rect.right - rect.left;
+	height = rect.bottom - rect.top;
+
+	for (i = 0; i < count; i++)
+	{
+		in_uint16_le(s, x);
+		in_uint16_le(s, y);
+
+		if (x + width > dst->width || y + height > dst->height)
+			continue;
+
+		rdpgfx_copy(rdpgfx_pixels(dst, x, y), dst->width,
+			    rdpgfx_pixels(src, rect.left, rect.top), src->width, width, height);
+		rdpgfx_invalidate(dst, x, y, x + width, y + height);
+	}
+
+	return True;
+}
+
+static RD_BOOL
+rdpgfx_process_surface_to_cache(STREAM s)
+{
+	uint16 id, slot;
+	rdpgfx_surface_t *surface;
+	rdpgfx_cache_entry_t *entry;
+	rdpgfx_rect_t rect;
+
+	if (!s_check_rem(s, 20))
+		return False;
+
+	in_uint16_le(s, id);	/* surfaceId */
+	in_uint8s(s, 8);	/* cacheKey */
+	in_uint16_le(s, slot);	/* cacheSlot */
+
+	surface = rdpgfx_get_surface(id);
+	if (surface == NULL)
+		return True;
+
+	if (!rdpgfx_in_rect(s, surface, &rect) || slot == 0 || slot > RDPGFX_MAX_CACHE_SLOTS)
+		return True;
+
+	entry = &g_gfx_cache[slot - 1];
+	entry->width = rect.right - rect.left;
+	entry->height = rect.bottom - rect.top;
+	entry->data = (uint8 *) xrealloc(entry->data, entry->width * entry->height * 4);
+	rdpgfx_copy(entry->data, entry->width, rdpgfx_pixels(surface, rect.left, rect.top),
+		    surface->width, entry->width, entry->height);
+
+	return True;
+}
+
+static RD_BOOL
+rdpgfx_process_cache_to_surface(STREAM s)
+{
+	uint16 slot, id, count, x, y;
+	rdpgfx_surface_t *surface;
+	rdpgfx_cache_entry_t *entry;
+	int i;
+
+	if (!s_check_rem(s, 6))
+		return False;
+
+	in_uint16_le(s, slot);	/* cacheSlot */
+	in_uint16_le(s, id);	/* surfaceId */
+	in_uint16_le(s, count);	/* destPtsCount */
+
+	if (!s_check_rem(s, count * 4))
+		return False;
+
+	surface = rdpgfx_get_surface(id);
+	if (surface == NULL)
+		return True;
+
+	if (slot == 0 || slot > RDPGFX_MAX_CACHE_SLOTS || g_gfx_cache[slot - 1].data == NULL)
+	{
+		logger(Graphics, Warning, "rdpgfx_process_cache_to_surface(), empty slot %d",
+		       slot);
+		return True;
+	}
+	entry = &g_gfx_cache[slot - 1];
+
+	for (i = 0; i < count; i++)
+	{
+		in_uint16_le(s, x);
+		in_uint16_le(s, y);
+
+		if (x + entry->width > surface->width || y + entry->height > surface->height)
+			continue;
+
+		rdpgfx_copy(rdpgfx_pixels(surface, x, y), surface->width, entry->data,
+			    entry->width, entry->width, entry->height);
+		rdpgfx_invalidate(surface, x, y, x + entry->width, y + entry->height);
+	}
+
+	return True;
+}
+
+static RD_BOOL
+rdpgfx_process_evict_cache_entry(STREAM s)
+{
+	uint16 slot;
+
+	if (!s_check_rem(s, 2))
+		return False;
+
+	in_uint16_le(s, slot);	/* cacheSlot */
+
+	if (slot > 0 && slot <= RDPGFX_MAX_CACHE_SLOTS)
+	{
+		xfree(g_gfx_cache[slot - 1].data);
+		g_gfx_cache[slot - 1].data = NULL;
+	}
+	return True;
+}
+
+static RD_BOOL
+rdpgfx_process_wire_to_surface_1(STREAM s)
+{
+	uint16 id, codec;
+	uint32 length;
+	rdpgfx_surface_t *surface;
+	rdpgfx_rect_t rect;
+	uint8 *data, *pixels;
+	int width, height;
+#ifdef WITH_H264
+	RD_RECT clip;
+#endif
+
+	if (!s_check_rem(s, 17))
+		return False;
+
+	in_uint16_le(s, id);	/* surfaceId */
+	in_uint16_le(s, codec);	/* codecId */
+	in_uint8s(s, 1);	/* pixelFormat */
+
+	surface = rdpgfx_get_surface(id);
+	if (surface == NULL)
+		return True;
+
+	if (!rdpgfx_in_rect(s, surface, &rect))
+		return True;
+
+	in_uint32_le(s, length);	/* bitmapDataLength */
+	if (!s_check_rem(s, length))
+		return False;
+	in_uint8p(s, data, length);
+
+	width = rect.right - rect.left;
+	height = rect.bottom - rect.top;
+
+	switch (codec)
+	{
+		case RDPGFX_CODECID_UNCOMPRESSED:
+			if (length < (uint32) width * height * 4)
+				return False;
+			rdpgfx_copy(rdpgfx_pixels(surface, rect.left, rect.top), surface->width,
+				    data, width, width, height);
+			break;
+
+		case RDPGFX_CODECID_PLANAR:
+			pixels = rdpgfx_scratch(width * height * 4);
+			if (!bitmap_decompress_planar(pixels, width, height, data, length))
+			{
+				logger(Graphics, Warning,
+				       "rdpgfx_process_wire_to_surface_1(), bad planar bitmap");
+				return True;
+			}
+			rdpgfx_copy(rdpgfx_pixels(surface, rect.left, rect.top), surface->width,
+				    pixels, width, width, height);
+			break;
+
+#ifdef WITH_H264
+		case RDPGFX_CODECID_AVC420:
+			if (surface->h264 == NULL)
+				surface->h264 = h264_open();
+			if (surface->h264 == NULL)
+				return True;
+
+			clip.x = rect.left;
+			clip.y = rect.top;
+			clip.cx = width;
+			clip.cy = height;
+			if (!h264_decode_avc420(surface->h264, data, length, surface->data,
+						surface->width, &clip))
+			{
+				logger(Graphics, Warning,
+				       "rdpgfx_process_wire_to_surface_1(), bad AVC420 bitmap");
+				return True;
+			}
+			break;
+#endif
+
+		default:
+			logger(Graphics, Warning,
+			       "rdpgfx_process_wire_to_surface_1(), unsupported codec 0x%x", codec);
+			return True;
+	}
+
+	rdpgfx_invalidate(surface, rect.left, rect.top, rect.right, rect.bottom);
+	return True;
+}
+
+static RD_BOOL
+rdpgfx_process_start_frame(STREAM s)
+{
+	if (!s_check_rem(s, 8))
+		return False;
+
+	in_uint8s(s, 4);	/* timestamp */
+	in_uint8s(s, 4);	/* frameId */
+
+	ui_begin_frame();
+	return True;
+}
+
+static RD_BOOL
+rdpgfx_process_end_frame(STREAM s)
+{
+	uint32 frame_id;
+
+	if (!s_check_rem(s, 4))
+		return False;
+
+	in_uint32_le(s, frame_id);	/* frameId */
+
+	rdpgfx_paint();
+	ui_end_frame();
+
+	g_gfx_frames_decoded++;
+	rdpgfx_send_frame_acknowledge(frame_id);
+	return True;
+}
+
+static RD_BOOL
+rdpgfx_process_cmd(STREAM s, uint16 cmd)
+{
+	switch (cmd)
+	{
+		case RDPGFX_CMDID_WIRETOSURFACE_1:
+			return rdpgfx_process_wire_to_surface_1(s);
+		case RDPGFX_CMDID_SOLIDFILL:
+			return rdpgfx_process_solid_fill(s);
+		case RDPGFX_CMDID_SURFACETOSURFACE:
+			return rdpgfx_process_surface_to_surface(s);
+		case RDPGFX_CMDID_SURFACETOCACHE:
+			return rdpgfx_process_surface_to_cache(s);
+		case RDPGFX_CMDID_CACHETOSURFACE:
+			return rdpgfx_process_cache_to_surface(s);
+		case RDPGFX_CMDID_EVICTCACHEENTRY:
+			return rdpgfx_process_evict_cache_entry(s);
+		case RDPGFX_CMDID_CREATESURFACE:
+			return rdpgfx_process_create_surface(s);
+		case RDPGFX_CMDID_DELETESURFACE:
+			return rdpgfx_process_delete_surface(s);
+		case RDPGFX_CMDID_STARTFRAME:
+			return rdpgfx_process_start_frame(s);
+		case RDPGFX_CMDID_ENDFRAME:
+			return rdpgfx_process_end_frame(s);
+		case RDPGFX_CMDID_RESETGRAPHICS:
+			return rdpgfx_process_reset_graphics(s);
+		case RDPGFX_CMDID_MAPSURFACETOOUTPUT:
+			return rdpgfx_process_map_surface_to_output(s);
+		case RDPGFX_CMDID_CAPSCONFIRM:
+			return rdpgfx_process_caps_confirm(s);
+
+		case RDPGFX_CMDID_DELETEENCODINGCONTEXT:
+		case RDPGFX_CMDID_CACHEIMPORTREPLY:
+			return True;
+
+		default:
+			logger(Graphics, Warning, "rdpgfx_process_cmd(), unhandled command 0x%x",
+			       cmd);
+			return True;
+	}
+}
+
+/* Process the RDPGFX PDUs of one message */
+static void
+rdpgfx_process_pdus(STREAM s)
+{
+	struct stream pdu;
+	uint16 cmd;
+	uint32 length;
+
+	while (s_check_rem(s, RDPGFX_HEADER_LENGTH))
+	{
+		/* RDPGFX_HEADER */
+		in_uint16_le(s, cmd);	/* cmdId */
+		in_uint8s(s, 2);	/* flags */
+		in_uint32_le(s, length);	/* pduLength */
+
+		if (length < RDPGFX_HEADER_LENGTH || !s_check_rem(s, length - RDPGFX_HEADER_LENGTH))
+		{
+			logger(Graphics, Error, "rdpgfx_process_pdus(), bad PDU length %u", length);
+			return;
+		}
+
+		pdu = *s;
+		pdu.end = s->p + length - RDPGFX_HEADER_LENGTH;
+		s->p = pdu.end;
+
+		if (!rdpgfx_process_cmd(&pdu, cmd))
+		{
+			logger(Graphics, Error, "rdpgfx_process_pdus(), command 0x%x parse error",
+			       cmd);
+			return;
+		}
+	}
+}
+
+/* Process a message, wrapped in RDP_SEGMENTED_DATA */
+static void
+rdpgfx_process(STREAM s)
+{
+	struct stream packet;
+	uint8 *data;
+	uint32 size;
+
+	if (!zgfx_decompress(&g_gfx_zgfx, s, &data, &size))
+		return;
+
+	memset(&packet, 0, sizeof(packet));
+	packet.data = packet.p = data;
+	packet.size = size;
+	packet.end = data + size;
+	rdpgfx_process_pdus(&packet);
+}
+
+static void
+rdpgfx_open(void)
+{
+	g_gfx_frames_decoded = 0;
+	zgfx_reset(&g_gfx_zgfx);
+	rdpgfx_send_caps_advertise();
+}
+
+void
+rdpgfx_init(void)
+{
+	if (!g_rdpgfx || g_server_depth != 32)
+		return;
+
+	zgfx_init(&g_gfx_zgfx);
+	dvc_channels_register(RDPGFX_CHANNEL_NAME, rdpgfx_process);
+	dvc_channels_set_open_handler(RDPGFX_CHANNEL_NAME, rdpgfx_open);
+}
@@ -0,0 +1,945 @@
+/* -*- c-basic-offset: 8 -*-
+   rdesktop: A Remote Desktop Protocol client.
+   RemoteFX codec, [MS-RDPRFX]
+
+   This program is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "rdesktop.h"
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+/* A RemoteFX message is a sequence of blocks. Tiles of 64x64 pixels
+   are entropy coded with RLGR, quantized and DWT transformed per
+   YCbCr component. Decoding a tile goes
+
+     RLGR -> differential LL3 -> dequantization -> inverse DWT -> RGB
+
+   and tiles are independent of each other, so the tiles of a tileset
+   are spread over a pool of worker threads. Painting happens on the
+   main thread, once all tiles are decoded. */
+
+#define WBT_SYNC		0xCCC0
+#define WBT_CODEC_VERSIONS	0xCCC1
+#define WBT_CHANNELS		0xCCC2
+#define WBT_CONTEXT		0xCCC3
+#define WBT_FRAME_BEGIN		0xCCC4
+#define WBT_FRAME_END		0xCCC5
+#define WBT_REGION		0xCCC6
+#define WBT_EXTENSION		0xCCC7
+
+#define CBT_REGION		0xCAC1
+#define CBT_TILESET		0xCAC2
+#define CBT_TILE		0xCAC3
+
+#define CBY_CAPS		0xCBC0
+#define CBY_CAPSET		0xCBC1
+#define CLY_CAPSET		0xCFC0
+
+#define CLW_VERSION_1_0		0x0100
+#define CLW_COL_CONV_ICT	0x01
+#define CLW_XFORM_DWT_53_A	0x01
+#define CLW_ENTROPY_RLGR1	0x01
+#define CLW_ENTROPY_RLGR3	0x04
+#define CARDP_CAPS_CAPTURE_NON_CAC	0x00000001
+#define CODEC_MODE		0x02
+
+#define RFX_TILE_SIZE		64
+#define RFX_TILE_PIXELS		(RFX_TILE_SIZE * RFX_TILE_SIZE)
+#define RFX_TILE_BYTES		(RFX_TILE_PIXELS * 4)
+
+/* RLGR adaptation parameters, [MS-RDPRFX] 3.1.8.1.7.1 */
+#define KPMAX	80
+#define LSGR	3
+#define UP_GR	4
+#define DN_GR	6
+#define UQ_GR	3
+#define DQ_GR	3
+
+/* Use the decoder threads for tilesets of at least this many tiles */
+#define RFX_MIN_THREADED_TILES	4
+
+typedef struct rfx_tile_t
+{
+	uint16 x, y;
+	uint8 quant[3];
+	uint8 *data[3];
+	uint16 length[3];
+	uint8 *pixels;
+} rfx_tile_t;
+
+/* Scratch space for decoding one tile */
+typedef struct rfx_work_t
+{
+	sint16 coef[3][RFX_TILE_PIXELS];
+	sint16 dwt[RFX_TILE_PIXELS];
+} rfx_work_t;
+
+typedef struct rfx_bits_t
+{
+	uint8 *p, *end;
+	uint32 acc;
+	int count;
+} rfx_bits_t;
+
+static int g_rfx_entropy = CLW_ENTROPY_RLGR1;
+
+static uint8 g_rfx_quant[256][10];
+static int g_rfx_num_quant;
+
+static RD_RECT *g_rfx_rects = NULL;
+static int g_rfx_num_rects;
+static int g_rfx_rects_size;
+
+static rfx_tile_t *g_rfx_tiles = NULL;
+static int g_rfx_num_tiles;
+static int g_rfx_tiles_size;
+static uint8 *g_rfx_pixels = NULL;
+
+/* Per worker thread */
+static rfx_work_t *g_rfx_work[WORKPOOL_MAX_THREADS + 1];
+
+/* Where rfx_decode() wants the tiles, NULL when painting them */
+static uint8 *g_rfx_output = NULL;
+
+#ifdef __SSE2__
+static RD_BOOL g_rfx_sse2 = True;
+#endif
+
+/* Bit reader, most significant bit first. Reading beyond the data
+   gives zero bits, which makes the RLGR decoder fill the rest of the
+   tile with zeros. */
+static void
+rfx_bits_refill(rfx_bits_t * b)
+{
+	uint32 byte;
+
+	while (b->count <= 24)
+	{
+		byte = (b->p < b->end) ? *b->p++ : 0;
+		b->acc |= byte << (24 - b->count);
+		b->count += 8;
+	}
+}
+
+/* Read up to 24 bits */
+static uint32
+rfx_bits_get(rfx_bits_t * b, int n)
+{
+	uint32 value;
+
+	if (n == 0)
+		return 0;
+
+	if (b->count < n)
+		rfx_bits_refill(b);
+
+	value = b->acc >> (32 - n);
+	b->acc <<= n;
+	b->count -= n;
+	return value;
+}
+
+/* Count and consume a run of one bits, and the zero bit ending it */
+static int
+rfx_bits_ones(rfx_bits_t * b)
+{
+	int n = 0, ones;
+
+	while (1)
+	{
+		rfx_bits_refill(b);
+
+#ifdef __GNUC__
+		ones = (~b->acc == 0) ? 32 : __builtin_clz(~b->acc);
+#else
+		for (ones = 0; ones < 32 && (b->acc & (0x80000000 >> ones)); ones++);
+#endif
+		if (ones < b->count)
+		{
+			b->acc <<= ones;
+			b->acc <<= 1;
+			b->count -= ones + 1;
+			return n + ones;
+		}
+
+		n += b->count;
+		b->acc = 0;
+		b->count = 0;
+	}
+}
+
+#define UPDATE_PARAM(param, delta, k) \
+{ \
+	param += delta; \
+	if (param > KPMAX) \
+		param = KPMAX; \
+	if (param < 0) \
+		param = 0; \
+	k = param >> LSGR; \
+}
+
+/* Read a Golomb-Rice code, adapting its parameter */
+static uint32
+rfx_rlgr_gr_code(rfx_bits_t * b, int *krp, int *kr)
+{
+	int vk;
+	uint32 mag;
+
+	vk = rfx_bits_ones(b);
+	mag = ((uint32) vk << *kr) | rfx_bits_get(b, *kr);
+
+	if (vk == 0)
+		UPDATE_PARAM(*krp, -2, *kr)
+	else if (vk != 1)
+		UPDATE_PARAM(*krp, vk, *kr)
+
+	return mag;
+}
+
+#define INT_FROM_2MAGSIGN(v) (((v) & 1) ? -(sint16) (((v) + 1) >> 1) : (sint16) ((v) >> 1))
+
+/* Decode RLGR1 or RLGR3 entropy coded data, [MS-RDPRFX] 3.1.8.1.7 */
+static void
+rfx_rlgr_decode(int mode, uint8 * data, int length, sint16 * out, int size)
+{
+	rfx_bits_t bits;
+	sint16 *dst = out, *end = out + size;
+	int k, kp, kr, krp, run;
+	uint32 mag, val1, val2, nbits;
+
+	bits.p = data;
+	bits.end = data + length;
+	bits.acc = 0;
+	bits.count = 0;
+
+	k = 1;
+	kp = k << LSGR;
+	kr = 1;
+	krp = kr << LSGR;
+
+	while (dst < end)
+	{
+		if (k)
+		{
+			/* Run length mode, each zero bit is a full run of zeros */
+			while (dst < end && !rfx_bits_get(&bits, 1))
+			{
+				run = MIN(1 << k, end - dst);
+				memset(dst, 0, run * sizeof(sint16));
+				dst += run;
+				UPDATE_PARAM(kp, UP_GR, k);
+			}
+
+			/* followed by a partial run and a nonzero value */
+			run = rfx_bits_get(&bits, k);
+			run = MIN(run, end - dst);
+			memset(dst, 0, run * sizeof(sint16));
+			dst += run;
+
+			val1 = rfx_bits_get(&bits, 1);
+			mag = rfx_rlgr_gr_code(&bits, &krp, &kr) + 1;
+			if (dst < end)
+				*dst++ = val1 ? -(sint16) mag : (sint16) mag;
+			UPDATE_PARAM(kp, -DN_GR, k);
+		}
+		else if (mode == CLW_ENTROPY_RLGR1)
+		{
+			/* Golomb-Rice mode, one value coded as 2 * magnitude - sign */
+			mag = rfx_rlgr_gr_code(&bits, &krp, &kr);
+			*dst++ = INT_FROM_2MAGSIGN(mag);
+			if (mag == 0)
+				UPDATE_PARAM(kp, UQ_GR, k)
+			else
+				UPDATE_PARAM(kp, -DQ_GR, k)
+		}
+		else
+		{
+			/* Golomb-Rice mode, the sum of two values followed by
+			   the first of them */
+			mag = rfx_rlgr_gr_code(&bits, &krp, &kr);
+			for (nbits = 0, val1 = mag; val1; nbits++)
+				val1 >>= 1;
+			val1 = (nbits > 24) ? (rfx_bits_get(&bits, nbits - 24) << 24) |
+				rfx_bits_get(&bits, 24) : rfx_bits_get(&bits, nbits);
+			val2 = mag - val1;
+
+			if (val1 && val2)
+				UPDATE_PARAM(kp, -2 * DQ_GR, k)
+			else if (!val1 && !val2)
+				UPDATE_PARAM(kp, 2 * UQ_GR, k)
+
+			*dst++ = INT_FROM_2MAGSIGN(val1);
+			if (dst < end)
+				*dst++ = INT_FROM_2MAGSIGN(val2);
+		}
+	}
+}
+
+/* Shift each band back up by its quantization factor. The bands are
+   laid out HL1 LH1 HH1 HL2 LH2 HH2 HL3 LH3 HH3 LL3 while the factors
+   come as LL3 LH3 HL3 HH3 LH2 HL2 HH2 LH1 HL1 HH1. */
+static void
+rfx_dequantize(sint16 * coef, uint8 * quant)
+{
+	static const struct
+	{
+		int offset, length, quant;
+	} bands[10] =
+	{
+		{0, 1024, 8}, {1024, 1024, 7}, {2048, 1024, 9},
+		{3072, 256, 5}, {3328, 256, 4}, {3584, 256, 6},
+		{3840, 64, 2}, {3904, 64, 1}, {3968, 64, 3}, {4032, 64, 0}
+	};
+	sint16 *p, *end;
+	int i, shift;
+
+	for (i = 0; i < 10; i++)
+	{
+		shift = quant[bands[i].quant] - 1;
+		if (shift <= 0)
+			continue;
+
+		p = coef + bands[i].offset;
+		end = p + bands[i].length;
+#ifdef __SSE2__
+		if (g_rfx_sse2)
+		{
+			__m128i count = _mm_cvtsi32_si128(shift);
+			for (; p < end; p += 8)
+				_mm_storeu_si128((__m128i *) p,
+						 _mm_sll_epi16(_mm_loadu_si128((__m128i *) p), count));
+			continue;
+		}
+#endif
+		for (; p < end; p++)
+			*p = *p * (1 << shift);
+	}
+}
+
+/* Inverse 5/3 lifting in the horizontal direction, giving the low and
+   high halves of one level, one after the other in idwt */
+static void
+rfx_dwt_horizontal(sint16 * buffer, sint16 * idwt, int width)
+{
+	int bands = width * width;
+	sint16 *hl = buffer, *lh = buffer + bands, *hh = buffer + 2 * bands;
+	sint16 *ll = buffer + 3 * bands;
+	sint16 *l = idwt, *h = idwt + 2 * bands;
+	int y, n;
+
+	for (y = 0; y < width; y++)
+	{
+		/* Even coefficients */
+		l[0] = ll[0] - hl[0];
+		h[0] = lh[0] - hh[0];
+		for (n = 1; n < width; n++)
+		{
+			l[2 * n] = ll[n] - ((hl[n - 1] + hl[n] + 1) >> 1);
+			h[2 * n] = lh[n] - ((hh[n - 1] + hh[n] + 1) >> 1);
+		}
+
+		/* Odd coefficients */
+		for (n = 0; n < width - 1; n++)
+		{
+			l[2 * n + 1] = hl[n] * 2 + ((l[2 * n] + l[2 * n + 2]) >> 1);
+			h[2 * n + 1] = hh[n] * 2 + ((h[2 * n] + h[2 * n + 2]) >> 1);
+		}
+		l[2 * n + 1] = hl[n] * 2 + l[2 * n];
+		h[2 * n + 1] = hh[n] * 2 + h[2 * n];
+
+		hl += width;
+		lh += width;
+		hh += width;
+		ll += width;
+		l += 2 * width;
+		h += 2 * width;
+	}
+}
+
+/* Inverse 5/3 lifting in the vertical direction, back into buffer */
+static void
+rfx_dwt_vertical(sint16 * buffer, sint16 * idwt, int width)
+{
+	int total = width * 2;
+	sint16 *l, *h, *dst;
+	int x, n;
+
+#ifdef __SSE2__
+	if (g_rfx_sse2)
+	{
+		/* Eight columns at a time, with averages that can't overflow */
+		__m128i one = _mm_set1_epi16(1);
+		__m128i lv, hv, hp, e0, e1, avg;
+
+		for (x = 0; x < total; x += 8)
+		{
+			l = idwt + x;
+			h = idwt + x + width * total;
+			dst = buffer + x;
+
+			hv = _mm_loadu_si128((__m128i *) h);
+			e0 = _mm_sub_epi16(_mm_loadu_si128((__m128i *) l), hv);
+			_mm_storeu_si128((__m128i *) dst, e0);
+
+			for (n = 1; n < width; n++)
+			{
+				l += total;
+				h += total;
+				hp = hv;
+				hv = _mm_loadu_si128((__m128i *) h);
+				lv = _mm_loadu_si128((__m128i *) l);
+
+				/* (hp + hv + 1) >> 1 */
+				avg = _mm_add_epi16(_mm_add_epi16(_mm_srai_epi16(hp, 1),
+								  _mm_srai_epi16(hv, 1)),
+						    _mm_and_si128(_mm_or_si128(hp, hv), one));
+				e1 = _mm_sub_epi16(lv, avg);
+				_mm_storeu_si128((__m128i *) (dst + 2 * total), e1);
+
+				/* hp * 2 + ((e0 + e1) >> 1) */
+				avg = _mm_add_epi16(_mm_add_epi16(_mm_srai_epi16(e0, 1),
+								  _mm_srai_epi16(e1, 1)),
+						    _mm_and_si128(_mm_and_si128(e0, e1), one));
+				_mm_storeu_si128((__m128i *) (dst + total),
+						 _mm_add_epi16(_mm_slli_epi16(hp, 1), avg));
+
+				e0 = e1;
+				dst += 2 * total;
+			}
+
+			_mm_storeu_si128((__m128i *) (dst + total),
+					 _mm_add_epi16(_mm_slli_epi16(hv, 1), e0));
+		}
+		return;
+	}
+#endif
+
+	for (x = 0; x < total; x++)
+	{
+		l = idwt + x;
+		h = idwt + x + width * total;
+		dst = buffer + x;
+
+		dst[0] = *l - *h;
+
+		for (n = 1; n < width; n++)
+		{
+			l += total;
+			h += total;
+
+			/* Even coefficients */
+			dst[2 * total] = *l - ((*(h - total) + *h + 1) >> 1);
+
+			/* Odd coefficients */
+			dst[total] = *(h - total) * 2 + ((dst[0] + dst[2 * total]) >> 1);
+
+			dst += 2 * total;
+		}
+
+		dst[total] = *h * 2 + dst[0];
+	}
+}
+
+static void
+rfx_dwt_decode(sint16 * coef, sint16 * idwt)
+{
+	rfx_dwt_horizontal(coef + 3840, idwt, 8);
+	rfx_dwt_vertical(coef + 3840, idwt, 8);
+	rfx_dwt_horizontal(coef + 3072, idwt, 16);
+	rfx_dwt_vertical(coef + 3072, idwt, 16);
+	rfx_dwt_horizontal(coef, idwt, 32);
+	rfx_dwt_vertical(coef, idwt, 32);
+}
+
+static void
+rfx_decode_component(int entropy, uint8 * data, int length, uint8 * quant, sint16 * coef,
+		     sint16 * idwt)
+{
+	int i;
+
+	rfx_rlgr_decode(entropy, data, length, coef, RFX_TILE_PIXELS);
+
+	/* LL3 is coded as differences */
+	for (i = 4033; i < RFX_TILE_PIXELS; i++)
+		coef[i] += coef[i - 1];
+
+	rfx_dequantize(coef, quant);
+	rfx_dwt_decode(coef, idwt);
+}
+
+/* Components are in 11.5 fixed point, Y offset by -128. The colour
+   conversion works in 14 bit fixed point, so that the products fit in
+   32 bits. */
+#define YCBCR_CR_R	22979	/* 1.402525 */
+#define YCBCR_CB_G	5632	/* 0.343730 */
+#define YCBCR_CR_G	11705	/* 0.714401 */
+#define YCBCR_CB_B	28998	/* 1.769905 */
+#define YCBCR_Y		(1 << 14)
+#define YCBCR_ROUND	(4096 << 14)
+#define YCBCR_SHIFT	(14 + 5)
+
+static uint8
+rfx_clamp(sint32 value)
+{
+	return value < 0 ? 0 : value > 255 ? 255 : value;
+}
+
+static void
+rfx_ycbcr_to_bgrx(sint16 * y, sint16 * cb, sint16 * cr, uint8 * out)
+{
+	int i;
+	sint32 yv;
+
+#ifdef __SSE2__
+	if (g_rfx_sse2)
+	{
+		__m128i k_r = _mm_set_epi16(YCBCR_CR_R, YCBCR_Y, YCBCR_CR_R, YCBCR_Y,
+					    YCBCR_CR_R, YCBCR_Y, YCBCR_CR_R, YCBCR_Y);
+		__m128i k_g = _mm_set_epi16(-YCBCR_CB_G, YCBCR_Y, -YCBCR_CB_G, YCBCR_Y,
+					    -YCBCR_CB_G, YCBCR_Y, -YCBCR_CB_G, YCBCR_Y);
+		__m128i k_gr = _mm_set_epi16(0, -YCBCR_CR_G, 0, -YCBCR_CR_G,
+					     0, -YCBCR_CR_G, 0, -YCBCR_CR_G);
+		__m128i k_b = _mm_set_epi16(YCBCR_CB_B, YCBCR_Y, YCBCR_CB_B, YCBCR_Y,
+					    YCBCR_CB_B, YCBCR_Y, YCBCR_CB_B, YCBCR_Y);
+		__m128i round = _mm_set1_epi32(YCBCR_ROUND);
+		__m128i zero = _mm_setzero_si128();
+		__m128i yy, bb, rr, r, g, b, lo, hi, bg, rx;
+
+#define YCBCR_MADD(a, c, k) \
+		_mm_srai_epi32(_mm_add_epi32(_mm_madd_epi16(_mm_unpack##a##_epi16(yy, c), k), round), \
+			       YCBCR_SHIFT)
+
+		for (i = 0; i < RFX_TILE_PIXELS; i += 8)
+		{
+			yy = _mm_loadu_si128((__m128i *) (y + i));
+			bb = _mm_loadu_si128((__m128i *) (cb + i));
+			rr = _mm_loadu_si128((__m128i *) (cr + i));
+
+			r = _mm_packs_epi32(YCBCR_MADD(lo, rr, k_r), YCBCR_MADD(hi, rr, k_r));
+			b = _mm_packs_epi32(YCBCR_MADD(lo, bb, k_b), YCBCR_MADD(hi, bb, k_b));
+
+			lo = _mm_add_epi32(_mm_madd_epi16(_mm_unpacklo_epi16(yy, bb), k_g),
+					   _mm_madd_epi16(_mm_unpacklo_epi16(rr, zero), k_gr));
+			hi = _mm_add_epi32(_mm_madd_epi16(_mm_unpackhi_epi16(yy, bb), k_g),
+					   _mm_madd_epi16(_mm_unpackhi_epi16(rr, zero), k_gr));
+			g = _mm_packs_epi32(_mm_srai_epi32(_mm_add_epi32(lo, round), YCBCR_SHIFT),
+					    _mm_srai_epi32(_mm_add_epi32(hi, round), YCBCR_SHIFT));
+
+			b = _mm_packus_epi16(b, b);
+			g = _mm_packus_epi16(g, g);
+			r = _mm_packus_epi16(r, r);
+			bg = _mm_unpacklo_epi8(b, g);
+			rx = _mm_unpacklo_epi8(r, zero);
+			_mm_storeu_si128((__m128i *) (out + i * 4), _mm_unpacklo_epi16(bg, rx));
+			_mm_storeu_si128((__m128i *) (out + i * 4 + 16), _mm_unpackhi_epi16(bg, rx));
+		}
+#undef YCBCR_MADD
+		return;
+	}
+#endif
+
+	for (i = 0; i < RFX_TILE_PIXELS; i++)
+	{
+		yv = y[i] * YCBCR_Y + YCBCR_ROUND;
+		*out++ = rfx_clamp((yv + cb[i] * YCBCR_CB_B) >> YCBCR_SHIFT);
+		*out++ = rfx_clamp((yv - cb[i] * YCBCR_CB_G - cr[i] * YCBCR_CR_G) >> YCBCR_SHIFT);
+		*out++ = rfx_clamp((yv + cr[i] * YCBCR_CR_R) >> YCBCR_SHIFT);
+		*out++ = 0;
+	}
+}
+
+static void
+rfx_decode_tile(rfx_work_t * work, rfx_tile_t * tile)
+{
+	int i;
+
+	for (i = 0; i < 3; i++)
+		rfx_decode_component(g_rfx_entropy, tile->data[i], tile->length[i],
+				     g_rfx_quant[tile->quant[i]], work->coef[i], work->dwt);
+
+	rfx_ycbcr_to_bgrx(work->coef[0], work->coef[1], work->coef[2], tile->pixels);
+}
+
+static void
+rfx_decode_tile_item(int worker, int item)
+{
+	if (g_rfx_work[worker] == NULL)
+		g_rfx_work[worker] = (rfx_work_t *) xmalloc(sizeof(rfx_work_t));
+
+	rfx_decode_tile(g_rfx_work[worker], &g_rfx_tiles[item]);
+}
+
+/* Decode all tiles of the current tileset */
+static void
+rfx_decode_tiles(void)
+{
+	int i;
+
+	if (g_rfx_num_tiles >= RFX_MIN_THREADED_TILES)
+	{
+		workpool_run(rfx_decode_tile_item, g_rfx_num_tiles);
+		return;
+	}
+
+	for (i = 0; i < g_rfx_num_tiles; i++)
+		rfx_decode_tile_item(0, i);
+}
+
+/* Paint the decoded tiles, clipped to the region rectangles */
+static void
+rfx_paint_tiles(SURFACE_BITS * bits)
+{
+	RD_RECT *rect;
+	rfx_tile_t *tile;
+	int i, j;
+
+	for (i = 0; i < g_rfx_num_rects; i++)
+	{
+		rect = &g_rfx_rects[i];
+		ui_set_clip(bits->left + rect->x, bits->top + rect->y, rect->cx, rect->cy);
+
+		for (j = 0; j < g_rfx_num_tiles; j++)
+		{
+			tile = &g_rfx_tiles[j];
+			if (tile->x >= rect->x + rect->cx || tile->x + RFX_TILE_SIZE <= rect->x ||
+			    tile->y >= rect->y + rect->cy || tile->y + RFX_TILE_SIZE <= rect->y)
+				continue;
+
+			ui_paint_bitmap(bits->left + tile->x, bits->top + tile->y, RFX_TILE_SIZE,
+					RFX_TILE_SIZE, RFX_TILE_SIZE, RFX_TILE_SIZE, tile->pixels);
+		}
+	}
+
+	ui_reset_clip();
+}
+
+/* Copy the decoded tiles into the bitmap of rfx_decode(), clipped to
+   the region rectangles and the bitmap */
+static void
+rfx_copy_tiles(SURFACE_BITS * bits)
+{
+	RD_RECT *rect;
+	rfx_tile_t *tile;
+	int i, j, x1, y1, x2, y2, y;
+
+	for (i = 0; i < g_rfx_num_rects; i++)
+	{
+		rect = &g_rfx_rects[i];
+
+		for (j = 0; j < g_rfx_num_tiles; j++)
+		{
+			tile = &g_rfx_tiles[j];
+			x1 = MAX(MAX(rect->x, tile->x), 0);
+			y1 = MAX(MAX(rect->y, tile->y), 0);
+			x2 = MIN(MIN(rect->x + rect->cx, tile->x + RFX_TILE_SIZE), bits->width);
+			y2 = MIN(MIN(rect->y + rect->cy, tile->y + RFX_TILE_SIZE), bits->height);
+
+			for (y = y1; y < y2 && x1 < x2; y++)
+				memcpy(g_rfx_output + (y * bits->width + x1) * 4,
+				       tile->pixels + ((y - tile->y) * RFX_TILE_SIZE + x1 -
+						       tile->x) * 4, (x2 - x1) * 4);
+		}
+	}
+}
+
+static RD_BOOL
+rfx_process_context(STREAM s)
+{
+	uint16 properties;
+
+	in_uint8s(s, 1);	/* ctxId */
+	in_uint8s(s, 2);	/* tileSize */
+	in_uint16_le(s, properties);
+
+	if (!s_check(s))
+		return False;
+
+	g_rfx_entropy = (properties >> 9) & 0x0f;
+	return True;
+}
+
+static RD_BOOL
+rfx_process_region(STREAM s, SURFACE_BITS * bits)
+{
+	uint16 count;
+	int i;
+
+	in_uint8s(s, 1);	/* regionFlags */
+	in_uint16_le(s, count);	/* numRects */
+
+	if (!s_check_rem(s, count * 8))
+		return False;
+
+	if (count > g_rfx_rects_size)
+	{
+		g_rfx_rects = (RD_RECT *) xrealloc(g_rfx_rects, count * sizeof(RD_RECT));
+		g_rfx_rects_size = count;
+	}
+
+	for (i = 0; i < count; i++)
+	{
+		in_uint16_le(s, g_rfx_rects[i].x);
+		in_uint16_le(s, g_rfx_rects[i].y);
+		in_uint16_le(s, g_rfx_rects[i].cx);
+		in_uint16_le(s, g_rfx_rects[i].cy);
+	}
+	g_rfx_num_rects = count;
+
+	/* No rectangles means the whole destination */
+	if (count == 0)
+	{
+		if (g_rfx_rects_size == 0)
+		{
+			g_rfx_rects = (RD_RECT *) xmalloc(sizeof(RD_RECT));
+			g_rfx_rects_size = 1;
+		}
+		g_rfx_rects[0].x = 0;
+		g_rfx_rects[0].y = 0;
+		g_rfx_rects[0].cx = bits->right - bits->left;
+		g_rfx_rects[0].cy = bits->bottom - bits->top;
+		g_rfx_num_rects = 1;
+	}
+
+	return True;
+}
+
+static RD_BOOL
+rfx_process_tileset(STREAM s, SURFACE_BITS * bits)
+{
+	uint16 subtype, properties, count, type, xidx, yidx;
+	uint8 quant, byte, *next;
+	uint32 length;
+	rfx_tile_t *tile;
+	int i, j;
+
+	in_uint16_le(s, subtype);
+	in_uint8s(s, 2);	/* idx */
+	in_uint16_le(s, properties);
+	in_uint8(s, quant);	/* numQuant */
+	in_uint8s(s, 1);	/* tileSize */
+	in_uint16_le(s, count);	/* numTiles */
+	in_uint8s(s, 4);	/* tilesDataSize */
+
+	g_rfx_num_tiles = 0;
+	if (subtype != CBT_TILESET || !s_check_rem(s, quant * 5))
+		return False;
+
+	g_rfx_entropy = (properties >> 10) & 0x0f;
+
+	g_rfx_num_quant = quant;
+	for (i = 0; i < quant; i++)
+	{
+		for (j = 0; j < 5; j++)
+		{
+			in_uint8(s, byte);
+			g_rfx_quant[i][j * 2] = byte & 0x0f;
+			g_rfx_quant[i][j * 2 + 1] = byte >> 4;
+		}
+	}
+
+	/* Each tile takes at least a tile block header and its quant
+	   indices, check that before growing the buffers to the count */
+	if (!s_check_rem(s, count * 19))
+		return False;
+
+	if (count > g_rfx_tiles_size)
+	{
+		g_rfx_tiles = (rfx_tile_t *) xrealloc(g_rfx_tiles, count * sizeof(rfx_tile_t));
+		g_rfx_pixels = (uint8 *) xrealloc(g_rfx_pixels, count * RFX_TILE_BYTES);
+		g_rfx_tiles_size = count;
+	}
+
+	for (i = 0; i < count; i++)
+	{
+		tile = &g_rfx_tiles[i];
+
+		if (!s_check_rem(s, 19))
+			return False;
+
+		in_uint16_le(s, type);
+		in_uint32_le(s, length);
+		if (type != CBT_TILE || length < 19 || !s_check_rem(s, length - 6))
+			return False;
+		next = s->p + length - 6;
+
+		in_uint8a(s, tile->quant, 3);
+		in_uint16_le(s, xidx);
+		in_uint16_le(s, yidx);
+		in_uint16_le(s, tile->length[0]);
+		in_uint16_le(s, tile->length[1]);
+		in_uint16_le(s, tile->length[2]);
+
+		if (19 + (uint32) tile->length[0] + tile->length[1] + tile->length[2] > length)
+			return False;
+
+		for (j = 0; j < 3; j++)
+		{
+			if (tile->quant[j] >= g_rfx_num_quant)
+				return False;
+			in_uint8p(s, tile->data[j], tile->length[j]);
+		}
+
+		tile->x = xidx * RFX_TILE_SIZE;
+		tile->y = yidx * RFX_TILE_SIZE;
+		tile->pixels = g_rfx_pixels + i * RFX_TILE_BYTES;
+		s->p = next;
+	}
+	g_rfx_num_tiles = count;
+
+	if (g_rfx_entropy != CLW_ENTROPY_RLGR1 && g_rfx_entropy != CLW_ENTROPY_RLGR3)
+	{
+		logger(Graphics, Warning, "rfx_process_tileset(), unknown entropy algorithm %d",
+		       g_rfx_entropy);
+		return False;
+	}
+
+	rfx_decode_tiles();
+	if (g_rfx_output != NULL)
+		rfx_copy_tiles(bits);
+	else
+		rfx_paint_tiles(bits);
+	return True;
+}
+
+/* Decode and paint a RemoteFX message */
+RD_BOOL
+rfx_process_message(SURFACE_BITS * bits)
+{
+	struct stream packet, block;
+	STREAM s = &packet;
+	uint16 type;
+	uint32 length;
+	RD_BOOL ok = True;
+
+	memset(&packet, 0, sizeof(packet));
+	packet.data = packet.p = bits->data;
+	packet.size = bits->length;
+	packet.end = packet.data + packet.size;
+
+	while (ok && s_check_rem(s, 6))
+	{
+		in_uint16_le(s, type);	/* blockType */
+		in_uint32_le(s, length);	/* blockLen */
+
+		if (length < 6 || !s_check_rem(s, length - 6))
+		{
+			logger(Graphics, Error, "rfx_process_message(), bad block length %u", length);
+			return False;
+		}
+
+		block = packet;
+		block.end = s->p + length - 6;
+		s->p = block.end;
+
+		/* Codec channel blocks start with codecId and channelId */
+		if (type >= WBT_CONTEXT && type <= WBT_EXTENSION)
+			in_uint8s(&block, 2);
+
+		switch (type)
+		{
+			case WBT_SYNC:
+			case WBT_CODEC_VERSIONS:
+			case WBT_CHANNELS:
+			case WBT_FRAME_BEGIN:
+			case WBT_FRAME_END:
+				break;
+
+			case WBT_CONTEXT:
+				ok = rfx_process_context(&block);
+				break;
+
+			case WBT_REGION:
+				ok = rfx_process_region(&block, bits);
+				break;
+
+			case WBT_EXTENSION:
+				ok = rfx_process_tileset(&block, bits);
+				break;
+
+			default:
+				logger(Graphics, Warning,
+				       "rfx_process_message(), unhandled block type 0x%x", type);
+				break;
+		}
+	}
+
+	if (!ok)
+		logger(Graphics, Error, "rfx_process_message(), block 0x%x parse error", type);
+
+	return ok;
+}
+
+/* Decode a RemoteFX message into width x height BGRX pixels, for
+   bitmaps that are cached rather than painted. Pixels outside the
+   region come out black. */
+RD_BOOL
+rfx_decode(uint8 * output, int width, int height, uint8 * input, uint32 size)
+{
+	SURFACE_BITS bits;
+	RD_BOOL ok;
+
+	memset(&bits, 0, sizeof(bits));
+	bits.right = bits.width = width;
+	bits.bottom = bits.height = height;
+	bits.bpp = 32;
+	bits.codec_id = RDP_CODEC_ID_REMOTEFX;
+	bits.length = size;
+	bits.data = input;
+
+	memset(output, 0, width * height * 4);
+
+	g_rfx_output = output;
+	ok = rfx_process_message(&bits);
+	g_rfx_output = NULL;
+	return ok;
+}
+
+/* Output the RemoteFX codec properties of the bitmap codecs capability
+   set, a TS_RFX_CLNT_CAPS_CONTAINER */
+void
+rfx_out_properties(STREAM s)
+{
+	int i;
+
+	out_uint32_le(s, RFX_PROPERTIES_LENGTH);	/* length */
+	out_uint32_le(s, CARDP_CAPS_CAPTURE_NON_CAC);	/* captureFlags */
+	out_uint32_le(s, RFX_PROPERTIES_LENGTH - 12);	/* capsLength */
+
+	/* TS_RFX_CAPS */
+	out_uint16_le(s, CBY_CAPS);	/* blockType */
+	out_uint32_le(s, 8);	/* blockLen */
+	out_uint16_le(s, 1);	/* numCapsets */
+
+	/* TS_RFX_CAPSET */
+	out_uint16_le(s, CBY_CAPSET);	/* blockType */
+	out_uint32_le(s, RFX_PROPERTIES_LENGTH - 20);	/* blockLen */
+	out_uint8(s, 1);	/* codecId */
+	out_uint16_le(s, CLY_CAPSET);	/* capsetType */
+	out_uint16_le(s, 2);	/* numIcaps */
+	out_uint16_le(s, 8);	/* icapLen */
+
+	/* TS_RFX_ICAP, one per entropy algorithm */
+	for (i = 0; i < 2; i++)
+	{
+		out_uint16_le(s, CLW_VERSION_1_0);	/* version */
+		out_uint16_le(s, RFX_TILE_SIZE);	/* tileSize */
+		out_uint8(s, CODEC_MODE);	/* flags */
+		out_uint8(s, CLW_COL_CONV_ICT);	/* colConvBits */
+		out_uint8(s, CLW_XFORM_DWT_53_A);	/* transformBits */
+		out_uint8(s, i == 0 ? CLW_ENTROPY_RLGR1 : CLW_ENTROPY_RLGR3);	/* entropyBits */
+	}
+}
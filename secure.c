@@ -39,6 +39,9 @@ extern uint32 g_redirect_session_id;
 extern int g_server_depth;
 extern VCHANNEL g_channels[];
 extern unsigned int g_num_channels;
+extern uint16 g_mcs_msgchannel;
+extern RD_BOOL g_network_autodetect;
+extern RD_BOOL g_rdpgfx;
 extern uint8 g_client_random[SEC_RANDOM_SIZE];
 
 static int g_rc4_key_len;
@@ -318,6 +321,18 @@ sec_rsa_encrypt(uint8 * out, uint8 * in, int len, uint32 modulus_size, uint8 * m
 	rdssl_rsa_encrypt(out, in, len, modulus_size, modulus, exponent);
 }
 
+/* Length of the security header of a packet sent with flags */
+int
+sec_header_length(uint32 flags)
+{
+	if (!g_licence_issued && !g_licence_error_result)
+		return (flags & SEC_ENCRYPT) ? 12 : 4;
+	else if (flags & SEC_ENCRYPT)
+		return 12;
+	else
+		return (flags & SEC_AUTODETECT_RSP) ? 4 : 0;
+}
+
 /* Initialise secure transport packet */
 STREAM
 sec_init(uint32 flags, int maxlen)
@@ -325,10 +340,7 @@ sec_init(uint32 flags, int maxlen)
 	int hdrlen;
 	STREAM s;
 
-	if (!g_licence_issued && !g_licence_error_result)
-		hdrlen = (flags & SEC_ENCRYPT) ? 12 : 4;
-	else
-		hdrlen = (flags & SEC_ENCRYPT) ? 12 : 0;
+	hdrlen = sec_header_length(flags);
 	s = mcs_init(maxlen + hdrlen);
 	s_push_layer(s, sec_hdr, hdrlen);
 
@@ -346,7 +358,8 @@ sec_send_to_channel(STREAM s, uint32 flags, uint16 channel)
 #endif
 
 	s_pop_layer(s, sec_hdr);
-	if ((!g_licence_issued && !g_licence_error_result) || (flags & SEC_ENCRYPT))
+	if ((!g_licence_issued && !g_licence_error_result)
+	    || (flags & (SEC_ENCRYPT | SEC_AUTODETECT_RSP)))
 		out_uint32_le(s, flags);
 
 	if (flags & SEC_ENCRYPT)
@@ -399,14 +412,27 @@ sec_out_mcs_connect_initial_pdu(STREAM s, uint32 selected_protocol)
 	unsigned int i;
 	uint32 rdpversion = RDP_40;
 	uint16 capflags = RNS_UD_CS_SUPPORT_ERRINFO_PDU;
+	uint8 connection_type = 0;
 	uint16 colorsupport = RNS_UD_24BPP_SUPPORT | RNS_UD_16BPP_SUPPORT | RNS_UD_32BPP_SUPPORT;
 	uint32 physwidth, physheight, desktopscale, devicescale;
 
 	logger(Protocol, Debug, "%s()", __func__);
 
 	if (g_rdp_version >= RDP_V5)
+	{
 		rdpversion = RDP_50;
 
+		/* Network auto-detect requests arrive on the MCS message channel */
+		capflags |= RNS_UD_CS_SUPPORT_NETCHAR_AUTODETECT;
+		length += 8;
+
+		if (g_network_autodetect)
+		{
+			capflags |= RNS_UD_CS_VALID_CONNECTION_TYPE;
+			connection_type = CONNECTION_TYPE_AUTODETECT;
+		}
+	}
+
 	if (g_num_channels > 0)
 		length += g_num_channels * 12 + 8;
 
@@ -453,12 +479,18 @@ sec_out_mcs_connect_initial_pdu(STREAM s, uint32 selected_protocol)
 	   To get 32BPP sessions, we need to set a capability flag. */
 	out_uint16_le(s, MIN(g_server_depth, 24));
 	if (g_server_depth == 32)
+	{
 		capflags |= RNS_UD_CS_WANT_32BPP_SESSION;
 
+		/* The graphics pipeline draws in 32 bpp only */
+		if (g_rdpgfx)
+			capflags |= RNS_UD_CS_SUPPORT_DYNVC_GFX_PROTOCOL;
+	}
+
 	out_uint16_le(s, colorsupport);	/* supportedColorDepths */
 	out_uint16_le(s, capflags);	/* earlyCapabilityFlags */
 	out_uint8s(s, 64);	/* clientDigProductId */
-	out_uint8(s, 0);	/* connectionType */
+	out_uint8(s, connection_type);	/* connectionType */
 	out_uint8(s, 0);	/* pad */
 	out_uint32_le(s, selected_protocol);	/* serverSelectedProtocol */
 	if (g_dpi > 0)
@@ -510,6 +542,14 @@ sec_out_mcs_connect_initial_pdu(STREAM s, uint32 selected_protocol)
 		}
 	}
 
+	if (g_rdp_version >= RDP_V5)
+	{
+		/* Client Message Channel Data (TS_UD_CS_MCS_MSGCHANNEL) */
+		out_uint16_le(s, CS_MCS_MSGCHANNEL);	/* type */
+		out_uint16_le(s, 8);	/* length */
+		out_uint32_le(s, 0);	/* flags */
+	}
+
 	s_mark_end(s);
 }
 
@@ -835,6 +875,12 @@ sec_process_mcs_data(STREAM s)
 				   channels */
 				break;
 
+			case SEC_TAG_SRV_MSGCHANNEL:
+				in_uint16_le(s, g_mcs_msgchannel);	/* MCSChannelID */
+				logger(Protocol, Debug, "%s(), SEC_TAG_SRV_MSGCHANNEL, channel %d",
+				       __func__, g_mcs_msgchannel);
+				break;
+
 			default:
 				logger(Protocol, Warning, "Unhandled response tag 0x%x", tag);
 		}
@@ -871,9 +917,37 @@ sec_recv(RD_BOOL * is_fastpath)
 				in_uint8s(s, 8);	/* signature */
 				sec_decrypt(s->p, s->end - s->p);
 			}
+			autodetect_bytes_received(s->end - s->p);
 			return s;
 		}
 
+		autodetect_bytes_received(s->end - s->p);
+
+		if (g_mcs_msgchannel != 0 && channel == g_mcs_msgchannel)
+		{
+			/* The message channel always carries a security header */
+			in_uint16_le(s, sec_flags);
+			in_uint8s(s, 2);	/* skip sec_flags_hi */
+
+			if (sec_flags & SEC_ENCRYPT)
+			{
+				if (!s_check_rem(s, 8)) {
+					rdp_protocol_error("sec_recv(), consume encrypt signature from stream would overrun", &packet);
+				}
+
+				in_uint8s(s, 8);	/* signature */
+				sec_decrypt(s->p, s->end - s->p);
+			}
+
+			if (sec_flags & SEC_AUTODETECT_REQ)
+				autodetect_process(s);
+			else
+				logger(Protocol, Warning,
+				       "sec_recv(), unhandled message channel PDU, flags 0x%x",
+				       sec_flags);
+			continue;
+		}
+
 		if (g_encryption || (!g_licence_issued && !g_licence_error_result))
 		{
 			/* TS_SECURITY_HEADER */
@@ -0,0 +1,251 @@
+/* -*- c-basic-offset: 8 -*-
+   rdesktop: A Remote Desktop Protocol client.
+   Surface commands and bitmap codec dispatch
+
+   This program is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "rdesktop.h"
+
+/* Set and stream surface bits commands carry a bitmap encoded with
+   one of the codecs the client listed in its bitmap codecs capability
+   set, identified by the ID the client assigned to it. Each codec is
+   an entry in g_surface_codecs, and its decoder is expected to paint
+   the result using ui_paint_bitmap(). Cache bitmap revision 3 orders
+   use the same codec IDs for bitmaps that go to the bitmap cache
+   instead, which the bitmap decoder of the codec writes to memory. */
+
+extern int g_server_depth;
+extern RD_BOOL g_nscodec;
+
+typedef RD_BOOL(*surface_decoder_t) (SURFACE_BITS * bits);
+typedef RD_BOOL(*surface_bitmap_decoder_t) (uint8 * output, int width, int height,
+					    uint8 * input, uint32 size);
+
+typedef struct surface_codec_t
+{
+	const char *name;
+	/* Codecs without a GUID are not negotiated */
+	const uint8 *guid;
+	/* Negotiated only if set, NULL for always */
+	RD_BOOL *enabled;
+	uint8 id;
+	uint16 properties_length;
+	void (*out_properties) (STREAM s);
+	surface_decoder_t decode;
+	/* 32 bpp top-down output, NULL if the codec can't */
+	surface_bitmap_decoder_t decode_bitmap;
+} surface_codec_t;
+
+/* CODEC_GUID_NSCODEC, {CA8D1BB9-000F-154F-589F-AE2D1A87E2D6} */
+static const uint8 g_nscodec_guid[16] = {
+	0xb9, 0x1b, 0x8d, 0xca, 0x0f, 0x00, 0x4f, 0x15,
+	0x58, 0x9f, 0xae, 0x2d, 0x1a, 0x87, 0xe2, 0xd6
+};
+
+/* CODEC_GUID_REMOTEFX, {76772F12-BD72-4463-AFB3-B73C9C6F7886} */
+static const uint8 g_remotefx_guid[16] = {
+	0x12, 0x2f, 0x77, 0x76, 0x72, 0xbd, 0x63, 0x44,
+	0xaf, 0xb3, 0xb7, 0x3c, 0x9c, 0x6f, 0x78, 0x86
+};
+
+static RD_BOOL surface_decode_none(SURFACE_BITS * bits);
+
+static surface_codec_t g_surface_codecs[] = {
+	{"none", NULL, NULL, RDP_CODEC_ID_NONE, 0, NULL, surface_decode_none, NULL},
+	{"NSCodec", g_nscodec_guid, &g_nscodec, RDP_CODEC_ID_NSCODEC, NSC_PROPERTIES_LENGTH,
+	 nsc_out_properties, nsc_process_message, nsc_decode},
+	{"RemoteFX", g_remotefx_guid, NULL, RDP_CODEC_ID_REMOTEFX, RFX_PROPERTIES_LENGTH,
+	 rfx_out_properties, rfx_process_message, rfx_decode}
+};
+
+#define NUM_SURFACE_CODECS (sizeof(g_surface_codecs) / sizeof(g_surface_codecs[0]))
+
+static RD_BOOL
+surface_codec_negotiated(surface_codec_t * codec)
+{
+	return codec->guid != NULL && (codec->enabled == NULL || *codec->enabled);
+}
+
+/* Uncompressed bottom-up bitmap in the session colour depth */
+static RD_BOOL
+surface_decode_none(SURFACE_BITS * bits)
+{
+	int Bpp = (bits->bpp + 7) / 8;
+	int y, stride;
+	uint8 *bmpdata;
+
+	if (bits->bpp != g_server_depth)
+	{
+		logger(Graphics, Warning,
+		       "surface_decode_none(), %d bpp bitmap in a %d bpp session", bits->bpp,
+		       g_server_depth);
+		return False;
+	}
+
+	if (bits->length < (uint32) bits->width * bits->height * Bpp)
+	{
+		logger(Graphics, Error, "surface_decode_none(), short bitmap data, %u bytes",
+		       bits->length);
+		return False;
+	}
+
+	if (bits->right < bits->left || bits->bottom < bits->top)
+	{
+		logger(Graphics, Error, "surface_decode_none(), invalid destination rectangle");
+		return False;
+	}
+
+	stride = bits->width * Bpp;
+	bmpdata = (uint8 *) xmalloc(bits->height * stride);
+	for (y = 0; y < bits->height; y++)
+		memcpy(&bmpdata[(bits->height - y - 1) * stride], &bits->data[y * stride], stride);
+
+	ui_paint_bitmap(bits->left, bits->top, MIN(bits->width, bits->right - bits->left),
+			MIN(bits->height, bits->bottom - bits->top), bits->width, bits->height,
+			bmpdata);
+	xfree(bmpdata);
+	return True;
+}
+
+/* Process a set or stream surface bits command, following the
+   cmdType. Returns False if the command could not be parsed, in
+   which case the rest of the update can't be either. */
+RD_BOOL
+surface_process_bits(STREAM s)
+{
+	SURFACE_BITS bits;
+	uint8 flags;
+	unsigned int i;
+
+	in_uint16_le(s, bits.left);	/* destLeft */
+	in_uint16_le(s, bits.top);	/* destTop */
+	in_uint16_le(s, bits.right);	/* destRight */
+	in_uint16_le(s, bits.bottom);	/* destBottom */
+
+	/* TS_BITMAP_DATA_EX */
+	in_uint8(s, bits.bpp);
+	in_uint8(s, flags);
+	in_uint8s(s, 1);	/* reserved */
+	in_uint8(s, bits.codec_id);
+	in_uint16_le(s, bits.width);
+	in_uint16_le(s, bits.height);
+	in_uint32_le(s, bits.length);
+
+	if (flags & EX_COMPRESSED_BITMAP_HEADER_PRESENT)
+		in_uint8s(s, 24);	/* exBitmapDataHeader */
+
+	if (!s_check_rem(s, bits.length))
+	{
+		rdp_protocol_error("surface_process_bits(), consume of bitmap data would overrun",
+				   s);
+		return False;
+	}
+
+	in_uint8p(s, bits.data, bits.length);
+
+	logger(Graphics, Debug,
+	       "surface_process_bits(), dest=(%d,%d,%d,%d), bpp=%d, codec=%d, %dx%d, %u bytes",
+	       bits.left, bits.top, bits.right, bits.bottom, bits.bpp, bits.codec_id,
+	       bits.width, bits.height, bits.length);
+
+	for (i = 0; i < NUM_SURFACE_CODECS; i++)
+	{
+		if (g_surface_codecs[i].id != bits.codec_id)
+			continue;
+
+		if (!g_surface_codecs[i].decode(&bits))
+			logger(Graphics, Warning, "surface_process_bits(), %s decoding failed",
+			       g_surface_codecs[i].name);
+		return True;
+	}
+
+	logger(Graphics, Warning, "surface_process_bits(), unknown codec id %d", bits.codec_id);
+	return True;
+}
+
+/* Decode a 32 bpp bitmap of a negotiated codec into width x height
+   pixels at output */
+RD_BOOL
+surface_decode_bitmap(uint8 codec_id, uint8 * output, int width, int height, uint8 * data,
+		      uint32 length)
+{
+	unsigned int i;
+
+	for (i = 0; i < NUM_SURFACE_CODECS; i++)
+	{
+		if (g_surface_codecs[i].id != codec_id)
+			continue;
+
+		if (!surface_codec_negotiated(&g_surface_codecs[i]) ||
+		    g_surface_codecs[i].decode_bitmap == NULL)
+			break;
+
+		if (g_surface_codecs[i].decode_bitmap(output, width, height, data, length))
+			return True;
+
+		logger(Graphics, Warning, "surface_decode_bitmap(), %s decoding failed",
+		       g_surface_codecs[i].name);
+		return False;
+	}
+
+	logger(Graphics, Warning, "surface_decode_bitmap(), unsupported codec id %d", codec_id);
+	return False;
+}
+
+/* Length of the bitmap codecs capability set */
+uint16
+surface_codecs_caplen(void)
+{
+	uint16 length = 4 + 1;
+	unsigned int i;
+
+	for (i = 0; i < NUM_SURFACE_CODECS; i++)
+	{
+		if (surface_codec_negotiated(&g_surface_codecs[i]))
+			length += 16 + 1 + 2 + g_surface_codecs[i].properties_length;
+	}
+
+	return length;
+}
+
+/* Output bitmap codecs capability set */
+void
+surface_out_codecs_capabilityset(STREAM s)
+{
+	uint8 count = 0;
+	unsigned int i;
+
+	for (i = 0; i < NUM_SURFACE_CODECS; i++)
+	{
+		if (surface_codec_negotiated(&g_surface_codecs[i]))
+			count++;
+	}
+
+	out_uint16_le(s, RDP_CAPSET_BITMAP_CODECS);
+	out_uint16_le(s, surface_codecs_caplen());
+	out_uint8(s, count);	/* bitmapCodecCount */
+
+	for (i = 0; i < NUM_SURFACE_CODECS; i++)
+	{
+		if (!surface_codec_negotiated(&g_surface_codecs[i]))
+			continue;
+
+		out_uint8a(s, g_surface_codecs[i].guid, 16);	/* codecGUID */
+		out_uint8(s, g_surface_codecs[i].id);	/* codecID */
+		out_uint16_le(s, g_surface_codecs[i].properties_length);
+		if (g_surface_codecs[i].out_properties != NULL)
+			g_surface_codecs[i].out_properties(s);
+	}
+}
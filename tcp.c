@@ -28,6 +28,8 @@
 #include <netinet/tcp.h>	/* TCP_NODELAY */
 #include <arpa/inet.h>		/* inet_addr */
 #include <errno.h>		/* errno */
+#include <fcntl.h>		/* fcntl O_NONBLOCK */
+#include <sys/uio.h>		/* writev */
 #endif
 
 #include <openssl/ssl.h>
@@ -52,6 +54,19 @@
 #define INADDR_NONE ((unsigned long) -1)
 #endif
 
+/* Connection attempts to the resolved addresses run in parallel, a new
+   one is started every TCP_CONNECT_STAGGER ms until one of them succeeds */
+#define TCP_CONNECT_MAX_ADDRS 8
+#define TCP_CONNECT_STAGGER 250	/* ms */
+#define TCP_CONNECT_TIMEOUT 15000	/* ms */
+
+/* Pieces per writev() call, and payload of a full TLS record */
+#define TCP_VECTOR_MAX 64
+#define TCP_TLS_RECORD_LENGTH 16384
+
+/* Number of servers we remember TLS sessions for */
+#define TLS_SESSION_CACHE_SIZE 8
+
 #ifdef WITH_SCARD
 #define STREAM_COUNT 8
 #else
@@ -74,10 +89,26 @@ static struct stream g_in;
 static struct stream g_out[STREAM_COUNT];
 int g_tcp_port_rdp = TCP_PORT_RDP;
 
+/* Packets sent between tcp_hold() and tcp_release() */
+static struct stream g_held;
+static RD_BOOL g_holding = False;
+
+/* TLS sessions for resumption, keyed by server, port and TLS version */
+typedef struct tls_session_entry
+{
+	char *key;
+	SSL_SESSION *session;
+} tls_session_entry;
+
+static tls_session_entry g_tls_sessions[TLS_SESSION_CACHE_SIZE];
+static int g_tls_sessions_next = 0;
+static char *g_tls_session_key = NULL;
+
 extern RD_BOOL g_exit_mainloop;
 extern RD_BOOL g_network_error;
 extern RD_BOOL g_reconnect_loop;
 extern char g_tls_version[];
+extern RD_BOOL g_tls_session_persist;
 
 /* wait till socket is ready to write or timeout */
 static RD_BOOL
@@ -119,25 +150,19 @@ tcp_init(uint32 maxlen)
 	return result;
 }
 
-/* Send TCP transport data packet */
-void
-tcp_send(STREAM s)
+/* Write length bytes, waiting while the socket is full. On failure
+   the connection is marked broken. */
+static RD_BOOL
+tcp_write(uint8 * data, int length)
 {
 	int ssl_err;
-	int length = s->end - s->data;
 	int sent, total = 0;
 
-	if (g_network_error == True)
-		return;
-
-#ifdef WITH_SCARD
-	scard_lock(SCARD_LOCK_TCP);
-#endif
 	while (total < length)
 	{
 		if (g_ssl)
 		{
-			sent = SSL_write(g_ssl, s->data + total, length - total);
+			sent = SSL_write(g_ssl, data + total, length - total);
 			if (sent <= 0)
 			{
 				ssl_err = SSL_get_error(g_ssl, sent);
@@ -149,20 +174,17 @@ tcp_send(STREAM s)
 				}
 				else
 				{
-#ifdef WITH_SCARD
-					scard_unlock(SCARD_LOCK_TCP);
-#endif
 					logger(Core, Error,
 					       "tcp_send(), SSL_write() failed with %d: %s",
 					       ssl_err, TCP_STRERROR);
 					g_network_error = True;
-					return;
+					return False;
 				}
 			}
 		}
 		else
 		{
-			sent = send(g_sock, s->data + total, length - total, 0);
+			sent = send(g_sock, data + total, length - total, 0);
 			if (sent <= 0)
 			{
 				if (sent == -1 && TCP_BLOCKS)
@@ -172,21 +194,200 @@ tcp_send(STREAM s)
 				}
 				else
 				{
-#ifdef WITH_SCARD
-					scard_unlock(SCARD_LOCK_TCP);
-#endif
 					logger(Core, Error, "tcp_send(), send() failed: %s",
 					       TCP_STRERROR);
 					g_network_error = True;
-					return;
+					return False;
 				}
 			}
 		}
 		total += sent;
 	}
+
+	return True;
+}
+
+/* Write out the held back packets */
+static void
+tcp_write_held(void)
+{
+	if (g_held.end > g_held.data)
+		tcp_write(g_held.data, g_held.end - g_held.data);
+	s_reset(&g_held);
+}
+
+/* Send TCP transport data packet */
+void
+tcp_send(STREAM s)
+{
+	int length = s->end - s->data;
+
+	if (g_network_error == True)
+		return;
+
+#ifdef WITH_SCARD
+	scard_lock(SCARD_LOCK_TCP);
+#endif
+	if (g_holding)
+	{
+		s_realloc(&g_held, (g_held.end - g_held.data) + length);
+		g_held.p = g_held.end;
+		out_uint8a(&g_held, s->data, length);
+		g_held.end = g_held.p;
+	}
+	else
+	{
+		tcp_write(s->data, length);
+	}
+#ifdef WITH_SCARD
+	scard_unlock(SCARD_LOCK_TCP);
+#endif
+}
+
+/* Hold back the packets sent from now on, so that tcp_release() can
+   write a burst of them at once; in one TLS record if they fit */
+void
+tcp_hold(void)
+{
+#ifdef WITH_SCARD
+	scard_lock(SCARD_LOCK_TCP);
+#endif
+	g_holding = True;
+#ifdef WITH_SCARD
+	scard_unlock(SCARD_LOCK_TCP);
+#endif
+}
+
+/* Write the packets held back since tcp_hold() */
+void
+tcp_release(void)
+{
+#ifdef WITH_SCARD
+	scard_lock(SCARD_LOCK_TCP);
+#endif
+	g_holding = False;
+	if (g_network_error == True)
+		s_reset(&g_held);
+	else
+		tcp_write_held();
+#ifdef WITH_SCARD
+	scard_unlock(SCARD_LOCK_TCP);
+#endif
+}
+
+#ifndef _WIN32
+/* Write the pieces with as few system calls as possible */
+static void
+tcp_writev(SEND_VECTOR * vector, int count)
+{
+	struct iovec iov[TCP_VECTOR_MAX];
+	int i, j, n, first;
+	ssize_t sent;
+
+	for (i = 0; i < count; i += n)
+	{
+		n = MIN(count - i, TCP_VECTOR_MAX);
+		for (j = 0; j < n; j++)
+		{
+			iov[j].iov_base = vector[i + j].data;
+			iov[j].iov_len = vector[i + j].length;
+		}
+
+		first = 0;
+		while (first < n)
+		{
+			sent = writev(g_sock, iov + first, n - first);
+			if (sent < 0)
+			{
+				if (TCP_BLOCKS)
+				{
+					tcp_can_send(g_sock, 100);
+					continue;
+				}
+				logger(Core, Error, "tcp_send_vector(), writev() failed: %s",
+				       TCP_STRERROR);
+				g_network_error = True;
+				return;
+			}
+
+			/* skip what was written */
+			while (first < n && (size_t) sent >= iov[first].iov_len)
+			{
+				sent -= iov[first].iov_len;
+				first++;
+			}
+			if (first < n)
+			{
+				iov[first].iov_base = (uint8 *) iov[first].iov_base + sent;
+				iov[first].iov_len -= sent;
+			}
+		}
+	}
+}
+#endif
+
+/* Send a packet, or several, made of pieces that are not joined
+   first. Without TLS they go out with writev(), with TLS they are
+   gathered into full records so that short pieces do not each cost a
+   record and a system call. */
+void
+tcp_send_vector(SEND_VECTOR * vector, int count)
+{
+	static uint8 batch[TCP_TLS_RECORD_LENGTH];
+	uint32 used, offset, part;
+	int i;
+
+	if (g_network_error == True)
+		return;
+
+#ifdef WITH_SCARD
+	scard_lock(SCARD_LOCK_TCP);
+#endif
+	/* Keep the order of the packets */
+	if (g_holding)
+		tcp_write_held();
+
+	if (g_ssl)
+	{
+		used = 0;
+		for (i = 0; i < count; i++)
+		{
+			for (offset = 0; offset < vector[i].length; offset += part)
+			{
+				part = MIN(vector[i].length - offset, sizeof(batch) - used);
+				memcpy(batch + used, vector[i].data + offset, part);
+				used += part;
+
+				if (used == sizeof(batch))
+				{
+					if (!tcp_write(batch, used))
+						goto out;
+					used = 0;
+				}
+			}
+		}
+
+		if (used > 0)
+			tcp_write(batch, used);
+	}
+	else
+	{
+#ifndef _WIN32
+		tcp_writev(vector, count);
+#else
+		for (i = 0; i < count; i++)
+		{
+			if (!tcp_write(vector[i].data, vector[i].length))
+				break;
+		}
+#endif
+	}
+
+      out:
 #ifdef WITH_SCARD
 	scard_unlock(SCARD_LOCK_TCP);
 #endif
+	return;
 }
 
 /* Receive a message on the TCP layer */
@@ -300,12 +501,158 @@ tcp_recv(STREAM s, uint32 length)
 	return s;
 }
 
+static tls_session_entry *
+tcp_tls_session_find(const char *key)
+{
+	int i;
+
+	for (i = 0; i < TLS_SESSION_CACHE_SIZE; i++)
+	{
+		if (g_tls_sessions[i].key != NULL && strcmp(g_tls_sessions[i].key, key) == 0)
+			return &g_tls_sessions[i];
+	}
+	return NULL;
+}
+
+static void
+tcp_tls_session_remove(const char *key)
+{
+	tls_session_entry *entry;
+
+	entry = tcp_tls_session_find(key);
+	if (entry == NULL)
+		return;
+
+	SSL_SESSION_free(entry->session);
+	entry->session = NULL;
+	xfree(entry->key);
+	entry->key = NULL;
+}
+
+static void
+tcp_tls_session_put(const char *key, SSL_SESSION * session)
+{
+	tls_session_entry *entry;
+
+	entry = tcp_tls_session_find(key);
+	if (entry == NULL)
+	{
+		/* replace the oldest entry */
+		entry = &g_tls_sessions[g_tls_sessions_next];
+		g_tls_sessions_next = (g_tls_sessions_next + 1) % TLS_SESSION_CACHE_SIZE;
+
+		if (entry->key != NULL)
+			xfree(entry->key);
+		entry->key = xstrdup(key);
+	}
+
+	if (entry->session != NULL)
+		SSL_SESSION_free(entry->session);
+	entry->session = session;
+}
+
+/* Look up a resumable session, first in memory then on disk */
+static SSL_SESSION *
+tcp_tls_session_get(const char *key)
+{
+	tls_session_entry *entry;
+	SSL_SESSION *session = NULL;
+	const unsigned char *p;
+	unsigned char *data;
+	int length;
+
+	entry = tcp_tls_session_find(key);
+	if (entry != NULL)
+	{
+		session = entry->session;
+	}
+	else if (g_tls_session_persist && (length = load_tls_session(key, &data)) > 0)
+	{
+		p = data;
+		session = d2i_SSL_SESSION(NULL, &p, length);
+		xfree(data);
+		if (session == NULL)
+			return NULL;
+		tcp_tls_session_put(key, session);
+	}
+
+	if (session == NULL)
+		return NULL;
+
+	if (SSL_SESSION_get_time(session) + SSL_SESSION_get_timeout(session) < time(NULL))
+	{
+		logger(Core, Debug, "tcp_tls_session_get(), session for %s has expired", key);
+		tcp_tls_session_remove(key);
+		return NULL;
+	}
+
+	return session;
+}
+
+/* Called by OpenSSL when the server has handed out a new session */
+static int
+tcp_tls_new_session(SSL * ssl, SSL_SESSION * session)
+{
+	unsigned char *data, *p;
+	int length;
+
+	UNUSED(ssl);
+
+	if (g_tls_session_key == NULL)
+		return 0;
+
+	logger(Core, Debug, "tcp_tls_new_session(), caching session for %s", g_tls_session_key);
+	tcp_tls_session_put(g_tls_session_key, session);
+
+	if (g_tls_session_persist)
+	{
+		length = i2d_SSL_SESSION(session, NULL);
+		if (length > 0)
+		{
+			data = p = xmalloc(length);
+			i2d_SSL_SESSION(session, &p);
+			save_tls_session(g_tls_session_key, data, length);
+			xfree(data);
+		}
+	}
+
+	/* we keep the reference */
+	return 1;
+}
+
+/* Log whether TLS records are processed by the kernel or by OpenSSL */
+static void
+tcp_tls_log_offload(void)
+{
+	RD_BOOL ktls_send = False, ktls_recv = False;
+
+#ifdef SSL_OP_ENABLE_KTLS
+	ktls_send = BIO_get_ktls_send(SSL_get_wbio(g_ssl));
+	ktls_recv = BIO_get_ktls_recv(SSL_get_rbio(g_ssl));
+#endif
+
+	if (ktls_send && ktls_recv)
+		logger(Core, Verbose, "%s (%s) established, using kernel TLS",
+		       SSL_get_version(g_ssl), SSL_get_cipher_name(g_ssl));
+	else if (ktls_send || ktls_recv)
+		logger(Core, Verbose, "%s (%s) established, using kernel TLS for %s only",
+		       SSL_get_version(g_ssl), SSL_get_cipher_name(g_ssl),
+		       ktls_send ? "send" : "receive");
+	else
+		logger(Core, Verbose, "%s (%s) established, using user space TLS",
+		       SSL_get_version(g_ssl), SSL_get_cipher_name(g_ssl));
+}
+
 /* Establish a SSL/TLS 1.0-1-2 connection */
 RD_BOOL
 tcp_tls_connect(void)
 {
 	int err;
 	long options;
+	SSL_SESSION *session;
+	char key[256];
+
+	timing_start(TIMING_TLS);
 
 	if (!g_ssl_initialized)
 	{
@@ -347,7 +694,17 @@ tcp_tls_connect(void)
 		options |= SSL_OP_NO_COMPRESSION;
 #endif // __SSL_OP_NO_COMPRESSION
 		options |= SSL_OP_DONT_INSERT_EMPTY_FRAGMENTS;
+#ifdef SSL_OP_ENABLE_KTLS
+		/* Let OpenSSL hand record encryption over to the kernel
+		   after the handshake, if kernel and cipher support it. */
+		options |= SSL_OP_ENABLE_KTLS;
+#endif
 		SSL_CTX_set_options(g_ssl_ctx, options);
+
+		/* Sessions are kept in our own cache which outlives the context */
+		SSL_CTX_set_session_cache_mode(g_ssl_ctx,
+					       SSL_SESS_CACHE_CLIENT | SSL_SESS_CACHE_NO_INTERNAL);
+		SSL_CTX_sess_set_new_cb(g_ssl_ctx, tcp_tls_new_session);
 	}
 
 	/* free old connection */
@@ -368,6 +725,16 @@ tcp_tls_connect(void)
 		goto fail;
 	}
 
+	snprintf(key, sizeof(key), "%s:%d/%s", g_last_server_name ? g_last_server_name : "",
+		 g_tcp_port_rdp, g_tls_version[0] ? g_tls_version : "1.0");
+	if (g_tls_session_key != NULL)
+		xfree(g_tls_session_key);
+	g_tls_session_key = xstrdup(key);
+
+	session = tcp_tls_session_get(key);
+	if (session != NULL)
+		SSL_set_session(g_ssl, session);
+
 	do
 	{
 		err = SSL_connect(g_ssl);
@@ -377,9 +744,17 @@ tcp_tls_connect(void)
 	if (err < 0)
 	{
 		rdssl_log_ssl_errors("tcp_tls_connect()");
+		/* don't offer a session that may have caused the failure again */
+		tcp_tls_session_remove(key);
 		goto fail;
 	}
 
+	if (SSL_session_reused(g_ssl))
+		logger(Core, Verbose, "Resumed TLS session with %s", key);
+
+	tcp_tls_log_offload();
+	timing_stop(TIMING_TLS);
+
 	return True;
 
       fail:
@@ -449,6 +824,154 @@ tcp_connect_resolve_hostname(const char *server)
 		g_last_server_name == NULL || strcmp(g_last_server_name, server) != 0);
 }
 
+/* Helper function to add milliseconds to a timeval */
+static void
+tcp_timeval_add_ms(struct timeval *tv, uint32 ms)
+{
+	tv->tv_sec += ms / 1000;
+	tv->tv_usec += (ms % 1000) * 1000;
+	if (tv->tv_usec >= 1000000)
+	{
+		tv->tv_sec++;
+		tv->tv_usec -= 1000000;
+	}
+}
+
+/* Connect to one of the given addresses using non-blocking sockets.
+   Attempts are started TCP_CONNECT_STAGGER ms apart, or as soon as all
+   running ones have failed, and the first one to complete wins. The
+   remaining attempts are cancelled. On success g_sock is set and the
+   index of the connected address is returned, otherwise -1. */
+static int
+tcp_connect_any(struct sockaddr **addrs, socklen_t * addrlens, int count)
+{
+	int socks[TCP_CONNECT_MAX_ADDRS];
+	int i, n, err, maxfd, started, pending, winner;
+	socklen_t len;
+	fd_set wfds;
+	struct timeval now, deadline, next_start, limit, tv;
+
+	started = 0;
+	pending = 0;
+	winner = -1;
+
+	gettimeofday(&now, NULL);
+	deadline = now;
+	tcp_timeval_add_ms(&deadline, TCP_CONNECT_TIMEOUT);
+	next_start = now;
+
+	while (winner == -1)
+	{
+		gettimeofday(&now, NULL);
+		if (timercmp(&now, &deadline, >=))
+		{
+			logger(Core, Debug, "tcp_connect_any(), timeout after %d ms",
+			       TCP_CONNECT_TIMEOUT);
+			break;
+		}
+
+		if (started < count && (pending == 0 || timercmp(&now, &next_start, >=)))
+		{
+			i = started++;
+			socks[i] = socket(addrs[i]->sa_family, SOCK_STREAM, 0);
+			if (socks[i] < 0)
+			{
+				logger(Core, Debug, "tcp_connect_any(), socket() failed: %s",
+				       TCP_STRERROR);
+				continue;
+			}
+
+			fcntl(socks[i], F_SETFL, fcntl(socks[i], F_GETFL) | O_NONBLOCK);
+			if (connect(socks[i], addrs[i], addrlens[i]) == 0)
+			{
+				winner = i;
+				break;
+			}
+
+			if (errno != EINPROGRESS)
+			{
+				logger(Core, Debug, "tcp_connect_any(), connect() failed: %s",
+				       TCP_STRERROR);
+				TCP_CLOSE(socks[i]);
+				socks[i] = -1;
+				continue;
+			}
+
+			pending++;
+			next_start = now;
+			tcp_timeval_add_ms(&next_start, TCP_CONNECT_STAGGER);
+			continue;
+		}
+
+		if (pending == 0)
+			break;
+
+		FD_ZERO(&wfds);
+		maxfd = -1;
+		for (i = 0; i < started; i++)
+		{
+			if (socks[i] == -1)
+				continue;
+			FD_SET(socks[i], &wfds);
+			maxfd = MAX(maxfd, socks[i]);
+		}
+
+		limit = deadline;
+		if (started < count && timercmp(&next_start, &deadline, <))
+			limit = next_start;
+		timerclear(&tv);
+		if (timercmp(&limit, &now, >))
+			timersub(&limit, &now, &tv);
+
+		n = select(maxfd + 1, NULL, &wfds, NULL, &tv);
+		if (n < 0)
+		{
+			if (errno == EINTR)
+				continue;
+			logger(Core, Error, "tcp_connect_any(), select() failed: %s", TCP_STRERROR);
+			break;
+		}
+
+		for (i = 0; i < started && winner == -1; i++)
+		{
+			if (socks[i] == -1 || !FD_ISSET(socks[i], &wfds))
+				continue;
+
+			len = sizeof(err);
+			if (getsockopt(socks[i], SOL_SOCKET, SO_ERROR, (void *) &err, &len) < 0)
+				err = errno;
+
+			if (err == 0)
+			{
+				winner = i;
+				continue;
+			}
+
+			logger(Core, Debug, "tcp_connect_any(), connect() failed: %s",
+			       strerror(err));
+			TCP_CLOSE(socks[i]);
+			socks[i] = -1;
+			pending--;
+		}
+	}
+
+	/* Cancel the attempts that lost the race */
+	for (i = 0; i < started; i++)
+	{
+		if (i == winner || socks[i] == -1)
+			continue;
+		logger(Core, Debug, "tcp_connect_any(), cancelling attempt %d", i);
+		TCP_CLOSE(socks[i]);
+	}
+
+	if (winner == -1)
+		return -1;
+
+	fcntl(socks[winner], F_SETFL, fcntl(socks[winner], F_GETFL) & ~O_NONBLOCK);
+	g_sock = socks[winner];
+	return winner;
+}
+
 /* Establish a connection on the TCP layer
 
    This function tries to avoid resolving any server address twice. The
@@ -469,9 +992,11 @@ tcp_connect(char *server)
 
 #ifdef IPv6
 
-	int n;
+	int n, count;
 	struct addrinfo hints, *res, *addr;
 	struct sockaddr *oldaddr;
+	struct sockaddr *addrs[TCP_CONNECT_MAX_ADDRS];
+	socklen_t addrlens[TCP_CONNECT_MAX_ADDRS];
 	char tcp_port_rdp_s[10];
 
 	if (tcp_connect_resolve_hostname(server))
@@ -482,7 +1007,10 @@ tcp_connect(char *server)
 		hints.ai_family = AF_UNSPEC;
 		hints.ai_socktype = SOCK_STREAM;
 
-		if ((n = getaddrinfo(server, tcp_port_rdp_s, &hints, &res)))
+		timing_start(TIMING_DNS);
+		n = getaddrinfo(server, tcp_port_rdp_s, &hints, &res);
+		timing_stop(TIMING_DNS);
+		if (n != 0)
 		{
 			logger(Core, Error, "tcp_connect(), getaddrinfo() failed: %s",
 			       gai_strerror(n));
@@ -495,16 +1023,10 @@ tcp_connect(char *server)
 	}
 
 	g_sock = -1;
+	count = 0;
 
-	for (addr = res; addr != NULL; addr = addr->ai_next)
+	for (addr = res; addr != NULL && count < TCP_CONNECT_MAX_ADDRS; addr = addr->ai_next)
 	{
-		g_sock = socket(addr->ai_family, addr->ai_socktype, addr->ai_protocol);
-		if (g_sock < 0)
-		{
-			logger(Core, Debug, "tcp_connect(), socket() failed: %s", TCP_STRERROR);
-			continue;
-		}
-
 		n = getnameinfo(addr->ai_addr, addr->ai_addrlen, buf, sizeof(buf), NULL, 0,
 				NI_NUMERICHOST);
 		if (n != 0)
@@ -516,19 +1038,25 @@ tcp_connect(char *server)
 
 		logger(Core, Debug, "tcp_connect(), trying %s (%s)", server, buf);
 
-		if (connect(g_sock, addr->ai_addr, addr->ai_addrlen) == 0)
-			break;
-
-		TCP_CLOSE(g_sock);
-		g_sock = -1;
+		addrs[count] = addr->ai_addr;
+		addrlens[count] = addr->ai_addrlen;
+		count++;
 	}
 
-	if (g_sock == -1)
+	timing_start(TIMING_TCP);
+	n = tcp_connect_any(addrs, addrlens, count);
+	timing_stop(TIMING_TCP);
+	if (n < 0)
 	{
 		logger(Core, Error, "tcp_connect(), unable to connect to %s", server);
+		if (res != g_server_address)
+			freeaddrinfo(res);
 		return False;
 	}
 
+	for (addr = res; n > 0; n--)
+		addr = addr->ai_next;
+
 	/* Save server address for later use, if we haven't already. */
 
 	if (g_server_address == NULL)
@@ -554,6 +1082,9 @@ tcp_connect(char *server)
 
 #else /* no IPv6 support */
 	struct hostent *nslookup = NULL;
+	struct sockaddr *addr;
+	socklen_t addrlen;
+	int n;
 
 	if (tcp_connect_resolve_hostname(server))
 	{
@@ -563,7 +1094,10 @@ tcp_connect(char *server)
 		g_server_address->sin_family = AF_INET;
 		g_server_address->sin_port = htons((uint16) g_tcp_port_rdp);
 
-		if ((nslookup = gethostbyname(server)) != NULL)
+		timing_start(TIMING_DNS);
+		nslookup = gethostbyname(server);
+		timing_stop(TIMING_DNS);
+		if (nslookup != NULL)
 		{
 			memcpy(&g_server_address->sin_addr, nslookup->h_addr,
 			       sizeof(g_server_address->sin_addr));
@@ -575,23 +1109,19 @@ tcp_connect(char *server)
 		}
 	}
 
-	if ((g_sock = socket(AF_INET, SOCK_STREAM, 0)) < 0)
-	{
-		logger(Core, Error, "tcp_connect(), socket() failed: %s", TCP_STRERROR);
-		return False;
-	}
-
 	logger(Core, Debug, "tcp_connect(), trying %s (%s)",
 	       server, inet_ntop(g_server_address->sin_family,
 				 &g_server_address->sin_addr, buf, sizeof(buf)));
 
-	if (connect(g_sock, (struct sockaddr *) g_server_address, sizeof(struct sockaddr)) < 0)
+	addr = (struct sockaddr *) g_server_address;
+	addrlen = sizeof(struct sockaddr_in);
+	timing_start(TIMING_TCP);
+	n = tcp_connect_any(&addr, &addrlen, 1);
+	timing_stop(TIMING_TCP);
+	if (n < 0)
 	{
 		if (!g_reconnect_loop)
-			logger(Core, Error, "tcp_connect(), connect() failed: %s", TCP_STRERROR);
-
-		TCP_CLOSE(g_sock);
-		g_sock = -1;
+			logger(Core, Error, "tcp_connect(), unable to connect to %s", server);
 		return False;
 	}
 
@@ -700,6 +1230,9 @@ tcp_reset_state(void)
 	{
 		s_reset(&g_out[i]);
 	}
+
+	s_reset(&g_held);
+	g_holding = False;
 }
 
 void
@@ -0,0 +1,20 @@
+#include <cgreen/mocks.h>
+#include "../rdesktop.h"
+
+void
+autodetect_process(STREAM s)
+{
+  mock(s);
+}
+
+void
+autodetect_bytes_received(uint32 length)
+{
+  mock(length);
+}
+
+void
+autodetect_reset_state()
+{
+  mock();
+}
@@ -0,0 +1,161 @@
+/* Microbenchmark for interleaved RLE bitmap decompression.
+
+   Encodes a screenful of 64x64 tiles that look roughly like a desktop
+   (long background runs, text drawn with fill or mix orders, and some
+   copied pixels), then decodes them over and over at each pixel size
+   and reports megabytes of pixels per second. Build it at two
+   revisions to compare them:
+
+       cd tests
+       make bitmap_bench
+       ./bitmap_bench [iterations]
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/time.h>
+
+#include "../rdesktop.h"
+#include "../bitmap.c"
+
+#define TILE 64
+#define TILES 300
+
+/* Stubs */
+
+void
+logger(log_subject_t c, log_level_t lvl, char *format, ...)
+{
+	UNUSED(c);
+	UNUSED(lvl);
+	UNUSED(format);
+}
+
+static uint32 g_seed = 1;
+
+static int
+rnd(int n)
+{
+	g_seed = g_seed * 1103515245 + 12345;
+	return (g_seed >> 16) % n;
+}
+
+/* Counts up to 0xffff in the 16 bit form, which every order takes */
+static uint8 *
+put_order(uint8 * p, int opcode, int count)
+{
+	*p++ = 0xf0 | opcode;
+	*p++ = count & 0xff;
+	*p++ = count >> 8;
+	return p;
+}
+
+static uint8 *
+put_pixel(uint8 * p, int bpp, int value)
+{
+	while (bpp-- > 0)
+		*p++ = value;
+	return p;
+}
+
+static uint32
+make_tile(uint8 * out, int bpp)
+{
+	uint8 *p = out;
+	int left = TILE * TILE, count, i;
+
+	/* The first line can only be colour, copy or white and black */
+	p = put_order(p, 3, TILE);
+	p = put_pixel(p, bpp, 0xee);
+	left -= TILE;
+
+	while (left > 0)
+	{
+		switch (rnd(4))
+		{
+			case 0:	/* Background */
+				count = 8 + rnd(200);
+				count = MIN(count, left);
+				p = put_order(p, 3, count);
+				p = put_pixel(p, bpp, 0xee);
+				break;
+			case 1:	/* Same as the line above */
+				count = 8 + rnd(100);
+				count = MIN(count, left);
+				p = put_order(p, 0, count);
+				break;
+			case 2:	/* Glyphs */
+				count = 8 * (1 + rnd(8));
+				count = MIN(count, left);
+				p = put_order(p, 7, count);
+				p = put_pixel(p, bpp, 0x33);
+				for (i = 0; i < (count + 7) / 8; i++)
+					*p++ = rnd(256);
+				break;
+			default:	/* Antialiasing and icons */
+				count = 1 + rnd(12);
+				count = MIN(count, left);
+				p = put_order(p, 4, count);
+				for (i = 0; i < count * bpp; i++)
+					*p++ = rnd(256);
+				break;
+		}
+		left -= count;
+	}
+	return p - out;
+}
+
+static double
+elapsed(struct timeval *start)
+{
+	struct timeval now;
+
+	gettimeofday(&now, NULL);
+	return (now.tv_sec - start->tv_sec) + (now.tv_usec - start->tv_usec) / 1000000.0;
+}
+
+int
+main(int argc, char **argv)
+{
+	static uint8 tiles[TILES][TILE * TILE * 3 * 2];
+	static uint32 lengths[TILES];
+	static uint8 output[TILE * TILE * 3];
+	struct timeval start;
+	long i, iterations = 20;
+	int bpp, t;
+	double secs;
+
+	if (argc > 1)
+		iterations = atol(argv[1]);
+
+	if (iterations < 1)
+	{
+		fprintf(stderr, "usage: %s [iterations]\n", argv[0]);
+		return 1;
+	}
+
+	for (bpp = 1; bpp <= 3; bpp++)
+	{
+		g_seed = 1;
+		for (t = 0; t < TILES; t++)
+			lengths[t] = make_tile(tiles[t], bpp);
+
+		gettimeofday(&start, NULL);
+		for (i = 0; i < iterations; i++)
+		{
+			for (t = 0; t < TILES; t++)
+			{
+				if (!bitmap_decompress(output, TILE, TILE, tiles[t], lengths[t], bpp))
+				{
+					fprintf(stderr, "tile %d failed to decode\n", t);
+					return 1;
+				}
+			}
+		}
+		secs = elapsed(&start);
+		printf("%d bytes per pixel: %.1f MB/s\n", bpp,
+		       (double) iterations * TILES * TILE * TILE * bpp / secs / 1000000.0);
+	}
+
+	return 0;
+}
@@ -0,0 +1,217 @@
+#include <cgreen/cgreen.h>
+#include <cgreen/mocks.h>
+#include "../bitmap.c"
+
+/* Boilerplate */
+Describe(Bitmap);
+BeforeEach(Bitmap) {}
+AfterEach(Bitmap) {}
+
+void logger(log_subject_t c, log_level_t lvl, char *format, ...) { (void) c; (void) lvl; (void) format; }
+
+/* Random but well formed interleaved RLE streams, using every order
+   the decoder knows in all of its encodings */
+
+static uint32 rng_state;
+
+static uint32 rng(void)
+{
+  rng_state ^= rng_state << 13;
+  rng_state ^= rng_state >> 17;
+  rng_state ^= rng_state << 5;
+  return rng_state;
+}
+
+static int rng_below(int n)
+{
+  return rng() % n;
+}
+
+static uint8 *put_bytes(uint8 *p, int count)
+{
+  while (count-- > 0)
+    *p++ = rng();
+  return p;
+}
+
+/* An order with a count in one of the three forms. Regular orders
+   take counts up to 31 in the code, lite ones up to 15. Fill or mix
+   counts in the code are in units of eight pixels. */
+static uint8 *put_order(uint8 *p, int opcode, int count, RD_BOOL fill_or_mix)
+{
+  int lite = (opcode >= 6), limit = lite ? 15 : 31, offset = lite ? 16 : 32;
+  uint8 code = lite ? (opcode + 6) << 4 : opcode << 5;
+
+  if (rng_below(8) == 0)
+  {
+    /* the 16 bit form is good for any count */
+  }
+  else if (fill_or_mix && count % 8 == 0 && count / 8 <= limit)
+  {
+    *p++ = code | (count / 8);
+    return p;
+  }
+  else if (fill_or_mix && count <= 256)
+  {
+    *p++ = code;
+    *p++ = count - 1;
+    return p;
+  }
+  else if (!fill_or_mix && count <= limit)
+  {
+    *p++ = code | count;
+    return p;
+  }
+  else if (!fill_or_mix && count <= 255 + offset)
+  {
+    *p++ = code;
+    *p++ = count - offset;
+    return p;
+  }
+
+  *p++ = 0xf0 | opcode;
+  *p++ = count & 0xff;
+  *p++ = count >> 8;
+  return p;
+}
+
+/* Fill about width * height pixels with random orders */
+static uint32 make_stream(uint8 *out, int width, int height, int bpp)
+{
+  uint8 *p = out;
+  int left = width * height, count, kind, opcode, longest;
+
+  while (left > 0)
+  {
+    kind = rng_below(12);
+    longest = rng_below(4) ? 40 : 600;
+    count = 1 + rng_below(MIN(left, longest));
+
+    switch (kind)
+    {
+      case 0: /* Fill, often twice in a row */
+      case 1:
+      case 2: /* Mix */
+      case 3: /* Colour */
+      case 4: /* Copy */
+        opcode = (kind <= 1) ? 0 : (kind == 2) ? 1 : kind;
+        p = put_order(p, opcode, count, False);
+        if (opcode == 3)
+          p = put_bytes(p, bpp);
+        else if (opcode == 4)
+          p = put_bytes(p, count * bpp);
+        break;
+      case 5: /* Fill or mix */
+      case 6: /* SetMix/Mix */
+      case 7: /* SetMix/FillOrMix */
+        opcode = (kind == 5) ? 2 : kind;
+        if (rng_below(2) && count >= 8)
+          count &= ~7;
+        if (opcode != 6 && count > 256 && rng_below(2))
+          count = 256;
+        p = put_order(p, opcode, count, opcode != 6);
+        if (opcode != 2)
+          p = put_bytes(p, bpp);
+        if (opcode != 6)
+          p = put_bytes(p, (count + 7) / 8);
+        break;
+      case 8: /* Bicolour, in pairs of pixels */
+        if (left < 2)
+          continue;
+        count = 1 + rng_below(left / 2 < 300 ? left / 2 : 300);
+        p = put_order(p, 8, count, False);
+        p = put_bytes(p, 2 * bpp);
+        count *= 2;
+        break;
+      case 9: /* FillOrMix_1 and FillOrMix_2 */
+        if (left < 8)
+          continue;
+        *p++ = rng_below(2) ? 0xf9 : 0xfa;
+        count = 8;
+        break;
+      default: /* White and Black */
+        *p++ = rng_below(2) ? 0xfd : 0xfe;
+        count = 1;
+        break;
+    }
+    left -= count;
+  }
+  return p - out;
+}
+
+static uint32 fnv1a(uint8 *data, int length)
+{
+  uint32 hash = 2166136261u;
+
+  while (length-- > 0)
+    hash = (hash ^ *data++) * 16777619u;
+  return hash;
+}
+
+/* Hashes of what the original per-depth decoders made of the streams
+   from seeds 1 to 60, at 1, 2 and 3 bytes per pixel in turn */
+static const uint32 corpus_hashes[] = {
+  0xb60ee929, 0xe4afba7e, 0xc1aa6d80, 0x6e3ed246, 0x7ea9c4b1, 0x8509c2d7,
+  0xae88d74e, 0xb18287ad, 0xbed2e3bf, 0x6fa9d9d4, 0x5ebfe3b6, 0x520a80af,
+  0xca792449, 0x12846f47, 0x53c7d066, 0xd9d73bb0, 0x88e6a54f, 0xfc5793f3,
+  0x8d6519b2, 0x9d202947, 0x7f03e71d, 0xd54d29c3, 0xe23e3b30, 0x09a6d327,
+  0xaae2e902, 0xe6fa9039, 0x164d952c, 0x91eee4d7, 0x3fea6836, 0xe56de3c2,
+  0xec4717f8, 0x15eefbf3, 0x2aff60c8, 0x4c0c9d8c, 0x604b415d, 0x28804e11,
+  0xe6f3482c, 0x3e67a721, 0x8148fca6, 0x68bd49d6, 0x37ce82bc, 0x05ed2f47,
+  0xbf47abce, 0x789383e1, 0x17c7c938, 0x0cb8f33c, 0xde350c4a, 0xf4fdfc01,
+  0x61f6ab7b, 0x6eabaca8, 0x58465b36, 0xe2411114, 0x14c162f7, 0x5fe34c46,
+  0x435c4cd5, 0xcb8dcfb2, 0x04ced2cd, 0xaf771b86, 0x767c5032, 0x5d2b0f28,
+};
+
+static uint8 input[1 << 16];
+static uint8 output[100 * 40 * 3];
+
+Ensure(Bitmap, decodes_the_corpus_like_the_original_decoders)
+{
+  int i, width, height, bpp;
+  uint32 length;
+
+  for (i = 0; i < 60; i++)
+  {
+    rng_state = 1 + i;
+    bpp = 1 + i % 3;
+    width = 1 + rng_below(100);
+    height = 1 + rng_below(40);
+    length = make_stream(input, width, height, bpp);
+
+    memset(output, 0, sizeof(output));
+    assert_that(bitmap_decompress(output, width, height, input, length, bpp), is_true);
+    assert_that(fnv1a(output, width * height * bpp), is_equal_to(corpus_hashes[i]));
+  }
+}
+
+Ensure(Bitmap, inserts_a_mix_pixel_between_fill_runs)
+{
+  /* Colour 0x11 on the first line, then two fills of two pixels on
+     the second. The second fill starts with the previous line XORed
+     with the default mix. */
+  uint8 stream[] = {0x64, 0x11, 0x02, 0x02};
+  uint8 expected[] = {0x11, 0x11, 0xee, 0x11, 0x11, 0x11, 0x11, 0x11};
+
+  memset(output, 0, sizeof(output));
+  assert_that(bitmap_decompress(output, 4, 2, stream, sizeof(stream), 1), is_true);
+  assert_that(output, is_equal_to_contents_of(expected, sizeof(expected)));
+}
+
+Ensure(Bitmap, fails_on_truncated_streams)
+{
+  uint8 fill_or_mix[] = {0x41};  /* eight pixels, the mask byte missing */
+  uint8 copy[] = {0x83, 0x01, 0x02};  /* three pixels, two given */
+  uint8 colour[] = {0xf3, 0x01};  /* no count */
+
+  assert_that(bitmap_decompress(output, 8, 1, fill_or_mix, sizeof(fill_or_mix), 1), is_false);
+  assert_that(bitmap_decompress(output, 8, 1, copy, sizeof(copy), 1), is_false);
+  assert_that(bitmap_decompress(output, 8, 1, colour, sizeof(colour), 2), is_false);
+}
+
+Ensure(Bitmap, fails_when_the_pixels_overflow_the_bitmap)
+{
+  uint8 stream[] = {0xfd, 0xfd, 0xfd};
+
+  assert_that(bitmap_decompress(output, 2, 1, stream, sizeof(stream), 3), is_false);
+}
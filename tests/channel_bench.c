@@ -0,0 +1,261 @@
+/* Benchmark for sending static virtual channel data.
+
+   Sends disk read completions the way rdpdr does, 64 kB at a time,
+   over a socket pair drained by a second thread. The copying path,
+   taken when standard RDP encryption is on (the encryption itself is
+   stubbed out here), is compared with the vectored path taken
+   otherwise. Reports MB/s of payload for both.
+
+       cd tests
+       make channel_bench
+       ./channel_bench [megabytes]
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/time.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+
+#include "../rdesktop.h"
+
+RDP_VERSION g_rdp_version = RDP_V5;
+RD_BOOL g_encryption = False;
+
+#include "../channels.c"
+
+#define READ_LENGTH 65536
+
+static int g_bench_sock[2];
+static struct stream g_bench_out;
+
+/* Stubs */
+
+void *
+xmalloc(int size)
+{
+	void *mem = malloc(size);
+	if (mem == NULL)
+		exit(EX_UNAVAILABLE);
+	return mem;
+}
+
+void *
+xrealloc(void *oldmem, size_t size)
+{
+	void *mem = realloc(oldmem, size ? size : 1);
+	if (mem == NULL)
+		exit(EX_UNAVAILABLE);
+	return mem;
+}
+
+void
+xfree(void *mem)
+{
+	free(mem);
+}
+
+void
+logger(log_subject_t c, log_level_t lvl, char *format, ...)
+{
+	UNUSED(c);
+	UNUSED(lvl);
+	UNUSED(format);
+}
+
+static void
+bench_write(uint8 * data, size_t length)
+{
+	ssize_t sent;
+
+	while (length > 0)
+	{
+		sent = write(g_bench_sock[0], data, length);
+		if (sent <= 0)
+			exit(1);
+		data += sent;
+		length -= sent;
+	}
+}
+
+/* The layers below the channel, as in iso_init(), mcs_init() and
+   sec_init() without encryption of the data */
+STREAM
+sec_init(uint32 flags, int maxlen)
+{
+	int hdrlen = (flags & SEC_ENCRYPT) ? 12 : 0;
+
+	if ((uint32) maxlen + 7 + 8 + hdrlen > g_bench_out.size)
+	{
+		g_bench_out.size = maxlen + 7 + 8 + hdrlen;
+		g_bench_out.data = (uint8 *) xrealloc(g_bench_out.data, g_bench_out.size);
+	}
+	g_bench_out.p = g_bench_out.data;
+	g_bench_out.end = g_bench_out.data + g_bench_out.size;
+
+	s_push_layer(&g_bench_out, iso_hdr, 7);
+	s_push_layer(&g_bench_out, mcs_hdr, 8);
+	s_push_layer(&g_bench_out, sec_hdr, hdrlen);
+	return &g_bench_out;
+}
+
+void
+sec_send_to_channel(STREAM s, uint32 flags, uint16 channel)
+{
+	UNUSED(flags);
+	UNUSED(channel);
+	memset(s->data, 0, s->sec_hdr - s->data);
+	bench_write(s->data, s->end - s->data);
+}
+
+int
+sec_header_length(uint32 flags)
+{
+	return (flags & SEC_ENCRYPT) ? 12 : 0;
+}
+
+void
+iso_out_data_header(STREAM s, uint16 length)
+{
+	UNUSED(length);
+	out_uint8s(s, 7);
+}
+
+void
+mcs_out_data_header(STREAM s, uint16 channel, uint16 length)
+{
+	UNUSED(channel);
+	UNUSED(length);
+	out_uint8s(s, 8);
+}
+
+void
+tcp_send_vector(SEND_VECTOR * vector, int count)
+{
+	struct iovec iov[128] = { {NULL, 0} };
+	int i;
+	ssize_t sent, total = 0;
+
+	if (count <= 0)
+		return;
+
+	/* channels.c sends far fewer pieces at a time */
+	if (count > (int) (sizeof(iov) / sizeof(iov[0])))
+		exit(1);
+
+	for (i = 0; i < count; i++)
+	{
+		iov[i].iov_base = vector[i].data;
+		iov[i].iov_len = vector[i].length;
+		total += vector[i].length;
+	}
+
+	sent = writev(g_bench_sock[0], iov, count);
+	if (sent < 0)
+		exit(1);
+
+	/* finish a short write piece by piece */
+	for (i = 0; i < count && sent < total; i++)
+	{
+		if ((size_t) sent >= iov[i].iov_len)
+		{
+			sent -= iov[i].iov_len;
+			total -= iov[i].iov_len;
+			continue;
+		}
+		bench_write((uint8 *) iov[i].iov_base + sent, iov[i].iov_len - sent);
+		total -= iov[i].iov_len;
+		sent = 0;
+	}
+}
+
+static void
+rdpdr_process(STREAM s)
+{
+	UNUSED(s);
+}
+
+/* The other end of the connection */
+static void *
+drain(void *arg)
+{
+	static uint8 buffer[262144];
+	UNUSED(arg);
+
+	while (read(g_bench_sock[1], buffer, sizeof(buffer)) > 0);
+	return NULL;
+}
+
+/* As rdpdr_send_completion() */
+static void
+send_completion(VCHANNEL * channel, uint32 id, uint8 * buffer, uint32 length)
+{
+	STREAM s;
+
+	s = channel_init(channel, 20 + length);
+	out_uint16_le(s, 0x4472);	/* RDPDR_CTYP_CORE */
+	out_uint16_le(s, 0x4943);	/* PAKID_CORE_DEVICE_IOCOMPLETION */
+	out_uint32_le(s, 1);
+	out_uint32_le(s, id);
+	out_uint32_le(s, 0);
+	out_uint32_le(s, length);
+	out_uint8p(s, buffer, length);
+	s_mark_end(s);
+	channel_send(s, channel);
+}
+
+static double
+elapsed(struct timeval *start)
+{
+	struct timeval now;
+
+	gettimeofday(&now, NULL);
+	return (now.tv_sec - start->tv_sec) + (now.tv_usec - start->tv_usec) / 1e6;
+}
+
+int
+main(int argc, char *argv[])
+{
+	static uint8 buffer[READ_LENGTH];
+	VCHANNEL *channel;
+	pthread_t reader;
+	struct timeval start;
+	int i, mode, reads, megabytes = 512;
+	double secs;
+
+	if (argc > 1)
+		megabytes = atoi(argv[1]);
+
+	if (megabytes < 1)
+	{
+		fprintf(stderr, "usage: %s [megabytes]\n", argv[0]);
+		return 1;
+	}
+
+	if (socketpair(AF_UNIX, SOCK_STREAM, 0, g_bench_sock) != 0)
+		return 1;
+	pthread_create(&reader, NULL, drain, NULL);
+
+	channel = channel_register("rdpdr", CHANNEL_OPTION_INITIALIZED, rdpdr_process);
+	memset(buffer, 0x5a, sizeof(buffer));
+	reads = megabytes * 1024 * 1024 / READ_LENGTH;
+
+	for (mode = 0; mode < 2; mode++)
+	{
+		g_encryption = (mode == 0);
+
+		gettimeofday(&start, NULL);
+		for (i = 0; i < reads; i++)
+			send_completion(channel, i, buffer, READ_LENGTH);
+		secs = elapsed(&start);
+
+		printf("%-10s %8.1f MB/s\n", mode == 0 ? "copying" : "vectored",
+		       (double) reads * READ_LENGTH / secs / 1e6);
+	}
+
+	shutdown(g_bench_sock[0], SHUT_WR);
+	pthread_join(reader, NULL);
+	return 0;
+}
@@ -0,0 +1,257 @@
+#include <cgreen/cgreen.h>
+#include <cgreen/mocks.h>
+#include "../dvc.c"
+
+char g_codepage[16];
+
+/* Boilerplate */
+Describe(DVC);
+BeforeEach(DVC) {}
+AfterEach(DVC) {}
+
+/* malloc; exit if out of memory */
+void *
+xmalloc(int size)
+{
+	void *mem = malloc(size);
+	if (mem == NULL)
+	{
+		logger(Core, Error, "xmalloc, failed to allocate %d bytes", size);
+		exit(EX_UNAVAILABLE);
+	}
+	return mem;
+}
+
+/* realloc; exit if out of memory */
+void *
+xrealloc(void *oldmem, size_t size)
+{
+	void *mem;
+
+	if (size == 0)
+		size = 1;
+	mem = realloc(oldmem, size);
+	if (mem == NULL)
+	{
+		logger(Core, Error, "xrealloc, failed to reallocate %ld bytes", size);
+		exit(EX_UNAVAILABLE);
+	}
+	return mem;
+}
+
+/* free */
+void
+xfree(void *mem)
+{
+	free(mem);
+}
+
+void logger(log_subject_t c, log_level_t lvl, char *format, ...) { (void) c; (void) lvl; (void) format; }
+
+uint32
+utils_djb2_hash(const char *str)
+{
+	uint32 hash = 5381;
+
+	while (*str)
+		hash = hash * 33 + *str++;
+	return hash;
+}
+
+/* The static channel, where responses go */
+static uint8 sent_data[64];
+static struct stream sent;
+
+VCHANNEL *channel_register(char *name, uint32 flags, void (*callback) (STREAM))
+{
+  (void) name; (void) flags; (void) callback;
+  return NULL;
+}
+
+STREAM channel_init(VCHANNEL *channel, uint32 length)
+{
+  (void) channel; (void) length;
+  memset(&sent, 0, sizeof(sent));
+  sent.data = sent.p = sent_data;
+  sent.size = sizeof(sent_data);
+  sent.end = sent_data + sizeof(sent_data);
+  return &sent;
+}
+
+void channel_send(STREAM s, VCHANNEL *channel)
+{
+  (void) s; (void) channel;
+}
+
+static int received;
+static uint32 received_length;
+static uint16 received_value;
+
+static void count_handler(STREAM s)
+{
+  received++;
+  received_length = s->end - s->p;
+  in_uint16_le(s, received_value);
+}
+
+static void process(uint8 *data, size_t length)
+{
+  struct stream s;
+  memset(&s, 0, sizeof(s));
+  s.data = s.p = data;
+  s.size = length;
+  s.end = data + length;
+  dvc_process_pdu(&s);
+}
+
+/* DYNVC_CREATE_REQ with a two byte channel id */
+static void server_create(uint16 id, const char *name)
+{
+  uint8 data[64];
+  data[0] = 0x11;
+  data[1] = id & 0xff;
+  data[2] = id >> 8;
+  strcpy((char *) data + 3, name);
+  process(data, 4 + strlen(name));
+}
+
+/* DYNVC_DATA with a two byte channel id and a two byte value */
+static void server_data(uint16 id, uint16 value)
+{
+  uint8 data[] = {0x31, id & 0xff, id >> 8, value & 0xff, value >> 8};
+  process(data, sizeof(data));
+}
+
+static void server_close(uint16 id)
+{
+  uint8 data[] = {0x41, id & 0xff, id >> 8};
+  process(data, sizeof(data));
+}
+
+static void forget_channels(void)
+{
+  dvc_channel_t *ch, *next;
+  uint32 i;
+
+  for (i = 0; i < channels[DVC_BY_NAME].size; i++)
+  {
+    for (ch = channels[DVC_BY_NAME].buckets[i]; ch != NULL; ch = next)
+    {
+      next = ch->next[DVC_BY_NAME];
+      xfree(ch->reassembly);
+      xfree(ch);
+    }
+  }
+  xfree(channels[DVC_BY_NAME].buckets);
+  xfree(channels[DVC_BY_ID].buckets);
+  memset(channels, 0, sizeof(channels));
+  received = 0;
+}
+
+#define MANY_CHANNELS 500
+
+Ensure(DVC, can_open_and_close_hundreds_of_channels)
+{
+  char name[32];
+  int i;
+
+  forget_channels();
+
+  for (i = 0; i < MANY_CHANNELS; i++)
+  {
+    sprintf(name, "channel%d", i);
+    assert_that(dvc_channels_register(name, count_handler), is_true);
+  }
+  assert_that(dvc_channels_register("channel7", count_handler), is_false);
+
+  for (i = 0; i < MANY_CHANNELS; i++)
+  {
+    sprintf(name, "channel%d", i);
+    server_create(i + 1, name);
+    assert_that(dvc_channels_is_available(name), is_true);
+  }
+
+  for (i = 0; i < MANY_CHANNELS; i++)
+  {
+    server_data(i + 1, i);
+    assert_that(received_value, is_equal_to(i));
+  }
+  assert_that(received, is_equal_to(MANY_CHANNELS));
+
+  /* Close every other channel, data for it goes nowhere */
+  for (i = 0; i < MANY_CHANNELS; i += 2)
+    server_close(i + 1);
+
+  for (i = 0; i < MANY_CHANNELS; i++)
+  {
+    sprintf(name, "channel%d", i);
+    assert_that(dvc_channels_is_available(name), is_equal_to(i % 2 == 1));
+    server_data(i + 1, i);
+  }
+  assert_that(received, is_equal_to(MANY_CHANNELS + MANY_CHANNELS / 2));
+
+  /* Reopen them under new ids */
+  for (i = 0; i < MANY_CHANNELS; i += 2)
+  {
+    sprintf(name, "channel%d", i);
+    server_create(1000 + i, name);
+    server_data(1000 + i, i);
+    assert_that(received_value, is_equal_to(i));
+    assert_that(dvc_channels_get_id(name), is_equal_to(1000 + i));
+  }
+  assert_that(received, is_equal_to(2 * MANY_CHANNELS));
+  assert_that(channels[DVC_BY_ID].count, is_equal_to(MANY_CHANNELS));
+}
+
+Ensure(DVC, refuses_to_open_unregistered_channels)
+{
+  forget_channels();
+
+  server_create(1, "unknown");
+  server_data(1, 42);
+
+  assert_that(dvc_channels_is_available("unknown"), is_false);
+  assert_that(sent_data[3], is_equal_to(0xff));  /* CreationStatus */
+  assert_that(received, is_equal_to(0));
+}
+
+Ensure(DVC, reassembles_fragmented_messages)
+{
+  uint8 first[] = {0x21, 0x09, 0x00, 0x08, 0x34, 0x12, 'a', 'b'};
+  uint8 middle[] = {0x31, 0x09, 0x00, 'c'};
+  uint8 last[] = {0x31, 0x09, 0x00, 'd', 'e', 'f'};
+  uint8 overrun[] = {0x31, 0x09, 0x00, 'x', 'y', 'z', 'w', 'v', 'u', 't'};
+
+  forget_channels();
+  dvc_channels_register("fragments", count_handler);
+  server_create(9, "fragments");
+
+  process(first, sizeof(first));
+  process(middle, sizeof(middle));
+  assert_that(received, is_equal_to(0));
+  process(last, sizeof(last));
+  assert_that(received, is_equal_to(1));
+  assert_that(received_length, is_equal_to(8));
+  assert_that(received_value, is_equal_to(0x1234));
+
+  /* A message longer than announced is dropped */
+  process(first, sizeof(first));
+  process(overrun, sizeof(overrun));
+  assert_that(received, is_equal_to(1));
+}
+
+Ensure(DVC, drops_oversized_messages)
+{
+  /* DYNVC_DATA_FIRST announcing 256 MB */
+  uint8 first[] = {0x29, 0x09, 0x00, 0x00, 0x00, 0x00, 0x10, 0x34, 0x12};
+
+  forget_channels();
+  dvc_channels_register("fragments", count_handler);
+  server_create(9, "fragments");
+
+  process(first, sizeof(first));
+  server_data(9, 0x5678);
+
+  assert_that(received, is_equal_to(1));
+  assert_that(received_value, is_equal_to(0x5678));
+}
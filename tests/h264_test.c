@@ -0,0 +1,358 @@
+#include <cgreen/cgreen.h>
+#include <cgreen/mocks.h>
+#include <math.h>
+#include "../h264.c"
+
+/* Boilerplate */
+Describe(H264);
+BeforeEach(H264) {}
+AfterEach(H264) {}
+
+/* malloc; exit if out of memory */
+void *
+xmalloc(int size)
+{
+	void *mem = malloc(size);
+	if (mem == NULL)
+	{
+		logger(Core, Error, "xmalloc, failed to allocate %d bytes", size);
+		exit(EX_UNAVAILABLE);
+	}
+	return mem;
+}
+
+/* realloc; exit if out of memory */
+void *
+xrealloc(void *oldmem, size_t size)
+{
+	void *mem;
+
+	if (size == 0)
+		size = 1;
+	mem = realloc(oldmem, size);
+	if (mem == NULL)
+	{
+		logger(Core, Error, "xrealloc, failed to reallocate %ld bytes", size);
+		exit(EX_UNAVAILABLE);
+	}
+	return mem;
+}
+
+/* free */
+void
+xfree(void *mem)
+{
+	free(mem);
+}
+
+void logger(log_subject_t c, log_level_t lvl, char *format, ...) { (void) c; (void) lvl; (void) format; }
+
+/* A 32x32 baseline profile stream: SPS, PPS and an IDR frame of four
+   I_PCM macroblocks, so that decoding is lossless and the picture is
+   given by sample_y(), sample_u() and sample_v() below */
+static uint8 sample[] = {
+  0x00, 0x00, 0x00, 0x01, 0x67, 0x42, 0xc0, 0x0a, 0xda, 0x25, 0x90, 0x00,
+  0x00, 0x00, 0x01, 0x68, 0xce, 0x3c, 0x80, 0x00, 0x00, 0x00, 0x01, 0x65,
+  0x88, 0x84, 0xa0, 0xd0, 0x10, 0x17, 0x1e, 0x25, 0x2c, 0x33, 0x3a, 0x41,
+  0x48, 0x4f, 0x56, 0x5d, 0x64, 0x6b, 0x72, 0x79, 0x15, 0x1c, 0x23, 0x2a,
+  0x31, 0x38, 0x3f, 0x46, 0x4d, 0x54, 0x5b, 0x62, 0x69, 0x70, 0x77, 0x7e,
+  0x1a, 0x21, 0x28, 0x2f, 0x36, 0x3d, 0x44, 0x4b, 0x52, 0x59, 0x60, 0x67,
+  0x6e, 0x75, 0x7c, 0x83, 0x1f, 0x26, 0x2d, 0x34, 0x3b, 0x42, 0x49, 0x50,
+  0x57, 0x5e, 0x65, 0x6c, 0x73, 0x7a, 0x81, 0x88, 0x24, 0x2b, 0x32, 0x39,
+  0x40, 0x47, 0x4e, 0x55, 0x5c, 0x63, 0x6a, 0x71, 0x78, 0x7f, 0x86, 0x8d,
+  0x29, 0x30, 0x37, 0x3e, 0x45, 0x4c, 0x53, 0x5a, 0x61, 0x68, 0x6f, 0x76,
+  0x7d, 0x84, 0x8b, 0x92, 0x2e, 0x35, 0x3c, 0x43, 0x4a, 0x51, 0x58, 0x5f,
+  0x66, 0x6d, 0x74, 0x7b, 0x82, 0x89, 0x90, 0x97, 0x33, 0x3a, 0x41, 0x48,
+  0x4f, 0x56, 0x5d, 0x64, 0x6b, 0x72, 0x79, 0x80, 0x87, 0x8e, 0x95, 0x9c,
+  0x38, 0x3f, 0x46, 0x4d, 0x54, 0x5b, 0x62, 0x69, 0x70, 0x77, 0x7e, 0x85,
+  0x8c, 0x93, 0x9a, 0xa1, 0x3d, 0x44, 0x4b, 0x52, 0x59, 0x60, 0x67, 0x6e,
+  0x75, 0x7c, 0x83, 0x8a, 0x91, 0x98, 0x9f, 0xa6, 0x42, 0x49, 0x50, 0x57,
+  0x5e, 0x65, 0x6c, 0x73, 0x7a, 0x81, 0x88, 0x8f, 0x96, 0x9d, 0xa4, 0xab,
+  0x47, 0x4e, 0x55, 0x5c, 0x63, 0x6a, 0x71, 0x78, 0x7f, 0x86, 0x8d, 0x94,
+  0x9b, 0xa2, 0xa9, 0xb0, 0x4c, 0x53, 0x5a, 0x61, 0x68, 0x6f, 0x76, 0x7d,
+  0x84, 0x8b, 0x92, 0x99, 0xa0, 0xa7, 0xae, 0xb5, 0x51, 0x58, 0x5f, 0x66,
+  0x6d, 0x74, 0x7b, 0x82, 0x89, 0x90, 0x97, 0x9e, 0xa5, 0xac, 0xb3, 0xba,
+  0x56, 0x5d, 0x64, 0x6b, 0x72, 0x79, 0x80, 0x87, 0x8e, 0x95, 0x9c, 0xa3,
+  0xaa, 0xb1, 0xb8, 0xbf, 0x5b, 0x62, 0x69, 0x70, 0x77, 0x7e, 0x85, 0x8c,
+  0x93, 0x9a, 0xa1, 0xa8, 0xaf, 0xb6, 0xbd, 0xc4, 0x28, 0x33, 0x3e, 0x49,
+  0x54, 0x5f, 0x6a, 0x75, 0x2b, 0x36, 0x41, 0x4c, 0x57, 0x62, 0x6d, 0x78,
+  0x2e, 0x39, 0x44, 0x4f, 0x5a, 0x65, 0x70, 0x7b, 0x31, 0x3c, 0x47, 0x52,
+  0x5d, 0x68, 0x73, 0x7e, 0x34, 0x3f, 0x4a, 0x55, 0x60, 0x6b, 0x76, 0x81,
+  0x37, 0x42, 0x4d, 0x58, 0x63, 0x6e, 0x79, 0x84, 0x3a, 0x45, 0x50, 0x5b,
+  0x66, 0x71, 0x7c, 0x87, 0x3d, 0x48, 0x53, 0x5e, 0x69, 0x74, 0x7f, 0x8a,
+  0xc8, 0xc3, 0xbe, 0xb9, 0xb4, 0xaf, 0xaa, 0xa5, 0xbf, 0xba, 0xb5, 0xb0,
+  0xab, 0xa6, 0xa1, 0x9c, 0xb6, 0xb1, 0xac, 0xa7, 0xa2, 0x9d, 0x98, 0x93,
+  0xad, 0xa8, 0xa3, 0x9e, 0x99, 0x94, 0x8f, 0x8a, 0xa4, 0x9f, 0x9a, 0x95,
+  0x90, 0x8b, 0x86, 0x81, 0x9b, 0x96, 0x91, 0x8c, 0x87, 0x82, 0x7d, 0x78,
+  0x92, 0x8d, 0x88, 0x83, 0x7e, 0x79, 0x74, 0x6f, 0x89, 0x84, 0x7f, 0x7a,
+  0x75, 0x70, 0x6b, 0x66, 0x0d, 0x00, 0x80, 0x87, 0x8e, 0x95, 0x9c, 0xa3,
+  0xaa, 0xb1, 0xb8, 0xbf, 0xc6, 0xcd, 0xd4, 0xdb, 0xe2, 0xe9, 0x85, 0x8c,
+  0x93, 0x9a, 0xa1, 0xa8, 0xaf, 0xb6, 0xbd, 0xc4, 0xcb, 0xd2, 0xd9, 0xe0,
+  0xe7, 0x12, 0x8a, 0x91, 0x98, 0x9f, 0xa6, 0xad, 0xb4, 0xbb, 0xc2, 0xc9,
+  0xd0, 0xd7, 0xde, 0xe5, 0x10, 0x17, 0x8f, 0x96, 0x9d, 0xa4, 0xab, 0xb2,
+  0xb9, 0xc0, 0xc7, 0xce, 0xd5, 0xdc, 0xe3, 0xea, 0x15, 0x1c, 0x94, 0x9b,
+  0xa2, 0xa9, 0xb0, 0xb7, 0xbe, 0xc5, 0xcc, 0xd3, 0xda, 0xe1, 0xe8, 0x13,
+  0x1a, 0x21, 0x99, 0xa0, 0xa7, 0xae, 0xb5, 0xbc, 0xc3, 0xca, 0xd1, 0xd8,
+  0xdf, 0xe6, 0x11, 0x18, 0x1f, 0x26, 0x9e, 0xa5, 0xac, 0xb3, 0xba, 0xc1,
+  0xc8, 0xcf, 0xd6, 0xdd, 0xe4, 0xeb, 0x16, 0x1d, 0x24, 0x2b, 0xa3, 0xaa,
+  0xb1, 0xb8, 0xbf, 0xc6, 0xcd, 0xd4, 0xdb, 0xe2, 0xe9, 0x14, 0x1b, 0x22,
+  0x29, 0x30, 0xa8, 0xaf, 0xb6, 0xbd, 0xc4, 0xcb, 0xd2, 0xd9, 0xe0, 0xe7,
+  0x12, 0x19, 0x20, 0x27, 0x2e, 0x35, 0xad, 0xb4, 0xbb, 0xc2, 0xc9, 0xd0,
+  0xd7, 0xde, 0xe5, 0x10, 0x17, 0x1e, 0x25, 0x2c, 0x33, 0x3a, 0xb2, 0xb9,
+  0xc0, 0xc7, 0xce, 0xd5, 0xdc, 0xe3, 0xea, 0x15, 0x1c, 0x23, 0x2a, 0x31,
+  0x38, 0x3f, 0xb7, 0xbe, 0xc5, 0xcc, 0xd3, 0xda, 0xe1, 0xe8, 0x13, 0x1a,
+  0x21, 0x28, 0x2f, 0x36, 0x3d, 0x44, 0xbc, 0xc3, 0xca, 0xd1, 0xd8, 0xdf,
+  0xe6, 0x11, 0x18, 0x1f, 0x26, 0x2d, 0x34, 0x3b, 0x42, 0x49, 0xc1, 0xc8,
+  0xcf, 0xd6, 0xdd, 0xe4, 0xeb, 0x16, 0x1d, 0x24, 0x2b, 0x32, 0x39, 0x40,
+  0x47, 0x4e, 0xc6, 0xcd, 0xd4, 0xdb, 0xe2, 0xe9, 0x14, 0x1b, 0x22, 0x29,
+  0x30, 0x37, 0x3e, 0x45, 0x4c, 0x53, 0xcb, 0xd2, 0xd9, 0xe0, 0xe7, 0x12,
+  0x19, 0x20, 0x27, 0x2e, 0x35, 0x3c, 0x43, 0x4a, 0x51, 0x58, 0x80, 0x8b,
+  0x96, 0xa1, 0xac, 0xb7, 0xc2, 0xcd, 0x83, 0x8e, 0x99, 0xa4, 0xaf, 0xba,
+  0xc5, 0xd0, 0x86, 0x91, 0x9c, 0xa7, 0xb2, 0xbd, 0xc8, 0xd3, 0x89, 0x94,
+  0x9f, 0xaa, 0xb5, 0xc0, 0xcb, 0xd6, 0x8c, 0x97, 0xa2, 0xad, 0xb8, 0xc3,
+  0xce, 0x29, 0x8f, 0x9a, 0xa5, 0xb0, 0xbb, 0xc6, 0xd1, 0x2c, 0x92, 0x9d,
+  0xa8, 0xb3, 0xbe, 0xc9, 0xd4, 0x2f, 0x95, 0xa0, 0xab, 0xb6, 0xc1, 0xcc,
+  0xd7, 0x32, 0xa0, 0x9b, 0x96, 0x91, 0x8c, 0x87, 0x82, 0x7d, 0x97, 0x92,
+  0x8d, 0x88, 0x83, 0x7e, 0x79, 0x74, 0x8e, 0x89, 0x84, 0x7f, 0x7a, 0x75,
+  0x70, 0x6b, 0x85, 0x80, 0x7b, 0x76, 0x71, 0x6c, 0x67, 0x62, 0x7c, 0x77,
+  0x72, 0x6d, 0x68, 0x63, 0x5e, 0x59, 0x73, 0x6e, 0x69, 0x64, 0x5f, 0x5a,
+  0x55, 0x50, 0x6a, 0x65, 0x60, 0x5b, 0x56, 0x51, 0x4c, 0x47, 0x61, 0x5c,
+  0x57, 0x52, 0x4d, 0x48, 0x43, 0x3e, 0x0d, 0x00, 0x60, 0x67, 0x6e, 0x75,
+  0x7c, 0x83, 0x8a, 0x91, 0x98, 0x9f, 0xa6, 0xad, 0xb4, 0xbb, 0xc2, 0xc9,
+  0x65, 0x6c, 0x73, 0x7a, 0x81, 0x88, 0x8f, 0x96, 0x9d, 0xa4, 0xab, 0xb2,
+  0xb9, 0xc0, 0xc7, 0xce, 0x6a, 0x71, 0x78, 0x7f, 0x86, 0x8d, 0x94, 0x9b,
+  0xa2, 0xa9, 0xb0, 0xb7, 0xbe, 0xc5, 0xcc, 0xd3, 0x6f, 0x76, 0x7d, 0x84,
+  0x8b, 0x92, 0x99, 0xa0, 0xa7, 0xae, 0xb5, 0xbc, 0xc3, 0xca, 0xd1, 0xd8,
+  0x74, 0x7b, 0x82, 0x89, 0x90, 0x97, 0x9e, 0xa5, 0xac, 0xb3, 0xba, 0xc1,
+  0xc8, 0xcf, 0xd6, 0xdd, 0x79, 0x80, 0x87, 0x8e, 0x95, 0x9c, 0xa3, 0xaa,
+  0xb1, 0xb8, 0xbf, 0xc6, 0xcd, 0xd4, 0xdb, 0xe2, 0x7e, 0x85, 0x8c, 0x93,
+  0x9a, 0xa1, 0xa8, 0xaf, 0xb6, 0xbd, 0xc4, 0xcb, 0xd2, 0xd9, 0xe0, 0xe7,
+  0x83, 0x8a, 0x91, 0x98, 0x9f, 0xa6, 0xad, 0xb4, 0xbb, 0xc2, 0xc9, 0xd0,
+  0xd7, 0xde, 0xe5, 0x10, 0x88, 0x8f, 0x96, 0x9d, 0xa4, 0xab, 0xb2, 0xb9,
+  0xc0, 0xc7, 0xce, 0xd5, 0xdc, 0xe3, 0xea, 0x15, 0x8d, 0x94, 0x9b, 0xa2,
+  0xa9, 0xb0, 0xb7, 0xbe, 0xc5, 0xcc, 0xd3, 0xda, 0xe1, 0xe8, 0x13, 0x1a,
+  0x92, 0x99, 0xa0, 0xa7, 0xae, 0xb5, 0xbc, 0xc3, 0xca, 0xd1, 0xd8, 0xdf,
+  0xe6, 0x11, 0x18, 0x1f, 0x97, 0x9e, 0xa5, 0xac, 0xb3, 0xba, 0xc1, 0xc8,
+  0xcf, 0xd6, 0xdd, 0xe4, 0xeb, 0x16, 0x1d, 0x24, 0x9c, 0xa3, 0xaa, 0xb1,
+  0xb8, 0xbf, 0xc6, 0xcd, 0xd4, 0xdb, 0xe2, 0xe9, 0x14, 0x1b, 0x22, 0x29,
+  0xa1, 0xa8, 0xaf, 0xb6, 0xbd, 0xc4, 0xcb, 0xd2, 0xd9, 0xe0, 0xe7, 0x12,
+  0x19, 0x20, 0x27, 0x2e, 0xa6, 0xad, 0xb4, 0xbb, 0xc2, 0xc9, 0xd0, 0xd7,
+  0xde, 0xe5, 0x10, 0x17, 0x1e, 0x25, 0x2c, 0x33, 0xab, 0xb2, 0xb9, 0xc0,
+  0xc7, 0xce, 0xd5, 0xdc, 0xe3, 0xea, 0x15, 0x1c, 0x23, 0x2a, 0x31, 0x38,
+  0x40, 0x4b, 0x56, 0x61, 0x6c, 0x77, 0x82, 0x8d, 0x43, 0x4e, 0x59, 0x64,
+  0x6f, 0x7a, 0x85, 0x90, 0x46, 0x51, 0x5c, 0x67, 0x72, 0x7d, 0x88, 0x93,
+  0x49, 0x54, 0x5f, 0x6a, 0x75, 0x80, 0x8b, 0x96, 0x4c, 0x57, 0x62, 0x6d,
+  0x78, 0x83, 0x8e, 0x99, 0x4f, 0x5a, 0x65, 0x70, 0x7b, 0x86, 0x91, 0x9c,
+  0x52, 0x5d, 0x68, 0x73, 0x7e, 0x89, 0x94, 0x9f, 0x55, 0x60, 0x6b, 0x76,
+  0x81, 0x8c, 0x97, 0xa2, 0x80, 0x7b, 0x76, 0x71, 0x6c, 0x67, 0x62, 0x5d,
+  0x77, 0x72, 0x6d, 0x68, 0x63, 0x5e, 0x59, 0x54, 0x6e, 0x69, 0x64, 0x5f,
+  0x5a, 0x55, 0x50, 0x4b, 0x65, 0x60, 0x5b, 0x56, 0x51, 0x4c, 0x47, 0x42,
+  0x5c, 0x57, 0x52, 0x4d, 0x48, 0x43, 0x3e, 0x39, 0x53, 0x4e, 0x49, 0x44,
+  0x3f, 0x3a, 0x35, 0x30, 0x4a, 0x45, 0x40, 0x3b, 0x36, 0x31, 0x2c, 0x27,
+  0x41, 0x3c, 0x37, 0x32, 0x2d, 0x28, 0x23, 0xc8, 0x0d, 0x00, 0xd0, 0xd7,
+  0xde, 0xe5, 0x10, 0x17, 0x1e, 0x25, 0x2c, 0x33, 0x3a, 0x41, 0x48, 0x4f,
+  0x56, 0x5d, 0xd5, 0xdc, 0xe3, 0xea, 0x15, 0x1c, 0x23, 0x2a, 0x31, 0x38,
+  0x3f, 0x46, 0x4d, 0x54, 0x5b, 0x62, 0xda, 0xe1, 0xe8, 0x13, 0x1a, 0x21,
+  0x28, 0x2f, 0x36, 0x3d, 0x44, 0x4b, 0x52, 0x59, 0x60, 0x67, 0xdf, 0xe6,
+  0x11, 0x18, 0x1f, 0x26, 0x2d, 0x34, 0x3b, 0x42, 0x49, 0x50, 0x57, 0x5e,
+  0x65, 0x6c, 0xe4, 0xeb, 0x16, 0x1d, 0x24, 0x2b, 0x32, 0x39, 0x40, 0x47,
+  0x4e, 0x55, 0x5c, 0x63, 0x6a, 0x71, 0xe9, 0x14, 0x1b, 0x22, 0x29, 0x30,
+  0x37, 0x3e, 0x45, 0x4c, 0x53, 0x5a, 0x61, 0x68, 0x6f, 0x76, 0x12, 0x19,
+  0x20, 0x27, 0x2e, 0x35, 0x3c, 0x43, 0x4a, 0x51, 0x58, 0x5f, 0x66, 0x6d,
+  0x74, 0x7b, 0x17, 0x1e, 0x25, 0x2c, 0x33, 0x3a, 0x41, 0x48, 0x4f, 0x56,
+  0x5d, 0x64, 0x6b, 0x72, 0x79, 0x80, 0x1c, 0x23, 0x2a, 0x31, 0x38, 0x3f,
+  0x46, 0x4d, 0x54, 0x5b, 0x62, 0x69, 0x70, 0x77, 0x7e, 0x85, 0x21, 0x28,
+  0x2f, 0x36, 0x3d, 0x44, 0x4b, 0x52, 0x59, 0x60, 0x67, 0x6e, 0x75, 0x7c,
+  0x83, 0x8a, 0x26, 0x2d, 0x34, 0x3b, 0x42, 0x49, 0x50, 0x57, 0x5e, 0x65,
+  0x6c, 0x73, 0x7a, 0x81, 0x88, 0x8f, 0x2b, 0x32, 0x39, 0x40, 0x47, 0x4e,
+  0x55, 0x5c, 0x63, 0x6a, 0x71, 0x78, 0x7f, 0x86, 0x8d, 0x94, 0x30, 0x37,
+  0x3e, 0x45, 0x4c, 0x53, 0x5a, 0x61, 0x68, 0x6f, 0x76, 0x7d, 0x84, 0x8b,
+  0x92, 0x99, 0x35, 0x3c, 0x43, 0x4a, 0x51, 0x58, 0x5f, 0x66, 0x6d, 0x74,
+  0x7b, 0x82, 0x89, 0x90, 0x97, 0x9e, 0x3a, 0x41, 0x48, 0x4f, 0x56, 0x5d,
+  0x64, 0x6b, 0x72, 0x79, 0x80, 0x87, 0x8e, 0x95, 0x9c, 0xa3, 0x3f, 0x46,
+  0x4d, 0x54, 0x5b, 0x62, 0x69, 0x70, 0x77, 0x7e, 0x85, 0x8c, 0x93, 0x9a,
+  0xa1, 0xa8, 0x98, 0xa3, 0xae, 0xb9, 0xc4, 0xcf, 0x2a, 0x35, 0x9b, 0xa6,
+  0xb1, 0xbc, 0xc7, 0xd2, 0x2d, 0x38, 0x9e, 0xa9, 0xb4, 0xbf, 0xca, 0xd5,
+  0x30, 0x3b, 0xa1, 0xac, 0xb7, 0xc2, 0xcd, 0x28, 0x33, 0x3e, 0xa4, 0xaf,
+  0xba, 0xc5, 0xd0, 0x2b, 0x36, 0x41, 0xa7, 0xb2, 0xbd, 0xc8, 0xd3, 0x2e,
+  0x39, 0x44, 0xaa, 0xb5, 0xc0, 0xcb, 0xd6, 0x31, 0x3c, 0x47, 0xad, 0xb8,
+  0xc3, 0xce, 0x29, 0x34, 0x3f, 0x4a, 0x58, 0x53, 0x4e, 0x49, 0x44, 0x3f,
+  0x3a, 0x35, 0x4f, 0x4a, 0x45, 0x40, 0x3b, 0x36, 0x31, 0x2c, 0x46, 0x41,
+  0x3c, 0x37, 0x32, 0x2d, 0x28, 0x23, 0x3d, 0x38, 0x33, 0x2e, 0x29, 0x24,
+  0x1f, 0xc4, 0x34, 0x2f, 0x2a, 0x25, 0x20, 0xc5, 0xc0, 0xbb, 0x2b, 0x26,
+  0x21, 0xc6, 0xc1, 0xbc, 0xb7, 0xb2, 0x22, 0xc7, 0xc2, 0xbd, 0xb8, 0xb3,
+  0xae, 0xa9, 0xc3, 0xbe, 0xb9, 0xb4, 0xaf, 0xaa, 0xa5, 0xa0, 0x80,
+};
+
+#define SAMPLE_SIZE 32
+
+static int sample_y(int x, int y) { return 16 + (x * 7 + y * 5) % 220; }
+static int sample_u(int x, int y) { return 40 + (x * 11 + y * 3) % 176; }
+static int sample_v(int x, int y) { return 200 - (x * 5 + y * 9) % 170; }
+
+static int clamp(double value)
+{
+  value = floor(value + 0.5);
+  return value < 0 ? 0 : value > 255 ? 255 : (int) value;
+}
+
+/* BT.709, full range, in floating point */
+static void expected_pixel(int x, int y, uint8 *out)
+{
+  double luma = sample_y(x, y);
+  double u = sample_u(x / 2, y / 2) - 128;
+  double v = sample_v(x / 2, y / 2) - 128;
+
+  out[0] = clamp(luma + 1.8556 * u);
+  out[1] = clamp(luma - 0.1873 * u - 0.4681 * v);
+  out[2] = clamp(luma + 1.5748 * v);
+}
+
+static int max_difference(uint8 *pixel, int x, int y)
+{
+  uint8 expected[3];
+  int i, diff, max = 0;
+
+  expected_pixel(x, y, expected);
+  for (i = 0; i < 3; i++)
+  {
+    diff = abs(pixel[i] - expected[i]);
+    max = MAX(max, diff);
+  }
+  return max;
+}
+
+/* RDPGFX_AVC420_BITMAP_STREAM of the sample with the given rectangles */
+static uint32 bitmap_stream(uint8 *out, uint16 (*rects)[4], int count)
+{
+  uint8 *p = out;
+  int i, j;
+
+  *p++ = count; *p++ = 0; *p++ = 0; *p++ = 0;
+  for (i = 0; i < count; i++)
+  {
+    for (j = 0; j < 4; j++)
+    {
+      *p++ = rects[i][j] & 0xff;
+      *p++ = rects[i][j] >> 8;
+    }
+  }
+  for (i = 0; i < count; i++)
+  {
+    *p++ = 22;   /* qpVal */
+    *p++ = 100;  /* qualityVal */
+  }
+  memcpy(p, sample, sizeof(sample));
+  return p - out + sizeof(sample);
+}
+
+Ensure(H264, decodes_the_sample_bitstream)
+{
+  uint16 rects[1][4] = {{0, 0, SAMPLE_SIZE, SAMPLE_SIZE}};
+  RD_RECT clip = {0, 0, SAMPLE_SIZE, SAMPLE_SIZE};
+  static uint8 data[sizeof(sample) + 64];
+  static uint8 pixels[SAMPLE_SIZE * SAMPLE_SIZE * 4];
+  H264_CONTEXT *h264;
+  uint32 length;
+  int x, y, worst = 0;
+
+  assert_that(h264_available(), is_true);
+  h264 = h264_open();
+  assert_that(h264, is_non_null);
+
+  length = bitmap_stream(data, rects, 1);
+  assert_that(h264_decode_avc420(h264, data, length, pixels, SAMPLE_SIZE, &clip), is_true);
+
+  for (y = 0; y < SAMPLE_SIZE; y++)
+    for (x = 0; x < SAMPLE_SIZE; x++)
+      worst = MAX(worst, max_difference(pixels + (y * SAMPLE_SIZE + x) * 4, x, y));
+  assert_that(worst, is_less_than(2));
+
+  h264_close(h264);
+}
+
+Ensure(H264, writes_only_updated_rectangles_inside_the_clip)
+{
+  /* The second rectangle reaches out of the clip, the third out of
+     the picture */
+  uint16 rects[3][4] = {{3, 5, 20, 17}, {25, 0, 40, 8}, {0, 30, 8, 40}};
+  RD_RECT clip = {0, 0, 30, 32};
+  static uint8 data[sizeof(sample) + 64];
+  static uint8 pixels[64 * 64 * 4];
+  H264_CONTEXT *h264;
+  uint32 length;
+  uint8 *pixel;
+  RD_BOOL inside;
+  int x, y;
+
+  memset(pixels, 0xaa, sizeof(pixels));
+  h264 = h264_open();
+  length = bitmap_stream(data, rects, 3);
+  assert_that(h264_decode_avc420(h264, data, length, pixels, 64, &clip), is_true);
+
+  for (y = 0; y < 64; y++)
+  {
+    for (x = 0; x < 64; x++)
+    {
+      pixel = pixels + (y * 64 + x) * 4;
+      inside = (x >= 3 && x < 20 && y >= 5 && y < 17) ||
+               (x >= 25 && x < 30 && y < 8) ||
+               (x < 8 && y >= 30 && y < 32);
+      if (inside)
+        assert_that(max_difference(pixel, x, y), is_less_than(2));
+      else
+        assert_that(pixel[0] == 0xaa && pixel[1] == 0xaa && pixel[2] == 0xaa, is_true);
+    }
+  }
+
+  h264_close(h264);
+}
+
+Ensure(H264, rejects_truncated_metablocks)
+{
+  uint8 huge[] = {0xff, 0xff, 0xff, 0x0f, 0, 0, 0, 0};
+  uint8 short_rects[] = {2, 0, 0, 0, 0, 0, 0, 0, 8, 0, 8, 0};
+  uint8 pixels[4];
+  RD_RECT clip = {0, 0, 1, 1};
+  H264_CONTEXT *h264;
+
+  h264 = h264_open();
+  assert_that(h264_decode_avc420(h264, huge, 3, pixels, 1, &clip), is_false);
+  assert_that(h264_decode_avc420(h264, huge, sizeof(huge), pixels, 1, &clip), is_false);
+  assert_that(h264_decode_avc420(h264, short_rects, sizeof(short_rects), pixels, 1, &clip),
+              is_false);
+  h264_close(h264);
+}
+
+#ifdef __SSE2__
+Ensure(H264, vectored_colour_conversion_matches_plain_code)
+{
+  static uint8 y[128], u[64], v[64], fast[128 * 4], plain[128 * 4];
+  int i, x, width;
+
+  srand(1);
+  for (i = 0; i < 128; i++)
+    y[i] = rand();
+  for (i = 0; i < 64; i++)
+  {
+    u[i] = rand();
+    v[i] = rand();
+  }
+  /* extremes, to hit the clamping */
+  y[0] = u[0] = v[0] = 0;
+  y[2] = u[1] = v[1] = 255;
+
+  for (x = 0; x < 9; x++)
+  {
+    for (width = 0; width <= 128 - x; width += 7)
+    {
+      g_h264_sse2 = True;
+      h264_yuv420_to_bgrx(y, u, v, x, width, fast);
+      g_h264_sse2 = False;
+      h264_yuv420_to_bgrx(y, u, v, x, width, plain);
+      assert_that(memcmp(fast, plain, width * 4), is_equal_to(0));
+    }
+  }
+  g_h264_sse2 = True;
+}
+#endif
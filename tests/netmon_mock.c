@@ -0,0 +1,20 @@
+#include <cgreen/mocks.h>
+#include "../rdesktop.h"
+
+RD_BOOL
+netmon_open()
+{
+  return mock();
+}
+
+void
+netmon_close()
+{
+  mock();
+}
+
+RD_BOOL
+netmon_wait(uint32 timeout)
+{
+  return mock(timeout);
+}
@@ -0,0 +1,224 @@
+/* Microbenchmark for polyline and polygon order parsing.
+
+   Feeds the same delta encoded orders through process_polyline(),
+   process_polygon() and process_polygon2() over and over with the
+   drawing stubbed out, and reports orders per second. Build it at two
+   revisions to compare them:
+
+       cd tests
+       make orders_bench
+       ./orders_bench [iterations] [points per order]
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/time.h>
+
+#include "../rdesktop.h"
+
+RDP_VERSION g_rdp_version = RDP_V5;
+int g_server_depth = 16;
+uint16 g_glyph_support_level = GLYPH_SUPPORT_ENCODE;
+
+#include "../orders.c"
+
+static unsigned long g_drawn_points;
+
+/* Stubs */
+
+void *
+xmalloc(int size)
+{
+	void *mem = malloc(size);
+	if (mem == NULL)
+		exit(EX_UNAVAILABLE);
+	return mem;
+}
+
+void
+xfree(void *mem)
+{
+	free(mem);
+}
+
+void
+logger(log_subject_t c, log_level_t lvl, char *format, ...)
+{
+	UNUSED(c);
+	UNUSED(lvl);
+	UNUSED(format);
+}
+
+void
+ui_polyline(uint8 opcode, RD_POINT * points, int npoints, PEN * pen)
+{
+	UNUSED(opcode);
+	UNUSED(pen);
+	g_drawn_points += npoints + points[npoints - 1].x;
+}
+
+void
+ui_polygon(uint8 opcode, uint8 fillmode, RD_POINT * point, int npoints, BRUSH * brush,
+	   uint32 bgcolour, uint32 fgcolour)
+{
+	UNUSED(opcode);
+	UNUSED(fillmode);
+	UNUSED(brush);
+	UNUSED(bgcolour);
+	UNUSED(fgcolour);
+	g_drawn_points += npoints + point[npoints - 1].y;
+}
+
+RD_BOOL bitmap_decompress(uint8 * output, int width, int height, uint8 * input, int size,
+			  int Bpp) { return False; }
+RD_HBITMAP cache_get_bitmap(uint8 id, uint16 idx) { return NULL; }
+void cache_put_bitmap(uint8 id, uint16 idx, RD_HBITMAP bitmap) { }
+void cache_put_font(uint8 font, uint16 character, uint16 offset, uint16 baseline,
+		    uint16 width, uint16 height, RD_HGLYPH pixmap) { }
+BRUSHDATA *cache_get_brush_data(uint8 colour_code, uint8 idx) { return NULL; }
+void cache_put_brush_data(uint8 colour_code, uint8 idx, BRUSHDATA * brush_data) { }
+RD_BOOL pstcache_save_bitmap(uint8 cache_id, uint16 cache_idx, uint8 * key, uint16 width,
+			     uint16 height, uint32 length, uint8 * data) { return False; }
+RD_BOOL surface_decode_bitmap(uint8 codec_id, uint8 * output, int width, int height,
+			      uint8 * data, uint32 length) { return False; }
+void rdp_protocol_error(const char *message, STREAM s) { }
+void timing_stop(timing_phase phase) { }
+RD_HBITMAP ui_create_bitmap(int width, int height, uint8 * data) { return NULL; }
+RD_HGLYPH ui_create_glyph(int width, int height, uint8 * data) { return NULL; }
+RD_HCOLOURMAP ui_create_colourmap(COLOURMAP * colours) { return NULL; }
+void ui_set_colourmap(RD_HCOLOURMAP map) { }
+void ui_set_clip(int x, int y, int cx, int cy) { }
+void ui_reset_clip(void) { }
+void ui_begin_frame(void) { }
+void ui_end_frame(void) { }
+void ui_destblt(uint8 opcode, int x, int y, int cx, int cy) { }
+void ui_patblt(uint8 opcode, int x, int y, int cx, int cy, BRUSH * brush, uint32 bgcolour,
+	       uint32 fgcolour) { }
+void ui_screenblt(uint8 opcode, int x, int y, int cx, int cy, int srcx, int srcy) { }
+void ui_memblt(uint8 opcode, int x, int y, int cx, int cy, RD_HBITMAP src, int srcx,
+	       int srcy) { }
+void ui_triblt(uint8 opcode, int x, int y, int cx, int cy, RD_HBITMAP src, int srcx,
+	       int srcy, BRUSH * brush, uint32 bgcolour, uint32 fgcolour) { }
+void ui_line(uint8 opcode, int startx, int starty, int endx, int endy, PEN * pen) { }
+void ui_rect(int x, int y, int cx, int cy, uint32 colour) { }
+void ui_multi_destblt(uint8 opcode, RD_RECT * rects, int count) { }
+void ui_multi_patblt(uint8 opcode, RD_RECT * rects, int count, BRUSH * brush,
+		     uint32 bgcolour, uint32 fgcolour) { }
+void ui_multi_screenblt(uint8 opcode, RD_RECT * rects, int count, int srcdx, int srcdy) { }
+void ui_multi_rect(RD_RECT * rects, int count, uint32 colour) { }
+void ui_ellipse(uint8 opcode, uint8 fillmode, int x, int y, int cx, int cy, BRUSH * brush,
+		uint32 bgcolour, uint32 fgcolour) { }
+void ui_draw_text(uint8 font, uint8 flags, uint8 opcode, int mixmode, int x, int y,
+		  int clipx, int clipy, int clipcx, int clipcy, int boxx, int boxy,
+		  int boxcx, int boxcy, BRUSH * brush, uint32 bgcolour, uint32 fgcolour,
+		  uint8 * text, uint8 length) { }
+void ui_desktop_save(uint32 offset, int x, int y, int cx, int cy) { }
+void ui_desktop_restore(uint32 offset, int x, int y, int cx, int cy) { }
+
+/* Benchmark */
+
+/* Build an order payload with npoints points, alternating one and two
+   byte deltas, every fourth point leaving out its y delta */
+static int
+make_order_data(uint8 * data, int npoints)
+{
+	int i, size;
+
+	size = ((npoints - 1) / 4) + 1;
+	memset(data, 0, size);
+
+	for (i = 0; i < npoints; i++)
+	{
+		if (i % 4 == 3)
+			data[i / 4] |= 0x40 >> ((i % 4) * 2);
+
+		if (i % 2)
+		{
+			data[size++] = 0x80 | 0x01;
+			data[size++] = 0x20;
+		}
+		else
+		{
+			data[size++] = 0x05;
+		}
+
+		if (i % 4 != 3)
+			data[size++] = 0x7e;
+	}
+
+	return size;
+}
+
+static double
+elapsed(struct timeval *start)
+{
+	struct timeval now;
+
+	gettimeofday(&now, NULL);
+	return (now.tv_sec - start->tv_sec) + (now.tv_usec - start->tv_usec) / 1000000.0;
+}
+
+int
+main(int argc, char *argv[])
+{
+	struct stream s;
+	struct timeval start;
+	POLYLINE_ORDER polyline;
+	POLYGON_ORDER polygon;
+	POLYGON2_ORDER polygon2;
+	long i, iterations = 1000000;
+	int npoints = 8;
+	double secs;
+
+	if (argc > 1)
+		iterations = atol(argv[1]);
+
+	if (argc > 2)
+		npoints = atoi(argv[2]);
+
+	if (npoints < 1 || npoints > 80)
+	{
+		fprintf(stderr, "usage: %s [iterations] [points per order, 1-80]\n", argv[0]);
+		return 1;
+	}
+
+	memset(&s, 0, sizeof(s));
+
+	memset(&polyline, 0, sizeof(polyline));
+	polyline.opcode = 0x0d;
+	polyline.lines = npoints;
+	polyline.datasize = make_order_data(polyline.data, npoints);
+
+	memset(&polygon, 0, sizeof(polygon));
+	polygon.opcode = 0x0d;
+	polygon.fillmode = ALTERNATE;
+	polygon.npoints = npoints;
+	polygon.datasize = make_order_data(polygon.data, npoints);
+
+	memset(&polygon2, 0, sizeof(polygon2));
+	polygon2.opcode = 0x0d;
+	polygon2.fillmode = WINDING;
+	polygon2.npoints = npoints;
+	polygon2.datasize = make_order_data(polygon2.data, npoints);
+
+	/* No fields present, so the orders are drawn from their saved state */
+	gettimeofday(&start, NULL);
+	for (i = 0; i < iterations; i++)
+		process_polyline(&s, &polyline, 0, False);
+	secs = elapsed(&start);
+	printf("polyline: %.0f orders/s\n", iterations / secs);
+
+	gettimeofday(&start, NULL);
+	for (i = 0; i < iterations; i++)
+		process_polygon(&s, &polygon, 0, False);
+	secs = elapsed(&start);
+	printf("polygon:  %.0f orders/s\n", iterations / secs);
+
+	gettimeofday(&start, NULL);
+	for (i = 0; i < iterations; i++)
+		process_polygon2(&s, &polygon2, 0, False);
+	secs = elapsed(&start);
+	printf("polygon2: %.0f orders/s\n", iterations / secs);
+
+	return (g_drawn_points == 0);
+}
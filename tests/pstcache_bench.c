@@ -0,0 +1,228 @@
+/* Microbenchmark for building the persistent bitmap cache key list.
+
+   Fills a persistent cache file with BMPCACHE2_NUM_PSTCELLS 64x64
+   bitmaps in a scratch directory, then times how long it takes from
+   pstcache_init() until the key list is ready, both by reading the
+   header of every cell (a first run, or after a crash) and from the
+   index file written on exit. Loading the recently used bitmaps, which
+   now happens after the key list is sent, is timed separately.
+
+       cd tests
+       make pstcache_bench
+       ./pstcache_bench [iterations] [scratch directory]
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/time.h>
+
+#include "../rdesktop.h"
+
+int g_server_depth = 32;
+RD_BOOL g_bitmap_cache = True;
+RD_BOOL g_bitmap_cache_persist_enable = True;
+RD_BOOL g_bitmap_cache_precache = True;
+
+#include "../pstcache.c"
+
+static char *g_dir = "/tmp";
+static unsigned long g_loaded;
+
+/* Stubs */
+
+void *
+xmalloc(int size)
+{
+	void *mem = malloc(size);
+	if (mem == NULL)
+		exit(EX_UNAVAILABLE);
+	return mem;
+}
+
+void
+xfree(void *mem)
+{
+	free(mem);
+}
+
+void
+logger(log_subject_t c, log_level_t lvl, char *format, ...)
+{
+	UNUSED(c);
+	UNUSED(lvl);
+	UNUSED(format);
+}
+
+RD_BOOL
+rd_pstcache_mkdir(void)
+{
+	return True;
+}
+
+int
+rd_open_file(char *filename)
+{
+	char path[512];
+
+	/* Everything is under cache/ */
+	snprintf(path, sizeof(path), "%s/%s", g_dir, filename + 6);
+	return open(path, O_RDWR | O_CREAT, S_IRUSR | S_IWUSR);
+}
+
+void
+rd_close_file(int fd)
+{
+	close(fd);
+}
+
+int
+rd_read_file(int fd, void *ptr, int len)
+{
+	return read(fd, ptr, len);
+}
+
+int
+rd_write_file(int fd, void *ptr, int len)
+{
+	return write(fd, ptr, len);
+}
+
+int
+rd_lseek_file(int fd, int offset)
+{
+	return lseek(fd, offset, SEEK_SET);
+}
+
+RD_BOOL
+rd_lock_file(int fd, int start, int len)
+{
+	UNUSED(fd);
+	UNUSED(start);
+	UNUSED(len);
+	return True;
+}
+
+RD_HBITMAP
+ui_create_bitmap(int width, int height, uint8 * data)
+{
+	g_loaded += width * height + data[0];
+	return (RD_HBITMAP) 1;
+}
+
+void
+cache_put_bitmap(uint8 id, uint16 idx, RD_HBITMAP bitmap)
+{
+	UNUSED(id);
+	UNUSED(idx);
+	UNUSED(bitmap);
+}
+
+void
+cache_rebuild_bmpcache_linked_list(uint8 id, sint16 * idx, int count)
+{
+	UNUSED(id);
+	UNUSED(idx);
+	UNUSED(count);
+}
+
+static double
+elapsed(struct timeval *start)
+{
+	struct timeval now;
+
+	gettimeofday(&now, NULL);
+	return (now.tv_sec - start->tv_sec) + (now.tv_usec - start->tv_usec) / 1000000.0;
+}
+
+/* Forget everything, as if rdesktop was started again */
+static void
+restart(void)
+{
+	if (g_pstcache_fd[2] > 0)
+		close(g_pstcache_fd[2]);
+	if (g_pstcache_index_fd[2] > 0)
+		close(g_pstcache_index_fd[2]);
+	g_pstcache_fd[2] = g_pstcache_index_fd[2] = 0;
+	g_pstcache_enumerated = False;
+}
+
+/* Time from pstcache_init() until the key list is ready */
+static double
+connect_keys(HASH_KEY * keylist, int *count)
+{
+	struct timeval start;
+
+	restart();
+	gettimeofday(&start, NULL);
+	pstcache_init(2);
+	*count = pstcache_enumerate(2, keylist);
+	return elapsed(&start);
+}
+
+int
+main(int argc, char **argv)
+{
+	static HASH_KEY keylist[BMPCACHE2_NUM_PSTCELLS];
+	static uint8 data[64 * 64 * 4];
+	char path[512];
+	struct timeval start;
+	double scan = 0, indexed = 0, precache = 0;
+	int i, count, iterations = 20;
+	uint8 key[8];
+
+	if (argc > 1)
+		iterations = atoi(argv[1]);
+
+	if (argc > 2)
+		g_dir = argv[2];
+
+	if (iterations < 1)
+	{
+		fprintf(stderr, "usage: %s [iterations] [scratch directory]\n", argv[0]);
+		return 1;
+	}
+
+	snprintf(path, sizeof(path), "%s/pstcache_2_4", g_dir);
+	unlink(path);
+	snprintf(path, sizeof(path), "%s/pstcache_2_4.idx", g_dir);
+	unlink(path);
+
+	pstcache_init(2);
+	for (i = 0; i < BMPCACHE2_NUM_PSTCELLS; i++)
+	{
+		memset(data, i, sizeof(data));
+		memcpy(key, &i, sizeof(i));
+		memcpy(key + 4, "bmp!", 4);
+		pstcache_save_bitmap(2, i, key, 64, 64, sizeof(data), data);
+		/* Every fourth bitmap was in use last time */
+		if (i % 4 == 0)
+			pstcache_touch_bitmap(2, i, i + 1);
+	}
+
+	for (i = 0; i < iterations; i++)
+	{
+		unlink(path);
+		scan += connect_keys(keylist, &count);
+		pstcache_save_index();
+		indexed += connect_keys(keylist, &count);
+
+		gettimeofday(&start, NULL);
+		pstcache_precache(2);
+		precache += elapsed(&start);
+		pstcache_save_index();
+	}
+
+	printf("%d keys\n", count);
+	printf("key list from the cells:      %.2f ms\n", scan * 1000 / iterations);
+	printf("key list from the index file: %.2f ms\n", indexed * 1000 / iterations);
+	printf("precaching:                   %.2f ms\n", precache * 1000 / iterations);
+
+	snprintf(path, sizeof(path), "%s/pstcache_2_4", g_dir);
+	unlink(path);
+	snprintf(path, sizeof(path), "%s/pstcache_2_4.idx", g_dir);
+	unlink(path);
+
+	return (g_loaded == 0);
+}
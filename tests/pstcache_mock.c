@@ -6,6 +6,11 @@ int pstcache_enumerate(uint8 id, HASH_KEY * keylist)
   return mock(id, keylist);
 }
 
+void pstcache_precache(uint8 id)
+{
+  mock(id);
+}
+
 RD_BOOL pstcache_init(uint8 cache_id)
 {
   return mock(cache_id);
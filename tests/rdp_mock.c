@@ -13,6 +13,12 @@ rdp_send_suppress_output_pdu(enum RDP_SUPPRESS_STATUS allowupdates)
   mock(allowupdates);
 }
 
+void
+rdp_send_frame_ack(uint32 frame_id)
+{
+  mock(frame_id);
+}
+
 RD_BOOL
 rdp_connect(char *server, uint32 flags, char *domain, char *password, char *command,
 	    char *directory, RD_BOOL reconnect)
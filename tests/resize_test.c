@@ -104,6 +104,8 @@ int g_server_depth;
 VCHANNEL g_channels[1];
 unsigned int g_num_channels;
 uint8 g_client_random[SEC_RANDOM_SIZE];
+uint16 g_mcs_msgchannel;
+RD_BOOL g_network_autodetect;
 
 /* Xlib macros to mock functions */
 #undef DefaultRootWindow
@@ -0,0 +1,337 @@
+/* Benchmark for the RemoteFX tile decoder.
+
+   Builds sample tiles by RLGR encoding synthetic quantized wavelet
+   coefficients, checks that the decoder gets the coefficients back and
+   that the SSE2 and C kernels agree, then reports tiles per second
+   decoded on the main thread only and with the decoder threads.
+
+       cd tests
+       make rfx_bench
+       ./rfx_bench [tiles]
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/time.h>
+
+#include "../rdesktop.h"
+
+#include "../rfx.c"
+#include "../workpool.c"
+
+/* Stubs */
+
+void *
+xmalloc(int size)
+{
+	void *mem = malloc(size);
+	if (mem == NULL)
+		exit(EX_UNAVAILABLE);
+	return mem;
+}
+
+void *
+xrealloc(void *oldmem, size_t size)
+{
+	void *mem = realloc(oldmem, size ? size : 1);
+	if (mem == NULL)
+		exit(EX_UNAVAILABLE);
+	return mem;
+}
+
+void
+xfree(void *mem)
+{
+	free(mem);
+}
+
+void
+logger(log_subject_t c, log_level_t lvl, char *format, ...)
+{
+	UNUSED(c);
+	UNUSED(lvl);
+	UNUSED(format);
+}
+
+void
+ui_set_clip(int x, int y, int cx, int cy)
+{
+	UNUSED(x);
+	UNUSED(y);
+	UNUSED(cx);
+	UNUSED(cy);
+}
+
+void
+ui_reset_clip(void)
+{
+}
+
+void
+ui_paint_bitmap(int x, int y, int cx, int cy, int width, int height, uint8 * data)
+{
+	UNUSED(x);
+	UNUSED(y);
+	UNUSED(cx);
+	UNUSED(cy);
+	UNUSED(width);
+	UNUSED(height);
+	UNUSED(data);
+}
+
+/* RLGR encoder, [MS-RDPRFX] 3.1.8.1.7.3 */
+
+typedef struct
+{
+	uint8 *data;
+	int size;
+	int pos;
+} bit_writer;
+
+static void
+put_bits(bit_writer * w, uint32 value, int n)
+{
+	while (n-- > 0)
+	{
+		if (w->pos / 8 >= w->size)
+			return;
+		if (w->pos % 8 == 0)
+			w->data[w->pos / 8] = 0;
+		if ((value >> n) & 1)
+			w->data[w->pos / 8] |= 0x80 >> (w->pos % 8);
+		w->pos++;
+	}
+}
+
+static void
+put_ones(bit_writer * w, int n)
+{
+	while (n-- > 0)
+		put_bits(w, 1, 1);
+}
+
+static void
+put_gr(bit_writer * w, int *krp, uint32 value)
+{
+	int kr = *krp >> LSGR;
+	uint32 vk = value >> kr;
+
+	put_ones(w, vk);
+	put_bits(w, 0, 1);
+	put_bits(w, value & ((1 << kr) - 1), kr);
+
+	if (vk == 0)
+		UPDATE_PARAM(*krp, -2, kr)
+	else if (vk > 1)
+		UPDATE_PARAM(*krp, (int) vk, kr)
+}
+
+static uint32
+two_mag_sign(int value)
+{
+	return value >= 0 ? 2 * value : -2 * value - 1;
+}
+
+static int
+rlgr_encode(int mode, sint16 * in, int count, uint8 * out, int size)
+{
+	bit_writer w;
+	int i = 0, k = 1, kp = 8, krp = 8, zeros, runmax;
+	uint32 a, b, nbits, v;
+
+	w.data = out;
+	w.size = size;
+	w.pos = 0;
+
+	while (i < count)
+	{
+		if (k)
+		{
+			for (zeros = 0; i + zeros < count && in[i + zeros] == 0; zeros++);
+			i += zeros;
+
+			runmax = 1 << k;
+			while (zeros >= runmax)
+			{
+				put_bits(&w, 0, 1);
+				zeros -= runmax;
+				UPDATE_PARAM(kp, UP_GR, k);
+				runmax = 1 << k;
+			}
+			put_bits(&w, 1, 1);
+			put_bits(&w, zeros, k);
+
+			if (i < count)
+			{
+				put_bits(&w, in[i] < 0, 1);
+				put_gr(&w, &krp, abs(in[i]) - 1);
+				UPDATE_PARAM(kp, -DN_GR, k);
+				i++;
+			}
+		}
+		else if (mode == CLW_ENTROPY_RLGR1)
+		{
+			a = two_mag_sign(in[i++]);
+			put_gr(&w, &krp, a);
+			if (a == 0)
+				UPDATE_PARAM(kp, UQ_GR, k)
+			else
+				UPDATE_PARAM(kp, -DQ_GR, k)
+		}
+		else
+		{
+			a = two_mag_sign(in[i++]);
+			b = (i < count) ? two_mag_sign(in[i++]) : 0;
+			put_gr(&w, &krp, a + b);
+			for (nbits = 0, v = a + b; v; nbits++)
+				v >>= 1;
+			put_bits(&w, a, nbits);
+
+			if (a && b)
+				UPDATE_PARAM(kp, -2 * DQ_GR, k)
+			else if (!a && !b)
+				UPDATE_PARAM(kp, 2 * UQ_GR, k)
+		}
+	}
+
+	return (w.pos + 7) / 8;
+}
+
+/* Quantized coefficients resembling those of a photo: sparse small
+   values in the high bands, denser at the lower levels, and a smooth
+   LL3 band coded as differences */
+static void
+make_coefficients(sint16 * coef, unsigned int seed)
+{
+	int i, zero_percent;
+
+	srand(seed);
+	for (i = 0; i < RFX_TILE_PIXELS; i++)
+	{
+		zero_percent = i < 3072 ? 85 : i < 3840 ? 60 : 30;
+		if (rand() % 100 < zero_percent)
+			coef[i] = 0;
+		else
+			coef[i] = (rand() % 7) - 3;
+	}
+
+	for (i = 4032; i < RFX_TILE_PIXELS; i++)
+		coef[i] = (rand() % 9) - 4;
+}
+
+static double
+elapsed(struct timeval *start)
+{
+	struct timeval now;
+
+	gettimeofday(&now, NULL);
+	return (now.tv_sec - start->tv_sec) + (now.tv_usec - start->tv_usec) / 1000000.0;
+}
+
+int
+main(int argc, char *argv[])
+{
+	static sint16 coef[RFX_TILE_PIXELS], decoded[RFX_TILE_PIXELS];
+	static uint8 data[3][8192];
+	static uint8 reference[RFX_TILE_BYTES];
+	rfx_work_t *work;
+	struct timeval start;
+	int i, j, mode, tiles = 2000, length[3], failed = 0;
+	double secs;
+
+	if (argc > 1)
+		tiles = atoi(argv[1]);
+
+	if (tiles < 1)
+	{
+		fprintf(stderr, "usage: %s [tiles]\n", argv[0]);
+		return 1;
+	}
+
+	/* RLGR round trip */
+	for (mode = CLW_ENTROPY_RLGR1; mode <= CLW_ENTROPY_RLGR3; mode += 3)
+	{
+		for (i = 0; i < 16; i++)
+		{
+			make_coefficients(coef, i);
+			length[0] = rlgr_encode(mode, coef, RFX_TILE_PIXELS, data[0], sizeof(data[0]));
+			rfx_rlgr_decode(mode, data[0], length[0], decoded, RFX_TILE_PIXELS);
+			if (memcmp(coef, decoded, sizeof(coef)) != 0)
+			{
+				printf("RLGR%d round trip failed for tile %d\n", mode, i);
+				failed = 1;
+			}
+		}
+	}
+
+	/* Sample tiles, three encoded components each */
+	for (i = 0; i < 3; i++)
+	{
+		make_coefficients(coef, 100 + i);
+		length[i] = rlgr_encode(CLW_ENTROPY_RLGR3, coef, RFX_TILE_PIXELS, data[i],
+					sizeof(data[i]));
+	}
+	printf("sample tile: %d bytes\n", length[0] + length[1] + length[2]);
+
+	g_rfx_entropy = CLW_ENTROPY_RLGR3;
+	for (i = 0; i < 10; i++)
+		g_rfx_quant[0][i] = 6 + i % 4;
+	g_rfx_num_quant = 1;
+
+	g_rfx_tiles = (rfx_tile_t *) xmalloc(tiles * sizeof(rfx_tile_t));
+	g_rfx_pixels = (uint8 *) xmalloc(tiles * RFX_TILE_BYTES);
+	g_rfx_tiles_size = g_rfx_num_tiles = tiles;
+	for (i = 0; i < tiles; i++)
+	{
+		for (j = 0; j < 3; j++)
+		{
+			g_rfx_tiles[i].quant[j] = 0;
+			g_rfx_tiles[i].data[j] = data[j];
+			g_rfx_tiles[i].length[j] = length[j];
+		}
+		g_rfx_tiles[i].pixels = g_rfx_pixels + i * RFX_TILE_BYTES;
+	}
+
+	work = (rfx_work_t *) xmalloc(sizeof(rfx_work_t));
+
+#ifdef __SSE2__
+	/* SSE2 kernels against the C ones */
+	g_rfx_sse2 = False;
+	rfx_decode_tile(work, &g_rfx_tiles[0]);
+	memcpy(reference, g_rfx_tiles[0].pixels, RFX_TILE_BYTES);
+	g_rfx_sse2 = True;
+	rfx_decode_tile(work, &g_rfx_tiles[0]);
+	if (memcmp(reference, g_rfx_tiles[0].pixels, RFX_TILE_BYTES) != 0)
+	{
+		printf("SSE2 and C kernels differ\n");
+		failed = 1;
+	}
+
+	g_rfx_sse2 = False;
+	gettimeofday(&start, NULL);
+	for (i = 0; i < tiles; i++)
+		rfx_decode_tile(work, &g_rfx_tiles[i]);
+	secs = elapsed(&start);
+	printf("C, one thread:     %.0f tiles/s\n", tiles / secs);
+	g_rfx_sse2 = True;
+#else
+	UNUSED(reference);
+#endif
+
+	gettimeofday(&start, NULL);
+	for (i = 0; i < tiles; i++)
+		rfx_decode_tile(work, &g_rfx_tiles[i]);
+	secs = elapsed(&start);
+	printf("one thread:        %.0f tiles/s\n", tiles / secs);
+
+#ifdef HAVE_PTHREAD
+	rfx_decode_tiles();
+	gettimeofday(&start, NULL);
+	rfx_decode_tiles();
+	secs = elapsed(&start);
+	printf("%d decoder threads: %.0f tiles/s\n", workpool_num_threads() + 1,
+	       tiles / secs);
+#endif
+
+	return failed;
+}
@@ -0,0 +1,20 @@
+#include <cgreen/mocks.h>
+#include "../rdesktop.h"
+
+RD_BOOL
+surface_process_bits(STREAM s)
+{
+  return mock(s);
+}
+
+uint16
+surface_codecs_caplen()
+{
+  return mock();
+}
+
+void
+surface_out_codecs_capabilityset(STREAM s)
+{
+  mock(s);
+}
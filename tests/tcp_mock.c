@@ -11,3 +11,15 @@ tcp_run_ui(RD_BOOL run)
 {
   mock(run);
 }
+
+void
+tcp_hold(void)
+{
+  mock();
+}
+
+void
+tcp_release(void)
+{
+  mock();
+}
@@ -0,0 +1,32 @@
+#include <cgreen/mocks.h>
+#include "../rdesktop.h"
+
+void
+timing_reset()
+{
+  mock();
+}
+
+void
+timing_start(timing_phase phase)
+{
+  mock(phase);
+}
+
+void
+timing_stop(timing_phase phase)
+{
+  mock(phase);
+}
+
+int
+timing_format(char *buf, size_t size)
+{
+  return mock(buf, size);
+}
+
+void
+timing_report()
+{
+  mock();
+}
@@ -50,6 +50,21 @@ void ui_end_update()
   mock();
 }
 
+void ui_begin_frame()
+{
+  mock();
+}
+
+void ui_end_frame()
+{
+  mock();
+}
+
+void ui_reset_state()
+{
+  mock();
+}
+
 void ui_move_pointer(int x, int y)
 {
   mock(x, y);
@@ -165,6 +165,26 @@ Ensure(XWIN, UiResizeWindowCallsXResizeWindow) {
   ui_resize_window(width, height);
 }
 
+Ensure(XWIN, UiSetClipOnlySendsChangedClip) {
+  expect(XSetClipRectangles, times(2));
+
+  ui_set_clip(0, 0, 640, 480);
+  ui_set_clip(0, 0, 640, 480);
+  ui_set_clip(10, 10, 100, 100);
+  ui_set_clip(10, 10, 100, 100);
+}
+
+Ensure(XWIN, UiResetClipDoesNotQueryWindowSize) {
+  never_expect(XGetWindowAttributes);
+  expect(XSetClipRectangles, times(1));
+
+  g_wnd_width = 640;
+  g_wnd_height = 480;
+
+  ui_set_clip(0, 0, 640, 480);
+  ui_reset_clip();
+}
+
 /* FIXME: This test is broken */
 #if 0
 Ensure(XWIN, UiSelectCallsProcessPendingResizeIfGPendingResizeIsTrue)
@@ -0,0 +1,436 @@
+#include <cgreen/cgreen.h>
+#include <cgreen/mocks.h>
+#include "../rdesktop.h"
+
+/* Boilerplate */
+Describe(ZGFX);
+BeforeEach(ZGFX) {}
+AfterEach(ZGFX) {}
+
+/* malloc; exit if out of memory */
+void *
+xmalloc(int size)
+{
+	void *mem = malloc(size);
+	if (mem == NULL)
+	{
+		logger(Core, Error, "xmalloc, failed to allocate %d bytes", size);
+		exit(EX_UNAVAILABLE);
+	}
+	return mem;
+}
+
+/* realloc; exit if out of memory */
+void *
+xrealloc(void *oldmem, size_t size)
+{
+	void *mem;
+
+	if (size == 0)
+		size = 1;
+	mem = realloc(oldmem, size);
+	if (mem == NULL)
+	{
+		logger(Core, Error, "xrealloc, failed to reallocate %ld bytes", size);
+		exit(EX_UNAVAILABLE);
+	}
+	return mem;
+}
+
+/* free */
+void
+xfree(void *mem)
+{
+	free(mem);
+}
+
+static struct stream stream_of(uint8 *data, size_t size)
+{
+  struct stream s;
+  memset(&s, 0, sizeof(s));
+  s.data = s.p = data;
+  s.size = size;
+  s.end = data + size;
+  return s;
+}
+
+/* A small greedy compressor, producing every kind of token the
+   decompressor has to handle */
+
+typedef struct
+{
+  uint8 *data;
+  size_t length;
+  int bits;
+} bit_writer;
+
+static void put_bits(bit_writer *w, uint32 value, int count)
+{
+  while (count-- > 0)
+  {
+    if (w->bits == 0)
+      w->data[w->length++] = 0;
+    if ((value >> count) & 1)
+      w->data[w->length - 1] |= 0x80 >> w->bits;
+    w->bits = (w->bits + 1) % 8;
+  }
+}
+
+static const uint8 short_literals[][3] = {
+  /* value, prefix length, prefix */
+  {0x00, 5, 0x18}, {0x01, 5, 0x19}, {0x02, 6, 0x34}, {0x03, 6, 0x35},
+  {0xff, 6, 0x36}, {0x04, 7, 0x6e}, {0x05, 7, 0x6f}, {0x06, 7, 0x70},
+  {0x07, 7, 0x71}, {0x08, 7, 0x72}, {0x09, 7, 0x73}, {0x0a, 7, 0x74},
+  {0x0b, 7, 0x75}, {0x3a, 7, 0x76}, {0x3b, 7, 0x77}, {0x3c, 7, 0x78},
+  {0x3d, 7, 0x79}, {0x3e, 7, 0x7a}, {0x3f, 7, 0x7b}, {0x40, 7, 0x7c},
+  {0x80, 7, 0x7d}, {0x0c, 8, 0xfc}, {0x38, 8, 0xfd}, {0x39, 8, 0xfe},
+  {0x66, 8, 0xff}
+};
+
+static const uint32 distances[][4] = {
+  /* prefix length, prefix, value bits, base */
+  {5, 0x11, 5, 0}, {5, 0x12, 7, 32}, {5, 0x13, 9, 160}, {5, 0x14, 10, 672},
+  {5, 0x15, 12, 1696}, {6, 0x2c, 14, 5792}, {6, 0x2d, 15, 22176},
+  {7, 0x5c, 18, 54944}, {7, 0x5d, 20, 317088}, {8, 0xbc, 20, 1365664},
+  {8, 0xbd, 21, 2414240}
+};
+
+static void put_literal(bit_writer *w, uint8 value)
+{
+  size_t i;
+
+  for (i = 0; i < sizeof(short_literals) / sizeof(short_literals[0]); i++)
+  {
+    if (short_literals[i][0] == value)
+    {
+      put_bits(w, short_literals[i][2], short_literals[i][1]);
+      return;
+    }
+  }
+  put_bits(w, 0, 1);
+  put_bits(w, value, 8);
+}
+
+static void put_match(bit_writer *w, uint32 distance, uint32 count)
+{
+  size_t i;
+  int k;
+
+  for (i = 0; distance >= distances[i][3] + (1u << distances[i][2]); i++);
+  put_bits(w, distances[i][1], distances[i][0]);
+  put_bits(w, distance - distances[i][3], distances[i][2]);
+
+  if (count == 3)
+  {
+    put_bits(w, 0, 1);
+    return;
+  }
+
+  for (k = 2; (1u << (k + 1)) <= count; k++);
+  put_bits(w, (1u << (k - 1)) - 1, k - 1);
+  put_bits(w, 0, 1);
+  put_bits(w, count - (1u << k), k);
+}
+
+static void put_unencoded(bit_writer *w, uint8 *data, uint32 count)
+{
+  put_bits(w, 0x11, 5);
+  put_bits(w, 0, 5);
+  put_bits(w, count, 15);
+  w->bits = 0;
+  memcpy(w->data + w->length, data, count);
+  w->length += count;
+}
+
+/* Large enough to keep most positions of a megabyte, so that matches
+   reach far back */
+#define HASH_BITS 22
+#define HASH_SIZE (1 << HASH_BITS)
+#define HISTORY_SIZE 2500000
+
+static uint32 hash4(uint8 *p)
+{
+  return ((p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32) p[3] << 24)) * 2654435761u)
+    >> (32 - HASH_BITS);
+}
+
+/* Compress in[start, end) to an RDP8_BULK_ENCODED_DATA at out, with
+   matches reaching back into everything before start. Returns the
+   compressed length. */
+static size_t compress_segment(uint8 *in, size_t start, size_t end, long *last, uint8 *out)
+{
+  bit_writer w;
+  size_t i, count, best_count;
+  long candidate;
+  int unused;
+
+  out[0] = 0x24;  /* PACKET_COMPR_TYPE_RDP8 | PACKET_COMPRESSED */
+  w.data = out + 1;
+  w.length = 0;
+  w.bits = 0;
+
+  i = start;
+  while (i < end)
+  {
+    best_count = 0;
+    if (i + 4 <= end)
+    {
+      candidate = last[hash4(in + i)];
+      last[hash4(in + i)] = i;
+      if (candidate >= 0 && i - candidate <= HISTORY_SIZE)
+      {
+        for (count = 0; i + count < end && in[candidate + count] == in[i + count]; count++);
+        if (count >= 3)
+          best_count = count;
+      }
+    }
+
+    if (best_count)
+    {
+      put_match(&w, i - candidate, best_count);
+      i += best_count;
+    }
+    else if (i + 32 <= end && in[i] == 0x5a && in[i + 1] == 0xa5)
+    {
+      /* Marked stretches go unencoded */
+      put_unencoded(&w, in + i, 32);
+      i += 32;
+    }
+    else
+    {
+      put_literal(&w, in[i]);
+      i++;
+    }
+  }
+
+  unused = (8 - w.bits) % 8;
+  w.data[w.length++] = unused;
+  return w.length + 1;
+}
+
+/* Compress to an RDP_SEGMENTED_DATA of one segment, or of several
+   segments of at most 65535 bytes */
+static size_t compress(uint8 *in, size_t start, size_t end, long *last, uint8 *out)
+{
+  size_t length, segment, offset;
+  uint16 count = 0;
+
+  if (end - start <= 65535)
+  {
+    out[0] = 0xe0;
+    return 1 + compress_segment(in, start, end, last, out + 1);
+  }
+
+  out[0] = 0xe1;
+  out[3] = (end - start) & 0xff;
+  out[4] = ((end - start) >> 8) & 0xff;
+  out[5] = ((end - start) >> 16) & 0xff;
+  out[6] = ((end - start) >> 24) & 0xff;
+  offset = 7;
+
+  for (; start < end; start += segment, count++)
+  {
+    segment = MIN(65535, end - start);
+    length = compress_segment(in, start, start + segment, last, out + offset + 4);
+    out[offset] = length & 0xff;
+    out[offset + 1] = (length >> 8) & 0xff;
+    out[offset + 2] = (length >> 16) & 0xff;
+    out[offset + 3] = 0;
+    offset += 4 + length;
+  }
+
+  out[1] = count & 0xff;
+  out[2] = count >> 8;
+  return offset;
+}
+
+static long *new_hash(void)
+{
+  long *last = malloc(HASH_SIZE * sizeof(long));
+  memset(last, 0xff, HASH_SIZE * sizeof(long));
+  return last;
+}
+
+static void fill_text(uint8 *data, size_t size)
+{
+  static const char *words[] = {"the ", "remote ", "desktop ", "protocol ", "graphics ",
+                                "pipeline ", "surface ", "cache ", "\n", "frame "};
+  size_t i = 0, n;
+  uint32 seed = 1;
+
+  while (i < size)
+  {
+    seed = seed * 1103515245 + 12345;
+    n = MIN(strlen(words[(seed >> 16) % 10]), size - i);
+    memcpy(data + i, words[(seed >> 16) % 10], n);
+    i += n;
+  }
+}
+
+static void fill_random(uint8 *data, size_t size, uint32 seed)
+{
+  size_t i;
+
+  for (i = 0; i < size; i++)
+  {
+    seed = seed * 1103515245 + 12345;
+    data[i] = seed >> 16;
+  }
+}
+
+static void assert_round_trip(ZGFX_CONTEXT *zgfx, uint8 *in, size_t start, size_t end,
+                              long *last)
+{
+  struct stream s;
+  uint8 *compressed, *out;
+  uint32 out_length;
+
+  compressed = malloc((end - start) * 2 + 64);
+  s = stream_of(compressed, compress(in, start, end, last, compressed));
+
+  assert_that(zgfx_decompress(zgfx, &s, &out, &out_length), is_true);
+  assert_that(out_length, is_equal_to(end - start));
+  assert_that(out, is_equal_to_contents_of(in + start, end - start));
+
+  free(compressed);
+}
+
+Ensure(ZGFX, decompresses_literals_and_an_overlapping_match)
+{
+  ZGFX_CONTEXT zgfx;
+  uint8 *out;
+  uint32 out_length;
+  uint8 data[] = {0xe0, 0x24, 0x30, 0x98, 0x8c, 0x71, 0x1d, 0x00, 0x07};
+  struct stream s = stream_of(data, sizeof(data));
+
+  zgfx_init(&zgfx);
+
+  assert_that(zgfx_decompress(&zgfx, &s, &out, &out_length), is_true);
+  assert_that(out_length, is_equal_to(9));
+  assert_that(out, is_equal_to_contents_of("abcabcabc", 9));
+}
+
+Ensure(ZGFX, decompresses_short_literals_and_unencoded_bytes)
+{
+  ZGFX_CONTEXT zgfx;
+  uint8 *out;
+  uint32 out_length;
+  uint8 data[] = {0xe0, 0x24, 0xc6, 0xd1, 0x00, 0x00, 0x30, 0x78, 0x79, 0x7a, 0xff, 0x88,
+                  0x80, 0x05};
+  uint8 expected[] = {0x00, 0xff, 0x78, 0x79, 0x7a, 0x66, 0x7a, 0x66, 0x7a};
+  struct stream s = stream_of(data, sizeof(data));
+
+  zgfx_init(&zgfx);
+
+  assert_that(zgfx_decompress(&zgfx, &s, &out, &out_length), is_true);
+  assert_that(out_length, is_equal_to(sizeof(expected)));
+  assert_that(out, is_equal_to_contents_of(expected, sizeof(expected)));
+}
+
+Ensure(ZGFX, uncompressed_segments_go_to_the_history)
+{
+  ZGFX_CONTEXT zgfx;
+  uint8 *out;
+  uint32 out_length;
+  uint8 raw[] = {0x04, 'a', 'b', 'c', 'd'};
+  /* Match of 4 bytes at distance 4 */
+  uint8 match[] = {0x24, 0x89, 0x20, 0x02};
+
+  zgfx_init(&zgfx);
+
+  assert_that(zgfx_decompress_segment(&zgfx, raw, sizeof(raw), &out, &out_length), is_true);
+  assert_that(out, is_equal_to_contents_of("abcd", 4));
+
+  assert_that(zgfx_decompress_segment(&zgfx, match, sizeof(match), &out, &out_length), is_true);
+  assert_that(out_length, is_equal_to(4));
+  assert_that(out, is_equal_to_contents_of("abcd", 4));
+}
+
+Ensure(ZGFX, round_trips_text_and_random_data)
+{
+  ZGFX_CONTEXT zgfx;
+  uint8 *in = malloc(90000);
+  long *last = new_hash();
+
+  zgfx_init(&zgfx);
+
+  fill_text(in, 30000);
+  fill_random(in + 30000, 30000, 7);
+  /* Mark a few stretches for unencoded tokens */
+  in[1000] = in[40000] = 0x5a;
+  in[1001] = in[40001] = 0xa5;
+
+  assert_round_trip(&zgfx, in, 0, 30000, last);
+  assert_round_trip(&zgfx, in, 30000, 60000, last);
+  /* Once more, now all matches into the history */
+  memcpy(in + 60000, in + 30000, 30000);
+  assert_round_trip(&zgfx, in, 60000, 90000, last);
+
+  free(last);
+  free(in);
+}
+
+Ensure(ZGFX, round_trips_multipart_data)
+{
+  ZGFX_CONTEXT zgfx;
+  size_t size = 300000;
+  uint8 *in = malloc(size);
+  long *last = new_hash();
+
+  zgfx_init(&zgfx);
+  fill_text(in, size / 2);
+  fill_random(in + size / 2, size / 2, 3);
+
+  assert_round_trip(&zgfx, in, 0, size, last);
+
+  free(last);
+  free(in);
+}
+
+Ensure(ZGFX, round_trips_matches_across_the_history_wrap)
+{
+  ZGFX_CONTEXT zgfx;
+  size_t block = 1100000, size = 3 * block, offset;
+  uint8 *in = malloc(size);
+  long *last = new_hash();
+
+  zgfx_init(&zgfx);
+  fill_random(in, block, 11);
+  memcpy(in + block, in, block);
+  memcpy(in + 2 * block, in, block);
+  fill_text(in + 2 * block + 500000, 1000);
+
+  for (offset = 0; offset < size; offset += 200000)
+    assert_round_trip(&zgfx, in, offset, MIN(size, offset + 200000), last);
+
+  free(last);
+  free(in);
+}
+
+Ensure(ZGFX, rejects_bad_data)
+{
+  ZGFX_CONTEXT zgfx;
+  uint8 *out;
+  uint32 out_length;
+  uint8 no_trailer[] = {0xe0, 0x24};
+  uint8 bad_descriptor[] = {0xe2, 0x04, 0x00};
+  uint8 bad_type[] = {0xe0, 0x21, 0x00, 0x00};
+  uint8 truncated[] = {0xe1, 0x01, 0x00, 0x04, 0x00, 0x00, 0x00, 0x10, 0x00, 0x00, 0x00,
+                       0x04, 'a'};
+  uint8 overrun[] = {0xe0, 0x24, 0x30, 0x98, 0x8c, 0x71, 0x1d, 0x00, 0x00};
+  struct stream s;
+
+  zgfx_init(&zgfx);
+
+  s = stream_of(no_trailer, sizeof(no_trailer));
+  assert_that(zgfx_decompress(&zgfx, &s, &out, &out_length), is_false);
+  s = stream_of(bad_descriptor, sizeof(bad_descriptor));
+  assert_that(zgfx_decompress(&zgfx, &s, &out, &out_length), is_false);
+  s = stream_of(bad_type, sizeof(bad_type));
+  assert_that(zgfx_decompress(&zgfx, &s, &out, &out_length), is_false);
+  s = stream_of(truncated, sizeof(truncated));
+  assert_that(zgfx_decompress(&zgfx, &s, &out, &out_length), is_false);
+  /* Trailing padding read as a token that runs past the end */
+  s = stream_of(overrun, sizeof(overrun));
+  assert_that(zgfx_decompress(&zgfx, &s, &out, &out_length), is_false);
+}
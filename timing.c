@@ -0,0 +1,152 @@
+/* -*- c-basic-offset: 8 -*-
+   rdesktop: A Remote Desktop Protocol client.
+   Connection phase timing
+
+   This program is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <stdio.h>
+#include <sys/time.h>
+#include "rdesktop.h"
+
+/* Wall clock time spent in each phase of the most recent connection,
+   from rdp_connect() until the first graphics update. Each phase is
+   measured once per connection; the first start and the first stop
+   after it count. */
+
+extern RD_BOOL g_timing_report;
+
+typedef struct timing_phase_t
+{
+	const char *name;
+	struct timeval start;
+	struct timeval elapsed;
+	RD_BOOL started;
+	RD_BOOL stopped;
+} timing_phase_t;
+
+static timing_phase_t g_phases[TIMING_PHASE_COUNT] = {
+	{"dns", {0, 0}, {0, 0}, False, False},
+	{"tcp", {0, 0}, {0, 0}, False, False},
+	{"tls", {0, 0}, {0, 0}, False, False},
+	{"credssp", {0, 0}, {0, 0}, False, False},
+	{"mcs", {0, 0}, {0, 0}, False, False},
+	{"licensing", {0, 0}, {0, 0}, False, False},
+	{"capabilities", {0, 0}, {0, 0}, False, False},
+	{"first_frame", {0, 0}, {0, 0}, False, False}
+};
+
+static struct timeval g_timing_begin;
+static struct timeval g_timing_total;
+static RD_BOOL g_timing_active = False;
+static RD_BOOL g_timing_complete = False;
+
+/* Begin profiling a new connection */
+void
+timing_reset(void)
+{
+	int i;
+
+	for (i = 0; i < TIMING_PHASE_COUNT; i++)
+	{
+		g_phases[i].started = False;
+		g_phases[i].stopped = False;
+		timerclear(&g_phases[i].elapsed);
+	}
+
+	timerclear(&g_timing_total);
+	gettimeofday(&g_timing_begin, NULL);
+	g_timing_active = True;
+	g_timing_complete = False;
+}
+
+void
+timing_start(timing_phase phase)
+{
+	if (!g_timing_active || g_phases[phase].started)
+		return;
+
+	g_phases[phase].started = True;
+	gettimeofday(&g_phases[phase].start, NULL);
+}
+
+void
+timing_stop(timing_phase phase)
+{
+	struct timeval now;
+
+	if (!g_timing_active || !g_phases[phase].started || g_phases[phase].stopped)
+		return;
+
+	gettimeofday(&now, NULL);
+	g_phases[phase].stopped = True;
+	timersub(&now, &g_phases[phase].start, &g_phases[phase].elapsed);
+
+	if (phase != TIMING_FIRST_FRAME)
+		return;
+
+	/* The first frame concludes the connection */
+	timersub(&now, &g_timing_begin, &g_timing_total);
+	g_timing_active = False;
+	g_timing_complete = True;
+
+	timing_report();
+}
+
+/* Format the breakdown as a single line of space separated name=value
+   pairs, values in milliseconds. Phases that did not take place in this
+   connection, e.g. credssp with TLS only, are left out. */
+int
+timing_format(char *buf, size_t size)
+{
+	int i, len;
+
+	if (!g_timing_complete)
+		return snprintf(buf, size, "timing incomplete");
+
+	len = snprintf(buf, size, "timing");
+	for (i = 0; i < TIMING_PHASE_COUNT && len < (int) size; i++)
+	{
+		if (!g_phases[i].stopped)
+			continue;
+
+		len += snprintf(buf + len, size - len, " %s_ms=%ld.%03ld", g_phases[i].name,
+				(long) g_phases[i].elapsed.tv_sec * 1000 +
+				g_phases[i].elapsed.tv_usec / 1000,
+				(long) g_phases[i].elapsed.tv_usec % 1000);
+	}
+
+	if (len < (int) size)
+		len += snprintf(buf + len, size - len, " total_ms=%ld.%03ld",
+				(long) g_timing_total.tv_sec * 1000 +
+				g_timing_total.tv_usec / 1000,
+				(long) g_timing_total.tv_usec % 1000);
+
+	return len;
+}
+
+void
+timing_report(void)
+{
+	char buf[512];
+
+	timing_format(buf, sizeof(buf));
+	logger(Core, Verbose, "Connection %s", buf);
+
+	if (g_timing_report)
+	{
+		fprintf(stdout, "%s\n", buf);
+		fflush(stdout);
+	}
+}
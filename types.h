@@ -65,6 +65,25 @@ typedef struct _RD_POINT
 }
 RD_POINT;
 
+typedef struct _RD_RECT
+{
+	sint16 x, y;
+	sint16 cx, cy;
+}
+RD_RECT;
+
+/* The bitmap of a set or stream surface bits command */
+typedef struct _SURFACE_BITS
+{
+	uint16 left, top, right, bottom;
+	uint8 bpp;
+	uint8 codec_id;
+	uint16 width, height;
+	uint32 length;
+	uint8 *data;
+}
+SURFACE_BITS;
+
 typedef struct _COLOURENTRY
 {
 	uint8 red;
@@ -310,6 +329,9 @@ FILEINFO;
 
 typedef RD_BOOL(*str_handle_lines_t) (const char *line, void *data);
 
+/* One item of a job for the worker threads */
+typedef void (*workpool_job_t) (int worker, int item);
+
 typedef enum
 {
 	Fixed,
@@ -318,4 +340,44 @@ typedef enum
 	Fullscreen,
 } window_size_type_t;
 
+/* A piece of an outgoing packet, see tcp_send_vector() */
+typedef struct _SEND_VECTOR
+{
+	uint8 *data;
+	uint32 length;
+}
+SEND_VECTOR;
+
+/* RDP 8.0 bulk decompressor, see zgfx.c */
+typedef struct _ZGFX_CONTEXT
+{
+	uint8 *history;
+	uint32 history_index;
+	uint8 *output;
+	uint32 output_length;
+	uint32 output_size;
+}
+ZGFX_CONTEXT;
+
+/* Decoder of one H.264 stream, see h264.c */
+typedef struct _H264_CONTEXT
+{
+	void *state;		/* of the decoder backend */
+}
+H264_CONTEXT;
+
+/* Connection phases measured by timing.c */
+typedef enum
+{
+	TIMING_DNS,
+	TIMING_TCP,
+	TIMING_TLS,
+	TIMING_CREDSSP,
+	TIMING_MCS,
+	TIMING_LICENSING,
+	TIMING_CAPABILITIES,
+	TIMING_FIRST_FRAME,
+	TIMING_PHASE_COUNT
+} timing_phase;
+
 #endif /* _TYPES_H */
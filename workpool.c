@@ -0,0 +1,150 @@
+/* -*- c-basic-offset: 8 -*-
+   rdesktop: A Remote Desktop Protocol client.
+   Worker threads for decoding
+
+   This program is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "rdesktop.h"
+
+#ifdef HAVE_PTHREAD
+#include <pthread.h>
+#include <unistd.h>
+#endif
+
+/* The codecs split a picture into independent items, tiles or bands
+   of rows, and hand them to workpool_run(). The calling thread and one
+   thread per additional processor claim items until none are left.
+   Jobs come from the main loop only, so there is one at a time. The
+   calling thread is worker 0, the pool threads are 1 and up, which
+   lets the job keep scratch space per worker. */
+
+#ifdef HAVE_PTHREAD
+static pthread_mutex_t g_workpool_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t g_workpool_start = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t g_workpool_done = PTHREAD_COND_INITIALIZER;
+static int g_workpool_num_threads = -1;
+static uint32 g_workpool_job;
+static workpool_job_t g_workpool_fn;
+static int g_workpool_count;
+static int g_workpool_next;
+static int g_workpool_busy;
+
+/* Claim and run items of the current job until there are none left.
+   Called with g_workpool_lock held. */
+static void
+workpool_run_claimed(int worker)
+{
+	int i;
+
+	while (g_workpool_next < g_workpool_count)
+	{
+		i = g_workpool_next++;
+		pthread_mutex_unlock(&g_workpool_lock);
+		g_workpool_fn(worker, i);
+		pthread_mutex_lock(&g_workpool_lock);
+	}
+}
+
+static void *
+workpool_thread(void *arg)
+{
+	int worker = (int) (long) arg;
+	uint32 job = 0;
+
+	pthread_mutex_lock(&g_workpool_lock);
+	while (1)
+	{
+		while (job == g_workpool_job)
+			pthread_cond_wait(&g_workpool_start, &g_workpool_lock);
+		job = g_workpool_job;
+
+		workpool_run_claimed(worker);
+
+		if (--g_workpool_busy == 0)
+			pthread_cond_signal(&g_workpool_done);
+	}
+
+	return NULL;
+}
+
+/* Start one thread per additional processor */
+static void
+workpool_start_threads(void)
+{
+	pthread_t thread;
+	long cpus;
+	int i;
+
+	g_workpool_num_threads = 0;
+
+	cpus = sysconf(_SC_NPROCESSORS_ONLN);
+	for (i = 0; i < MIN(cpus - 1, WORKPOOL_MAX_THREADS); i++)
+	{
+		if (pthread_create(&thread, NULL, workpool_thread, (void *) (long) (i + 1)) != 0)
+		{
+			logger(Core, Warning, "workpool_start_threads(), pthread_create() failed");
+			break;
+		}
+		pthread_detach(thread);
+		g_workpool_num_threads++;
+	}
+
+	logger(Core, Debug, "workpool_start_threads(), %d worker threads", g_workpool_num_threads);
+}
+#endif
+
+/* The number of threads besides the calling one, started on first use */
+int
+workpool_num_threads(void)
+{
+#ifdef HAVE_PTHREAD
+	if (g_workpool_num_threads == -1)
+		workpool_start_threads();
+
+	return g_workpool_num_threads;
+#else
+	return 0;
+#endif
+}
+
+/* Run fn for the items 0 to count - 1, and return when all are done */
+void
+workpool_run(workpool_job_t fn, int count)
+{
+	int i;
+
+#ifdef HAVE_PTHREAD
+	if (count > 1 && workpool_num_threads() > 0)
+	{
+		pthread_mutex_lock(&g_workpool_lock);
+		g_workpool_fn = fn;
+		g_workpool_count = count;
+		g_workpool_next = 0;
+		g_workpool_busy = g_workpool_num_threads;
+		g_workpool_job++;
+		pthread_cond_broadcast(&g_workpool_start);
+
+		workpool_run_claimed(0);
+
+		while (g_workpool_busy > 0)
+			pthread_cond_wait(&g_workpool_done, &g_workpool_lock);
+		pthread_mutex_unlock(&g_workpool_lock);
+		return;
+	}
+#endif
+
+	for (i = 0; i < count; i++)
+		fn(0, i);
+}
@@ -30,6 +30,7 @@
 #include <time.h>
 #include <errno.h>
 #include <strings.h>
+#include <limits.h>
 #include "rdesktop.h"
 #include "xproto.h"
 #include <X11/Xcursor/Xcursor.h>
@@ -85,6 +86,10 @@ Time g_last_gesturetime;
 static int g_x_socket;
 static Screen *g_screen;
 Window g_wnd;
+/* Current size of g_wnd as tracked from our own requests and
+   ConfigureNotify, so that it never has to be queried from the server */
+static int g_wnd_width;
+static int g_wnd_height;
 
 RD_BOOL g_dynamic_session_resize = True;
 
@@ -138,6 +143,7 @@ static GC g_gc = NULL;
 static GC g_create_bitmap_gc = NULL;
 static GC g_create_glyph_gc = NULL;
 static XRectangle g_clip_rectangle;
+static RD_BOOL g_clip_valid = False;	/* g_clip_rectangle is set in g_gc */
 static Visual *g_visual;
 /* Color depth of the X11 visual of our window (e.g. 24 for True Color R8G8B visual).
    This may be 32 for R8G8B8 visuals, and then the rest of the bits are undefined
@@ -258,6 +264,24 @@ seamless_XDrawLines(Drawable d, XPoint * points, int npoints, int xoffset, int y
 	points[0].y += yoffset;
 }
 
+static void
+seamless_XFillRectangles(Drawable d, XRectangle * rects, int n, int xoffset, int yoffset)
+{
+	int i;
+
+	for (i = 0; i < n; i++)
+	{
+		rects[i].x -= xoffset;
+		rects[i].y -= yoffset;
+	}
+	XFillRectangles(g_display, d, g_gc, rects, n);
+	for (i = 0; i < n; i++)
+	{
+		rects[i].x += xoffset;
+		rects[i].y += yoffset;
+	}
+}
+
 #define FILL_RECTANGLE(x,y,cx,cy)\
 { \
 	XFillRectangle(g_display, g_wnd, g_gc, x, y, cx, cy); \
@@ -266,6 +290,14 @@ seamless_XDrawLines(Drawable d, XPoint * points, int npoints, int xoffset, int y
 		XFillRectangle(g_display, g_backstore, g_gc, x, y, cx, cy); \
 }
 
+#define FILL_RECTANGLES(r,n)\
+{ \
+	XFillRectangles(g_display, g_wnd, g_gc, r, n); \
+	ON_ALL_SEAMLESS_WINDOWS(seamless_XFillRectangles, (sw->wnd, r, n, sw->xoffset, sw->yoffset)); \
+	if (g_ownbackstore) \
+		XFillRectangles(g_display, g_backstore, g_gc, r, n); \
+}
+
 #define FILL_RECTANGLE_BACKSTORE(x,y,cx,cy)\
 { \
 	XFillRectangle(g_display, g_ownbackstore ? g_backstore : g_wnd, g_gc, x, y, cx, cy); \
@@ -895,6 +927,95 @@ translate_colour(uint32 colour)
 	return MAKECOLOUR(pc);
 }
 
+/* Runs of rect and line orders with the same colour and raster
+   operation, e.g. the grid of a spreadsheet, are collected and sent
+   as one XFillRectangles or XDrawSegments request per drawable.
+   Everything else that draws or changes g_gc flushes the batch
+   first, so output is the same as drawing each order by itself. */
+#define BATCH_MAX 256
+
+typedef enum
+{
+	BATCH_NONE,
+	BATCH_RECTS,
+	BATCH_SEGMENTS
+} batch_type;
+
+static batch_type g_batch_type = BATCH_NONE;
+static uint32 g_batch_colour;
+static uint8 g_batch_opcode;
+static int g_batch_count;
+static XRectangle g_batch_rects[BATCH_MAX];
+static XSegment g_batch_segments[BATCH_MAX];
+
+static RD_BOOL g_frame_active = False;
+
+static void
+seamless_XDrawSegments(Drawable d, XSegment * segs, int n, int xoffset, int yoffset)
+{
+	int i;
+
+	for (i = 0; i < n; i++)
+	{
+		segs[i].x1 -= xoffset;
+		segs[i].y1 -= yoffset;
+		segs[i].x2 -= xoffset;
+		segs[i].y2 -= yoffset;
+	}
+	XDrawSegments(g_display, d, g_gc, segs, n);
+	for (i = 0; i < n; i++)
+	{
+		segs[i].x1 += xoffset;
+		segs[i].y1 += yoffset;
+		segs[i].x2 += xoffset;
+		segs[i].y2 += yoffset;
+	}
+}
+
+static void
+batch_flush(void)
+{
+	if (g_batch_type == BATCH_NONE)
+		return;
+
+	SET_FUNCTION(g_batch_opcode);
+	SET_FOREGROUND(g_batch_colour);
+
+	if (g_batch_type == BATCH_RECTS)
+	{
+		FILL_RECTANGLES(g_batch_rects, g_batch_count);
+	}
+	else
+	{
+		XDrawSegments(g_display, g_wnd, g_gc, g_batch_segments, g_batch_count);
+		ON_ALL_SEAMLESS_WINDOWS(seamless_XDrawSegments,
+					(sw->wnd, g_batch_segments, g_batch_count, sw->xoffset,
+					 sw->yoffset));
+		if (g_ownbackstore)
+			XDrawSegments(g_display, g_backstore, g_gc, g_batch_segments,
+				      g_batch_count);
+	}
+
+	RESET_FUNCTION(g_batch_opcode);
+
+	g_batch_type = BATCH_NONE;
+	g_batch_count = 0;
+}
+
+/* Start a new batch unless the current one can take another entry */
+static void
+batch_begin(batch_type type, uint8 opcode, uint32 colour)
+{
+	if (g_batch_type == type && g_batch_opcode == opcode && g_batch_colour == colour
+	    && g_batch_count < BATCH_MAX)
+		return;
+
+	batch_flush();
+	g_batch_type = type;
+	g_batch_opcode = opcode;
+	g_batch_colour = colour;
+}
+
 /* indent is confused by UNROLL8 */
 /* *INDENT-OFF* */
 
@@ -2026,6 +2147,7 @@ ui_deinit(void)
 	XFreeModifiermap(g_mod_map);
 
 	XFreeGC(g_display, g_gc);
+	g_clip_valid = False;
 	XCloseDisplay(g_display);
 	g_display = NULL;
 }
@@ -2142,12 +2264,16 @@ ui_create_window(uint32 width, uint32 height)
 	g_wnd = XCreateWindow(g_display, RootWindowOfScreen(g_screen), g_xpos, g_ypos, width,
 			      height, 0, g_depth, InputOutput, g_visual, value_mask, &attribs);
 
+	g_wnd_width = width;
+	g_wnd_height = height;
+
 	ewmh_set_wm_pid(g_wnd, getpid());
 	set_wm_client_machine(g_display, g_wnd);
 
 	if (g_gc == NULL)
 	{
 		g_gc = XCreateGC(g_display, g_wnd, 0, NULL);
+		g_clip_valid = False;
 		ui_reset_clip();
 	}
 
@@ -2251,6 +2377,8 @@ ui_resize_window(uint32 width, uint32 height)
 	XSizeHints *sizehints;
 	Pixmap bs;
 
+	batch_flush();
+
 	XGetWindowAttributes(g_display, g_wnd, &attr);
 
 	if ((attr.width == (int) width && attr.height == (int) height))
@@ -2274,6 +2402,8 @@ ui_resize_window(uint32 width, uint32 height)
 	if (!g_embed_wnd)
 	{
 		XResizeWindow(g_display, g_wnd, width, height);
+		g_wnd_width = width;
+		g_wnd_height = height;
 	}
 
 	/* create new backstore pixmap */
@@ -2299,6 +2429,8 @@ ui_have_window()
 void
 ui_destroy_window(void)
 {
+	batch_flush();
+
 	if (g_IC != NULL)
 		XDestroyIC(g_IC);
 
@@ -2425,11 +2557,8 @@ xwin_toggle_fullscreen(void)
 static void
 handle_button_event(XEvent xevent, RD_BOOL down)
 {
-	XWindowAttributes attr;
 	uint16 button, input_type, flags = 0;
 
-	XGetWindowAttributes(g_display, g_wnd, &attr);
-
 	g_last_gesturetime = xevent.xbutton.time;
 	/* Reverse the pointer button mapping, e.g. in the case of
 	   "left-handed mouse mode"; the RDP session expects to
@@ -2452,12 +2581,12 @@ handle_button_event(XEvent xevent, RD_BOOL down)
 	if (xevent.xbutton.y < g_win_button_size)
 	{
 		/*  Check from right to left: */
-		if (xevent.xbutton.x >= attr.width - g_win_button_size)
+		if (xevent.xbutton.x >= g_wnd_width - g_win_button_size)
 		{
 			/* The close button, continue */
 			;
 		}
-		else if (xevent.xbutton.x >= attr.width - g_win_button_size * 2)
+		else if (xevent.xbutton.x >= g_wnd_width - g_win_button_size * 2)
 		{
 			/* The maximize/restore button. Do not send to
 			   server.  It might be a good idea to change the
@@ -2466,7 +2595,7 @@ handle_button_event(XEvent xevent, RD_BOOL down)
 			if (xevent.type == ButtonPress)
 				return;
 		}
-		else if (xevent.xbutton.x >= attr.width - g_win_button_size * 3)
+		else if (xevent.xbutton.x >= g_wnd_width - g_win_button_size * 3)
 		{
 			/* The minimize button. Iconify window. */
 			if (xevent.type == ButtonRelease)
@@ -2834,6 +2963,8 @@ xwin_process_events(void)
 					XGetWindowAttributes(g_display, g_wnd, &attr);
 					g_window_width = attr.width;
 					g_window_height = attr.height;
+					g_wnd_width = attr.width;
+					g_wnd_height = attr.height;
 
 					logger(GUI, Debug,
 					       "xwin_process_events(), Window mapped with size %dx%d",
@@ -2859,6 +2990,12 @@ xwin_process_events(void)
 				}
 				break;
 			case ConfigureNotify:
+				if (xevent.xconfigure.window == g_wnd)
+				{
+					g_wnd_width = xevent.xconfigure.width;
+					g_wnd_height = xevent.xconfigure.height;
+				}
+
 #ifdef HAVE_XRANDR
 				/* Resize on root window size change */
 				if (xevent.xconfigure.window == DefaultRootWindow(g_display))
@@ -3254,6 +3391,8 @@ ui_paint_bitmap(int x, int y, int cx, int cy, int width, int height, uint8 * dat
 	uint8 *tdata;
 	int bitmap_pad;
 
+	batch_flush();
+
 	if (g_server_depth == 8)
 	{
 		bitmap_pad = 8;
@@ -3662,6 +3801,8 @@ ui_destroy_colourmap(RD_HCOLOURMAP map)
 void
 ui_set_colourmap(RD_HCOLOURMAP map)
 {
+	batch_flush();
+
 	if (!g_owncolmap)
 	{
 		if (g_colmap)
@@ -3676,22 +3817,28 @@ ui_set_colourmap(RD_HCOLOURMAP map)
 	}
 }
 
+/* Orders set and reset the clip all the time, most often to what it
+   already is. Only changes are sent to the X server. */
 void
 ui_set_clip(int x, int y, int cx, int cy)
 {
+	if (g_clip_valid && g_clip_rectangle.x == x && g_clip_rectangle.y == y
+	    && g_clip_rectangle.width == cx && g_clip_rectangle.height == cy)
+		return;
+
+	batch_flush();
 	g_clip_rectangle.x = x;
 	g_clip_rectangle.y = y;
 	g_clip_rectangle.width = cx;
 	g_clip_rectangle.height = cy;
 	XSetClipRectangles(g_display, g_gc, 0, 0, &g_clip_rectangle, 1, YXBanded);
+	g_clip_valid = True;
 }
 
 void
 ui_reset_clip(void)
 {
-	XWindowAttributes attr;
-	XGetWindowAttributes(g_display, g_wnd, &attr);
-	ui_set_clip(0, 0, attr.width, attr.height);
+	ui_set_clip(0, 0, g_wnd_width, g_wnd_height);
 }
 
 void
@@ -3704,6 +3851,8 @@ void
 ui_destblt(uint8 opcode,
 	   /* dest */ int x, int y, int cx, int cy)
 {
+	batch_flush();
+
 	SET_FUNCTION(opcode);
 	FILL_RECTANGLE(x, y, cx, cy);
 	RESET_FUNCTION(opcode);
@@ -3726,6 +3875,8 @@ ui_patblt(uint8 opcode,
 	Pixmap fill;
 	uint8 i, ipattern[8];
 
+	batch_flush();
+
 	SET_FUNCTION(opcode);
 
 	switch (brush->style)
@@ -3810,6 +3961,8 @@ ui_screenblt(uint8 opcode,
 	     /* dest */ int x, int y, int cx, int cy,
 	     /* src */ int srcx, int srcy)
 {
+	batch_flush();
+
 	SET_FUNCTION(opcode);
 	if (g_ownbackstore)
 	{
@@ -3834,6 +3987,8 @@ ui_memblt(uint8 opcode,
 	  /* dest */ int x, int y, int cx, int cy,
 	  /* src */ RD_HBITMAP src, int srcx, int srcy)
 {
+	batch_flush();
+
 	SET_FUNCTION(opcode);
 	XCopyArea(g_display, (Pixmap) src, g_wnd, g_gc, srcx, srcy, cx, cy, x, y);
 	ON_ALL_SEAMLESS_WINDOWS(XCopyArea,
@@ -3850,6 +4005,8 @@ ui_triblt(uint8 opcode,
 	  /* src */ RD_HBITMAP src, int srcx, int srcy,
 	  /* brush */ BRUSH * brush, uint32 bgcolour, uint32 fgcolour)
 {
+	batch_flush();
+
 	/* This is potentially difficult to do in general. Until someone
 	   comes up with a more efficient way of doing it I am using cases. */
 
@@ -3882,15 +4039,14 @@ ui_line(uint8 opcode,
 	/* dest */ int startx, int starty, int endx, int endy,
 	/* pen */ PEN * pen)
 {
-	SET_FUNCTION(opcode);
-	SET_FOREGROUND(pen->colour);
-	XDrawLine(g_display, g_wnd, g_gc, startx, starty, endx, endy);
-	ON_ALL_SEAMLESS_WINDOWS(XDrawLine, (g_display, sw->wnd, g_gc,
-					    startx - sw->xoffset, starty - sw->yoffset,
-					    endx - sw->xoffset, endy - sw->yoffset));
-	if (g_ownbackstore)
-		XDrawLine(g_display, g_backstore, g_gc, startx, starty, endx, endy);
-	RESET_FUNCTION(opcode);
+	XSegment *seg;
+
+	batch_begin(BATCH_SEGMENTS, opcode, pen->colour);
+	seg = &g_batch_segments[g_batch_count++];
+	seg->x1 = startx;
+	seg->y1 = starty;
+	seg->x2 = endx;
+	seg->y2 = endy;
 }
 
 void
@@ -3898,8 +4054,134 @@ ui_rect(
 	       /* dest */ int x, int y, int cx, int cy,
 	       /* brush */ uint32 colour)
 {
-	SET_FOREGROUND(colour);
-	FILL_RECTANGLE(x, y, cx, cy);
+	XRectangle *rect;
+
+	batch_begin(BATCH_RECTS, ROP2_COPY, colour);
+	rect = &g_batch_rects[g_batch_count++];
+	rect->x = x;
+	rect->y = y;
+	rect->width = cx;
+	rect->height = cy;
+}
+
+/* Limit g_gc to the parts of the rectangles that are inside the
+   current clip, and return their bounding box. Returns False if
+   nothing is left to draw. Undone by restore_clip(). */
+static RD_BOOL
+set_clip_rects(RD_RECT * rects, int count, XRectangle * bounds)
+{
+	int i, n, x1, y1, x2, y2, left, top, right, bottom;
+	XRectangle *clip = g_batch_rects;
+
+	batch_flush();
+
+	left = top = INT_MAX;
+	right = bottom = INT_MIN;
+	for (i = n = 0; i < count && n < BATCH_MAX; i++)
+	{
+		x1 = MAX(rects[i].x, g_clip_rectangle.x);
+		y1 = MAX(rects[i].y, g_clip_rectangle.y);
+		x2 = MIN(rects[i].x + rects[i].cx, g_clip_rectangle.x + g_clip_rectangle.width);
+		y2 = MIN(rects[i].y + rects[i].cy, g_clip_rectangle.y + g_clip_rectangle.height);
+		if (x2 <= x1 || y2 <= y1)
+			continue;
+
+		clip[n].x = x1;
+		clip[n].y = y1;
+		clip[n].width = x2 - x1;
+		clip[n].height = y2 - y1;
+		n++;
+
+		left = MIN(left, x1);
+		top = MIN(top, y1);
+		right = MAX(right, x2);
+		bottom = MAX(bottom, y2);
+	}
+
+	if (n == 0)
+		return False;
+
+	XSetClipRectangles(g_display, g_gc, 0, 0, clip, n, Unsorted);
+
+	bounds->x = left;
+	bounds->y = top;
+	bounds->width = right - left;
+	bounds->height = bottom - top;
+	return True;
+}
+
+static void
+restore_clip(void)
+{
+	XSetClipRectangles(g_display, g_gc, 0, 0, &g_clip_rectangle, 1, YXBanded);
+}
+
+/* Multi rectangle orders, drawn with one request per drawable where
+   the primitive allows it and otherwise as one operation on the
+   bounding box with the rectangles as clip. */
+void
+ui_multi_destblt(uint8 opcode,
+		 /* dest */ RD_RECT * rects, int count)
+{
+	XRectangle *xrects = g_batch_rects;
+	int i;
+
+	batch_flush();
+
+	if (count > BATCH_MAX)
+		count = BATCH_MAX;
+
+	for (i = 0; i < count; i++)
+	{
+		xrects[i].x = rects[i].x;
+		xrects[i].y = rects[i].y;
+		xrects[i].width = rects[i].cx;
+		xrects[i].height = rects[i].cy;
+	}
+
+	SET_FUNCTION(opcode);
+	FILL_RECTANGLES(xrects, count);
+	RESET_FUNCTION(opcode);
+}
+
+void
+ui_multi_patblt(uint8 opcode,
+		/* dest */ RD_RECT * rects, int count,
+		/* brush */ BRUSH * brush, uint32 bgcolour, uint32 fgcolour)
+{
+	XRectangle bounds;
+
+	if (!set_clip_rects(rects, count, &bounds))
+		return;
+
+	ui_patblt(opcode, bounds.x, bounds.y, bounds.width, bounds.height, brush, bgcolour,
+		  fgcolour);
+	restore_clip();
+}
+
+void
+ui_multi_screenblt(uint8 opcode,
+		   /* dest */ RD_RECT * rects, int count,
+		   /* src */ int srcdx, int srcdy)
+{
+	XRectangle bounds;
+
+	if (!set_clip_rects(rects, count, &bounds))
+		return;
+
+	ui_screenblt(opcode, bounds.x, bounds.y, bounds.width, bounds.height,
+		     bounds.x + srcdx, bounds.y + srcdy);
+	restore_clip();
+}
+
+void
+ui_multi_rect(/* dest */ RD_RECT * rects, int count,
+	      /* brush */ uint32 colour)
+{
+	int i;
+
+	for (i = 0; i < count; i++)
+		ui_rect(rects[i].x, rects[i].y, rects[i].cx, rects[i].cy, colour);
 }
 
 void
@@ -3911,6 +4193,8 @@ ui_polygon(uint8 opcode,
 	uint8 style, i, ipattern[8];
 	Pixmap fill;
 
+	batch_flush();
+
 	SET_FUNCTION(opcode);
 
 	switch (fillmode)
@@ -4005,6 +4289,8 @@ ui_polyline(uint8 opcode,
 	    /* dest */ RD_POINT * points, int npoints,
 	    /* pen */ PEN * pen)
 {
+	batch_flush();
+
 	/* TODO: set join style */
 	SET_FUNCTION(opcode);
 	SET_FOREGROUND(pen->colour);
@@ -4028,6 +4314,8 @@ ui_ellipse(uint8 opcode,
 	uint8 style, i, ipattern[8];
 	Pixmap fill;
 
+	batch_flush();
+
 	SET_FUNCTION(opcode);
 
 	if (brush)
@@ -4112,6 +4400,8 @@ ui_draw_glyph(int mixmode,
 	      /* src */ RD_HGLYPH glyph, int srcx, int srcy,
 	      uint32 bgcolour, uint32 fgcolour)
 {
+	batch_flush();
+
 	UNUSED(srcx);
 	UNUSED(srcy);
 
@@ -4168,12 +4458,11 @@ ui_draw_text(uint8 font, uint8 flags, uint8 opcode, int mixmode, int x, int y,
 	     int boxx, int boxy, int boxcx, int boxcy, BRUSH * brush,
 	     uint32 bgcolour, uint32 fgcolour, uint8 * text, uint8 length)
 {
-	XWindowAttributes attr;
+	batch_flush();
+
 	UNUSED(opcode);
 	UNUSED(brush);
 
-	XGetWindowAttributes(g_display, g_wnd, &attr);
-
 	/* TODO: use brush appropriately */
 
 	FONTGLYPH *glyph;
@@ -4185,8 +4474,8 @@ ui_draw_text(uint8 font, uint8 flags, uint8 opcode, int mixmode, int x, int y,
 	/* Sometimes, the boxcx value is something really large, like
 	   32691. This makes XCopyArea fail with Xvnc. The code below
 	   is a quick fix. */
-	if (boxx + boxcx > attr.width)
-		boxcx = attr.width - boxx;
+	if (boxx + boxcx > g_wnd_width)
+		boxcx = g_wnd_width - boxx;
 
 	if (boxcx > 1)
 	{
@@ -4296,6 +4585,8 @@ ui_desktop_save(uint32 offset, int x, int y, int cx, int cy)
 	Pixmap pix;
 	XImage *image;
 
+	batch_flush();
+
 	if (g_ownbackstore)
 	{
 		image = XGetImage(g_display, g_backstore, x, y, cx, cy, AllPlanes, ZPixmap);
@@ -4322,6 +4613,8 @@ ui_desktop_restore(uint32 offset, int x, int y, int cx, int cy)
 	XImage *image;
 	uint8 *data;
 
+	batch_flush();
+
 	offset *= g_bpp / 8;
 	data = cache_get_desktop(offset, cx, cy, g_bpp / 8);
 	if (data == NULL)
@@ -4358,9 +4651,37 @@ ui_begin_update(void)
 void
 ui_end_update(void)
 {
+	batch_flush();
+
+	/* Within a frame, the result is presented at the frame end */
+	if (!g_frame_active)
+		XFlush(g_display);
+}
+
+/* The server delimits logical frames with frame markers, which lets
+   us send the drawing of a frame to the X server in one go instead
+   of after each update PDU */
+void
+ui_begin_frame(void)
+{
+	g_frame_active = True;
+}
+
+void
+ui_end_frame(void)
+{
+	g_frame_active = False;
+	batch_flush();
 	XFlush(g_display);
 }
 
+/* Forget the frame in progress, its end is lost with the connection */
+void
+ui_reset_state(void)
+{
+	g_frame_active = False;
+}
+
 
 void
 ui_seamless_begin(RD_BOOL hidden)
@@ -0,0 +1,444 @@
+/* -*- c-basic-offset: 8 -*-
+   rdesktop: A Remote Desktop Protocol client.
+   RDP 8.0 bulk decompression (ZGFX), [MS-RDPEGFX] 3.1.9.1
+
+   This program is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "rdesktop.h"
+
+/* Compressed data is a bit stream, most significant bit first, of
+   prefix coded tokens. A token is either a literal byte or a match
+   copying earlier output from the history, which holds the last 2.5 MB
+   decompressed on the same context. The last byte of a compressed
+   segment gives the number of unused bits in the byte before it.
+
+   Tokens are at most nine bits, so they are decoded with a lookup on
+   the next nine bits of input. */
+
+#define ZGFX_HISTORY_SIZE	2500000
+#define ZGFX_SEGMENT_MAX	65535
+
+/* RDP_SEGMENTED_DATA and RDP8_BULK_ENCODED_DATA */
+#define ZGFX_SEGMENTED_SINGLE		0xE0
+#define ZGFX_SEGMENTED_MULTIPART	0xE1
+#define ZGFX_PACKET_COMPR_TYPE_RDP8	0x04
+#define ZGFX_PACKET_COMPRESSED		0x20
+
+#define ZGFX_TOKEN_BITS		9
+
+typedef struct zgfx_token_t
+{
+	uint8 prefix_length;
+	uint16 prefix;
+	uint8 value_bits;
+	RD_BOOL match;
+	uint32 value_base;
+} zgfx_token_t;
+
+static const zgfx_token_t g_zgfx_tokens[] = {
+	{1, 0x000, 8, False, 0},
+	{5, 0x011, 5, True, 0},
+	{5, 0x012, 7, True, 32},
+	{5, 0x013, 9, True, 160},
+	{5, 0x014, 10, True, 672},
+	{5, 0x015, 12, True, 1696},
+	{5, 0x018, 0, False, 0x00},
+	{5, 0x019, 0, False, 0x01},
+	{6, 0x02c, 14, True, 5792},
+	{6, 0x02d, 15, True, 22176},
+	{6, 0x034, 0, False, 0x02},
+	{6, 0x035, 0, False, 0x03},
+	{6, 0x036, 0, False, 0xff},
+	{7, 0x05c, 18, True, 54944},
+	{7, 0x05d, 20, True, 317088},
+	{7, 0x06e, 0, False, 0x04},
+	{7, 0x06f, 0, False, 0x05},
+	{7, 0x070, 0, False, 0x06},
+	{7, 0x071, 0, False, 0x07},
+	{7, 0x072, 0, False, 0x08},
+	{7, 0x073, 0, False, 0x09},
+	{7, 0x074, 0, False, 0x0a},
+	{7, 0x075, 0, False, 0x0b},
+	{7, 0x076, 0, False, 0x3a},
+	{7, 0x077, 0, False, 0x3b},
+	{7, 0x078, 0, False, 0x3c},
+	{7, 0x079, 0, False, 0x3d},
+	{7, 0x07a, 0, False, 0x3e},
+	{7, 0x07b, 0, False, 0x3f},
+	{7, 0x07c, 0, False, 0x40},
+	{7, 0x07d, 0, False, 0x80},
+	{8, 0x0bc, 20, True, 1365664},
+	{8, 0x0bd, 21, True, 2414240},
+	{8, 0x0fc, 0, False, 0x0c},
+	{8, 0x0fd, 0, False, 0x38},
+	{8, 0x0fe, 0, False, 0x39},
+	{8, 0x0ff, 0, False, 0x66},
+	{9, 0x17c, 22, True, 4511392},
+	{9, 0x17d, 23, True, 8705696},
+	{9, 0x17e, 24, True, 17094304}
+};
+
+#define ZGFX_NUM_TOKENS (sizeof(g_zgfx_tokens) / sizeof(g_zgfx_tokens[0]))
+
+/* Token for each value of the next nine bits, 0xff for none */
+static uint8 g_zgfx_lookup[1 << ZGFX_TOKEN_BITS];
+static RD_BOOL g_zgfx_lookup_ready = False;
+
+typedef struct zgfx_bits_t
+{
+	uint8 *p, *end;
+	uint32 acc;
+	int count;
+	sint32 remaining;
+} zgfx_bits_t;
+
+static void
+zgfx_build_lookup(void)
+{
+	unsigned int i, j, shift;
+
+	memset(g_zgfx_lookup, 0xff, sizeof(g_zgfx_lookup));
+	for (i = 0; i < ZGFX_NUM_TOKENS; i++)
+	{
+		shift = ZGFX_TOKEN_BITS - g_zgfx_tokens[i].prefix_length;
+		for (j = 0; j < (1u << shift); j++)
+			g_zgfx_lookup[(g_zgfx_tokens[i].prefix << shift) | j] = i;
+	}
+	g_zgfx_lookup_ready = True;
+}
+
+/* Make sure there are at least n <= 24 bits in the accumulator.
+   Beyond the end of the data, zero bits are read. */
+static void
+zgfx_bits_fill(zgfx_bits_t * b, int n)
+{
+	while (b->count < n)
+	{
+		b->acc = (b->acc << 8) | (b->p < b->end ? *b->p : 0);
+		b->p++;
+		b->count += 8;
+	}
+}
+
+static uint32
+zgfx_bits_peek(zgfx_bits_t * b, int n)
+{
+	zgfx_bits_fill(b, n);
+	return (b->acc >> (b->count - n)) & ((1u << n) - 1);
+}
+
+static void
+zgfx_bits_skip(zgfx_bits_t * b, int n)
+{
+	b->count -= n;
+	b->remaining -= n;
+}
+
+static uint32
+zgfx_bits_get(zgfx_bits_t * b, int n)
+{
+	uint32 value = zgfx_bits_peek(b, n);
+	zgfx_bits_skip(b, n);
+	return value;
+}
+
+void
+zgfx_reset(ZGFX_CONTEXT * zgfx)
+{
+	zgfx->history_index = 0;
+}
+
+void
+zgfx_init(ZGFX_CONTEXT * zgfx)
+{
+	memset(zgfx, 0, sizeof(ZGFX_CONTEXT));
+	zgfx->history = (uint8 *) xmalloc(ZGFX_HISTORY_SIZE);
+	memset(zgfx->history, 0, ZGFX_HISTORY_SIZE);
+
+	if (!g_zgfx_lookup_ready)
+		zgfx_build_lookup();
+}
+
+/* Append length bytes to the output, which grows as needed */
+static uint8 *
+zgfx_output(ZGFX_CONTEXT * zgfx, uint32 length)
+{
+	if (zgfx->output_length + length > zgfx->output_size)
+	{
+		zgfx->output_size = zgfx->output_length + MAX(length, ZGFX_SEGMENT_MAX);
+		zgfx->output = (uint8 *) xrealloc(zgfx->output, zgfx->output_size);
+	}
+
+	zgfx->output_length += length;
+	return zgfx->output + zgfx->output_length - length;
+}
+
+/* Copy count bytes starting at history index from */
+static void
+zgfx_history_read(ZGFX_CONTEXT * zgfx, uint32 from, uint8 * out, uint32 count)
+{
+	uint32 part = MIN(count, ZGFX_HISTORY_SIZE - from);
+
+	memcpy(out, zgfx->history + from, part);
+	memcpy(out + part, zgfx->history, count - part);
+}
+
+static void
+zgfx_history_write(ZGFX_CONTEXT * zgfx, uint8 * data, uint32 count)
+{
+	uint32 part = MIN(count, ZGFX_HISTORY_SIZE - zgfx->history_index);
+
+	memcpy(zgfx->history + zgfx->history_index, data, part);
+	memcpy(zgfx->history, data + part, count - part);
+	zgfx->history_index = (zgfx->history_index + count) % ZGFX_HISTORY_SIZE;
+}
+
+/* Copy a match of count bytes at distance back to the end of the
+   history. A match may overlap itself, repeating the last distance
+   bytes. */
+static void
+zgfx_history_copy(ZGFX_CONTEXT * zgfx, uint32 distance, uint32 count)
+{
+	uint8 *history = zgfx->history;
+	uint32 dst = zgfx->history_index;
+	uint32 src = (dst + ZGFX_HISTORY_SIZE - distance) % ZGFX_HISTORY_SIZE;
+
+	if (distance >= count && src + count <= ZGFX_HISTORY_SIZE &&
+	    dst + count <= ZGFX_HISTORY_SIZE)
+	{
+		memcpy(history + dst, history + src, count);
+		dst += count;
+	}
+	else
+	{
+		while (count-- > 0)
+		{
+			history[dst++] = history[src++];
+			if (dst == ZGFX_HISTORY_SIZE)
+				dst = 0;
+			if (src == ZGFX_HISTORY_SIZE)
+				src = 0;
+		}
+	}
+
+	zgfx->history_index = dst % ZGFX_HISTORY_SIZE;
+}
+
+static RD_BOOL
+zgfx_decompress_bits(ZGFX_CONTEXT * zgfx, uint8 * data, uint32 length)
+{
+	zgfx_bits_t b;
+	const zgfx_token_t *token;
+	uint32 start = zgfx->history_index, produced = 0;
+	uint32 value, count, extra;
+	uint8 index;
+
+	if (length < 1 || data[length - 1] > 7)
+		return False;
+
+	b.p = data;
+	b.end = data + length - 1;
+	b.acc = 0;
+	b.count = 0;
+	b.remaining = 8 * (length - 1) - data[length - 1];
+
+	while (b.remaining > 0)
+	{
+		index = g_zgfx_lookup[zgfx_bits_peek(&b, ZGFX_TOKEN_BITS)];
+		if (index == 0xff)
+			return False;
+		token = &g_zgfx_tokens[index];
+		if (token->prefix_length + token->value_bits > b.remaining)
+			return False;
+
+		zgfx_bits_skip(&b, token->prefix_length);
+		value = token->value_base;
+		if (token->value_bits)
+			value += zgfx_bits_get(&b, token->value_bits);
+
+		if (!token->match)
+		{
+			if (produced >= ZGFX_SEGMENT_MAX)
+				return False;
+			zgfx->history[zgfx->history_index++] = value;
+			if (zgfx->history_index == ZGFX_HISTORY_SIZE)
+				zgfx->history_index = 0;
+			produced++;
+			continue;
+		}
+
+		if (value == 0)
+		{
+			/* Unencoded bytes, starting at the next whole byte */
+			count = zgfx_bits_get(&b, 15);
+			b.remaining -= b.count % 8;
+			b.p -= b.count / 8;
+			b.count = 0;
+
+			if (b.end - b.p < (sint32) count || b.remaining < (sint32) count * 8 ||
+			    produced + count > ZGFX_SEGMENT_MAX)
+				return False;
+
+			zgfx_history_write(zgfx, b.p, count);
+			b.p += count;
+			b.remaining -= count * 8;
+			produced += count;
+			continue;
+		}
+
+		if (value > ZGFX_HISTORY_SIZE)
+			return False;
+
+		/* Match length: 0 is 3, then each leading 1 doubles the base */
+		if (zgfx_bits_get(&b, 1) == 0)
+		{
+			count = 3;
+		}
+		else
+		{
+			count = 4;
+			extra = 2;
+			while (zgfx_bits_get(&b, 1) == 1)
+			{
+				if (++extra > 16)
+					return False;
+				count *= 2;
+			}
+			count += zgfx_bits_get(&b, extra);
+		}
+
+		if (b.remaining < 0 || produced + count > ZGFX_SEGMENT_MAX)
+			return False;
+
+		zgfx_history_copy(zgfx, value, count);
+		produced += count;
+	}
+
+	zgfx_history_read(zgfx, start, zgfx_output(zgfx, produced), produced);
+	return True;
+}
+
+/* Decompress one RDP8_BULK_ENCODED_DATA, appending to the output */
+static RD_BOOL
+zgfx_decompress_bulk(ZGFX_CONTEXT * zgfx, uint8 * data, uint32 length)
+{
+	uint8 header;
+
+	if (length < 1)
+		return False;
+
+	header = data[0];
+	if ((header & 0x0f) != ZGFX_PACKET_COMPR_TYPE_RDP8)
+	{
+		logger(Protocol, Warning, "zgfx_decompress_bulk(), unknown compression type 0x%x",
+		       header & 0x0f);
+		return False;
+	}
+
+	if (header & ZGFX_PACKET_COMPRESSED)
+		return zgfx_decompress_bits(zgfx, data + 1, length - 1);
+
+	if (length - 1 > ZGFX_SEGMENT_MAX)
+		return False;
+
+	/* Uncompressed data goes to the history too */
+	memcpy(zgfx_output(zgfx, length - 1), data + 1, length - 1);
+	zgfx_history_write(zgfx, data + 1, length - 1);
+	return True;
+}
+
+/* Decompress a single RDP8_BULK_ENCODED_DATA, as in compressed
+   dynamic virtual channel PDUs. The result is valid until the next
+   call on the same context. */
+RD_BOOL
+zgfx_decompress_segment(ZGFX_CONTEXT * zgfx, uint8 * data, uint32 length, uint8 ** out,
+			uint32 * out_length)
+{
+	zgfx->output_length = 0;
+	if (!zgfx_decompress_bulk(zgfx, data, length))
+	{
+		logger(Protocol, Error, "zgfx_decompress_segment(), bad compressed data");
+		return False;
+	}
+
+	*out = zgfx->output;
+	*out_length = zgfx->output_length;
+	return True;
+}
+
+/* Decompress an RDP_SEGMENTED_DATA, with one or more segments. The
+   result is valid until the next call on the same context. */
+RD_BOOL
+zgfx_decompress(ZGFX_CONTEXT * zgfx, STREAM s, uint8 ** out, uint32 * out_length)
+{
+	uint8 descriptor, *data;
+	uint16 count;
+	uint32 total, length;
+	int i;
+
+	zgfx->output_length = 0;
+
+	if (!s_check_rem(s, 1))
+		return False;
+	in_uint8(s, descriptor);	/* descriptor */
+
+	if (descriptor == ZGFX_SEGMENTED_SINGLE)
+	{
+		length = s->end - s->p;
+		in_uint8p(s, data, length);
+		if (!zgfx_decompress_bulk(zgfx, data, length))
+			goto error;
+	}
+	else if (descriptor == ZGFX_SEGMENTED_MULTIPART)
+	{
+		if (!s_check_rem(s, 6))
+			return False;
+		in_uint16_le(s, count);	/* segmentCount */
+		in_uint32_le(s, total);	/* uncompressedSize */
+
+		for (i = 0; i < count; i++)
+		{
+			if (!s_check_rem(s, 4))
+				goto error;
+			in_uint32_le(s, length);	/* size */
+			if (!s_check_rem(s, length))
+				goto error;
+			in_uint8p(s, data, length);
+
+			if (!zgfx_decompress_bulk(zgfx, data, length))
+				goto error;
+		}
+
+		if (zgfx->output_length != total)
+		{
+			logger(Protocol, Warning,
+			       "zgfx_decompress(), got %u bytes, %u expected", zgfx->output_length,
+			       total);
+		}
+	}
+	else
+	{
+		logger(Protocol, Error, "zgfx_decompress(), bad descriptor 0x%x", descriptor);
+		return False;
+	}
+
+	*out = zgfx->output;
+	*out_length = zgfx->output_length;
+	return True;
+
+      error:
+	logger(Protocol, Error, "zgfx_decompress(), bad compressed data");
+	return False;
+}